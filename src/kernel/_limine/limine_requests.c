@@ -22,4 +22,33 @@ __attribute__((used, section(".requests")))
 volatile struct limine_executable_address_request exec_addr_request = {
     .id = LIMINE_EXECUTABLE_ADDRESS_REQUEST_ID,
     .revision = 0
-};
\ No newline at end of file
+};
+
+// Kernel command line, for boot options like log=
+__attribute__((used, section(".requests")))
+volatile struct limine_executable_cmdline_request cmdline_request = {
+    .id = LIMINE_EXECUTABLE_CMDLINE_REQUEST_ID,
+    .revision = 0
+};
+
+// Framebuffer, for the local console
+__attribute__((used, section(".requests")))
+volatile struct limine_framebuffer_request framebuffer_request = {
+    .id = LIMINE_FRAMEBUFFER_REQUEST_ID,
+    .revision = 0
+};
+
+// Application processors, started by smp_init()
+__attribute__((used, section(".requests")))
+volatile struct limine_mp_request mp_request = {
+    .id = LIMINE_MP_REQUEST_ID,
+    .revision = 0,
+    .flags = 0
+};
+
+// ACPI tables, for the HPET
+__attribute__((used, section(".requests")))
+volatile struct limine_rsdp_request rsdp_request = {
+    .id = LIMINE_RSDP_REQUEST_ID,
+    .revision = 0
+};
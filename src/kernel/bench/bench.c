@@ -0,0 +1,101 @@
+#include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/serial.h"
+#include "../include/cmdline.h"
+#include "../include/tsc.h"
+#include "../include/qemu.h"
+#include "../include/klog.h"
+#include "../include/bench.h"
+
+void bench_report(const char *suite, const char *name, uint64_t param,
+                  uint64_t ops, uint64_t cycles) {
+    serial_puts("BENCH ");
+    serial_puts(suite);
+    serial_puts(" ");
+    serial_puts(name);
+    serial_puts(" param=");
+    serial_put_dec(param);
+    serial_puts(" ops=");
+    serial_put_dec(ops);
+    serial_puts(" cycles=");
+    serial_put_dec(cycles);
+    serial_puts(" cyc/op=");
+    serial_put_dec(ops ? cycles / ops : 0);
+
+    if (tsc_khz() && ops) {
+        // Hundredths of a nanosecond per op
+        uint64_t ns100 = tsc_cycles_to_ns(cycles * 100) / ops;
+        serial_puts(" ns/op=");
+        serial_put_dec(ns100 / 100);
+        serial_puts(".");
+        serial_put_dec(ns100 / 10 % 10);
+        serial_put_dec(ns100 % 10);
+    }
+    serial_puts("\n");
+}
+
+void bench_report_value(const char *suite, const char *name, uint64_t param,
+                        const char *key, uint64_t value) {
+    serial_puts("BENCH ");
+    serial_puts(suite);
+    serial_puts(" ");
+    serial_puts(name);
+    serial_puts(" param=");
+    serial_put_dec(param);
+    serial_puts(" ");
+    serial_puts(key);
+    serial_puts("=");
+    serial_put_dec(value);
+    serial_puts("\n");
+}
+
+static const struct {
+    const char *name;
+    void (*run)(void);
+} suites[] = {
+    { "pmm",           bench_pmm },
+    { "vmm",           bench_vmm },
+    { "kmem",          bench_kmem },
+    { "krealloc",      bench_krealloc },
+    { "kmalloc_large", bench_kmalloc_large },
+    { "arena",         bench_arena },
+    { "string",        bench_string },
+    { "simd",          bench_simd },
+    { "sink",          bench_sink },
+    { "fbcon",         bench_fbcon },
+    { "lock",          bench_lock },
+    { "timer",         bench_timer },
+};
+
+#define NR_SUITES (sizeof(suites) / sizeof(suites[0]))
+
+void bench_main(void) {
+    size_t len;
+    const char *list = cmdline_get("bench", &len);
+    if (!list) {
+        return;
+    }
+
+    int all = len == 0 || cmdline_list_has(list, len, "all");
+
+    serial_puts("\n=== Running benchmarks ===\n");
+
+    // Lets runs under different -smp counts and hosts be told apart
+    serial_puts("BENCH_CONFIG cpus=");
+    serial_put_dec(cpu_count());
+    serial_puts(" tsc_khz=");
+    serial_put_dec(tsc_khz());
+    serial_puts("\n");
+
+    for (size_t i = 0; i < NR_SUITES; i++) {
+        if (all || cmdline_list_has(list, len, suites[i].name)) {
+            suites[i].run();
+        }
+    }
+
+    serial_puts("=== Benchmarks done ===\n");
+
+    // Make sure the UART has everything before QEMU goes away
+    klog_flush();
+    qemu_debug_exit(0);
+}
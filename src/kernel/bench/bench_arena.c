@@ -0,0 +1,77 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/kalloc.h"
+#include "../include/arena.h"
+#include "../include/bench.h"
+
+#define ARENA_ITERS  2000
+#define ARENA_BATCH  64
+
+// Mixed small sizes, like the nodes of a parsed table
+static size_t batch_size(int i) {
+    return 16 + (i % 8) * 24;
+}
+
+// A batch of objects that all die together, freed one by one
+static void bench_kmalloc_batch(void) {
+    void *objs[ARENA_BATCH];
+
+    uint64_t start = rdtsc();
+    for (int i = 0; i < ARENA_ITERS; i++) {
+        for (int j = 0; j < ARENA_BATCH; j++) {
+            objs[j] = kmalloc(batch_size(j));
+        }
+        for (int j = 0; j < ARENA_BATCH; j++) {
+            kfree(objs[j]);
+        }
+    }
+    uint64_t cycles = rdtsc() - start;
+
+    bench_report("arena", "kmalloc_batch64", ARENA_BATCH, (uint64_t)ARENA_ITERS * ARENA_BATCH, cycles);
+}
+
+// The same batch bump-allocated and dropped with one rewind
+static void bench_arena_batch(void) {
+    struct arena *arena = arena_create(16 * 1024, ARENA_GROW);
+    if (!arena) return;
+
+    arena_mark_t mark = arena_mark(arena);
+
+    uint64_t start = rdtsc();
+    for (int i = 0; i < ARENA_ITERS; i++) {
+        for (int j = 0; j < ARENA_BATCH; j++) {
+            void *volatile obj = arena_alloc(arena, batch_size(j), 0);
+            (void)obj;
+        }
+        arena_rewind(arena, mark);
+    }
+    uint64_t cycles = rdtsc() - start;
+
+    bench_report("arena", "arena_batch64", ARENA_BATCH, (uint64_t)ARENA_ITERS * ARENA_BATCH, cycles);
+    arena_destroy(arena);
+}
+
+// Per-CPU scratch, including the growth and chunk release on every round
+static void bench_scratch_grow(void) {
+    uint64_t start = rdtsc();
+    for (int i = 0; i < ARENA_ITERS; i++) {
+        arena_scratch_t scratch = arena_scratch_begin();
+        if (!scratch.arena) return;
+
+        for (int j = 0; j < ARENA_BATCH; j++) {
+            void *volatile obj = arena_alloc(scratch.arena, 2048, 0);
+            (void)obj;
+        }
+        arena_scratch_end(scratch);
+    }
+    uint64_t cycles = rdtsc() - start;
+
+    bench_report("arena", "scratch_grow", 2048 * ARENA_BATCH, (uint64_t)ARENA_ITERS * ARENA_BATCH, cycles);
+}
+
+void bench_arena(void) {
+    bench_kmalloc_batch();
+    bench_arena_batch();
+    bench_scratch_grow();
+}
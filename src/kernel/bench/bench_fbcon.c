@@ -0,0 +1,61 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/fbcon.h"
+#include "../include/bench.h"
+
+#define CHAR_LINES  256
+#define SCROLLS     64
+
+// 79 characters and a newline, one console line on an 80+ column screen
+static const char line[] =
+    "fbcon bench: the quick brown fox jumps over the lazy dog 0123456789 ABCDEFGHIJ\n";
+
+#define LINE_LEN (sizeof(line) - 1)
+
+void bench_fbcon(void) {
+    int rows = fbcon_rows();
+    if (!rows) {
+        return;
+    }
+
+    bench_report_value("fbcon", "grid", 0, "cols", fbcon_cols());
+    bench_report_value("fbcon", "grid", 0, "rows", rows);
+
+    // A line per write, as klog does: render, scroll, flush
+    uint64_t start = rdtsc();
+    for (int i = 0; i < CHAR_LINES; i++) {
+        fbcon_write(line, LINE_LEN);
+    }
+    uint64_t cycles = rdtsc() - start;
+    bench_report("fbcon", "chars", LINE_LEN, (uint64_t)CHAR_LINES * LINE_LEN, cycles);
+
+    // Just the glyphs: no newline, so nothing scrolls. Ends with one.
+    start = rdtsc();
+    for (int i = 0; i < CHAR_LINES; i++) {
+        fbcon_write(line, 64);
+        fbcon_write("\r", 1);
+    }
+    cycles = rdtsc() - start;
+    fbcon_write("\n", 1);
+    bench_report("fbcon", "chars_noscroll", 64, (uint64_t)CHAR_LINES * 64, cycles);
+
+    // Full screen scroll: one newline at the bottom, every row re-flushed
+    start = rdtsc();
+    for (int i = 0; i < SCROLLS; i++) {
+        fbcon_write("\n", 1);
+    }
+    bench_report("fbcon", "scroll", rows, SCROLLS, rdtsc() - start);
+
+    // A screenful of newlines in one write still flushes only once
+    static char newlines[256];
+    int n = rows < (int)sizeof(newlines) ? rows : (int)sizeof(newlines);
+    for (int i = 0; i < n; i++) {
+        newlines[i] = '\n';
+    }
+    start = rdtsc();
+    for (int i = 0; i < SCROLLS; i++) {
+        fbcon_write(newlines, n);
+    }
+    bench_report("fbcon", "scroll_screen", n, SCROLLS, rdtsc() - start);
+}
@@ -0,0 +1,32 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/kalloc.h"
+#include "../include/bench.h"
+
+#define LARGE_ITERS 200
+#define LARGE_MIN   (8 * 1024)
+#define LARGE_MAX   (1024 * 1024)
+
+// Time alloc+free pairs of one size through the given allocator
+static void bench_large_mode(const char *name, void *(*alloc)(size_t), size_t size) {
+    uint64_t start = rdtsc();
+    for (int i = 0; i < LARGE_ITERS; i++) {
+        void *p = alloc(size);
+        if (!p) {
+            return;
+        }
+        kfree(p);
+    }
+    uint64_t cycles = rdtsc() - start;
+
+    bench_report("kmalloc_large", name, size, LARGE_ITERS, cycles);
+}
+
+// HHDM-backed contiguous blocks against page-mapped ones
+void bench_kmalloc_large(void) {
+    for (size_t size = LARGE_MIN; size <= LARGE_MAX; size *= 2) {
+        bench_large_mode("contig", kmalloc, size);
+        bench_large_mode("mapped", vmalloc, size);
+    }
+}
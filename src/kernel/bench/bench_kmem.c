@@ -0,0 +1,218 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/kalloc.h"
+#include "../include/pmc.h"
+#include "../include/format.h"
+#include "../include/bench.h"
+
+#define PINGPONG_ITERS 100000
+#define BATCH_ITERS    2000
+#define BATCH_SIZE     64
+
+static const size_t bench_sizes[] = { 16, 64, 256, 1024 };
+
+// Live sets for the steady-state churn benchmark, and its size classes
+static const size_t live_sets[] = { 64, 1024, 16384 };
+static const size_t live_sizes[] = { 16, 64, 256, 1024, 2048, 4096 };
+#define LIVE_OPS 100000
+
+// Large working set comparison of slab layouts: 64K objects of 64 bytes
+// (4 MiB, well past L2) churned in random order
+#define LAYOUT_OBJS    65536
+#define LAYOUT_SIZE    64
+#define LAYOUT_ROUNDS  8
+
+// Alloc one object and free it straight away, the best case for magazines
+static void bench_pingpong(size_t size) {
+    // Warm up the loaded magazine
+    kfree(kmalloc(size));
+
+    uint64_t start = rdtsc();
+    for (int i = 0; i < PINGPONG_ITERS; i++) {
+        void *p = kmalloc(size);
+        kfree(p);
+    }
+    uint64_t cycles = rdtsc() - start;
+
+    bench_report("kmem", "pingpong", size, PINGPONG_ITERS * 2ULL, cycles);
+}
+
+// Alloc a batch then free it, which forces magazine exchanges with the depot
+static void bench_batch(size_t size) {
+    void *objs[BATCH_SIZE];
+
+    uint64_t start = rdtsc();
+    for (int i = 0; i < BATCH_ITERS; i++) {
+        for (int j = 0; j < BATCH_SIZE; j++) {
+            objs[j] = kmalloc(size);
+        }
+        for (int j = 0; j < BATCH_SIZE; j++) {
+            kfree(objs[j]);
+        }
+    }
+    uint64_t cycles = rdtsc() - start;
+
+    bench_report("kmem", "batch64", size, (uint64_t)BATCH_ITERS * BATCH_SIZE * 2, cycles);
+}
+
+// Batches from a dedicated cache, one call per object...
+static void bench_cache_single(struct kmem_cache *cache, size_t size) {
+    void *objs[BATCH_SIZE];
+
+    uint64_t start = rdtsc();
+    for (int i = 0; i < BATCH_ITERS; i++) {
+        for (int j = 0; j < BATCH_SIZE; j++) {
+            objs[j] = kmem_cache_alloc(cache);
+        }
+        for (int j = 0; j < BATCH_SIZE; j++) {
+            kmem_cache_free(cache, objs[j]);
+        }
+    }
+    uint64_t cycles = rdtsc() - start;
+
+    bench_report("kmem", "cache_single64", size, (uint64_t)BATCH_ITERS * BATCH_SIZE * 2, cycles);
+}
+
+// ...and one bulk call per batch
+static void bench_cache_bulk(struct kmem_cache *cache, size_t size) {
+    void *objs[BATCH_SIZE];
+
+    uint64_t start = rdtsc();
+    for (int i = 0; i < BATCH_ITERS; i++) {
+        kmem_cache_alloc_bulk(cache, BATCH_SIZE, objs);
+        kmem_cache_free_bulk(cache, BATCH_SIZE, objs);
+    }
+    uint64_t cycles = rdtsc() - start;
+
+    bench_report("kmem", "cache_bulk64", size, (uint64_t)BATCH_ITERS * BATCH_SIZE * 2, cycles);
+}
+
+// Helper: xorshift64, good enough to scatter frees
+static uint64_t bench_rand(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+// Helper: Report one phase of the layout benchmark
+static void layout_report(const char *name, uint64_t ops, uint64_t cycles, uint64_t misses) {
+    bench_report("slab_layout", name, LAYOUT_SIZE, ops, cycles);
+    if (pmc_available()) {
+        bench_report_value("slab_layout", name, LAYOUT_SIZE, "llc_misses", misses);
+    }
+}
+
+// Fill, churn in random order and drain one cache. Magazines are off so
+// every operation hits the slab layer being measured.
+static void bench_layout(int flags, const char *fill, const char *churn, const char *drain) {
+    struct kmem_cache *cache = kmem_cache_create("bench_layout", LAYOUT_SIZE, 0, NULL,
+                                                 KMC_NOMAGAZINE | flags);
+    void **objs = vmalloc(LAYOUT_OBJS * sizeof(void *));
+    if (!cache || !objs) {
+        if (cache) kmem_cache_destroy(cache);
+        kfree(objs);
+        return;
+    }
+
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+
+    pmc_llc_start();
+    uint64_t start = rdtsc();
+    for (int i = 0; i < LAYOUT_OBJS; i++) {
+        objs[i] = kmem_cache_alloc(cache);
+    }
+    layout_report(fill, LAYOUT_OBJS, rdtsc() - start, pmc_llc_read());
+
+    // Free a random half, then allocate the holes again
+    uint64_t ops = 0;
+    pmc_llc_start();
+    start = rdtsc();
+    for (int r = 0; r < LAYOUT_ROUNDS; r++) {
+        for (int i = 0; i < LAYOUT_OBJS / 2; i++) {
+            uint64_t j = bench_rand(&seed) % LAYOUT_OBJS;
+            if (objs[j]) {
+                kmem_cache_free(cache, objs[j]);
+                objs[j] = NULL;
+                ops++;
+            }
+        }
+        for (int i = 0; i < LAYOUT_OBJS; i++) {
+            if (!objs[i]) {
+                objs[i] = kmem_cache_alloc(cache);
+                ops++;
+            }
+        }
+    }
+    layout_report(churn, ops, rdtsc() - start, pmc_llc_read());
+
+    pmc_llc_start();
+    start = rdtsc();
+    for (int i = 0; i < LAYOUT_OBJS; i++) {
+        kmem_cache_free(cache, objs[i]);
+    }
+    layout_report(drain, LAYOUT_OBJS, rdtsc() - start, pmc_llc_read());
+    pmc_stop();
+
+    kfree(objs);
+    kmem_cache_destroy(cache);
+}
+
+// Keep `live` objects allocated and replace random ones, so frees hit
+// cold objects spread over many slabs like a long running workload
+static void bench_live(size_t size, size_t live) {
+    void **objs = vmalloc(live * sizeof(void *));
+    if (!objs) {
+        return;
+    }
+
+    for (size_t i = 0; i < live; i++) {
+        objs[i] = kmalloc(size);
+    }
+
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    uint64_t start = rdtsc();
+    for (int i = 0; i < LIVE_OPS; i++) {
+        uint64_t j = bench_rand(&seed) % live;
+        kfree(objs[j]);
+        objs[j] = kmalloc(size);
+    }
+    uint64_t cycles = rdtsc() - start;
+
+    for (size_t i = 0; i < live; i++) {
+        kfree(objs[i]);
+    }
+    kfree(objs);
+
+    // The size goes in the name so param can be the live set
+    char name[16];
+    ksnprintf(name, sizeof(name), "live%lu", (uint64_t)size);
+    bench_report("kmem", name, live, LIVE_OPS * 2ULL, cycles);
+}
+
+void bench_kmem(void) {
+    for (size_t i = 0; i < sizeof(bench_sizes) / sizeof(bench_sizes[0]); i++) {
+        bench_pingpong(bench_sizes[i]);
+        bench_batch(bench_sizes[i]);
+    }
+
+    for (size_t i = 0; i < sizeof(bench_sizes) / sizeof(bench_sizes[0]); i++) {
+        struct kmem_cache *cache = kmem_cache_create("bench_bulk", bench_sizes[i], 0, NULL, 0);
+        if (!cache) continue;
+
+        bench_cache_single(cache, bench_sizes[i]);
+        bench_cache_bulk(cache, bench_sizes[i]);
+        kmem_cache_destroy(cache);
+    }
+
+    for (size_t l = 0; l < sizeof(live_sets) / sizeof(live_sets[0]); l++) {
+        for (size_t i = 0; i < sizeof(live_sizes) / sizeof(live_sizes[0]); i++) {
+            bench_live(live_sizes[i], live_sets[l]);
+        }
+    }
+
+    bench_layout(0, "freelist_fill", "freelist_churn", "freelist_drain");
+    bench_layout(KMC_BITMAP, "bitmap_fill", "bitmap_churn", "bitmap_drain");
+}
@@ -0,0 +1,79 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/kalloc.h"
+#include "../include/bench.h"
+
+#define GROW_START (4 * 1024)
+#define GROW_LIMIT (64 * 1024 * 1024)
+
+// Touch one byte per page so the timing includes backing the new pages
+static void touch_pages(uint8_t *p, size_t from, size_t to) {
+    for (size_t off = from; off < to; off += 4096) {
+        p[off] = (uint8_t)off;
+    }
+}
+
+// Grow a buffer by doubling up to GROW_LIMIT through krealloc
+static void bench_grow_krealloc(void) {
+    uint8_t *p = kmalloc(GROW_START);
+    if (!p) {
+        return;
+    }
+    touch_pages(p, 0, GROW_START);
+
+    uint64_t total = 0;
+    for (size_t size = GROW_START * 2; size <= GROW_LIMIT; size *= 2) {
+        uint64_t start = rdtsc();
+        uint8_t *q = krealloc(p, size);
+        uint64_t cycles = rdtsc() - start;
+
+        if (!q) {
+            break;
+        }
+        touch_pages(q, size / 2, size);
+
+        bench_report("krealloc", q == p ? "grow_inplace" : "grow_remap", size, 1, cycles);
+        total += cycles;
+        p = q;
+    }
+
+    bench_report("krealloc", "grow_total", GROW_LIMIT, 1, total);
+    kfree(p);
+}
+
+// The same growth done the old way: new block, byte copy, free
+static void bench_grow_copy(void) {
+    uint8_t *p = kmalloc(GROW_START);
+    if (!p) {
+        return;
+    }
+    touch_pages(p, 0, GROW_START);
+
+    uint64_t total = 0;
+    for (size_t size = GROW_START * 2; size <= GROW_LIMIT; size *= 2) {
+        uint64_t start = rdtsc();
+        uint8_t *q = kmalloc(size);
+        if (!q) {
+            break;
+        }
+        for (size_t i = 0; i < size / 2; i++) {
+            q[i] = p[i];
+        }
+        kfree(p);
+        uint64_t cycles = rdtsc() - start;
+
+        touch_pages(q, size / 2, size);
+        bench_report("krealloc", "grow_copy", size, 1, cycles);
+        total += cycles;
+        p = q;
+    }
+
+    bench_report("krealloc", "grow_copy_total", GROW_LIMIT, 1, total);
+    kfree(p);
+}
+
+void bench_krealloc(void) {
+    bench_grow_krealloc();
+    bench_grow_copy();
+}
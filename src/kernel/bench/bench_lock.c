@@ -0,0 +1,131 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/smp.h"
+#include "../include/spinlock.h"
+#include "../include/kalloc.h"
+#include "../include/bench.h"
+
+// Lock scaling: k CPUs hammer one lock together, for k = 1, 2,
+// 4, ... up to every online CPU. Critical sections are a single counter
+// bump, so the numbers are nearly all lock handover. cycles is the
+// slowest CPU's run, ops counts every CPU's, so cyc/op going up with k
+// means the lock stops scaling.
+
+#define LOCK_ITERS 20000
+
+enum lock_op {
+    OP_TICKET,
+    OP_MCS,
+    OP_READ,
+    OP_WRITE,
+    OP_KMALLOC,
+};
+
+static const struct {
+    const char *name;
+    enum lock_op op;
+} lock_ops[] = {
+    { "ticket",       OP_TICKET },
+    { "mcs",          OP_MCS },
+    { "rw_read",      OP_READ },
+    { "rw_write",     OP_WRITE },
+    { "kmalloc_pair", OP_KMALLOC },
+};
+
+#define NR_LOCK_OPS (sizeof(lock_ops) / sizeof(lock_ops[0]))
+
+static spinlock_t ticket = SPINLOCK_INIT;
+static mcs_lock_t mcs = MCS_LOCK_INIT;
+static rwlock_t rw = RWLOCK_INIT;
+static volatile uint64_t shared_count;
+
+struct lock_run {
+    enum lock_op op;
+    unsigned int cpus;          // CPUs taking part
+    unsigned int joined;        // Ranks handed out, the first `cpus` take part
+    unsigned int arrived;       // Start barrier
+    uint64_t cycles[MAX_CPUS];  // By rank
+};
+
+// Helper: LOCK_ITERS rounds of one operation
+static void lock_loop(enum lock_op op) {
+    struct mcs_node node;
+
+    for (int i = 0; i < LOCK_ITERS; i++) {
+        switch (op) {
+        case OP_TICKET:
+            spin_lock(&ticket);
+            shared_count++;
+            spin_unlock(&ticket);
+            break;
+        case OP_MCS:
+            mcs_lock(&mcs, &node);
+            shared_count++;
+            mcs_unlock(&mcs, &node);
+            break;
+        case OP_READ:
+            read_lock(&rw);
+            (void)shared_count;
+            read_unlock(&rw);
+            break;
+        case OP_WRITE:
+            write_lock(&rw);
+            shared_count++;
+            write_unlock(&rw);
+            break;
+        case OP_KMALLOC:
+            kfree(kmalloc(64));
+            break;
+        }
+    }
+}
+
+// Runs on every CPU through smp_call_all(). CPUs take part by the order
+// they show up in, not by number: CPU ids needn't be dense, an AP that
+// never came online leaves a hole.
+static void lock_worker(void *arg) {
+    struct lock_run *run = arg;
+    unsigned int rank = __atomic_fetch_add(&run->joined, 1, __ATOMIC_RELAXED);
+
+    if (rank >= run->cpus) {
+        return;
+    }
+
+    // Start together, or the first CPU finishes before the last begins
+    __atomic_fetch_add(&run->arrived, 1, __ATOMIC_ACQ_REL);
+    while (__atomic_load_n(&run->arrived, __ATOMIC_ACQUIRE) < run->cpus) {
+        cpu_relax();
+    }
+
+    uint64_t start = rdtsc();
+    lock_loop(run->op);
+    run->cycles[rank] = rdtsc() - start;
+}
+
+void bench_lock(void) {
+    unsigned int online = smp_online();
+
+    for (size_t o = 0; o < NR_LOCK_OPS; o++) {
+        for (unsigned int k = 1; ; k *= 2) {
+            if (k > online) {
+                k = online;
+            }
+
+            struct lock_run run = { .op = lock_ops[o].op, .cpus = k };
+            smp_call_all(lock_worker, &run);
+
+            uint64_t slowest = 0;
+            for (unsigned int i = 0; i < k; i++) {
+                if (run.cycles[i] > slowest) {
+                    slowest = run.cycles[i];
+                }
+            }
+            bench_report("lock", lock_ops[o].name, k, (uint64_t)k * LOCK_ITERS, slowest);
+
+            if (k == online) {
+                break;
+            }
+        }
+    }
+}
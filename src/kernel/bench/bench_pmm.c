@@ -0,0 +1,72 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/pmm.h"
+#include "../include/bench.h"
+
+#define PAIR_ITERS  100000
+#define BATCH_SIZE  512
+#define BATCH_ITERS 64
+#define MAX_ORDER   4
+
+static void *blocks[BATCH_SIZE];
+
+// Alloc a block and free it straight away, the block goes back to the
+// head of its free list so this is the buddy allocator's best case
+static void bench_pair(unsigned int order) {
+    pmm_free_pages(pmm_alloc_pages(order), order);
+
+    uint64_t start = rdtsc();
+    for (int i = 0; i < PAIR_ITERS; i++) {
+        void *p = pmm_alloc_pages(order);
+        pmm_free_pages(p, order);
+    }
+    uint64_t cycles = rdtsc() - start;
+
+    bench_report("pmm", "pair", order, PAIR_ITERS * 2ULL, cycles);
+}
+
+// Allocate a batch, then free it. Allocation splits larger blocks and
+// freeing merges the buddies back, so both walk the orders.
+static void bench_batch(unsigned int order) {
+    uint64_t alloc_cycles = 0;
+    uint64_t free_cycles = 0;
+
+    for (int i = 0; i < BATCH_ITERS; i++) {
+        uint64_t start = rdtsc();
+        for (int j = 0; j < BATCH_SIZE; j++) {
+            blocks[j] = pmm_alloc_pages(order);
+        }
+        uint64_t mid = rdtsc();
+        for (int j = 0; j < BATCH_SIZE; j++) {
+            pmm_free_pages(blocks[j], order);
+        }
+        free_cycles += rdtsc() - mid;
+        alloc_cycles += mid - start;
+    }
+
+    bench_report("pmm", "batch_alloc", order, (uint64_t)BATCH_ITERS * BATCH_SIZE, alloc_cycles);
+    bench_report("pmm", "batch_free", order, (uint64_t)BATCH_ITERS * BATCH_SIZE, free_cycles);
+}
+
+// PMM_ZERO on dirty memory, i.e. what clearing a page costs
+static void bench_zero(void) {
+    uint64_t start = rdtsc();
+    for (int i = 0; i < PAIR_ITERS / 10; i++) {
+        void *p = pmm_alloc_pages_flags(0, PMM_ZERO);
+        pmm_free_pages(p, 0);
+    }
+    uint64_t cycles = rdtsc() - start;
+
+    bench_report("pmm", "pair_zero", 0, PAIR_ITERS / 10 * 2ULL, cycles);
+}
+
+void bench_pmm(void) {
+    for (unsigned int order = 0; order <= MAX_ORDER; order++) {
+        bench_pair(order);
+    }
+    for (unsigned int order = 0; order <= MAX_ORDER; order++) {
+        bench_batch(order);
+    }
+    bench_zero();
+}
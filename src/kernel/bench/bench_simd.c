@@ -0,0 +1,145 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/kalloc.h"
+#include "../include/string.h"
+#include "../include/fpu.h"
+#include "../include/simd.h"
+#include "../include/crc32c.h"
+#include "../include/bench.h"
+
+#define PAGE_ITERS 4096
+#define FPU_ITERS  4096
+#define CRC_ITERS  1024
+
+typedef void (*clear_fn_t)(void *dst);
+typedef void (*copy_fn_t)(void *dst, const void *src);
+
+// Many pages inside one FPU section, the cost of the loop alone
+static void pages_batched(const char *clear_name, clear_fn_t clear,
+                          const char *copy_name, copy_fn_t copy,
+                          void *dst, const void *src) {
+    kernel_fpu_begin();
+    uint64_t start = rdtsc();
+    for (int i = 0; i < PAGE_ITERS; i++) {
+        clear(dst);
+    }
+    uint64_t cycles = rdtsc() - start;
+    kernel_fpu_end();
+    bench_report("simd", clear_name, 4096, PAGE_ITERS, cycles);
+
+    kernel_fpu_begin();
+    start = rdtsc();
+    for (int i = 0; i < PAGE_ITERS; i++) {
+        copy(dst, src);
+    }
+    cycles = rdtsc() - start;
+    kernel_fpu_end();
+    bench_report("simd", copy_name, 4096, PAGE_ITERS, cycles);
+}
+
+static void bench_pages(void *dst, const void *src) {
+    uint64_t start = rdtsc();
+    for (int i = 0; i < PAGE_ITERS; i++) {
+        clear_page(dst);
+    }
+    bench_report("simd", "clear_page_rep", 4096, PAGE_ITERS, rdtsc() - start);
+
+    start = rdtsc();
+    for (int i = 0; i < PAGE_ITERS; i++) {
+        copy_page(dst, src);
+    }
+    bench_report("simd", "copy_page_rep", 4096, PAGE_ITERS, rdtsc() - start);
+
+    pages_batched("clear_page_sse2", clear_page_sse2,
+                  "copy_page_sse2", copy_page_sse2, dst, src);
+    if (fpu_features() & FPU_AVX2) {
+        pages_batched("clear_page_avx2", clear_page_avx2,
+                      "copy_page_avx2", copy_page_avx2, dst, src);
+    }
+
+    // One page per section, what a lone caller of the dispatchers pays
+    start = rdtsc();
+    for (int i = 0; i < PAGE_ITERS; i++) {
+        simd_clear_page(dst);
+    }
+    bench_report("simd", "simd_clear_page", 4096, PAGE_ITERS, rdtsc() - start);
+
+    start = rdtsc();
+    for (int i = 0; i < PAGE_ITERS; i++) {
+        simd_copy_page(dst, src);
+    }
+    bench_report("simd", "simd_copy_page", 4096, PAGE_ITERS, rdtsc() - start);
+}
+
+static void bench_fpu_section(void) {
+    uint64_t start = rdtsc();
+    for (int i = 0; i < FPU_ITERS; i++) {
+        kernel_fpu_begin();
+        kernel_fpu_end();
+    }
+    bench_report("simd", "fpu_begin_end", 0, FPU_ITERS, rdtsc() - start);
+
+    // Inner sections save into a fresh area each time
+    kernel_fpu_begin();
+    start = rdtsc();
+    for (int i = 0; i < FPU_ITERS; i++) {
+        kernel_fpu_begin();
+        kernel_fpu_end();
+    }
+    uint64_t cycles = rdtsc() - start;
+    kernel_fpu_end();
+    bench_report("simd", "fpu_begin_end_nested", 1, FPU_ITERS, cycles);
+}
+
+static void bench_crc(const void *buf) {
+    volatile uint32_t sink = 0;
+
+    uint64_t start = rdtsc();
+    for (int i = 0; i < CRC_ITERS; i++) {
+        sink = crc32c_sw(sink, buf, 4096);
+    }
+    bench_report("simd", "crc32c_sw", 4096, CRC_ITERS, rdtsc() - start);
+
+    if (!crc32c_hw_available()) {
+        return;
+    }
+
+    start = rdtsc();
+    for (int i = 0; i < CRC_ITERS; i++) {
+        sink = crc32c_hw(sink, buf, 4096);
+    }
+    bench_report("simd", "crc32c_hw", 4096, CRC_ITERS, rdtsc() - start);
+
+    // Both variants must agree with each other and the check value
+    uint32_t sw = crc32c_sw(0, buf, 4096);
+    uint32_t hw = crc32c_hw(0, buf, 4096);
+    bench_report_value("simd", "crc32c_check", 0, "ok",
+                       sw == hw && crc32c(0, "123456789", 9) == 0xE3069283);
+}
+
+void bench_simd(void) {
+    uint8_t *src = kmalloc(4096);
+    uint8_t *dst = kmalloc(4096);
+    if (!src || !dst) {
+        kfree(src);
+        kfree(dst);
+        return;
+    }
+
+    for (int i = 0; i < 4096; i++) {
+        src[i] = (uint8_t)(i * 131 + 7);
+    }
+
+    int features = fpu_features();
+    bench_report_value("simd", "features", 0, "xsaveopt", (features & FPU_XSAVEOPT) != 0);
+    bench_report_value("simd", "features", 0, "avx2", (features & FPU_AVX2) != 0);
+    bench_report_value("simd", "features", 0, "sse42", (features & FPU_SSE42) != 0);
+
+    bench_pages(dst, src);
+    bench_fpu_section();
+    bench_crc(src);
+
+    kfree(src);
+    kfree(dst);
+}
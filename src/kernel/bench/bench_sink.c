@@ -0,0 +1,54 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/string.h"
+#include "../include/klog.h"
+#include "../include/sink.h"
+#include "../include/bench.h"
+
+// A typical boot log line, 64 bytes
+static const char line[] = "sink bench: Adding usable region: 0x100000 - 0x7FE0000 ......\n";
+
+#define LINE_LEN (sizeof(line) - 1)
+
+// Lines per measurement. The UART and debugcon ones end up on the console.
+#define LINES_DEVICE 64
+#define LINES_MEMORY 4096
+
+static void bench_one(int sink, int lines) {
+    uint64_t start = rdtsc();
+    for (int i = 0; i < lines; i++) {
+        sink_write_one(sink, line, LINE_LEN);
+    }
+    uint64_t cycles = rdtsc() - start;
+
+    bench_report("sink", sink_name(sink), LINE_LEN, lines, cycles);
+    bench_report_value("sink", sink_name(sink), LINE_LEN, "bytes_per_mcyc",
+                       (uint64_t)lines * LINE_LEN * 1000000 / (cycles ? cycles : 1));
+}
+
+void bench_sink(void) {
+    int enabled = sink_enabled();
+
+    bench_report_value("sink", "enabled", 0, "mask", enabled);
+
+    for (int sink = 0; sink < SINK_NR; sink++) {
+        if (enabled & (1 << sink)) {
+            bench_one(sink, (1 << sink) == SINK_MEMORY ? LINES_MEMORY : LINES_DEVICE);
+        }
+    }
+
+    // What a klog() caller pays: formatting, the ring and the cheap sinks,
+    // then the interrupt driven drain separately
+    klog_flush();
+    uint64_t start = rdtsc();
+    for (int i = 0; i < LINES_DEVICE; i++) {
+        klog(KLOG_INFO, "sink bench: klog line %d of %d ...........................\n",
+             i, LINES_DEVICE);
+    }
+    bench_report("sink", "klog", LINE_LEN, LINES_DEVICE, rdtsc() - start);
+
+    start = rdtsc();
+    klog_flush();
+    bench_report("sink", "klog_flush", LINE_LEN, LINES_DEVICE, rdtsc() - start);
+}
@@ -0,0 +1,118 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/kalloc.h"
+#include "../include/string.h"
+#include "../include/bench.h"
+
+#define SWEEP_MIN   8
+#define SWEEP_MAX   (1024 * 1024)
+
+// Bytes moved per measurement, so small sizes get enough iterations
+#define SWEEP_BYTES (8 * 1024 * 1024)
+#define SWEEP_MIN_ITERS 8
+
+#define PAGE_ITERS  4096
+
+typedef void *(*copy_fn_t)(void *dst, const void *src, size_t n);
+typedef void *(*set_fn_t)(void *dst, int c, size_t n);
+
+// The old way, one byte at a time
+static void *copy_bytes(void *dst, const void *src, size_t n) {
+    volatile uint8_t *d = (volatile uint8_t *)dst;
+    const uint8_t *s = (const uint8_t *)src;
+    for (size_t i = 0; i < n; i++) {
+        d[i] = s[i];
+    }
+    return dst;
+}
+
+static void *set_bytes(void *dst, int c, size_t n) {
+    volatile uint8_t *d = (volatile uint8_t *)dst;
+    for (size_t i = 0; i < n; i++) {
+        d[i] = (uint8_t)c;
+    }
+    return dst;
+}
+
+static uint64_t sweep_iters(size_t size) {
+    uint64_t iters = SWEEP_BYTES / size;
+    return iters < SWEEP_MIN_ITERS ? SWEEP_MIN_ITERS : iters;
+}
+
+static void sweep_copy(const char *name, copy_fn_t fn, void *dst, const void *src) {
+    for (size_t size = SWEEP_MIN; size <= SWEEP_MAX; size *= 2) {
+        uint64_t iters = sweep_iters(size);
+
+        uint64_t start = rdtsc();
+        for (uint64_t i = 0; i < iters; i++) {
+            fn(dst, src, size);
+        }
+        bench_report("string", name, size, iters, rdtsc() - start);
+    }
+}
+
+static void sweep_set(const char *name, set_fn_t fn, void *dst) {
+    for (size_t size = SWEEP_MIN; size <= SWEEP_MAX; size *= 2) {
+        uint64_t iters = sweep_iters(size);
+
+        uint64_t start = rdtsc();
+        for (uint64_t i = 0; i < iters; i++) {
+            fn(dst, (int)i, size);
+        }
+        bench_report("string", name, size, iters, rdtsc() - start);
+    }
+}
+
+static void bench_pages(void *dst, const void *src) {
+    uint64_t start = rdtsc();
+    for (int i = 0; i < PAGE_ITERS; i++) {
+        copy_page(dst, src);
+    }
+    bench_report("string", "copy_page", 4096, PAGE_ITERS, rdtsc() - start);
+
+    start = rdtsc();
+    for (int i = 0; i < PAGE_ITERS; i++) {
+        clear_page(dst);
+    }
+    bench_report("string", "clear_page", 4096, PAGE_ITERS, rdtsc() - start);
+
+    // Non-temporal clear of the whole buffer, as idle pre-zeroing does
+    start = rdtsc();
+    for (int i = 0; i < SWEEP_MIN_ITERS; i++) {
+        clear_nt(dst, SWEEP_MAX);
+    }
+    bench_report("string", "clear_nt", SWEEP_MAX, SWEEP_MIN_ITERS, rdtsc() - start);
+}
+
+void bench_string(void) {
+    // Page aligned buffers, big enough for the largest size
+    uint8_t *src = kmalloc(SWEEP_MAX);
+    uint8_t *dst = kmalloc(SWEEP_MAX);
+    if (!src || !dst) {
+        kfree(src);
+        kfree(dst);
+        return;
+    }
+
+    memset(src, 0x5A, SWEEP_MAX);
+
+    int features = string_features();
+    bench_report_value("string", "features", 0, "erms", (features & STRING_ERMS) != 0);
+    bench_report_value("string", "features", 0, "fsrm", (features & STRING_FSRM) != 0);
+
+    sweep_copy("memcpy", memcpy, dst, src);
+    sweep_copy("memcpy_rep", memcpy_rep, dst, src);
+    sweep_copy("memcpy_loop", memcpy_loop, dst, src);
+    sweep_copy("memcpy_bytes", copy_bytes, dst, src);
+
+    sweep_set("memset", memset, dst);
+    sweep_set("memset_rep", memset_rep, dst);
+    sweep_set("memset_loop", memset_loop, dst);
+    sweep_set("memset_bytes", set_bytes, dst);
+
+    bench_pages(dst, src);
+
+    kfree(src);
+    kfree(dst);
+}
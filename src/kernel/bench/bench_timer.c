@@ -0,0 +1,124 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/list.h"
+#include "../include/ktime.h"
+#include "../include/timer.h"
+#include "../include/lapic.h"
+#include "../include/bench.h"
+
+// Timer costs on the BSP: add/cancel pairs at each wheel level and on the
+// hires list, adds into a populated wheel, how late timers fire, and how
+// often an idle CPU wakes up.
+
+#define ADD_ITERS     10000
+#define POPULATED     4096
+#define LATE_RUNS     20
+#define IDLE_NS       1000000000ULL
+
+// Timeouts for the add/cancel pairs, in microseconds: hires, then one
+// per wheel level
+static const uint64_t add_delays_us[] = { 200, 20000, 1000000, 100000000, 3600000000ULL };
+
+struct bench_wait {
+    struct timer timer;
+    volatile uint64_t fired;    // ktime_get() in the callback, 0 until then
+};
+
+static void wait_fired(struct timer *timer) {
+    struct bench_wait *w = container_of(timer, struct bench_wait, timer);
+    w->fired = ktime_get();
+}
+
+static void nop_fired(struct timer *timer) {
+}
+
+// One add and one cancel per round, never firing
+static void bench_add_cancel(uint64_t delay_us) {
+    struct timer timer;
+    timer_init(&timer, nop_fired, 0);
+
+    uint64_t start = rdtsc();
+    for (int i = 0; i < ADD_ITERS; i++) {
+        timer_add(&timer, ktime_get() + delay_us * 1000);
+        timer_cancel(&timer);
+    }
+    uint64_t cycles = rdtsc() - start;
+
+    bench_report("timer", "add_cancel", delay_us, ADD_ITERS * 2ULL, cycles);
+}
+
+// Adds with thousands of timers already queued, which a wheel shouldn't
+// notice
+static void bench_add_populated(void) {
+    static struct timer timers[POPULATED];
+    uint64_t now = ktime_get();
+
+    for (int i = 0; i < POPULATED; i++) {
+        timer_init(&timers[i], nop_fired, 0);
+    }
+
+    uint64_t start = rdtsc();
+    for (int i = 0; i < POPULATED; i++) {
+        // Spread from 10 ms to about 40 s out
+        timer_add(&timers[i], now + 10000000ULL + (uint64_t)i * 10000000ULL);
+    }
+    uint64_t cycles = rdtsc() - start;
+
+    for (int i = 0; i < POPULATED; i++) {
+        timer_cancel(&timers[i]);
+    }
+
+    bench_report("timer", "add_populated", POPULATED, POPULATED, cycles);
+}
+
+// Average ns between a timer's deadline and its callback
+static void bench_lateness(const char *name, uint64_t delay_ns, unsigned int flags) {
+    struct bench_wait w;
+    uint64_t total = 0;
+
+    timer_init(&w.timer, wait_fired, flags);
+    for (int i = 0; i < LATE_RUNS; i++) {
+        w.fired = 0;
+        timer_add(&w.timer, ktime_get() + delay_ns);
+        while (!w.fired) {
+            cpu_idle();
+        }
+        total += w.fired - w.timer.expires;
+    }
+
+    bench_report_value("timer", name, delay_ns / 1000, "late_ns", total / LATE_RUNS);
+}
+
+// Wakeups over a second of idling with nothing but the final timer armed.
+// Anything past 1 is another interrupt source.
+static void bench_idle_wakeups(void) {
+    struct bench_wait w;
+    uint64_t wakeups = 0;
+
+    timer_init(&w.timer, wait_fired, 0);
+    w.fired = 0;
+    timer_add(&w.timer, ktime_get() + IDLE_NS);
+
+    while (!w.fired) {
+        cpu_idle();
+        wakeups++;
+    }
+
+    bench_report_value("timer", "idle_1s", 0, "wakeups", wakeups);
+}
+
+void bench_timer(void) {
+    for (size_t i = 0; i < sizeof(add_delays_us) / sizeof(add_delays_us[0]); i++) {
+        bench_add_cancel(add_delays_us[i]);
+    }
+    bench_add_populated();
+
+    // Waiting needs a timer interrupt
+    if (!lapic_timer_available()) {
+        return;
+    }
+    bench_lateness("late_hires", 200000, TIMER_HIRES);
+    bench_lateness("late_wheel", 5000000, 0);
+    bench_idle_wakeups();
+}
@@ -0,0 +1,92 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/pmm.h"
+#include "../include/vmm.h"
+#include "../include/limine_requests.h"
+#include "../include/bench.h"
+
+// Scratch virtual range nothing else uses: above the HHDM's reach and well
+// below the kernel image and heap windows
+#define BENCH_VA 0xFFFFC00000000000ULL
+
+#define SINGLE_ITERS 20000
+#define RANGE_ITERS  32
+
+static const size_t range_pages[] = { 16, 512 };
+
+// Map and unmap one page over and over. The first map builds the page
+// tables, after that it's the walk, the store and the invlpg.
+static void bench_single(uint64_t phys) {
+    vmm_map(BENCH_VA, phys, VMM_WRITE);
+    vmm_unmap(BENCH_VA);
+
+    uint64_t map_cycles = 0;
+    uint64_t unmap_cycles = 0;
+
+    for (int i = 0; i < SINGLE_ITERS; i++) {
+        uint64_t start = rdtsc();
+        vmm_map(BENCH_VA, phys, VMM_WRITE);
+        uint64_t mid = rdtsc();
+        vmm_unmap(BENCH_VA);
+        unmap_cycles += rdtsc() - mid;
+        map_cycles += mid - start;
+    }
+
+    bench_report("vmm", "map", 1, SINGLE_ITERS, map_cycles);
+    bench_report("vmm", "unmap", 1, SINGLE_ITERS, unmap_cycles);
+}
+
+// Map a contiguous range page by page, then unmap it, reported per page
+static void bench_range(uint64_t phys, size_t pages) {
+    uint64_t map_cycles = 0;
+    uint64_t unmap_cycles = 0;
+
+    for (int i = 0; i < RANGE_ITERS; i++) {
+        uint64_t start = rdtsc();
+        for (size_t p = 0; p < pages; p++) {
+            vmm_map(BENCH_VA + p * 4096, phys, VMM_WRITE);
+        }
+        uint64_t mid = rdtsc();
+        for (size_t p = 0; p < pages; p++) {
+            vmm_unmap(BENCH_VA + p * 4096);
+        }
+        unmap_cycles += rdtsc() - mid;
+        map_cycles += mid - start;
+    }
+
+    bench_report("vmm", "map_range", pages, (uint64_t)RANGE_ITERS * pages, map_cycles);
+    bench_report("vmm", "unmap_range", pages, (uint64_t)RANGE_ITERS * pages, unmap_cycles);
+}
+
+// Walk without changing anything
+static void bench_translate(uint64_t phys) {
+    vmm_map(BENCH_VA, phys, VMM_WRITE);
+
+    uint64_t out;
+    uint64_t start = rdtsc();
+    for (int i = 0; i < SINGLE_ITERS; i++) {
+        vmm_translate(BENCH_VA, &out);
+    }
+    uint64_t cycles = rdtsc() - start;
+
+    vmm_unmap(BENCH_VA);
+    bench_report("vmm", "translate", 1, SINGLE_ITERS, cycles);
+}
+
+void bench_vmm(void) {
+    // Every mapping points at the same frame, only the tables matter
+    void *frame = pmm_alloc();
+    if (!frame) {
+        return;
+    }
+    uint64_t phys = (uint64_t)frame - hhdm_request.response->offset;
+
+    bench_single(phys);
+    for (size_t i = 0; i < sizeof(range_pages) / sizeof(range_pages[0]); i++) {
+        bench_range(phys, range_pages[i]);
+    }
+    bench_translate(phys);
+
+    pmm_free(frame);
+}
@@ -0,0 +1,193 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "../include/klog.h"
+#include "../include/vmm.h"
+#include "../include/string.h"
+#include "../include/limine_requests.h"
+#include "../include/acpi.h"
+
+struct rsdp {
+    char signature[8];          // "RSD PTR "
+    uint8_t checksum;           // Over the first 20 bytes
+    char oem_id[6];
+    uint8_t revision;           // 2 and up have the XSDT fields
+    uint32_t rsdt_address;
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed));
+
+// Root tables list the others by physical address, 4 bytes each in the
+// RSDT and 8 (unaligned) in the XSDT
+struct rsdt {
+    struct acpi_sdt_header header;
+    uint32_t entries[];
+} __attribute__((packed));
+
+struct xsdt {
+    struct acpi_sdt_header header;
+    uint64_t entries[];
+} __attribute__((packed));
+
+// Tables are plain RAM, map them cacheable and read-only
+#define ACPI_MAP_FLAGS VMM_NX
+
+// Tables listed by the root, most firmware has a few dozen
+#define ACPI_MAX_TABLES 64
+
+// A table the root lists. Its header is mapped once while the root is
+// read, the whole table the first time someone asks for it.
+struct acpi_entry {
+    uint64_t phys;
+    uint32_t length;
+    char signature[4];
+    const struct acpi_sdt_header *table;    // NULL until mapped and checked
+    int bad;                                // Failed to map or checksum
+};
+
+// Root table once found, and how wide its entries are
+static const struct acpi_sdt_header *root = NULL;
+static int root_is_xsdt = 0;
+static int root_missing = 0;
+
+static struct acpi_entry entries[ACPI_MAX_TABLES];
+static size_t nr_entries = 0;
+
+// Helper: Sum of `len` bytes, 0 for a valid table
+static uint8_t checksum(const void *p, uint32_t len) {
+    const uint8_t *b = p;
+    uint8_t sum = 0;
+
+    for (uint32_t i = 0; i < len; i++) {
+        sum += b[i];
+    }
+    return sum;
+}
+
+// Helper: Whether the page holding a table's header holds all of it
+static int fits_header_page(uint64_t phys, uint32_t length) {
+    return (phys & 0xFFF) + length <= 0x1000;
+}
+
+// Helper: The table of `length` bytes at phys mapped whole, reusing the
+// header's mapping if that covers it. NULL if it can't be mapped or its
+// checksum is off.
+static const struct acpi_sdt_header *map_whole(uint64_t phys, uint32_t length,
+                                               const struct acpi_sdt_header *header) {
+    if (length < sizeof(*header)) {
+        return NULL;
+    }
+
+    const struct acpi_sdt_header *table = header;
+    if (!table || !fits_header_page(phys, length)) {
+        table = vmm_map_phys(phys, length, ACPI_MAP_FLAGS);
+    }
+
+    if (!table || checksum(table, length) != 0) {
+        return NULL;
+    }
+    return table;
+}
+
+// Helper: Map the table at phys whole, NULL if it can't be mapped or its
+// checksum is off
+static const struct acpi_sdt_header *map_table(uint64_t phys) {
+    const struct acpi_sdt_header *header = vmm_map_phys(phys, sizeof(*header), ACPI_MAP_FLAGS);
+    return header ? map_whole(phys, header->length, header) : NULL;
+}
+
+// Helper: Note the signature of every table the root lists
+static void read_entries(void) {
+    size_t width = root_is_xsdt ? 8 : 4;
+    size_t count = (root->length - sizeof(*root)) / width;
+
+    if (count > ACPI_MAX_TABLES) {
+        klog(KLOG_WARN, "ACPI: %lu tables, only looking at %d\n", count, ACPI_MAX_TABLES);
+        count = ACPI_MAX_TABLES;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        uint64_t phys = root_is_xsdt ? ((const struct xsdt *)root)->entries[i]
+                                     : ((const struct rsdt *)root)->entries[i];
+
+        const struct acpi_sdt_header *header = vmm_map_phys(phys, sizeof(*header), ACPI_MAP_FLAGS);
+        if (!header) {
+            continue;
+        }
+
+        struct acpi_entry *entry = &entries[nr_entries++];
+        entry->phys = phys;
+        entry->length = header->length;
+        memcpy(entry->signature, header->signature, 4);
+
+        // Most tables fit in their header's page, check them right away
+        // so the mapping gets used. Bigger ones are mapped on demand.
+        if (fits_header_page(phys, entry->length)) {
+            entry->table = map_whole(phys, entry->length, header);
+            entry->bad = !entry->table;
+        }
+    }
+}
+
+// Helper: Find and map the RSDT or XSDT, on the first call
+static int find_root(void) {
+    if (root || root_missing) {
+        return root ? 0 : -1;
+    }
+    root_missing = 1;
+
+    if (!rsdp_request.response) {
+        klog(KLOG_WARN, "ACPI: no RSDP from the bootloader\n");
+        return -1;
+    }
+
+    // Base revision 3 hands over the physical address
+    const struct rsdp *rsdp = vmm_map_phys((uint64_t)rsdp_request.response->address,
+                                           sizeof(struct rsdp), ACPI_MAP_FLAGS);
+    if (!rsdp || memcmp(rsdp->signature, "RSD PTR ", 8) != 0 || checksum(rsdp, 20) != 0) {
+        klog(KLOG_WARN, "ACPI: bad RSDP\n");
+        return -1;
+    }
+
+    if (rsdp->revision >= 2 && rsdp->xsdt_address) {
+        root = map_table(rsdp->xsdt_address);
+        root_is_xsdt = 1;
+    } else {
+        root = map_table(rsdp->rsdt_address);
+    }
+
+    if (!root) {
+        klog(KLOG_WARN, "ACPI: bad %s\n", root_is_xsdt ? "XSDT" : "RSDT");
+        return -1;
+    }
+
+    root_missing = 0;
+    klog(KLOG_INFO, "ACPI: revision %u, %s\n", rsdp->revision, root_is_xsdt ? "XSDT" : "RSDT");
+
+    read_entries();
+    return 0;
+}
+
+const struct acpi_sdt_header *acpi_find_table(const char *signature) {
+    if (find_root() != 0) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < nr_entries; i++) {
+        struct acpi_entry *entry = &entries[i];
+        if (memcmp(entry->signature, signature, 4) != 0) {
+            continue;
+        }
+
+        if (!entry->table && !entry->bad) {
+            entry->table = map_whole(entry->phys, entry->length, NULL);
+            entry->bad = !entry->table;
+        }
+        if (entry->bad) {
+            klog(KLOG_WARN, "ACPI: %s has a bad checksum\n", signature);
+        }
+        return entry->table;
+    }
+    return NULL;
+}
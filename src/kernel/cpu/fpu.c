@@ -0,0 +1,186 @@
+#include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/serial.h"
+#include "../include/fpu.h"
+#include "../include/percpu.h"
+
+#define CR0_MP (1ULL << 1)
+#define CR0_EM (1ULL << 2)
+#define CR0_TS (1ULL << 3)
+
+#define CR4_OSFXSR     (1ULL << 9)
+#define CR4_OSXMMEXCPT (1ULL << 10)
+#define CR4_OSXSAVE    (1ULL << 18)
+
+#define XCR0_X87 (1ULL << 0)
+#define XCR0_SSE (1ULL << 1)
+#define XCR0_AVX (1ULL << 2)
+
+// Room for legacy, header and AVX state (832 bytes), 64-byte aligned for
+// XSAVE. Deeper feature sets aren't enabled.
+#define FPU_AREA_SIZE 1024
+
+// Nesting levels per CPU: task, interrupt, and some slack
+#define FPU_MAX_DEPTH 4
+
+struct fpu_cpu {
+    uint8_t area[FPU_MAX_DEPTH][FPU_AREA_SIZE];
+    int depth;
+    uint64_t overflows;         // begin() calls past FPU_MAX_DEPTH
+} __attribute__((aligned(64)));
+
+static DEFINE_PER_CPU_ALIGNED(struct fpu_cpu, fpu_cpu);
+
+static int features = 0;
+static uint64_t xcr0 = 0;
+
+static inline uint64_t read_cr4(void) {
+    uint64_t v;
+    asm volatile ("mov %%cr4, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr4(uint64_t v) {
+    asm volatile ("mov %0, %%cr4" :: "r"(v) : "memory");
+}
+
+static inline void xsetbv(uint32_t reg, uint64_t v) {
+    asm volatile ("xsetbv" :: "c"(reg), "a"((uint32_t)v), "d"((uint32_t)(v >> 32)));
+}
+
+void fpu_init(void) {
+    uint32_t a, b, c, d;
+
+    cpuid(1, 0, &a, &b, &c, &d);
+    int has_xsave = (c >> 26) & 1;
+    int has_avx = (c >> 28) & 1;
+    if ((c >> 20) & 1) {
+        features |= FPU_SSE42;
+    }
+
+    // No emulation, no lazy switching traps
+    write_cr0((read_cr0() & ~(CR0_EM | CR0_TS)) | CR0_MP);
+
+    uint64_t cr4 = read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT;
+    if (has_xsave) {
+        cr4 |= CR4_OSXSAVE;
+    }
+    write_cr4(cr4);
+
+    if (has_xsave) {
+        features |= FPU_XSAVE;
+        xcr0 = XCR0_X87 | XCR0_SSE;
+        if (has_avx) {
+            xcr0 |= XCR0_AVX;
+        }
+        xsetbv(0, xcr0);
+
+        // Size of the area for what XCR0 now enables
+        cpuid(0x0D, 0, &a, &b, &c, &d);
+        if (b > FPU_AREA_SIZE) {
+            serial_puts("FPU: XSAVE area too big, AVX left disabled\n");
+            xcr0 &= ~XCR0_AVX;
+            xsetbv(0, xcr0);
+        }
+
+        cpuid(0x0D, 1, &a, &b, &c, &d);
+        if (a & 1) {
+            features |= FPU_XSAVEOPT;
+        }
+
+        if (xcr0 & XCR0_AVX) {
+            features |= FPU_AVX;
+
+            cpuid(0, 0, &a, &b, &c, &d);
+            if (a >= 7) {
+                cpuid(7, 0, &a, &b, &c, &d);
+                if ((b >> 5) & 1) {
+                    features |= FPU_AVX2;
+                }
+            }
+        }
+    }
+
+    // Clean x87 and SSE state to start from
+    uint32_t mxcsr = 0x1F80;
+    asm volatile ("fninit\n\tldmxcsr %0" :: "m"(mxcsr));
+
+    serial_puts("FPU: ");
+    serial_puts(features & FPU_XSAVEOPT ? "xsaveopt" : features & FPU_XSAVE ? "xsave" : "fxsave");
+    serial_puts(features & FPU_AVX2 ? " avx2" : features & FPU_AVX ? " avx" : " sse2");
+    serial_puts(features & FPU_SSE42 ? " sse4.2\n" : "\n");
+}
+
+void fpu_init_ap(void) {
+    write_cr0((read_cr0() & ~(CR0_EM | CR0_TS)) | CR0_MP);
+
+    uint64_t cr4 = read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT;
+    if (features & FPU_XSAVE) {
+        cr4 |= CR4_OSXSAVE;
+    }
+    write_cr4(cr4);
+
+    if (features & FPU_XSAVE) {
+        xsetbv(0, xcr0);
+    }
+
+    uint32_t mxcsr = 0x1F80;
+    asm volatile ("fninit\n\tldmxcsr %0" :: "m"(mxcsr));
+}
+
+int fpu_features(void) {
+    return features;
+}
+
+// Helper: Save the live extended state
+static inline void fpu_save(void *area) {
+    uint32_t lo = (uint32_t)xcr0, hi = (uint32_t)(xcr0 >> 32);
+
+    if (features & FPU_XSAVEOPT) {
+        asm volatile ("xsaveopt64 (%0)" :: "r"(area), "a"(lo), "d"(hi) : "memory");
+    } else if (features & FPU_XSAVE) {
+        asm volatile ("xsave64 (%0)" :: "r"(area), "a"(lo), "d"(hi) : "memory");
+    } else {
+        asm volatile ("fxsave64 (%0)" :: "r"(area) : "memory");
+    }
+}
+
+// Helper: Load it back
+static inline void fpu_restore(void *area) {
+    uint32_t lo = (uint32_t)xcr0, hi = (uint32_t)(xcr0 >> 32);
+
+    if (features & FPU_XSAVE) {
+        asm volatile ("xrstor64 (%0)" :: "r"(area), "a"(lo), "d"(hi) : "memory");
+    } else {
+        asm volatile ("fxrstor64 (%0)" :: "r"(area) : "memory");
+    }
+}
+
+void kernel_fpu_begin(void) {
+    uint64_t flags = local_irq_save();
+    struct fpu_cpu *fpu = this_cpu_ptr(fpu_cpu);
+
+    if (fpu->depth >= FPU_MAX_DEPTH) {
+        // Can't save another level, count it so end() stays balanced
+        if (fpu->overflows++ == 0) {
+            serial_puts("FPU: kernel_fpu_begin() nested too deep!\n");
+        }
+    } else {
+        fpu_save(fpu->area[fpu->depth]);
+    }
+    fpu->depth++;
+
+    local_irq_restore(flags);
+}
+
+void kernel_fpu_end(void) {
+    uint64_t flags = local_irq_save();
+    struct fpu_cpu *fpu = this_cpu_ptr(fpu_cpu);
+
+    fpu->depth--;
+    if (fpu->depth < FPU_MAX_DEPTH) {
+        fpu_restore(fpu->area[fpu->depth]);
+    }
+
+    local_irq_restore(flags);
+}
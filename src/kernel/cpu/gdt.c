@@ -0,0 +1,73 @@
+#include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/gdt.h"
+
+// Null, kernel code, kernel data, then the TSS which takes two slots
+#define GDT_ENTRIES 5
+
+#define SEG_KERNEL_CODE 0x00AF9A000000FFFFULL // Present, DPL 0, long mode code
+#define SEG_KERNEL_DATA 0x00CF92000000FFFFULL // Present, DPL 0, writable data
+#define SEG_TSS_TYPE    0x89ULL               // Present, available 64-bit TSS
+
+struct tss {
+    uint32_t reserved0;
+    uint64_t rsp[3];
+    uint64_t reserved1;
+    uint64_t ist[7];
+    uint64_t reserved2;
+    uint16_t reserved3;
+    uint16_t iomap_base;
+} __attribute__((packed));
+
+struct gdt_ptr {
+    uint16_t limit;
+    uint64_t base;
+} __attribute__((packed));
+
+struct gdt_cpu {
+    uint64_t gdt[GDT_ENTRIES];
+    struct tss tss;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static struct gdt_cpu gdt_cpus[MAX_CPUS];
+
+void gdt_init(unsigned int cpu, uint64_t df_stack_top) {
+    struct gdt_cpu *g = &gdt_cpus[cpu];
+    uint64_t base = (uint64_t)&g->tss;
+    uint64_t limit = sizeof(g->tss) - 1;
+
+    g->tss.ist[IST_DOUBLE_FAULT - 1] = df_stack_top;
+    // No I/O permission bitmap, the offset points past the limit
+    g->tss.iomap_base = sizeof(g->tss);
+
+    g->gdt[0] = 0;
+    g->gdt[GDT_KERNEL_CODE / 8] = SEG_KERNEL_CODE;
+    g->gdt[GDT_KERNEL_DATA / 8] = SEG_KERNEL_DATA;
+    g->gdt[GDT_TSS / 8] = (limit & 0xFFFF) | ((base & 0xFFFFFF) << 16) |
+                          (SEG_TSS_TYPE << 40) | (((limit >> 16) & 0xF) << 48) |
+                          (((base >> 24) & 0xFF) << 56);
+    g->gdt[GDT_TSS / 8 + 1] = base >> 32;
+
+    struct gdt_ptr ptr = {
+        .limit = sizeof(g->gdt) - 1,
+        .base = (uint64_t)g->gdt,
+    };
+
+    // CS can only be changed by a far transfer, return to the next
+    // instruction through our code selector
+    asm volatile ("lgdt %0\n\t"
+                  "pushq %1\n\t"
+                  "leaq 1f(%%rip), %%rax\n\t"
+                  "pushq %%rax\n\t"
+                  "lretq\n"
+                  "1:\n\t"
+                  "mov %w2, %%ds\n\t"
+                  "mov %w2, %%es\n\t"
+                  "mov %w2, %%ss\n\t"
+                  "xor %%eax, %%eax\n\t"
+                  "mov %%ax, %%fs\n\t"
+                  "mov %%ax, %%gs\n\t"
+                  "ltr %w3"
+                  :: "m"(ptr), "i"(GDT_KERNEL_CODE), "r"(GDT_KERNEL_DATA), "r"(GDT_TSS)
+                  : "rax", "memory");
+}
@@ -0,0 +1,82 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "../include/klog.h"
+#include "../include/vmm.h"
+#include "../include/acpi.h"
+#include "../include/hpet.h"
+
+// ACPI's description of the HPET
+struct hpet_table {
+    struct acpi_sdt_header header;
+    uint32_t event_timer_block_id;
+    struct acpi_gas base;
+    uint8_t number;
+    uint16_t min_tick;
+    uint8_t page_protection;
+} __attribute__((packed));
+
+// Registers, all 64 bits wide
+#define HPET_CAP          0x000
+#define HPET_CONFIG       0x010
+#define HPET_COUNTER      0x0F0
+
+#define CAP_COUNT_64      (1ULL << 13)
+#define CAP_PERIOD_SHIFT  32
+#define CONFIG_ENABLE     (1ULL << 0)
+
+// The spec caps the tick at 100 ns
+#define HPET_MAX_PERIOD_FS 100000000ULL
+
+static volatile uint64_t *regs = NULL;
+static uint64_t period_fs = 0;
+static int counter_64bit = 0;
+
+int hpet_init(void) {
+    const struct hpet_table *table = (const struct hpet_table *)acpi_find_table("HPET");
+    if (!table) {
+        klog(KLOG_INFO, "HPET: not present\n");
+        return -1;
+    }
+
+    if (table->base.space_id != ACPI_SPACE_MEMORY) {
+        klog(KLOG_WARN, "HPET: not memory mapped, ignoring it\n");
+        return -1;
+    }
+
+    volatile uint64_t *r = vmm_map_mmio(table->base.address, 0x400);
+    if (!r) {
+        return -1;
+    }
+
+    uint64_t cap = r[HPET_CAP / 8];
+    uint64_t period = cap >> CAP_PERIOD_SHIFT;
+    if (period == 0 || period > HPET_MAX_PERIOD_FS) {
+        klog(KLOG_WARN, "HPET: bogus period %lu fs, ignoring it\n", period);
+        return -1;
+    }
+
+    // Firmware may leave it halted, the counter only runs when enabled
+    if (!(r[HPET_CONFIG / 8] & CONFIG_ENABLE)) {
+        r[HPET_CONFIG / 8] |= CONFIG_ENABLE;
+    }
+
+    regs = r;
+    period_fs = period;
+    counter_64bit = (cap & CAP_COUNT_64) != 0;
+
+    klog(KLOG_INFO, "HPET: at 0x%lX, %lu kHz, %s counter\n", table->base.address,
+         1000000000000UL / period, counter_64bit ? "64-bit" : "32-bit");
+    return 0;
+}
+
+uint64_t hpet_read(void) {
+    return regs[HPET_COUNTER / 8];
+}
+
+uint64_t hpet_period_fs(void) {
+    return period_fs;
+}
+
+int hpet_counter_64bit(void) {
+    return counter_64bit;
+}
@@ -0,0 +1,133 @@
+#include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/pic.h"
+#include "../include/klog.h"
+#include "../include/idt.h"
+#include "../include/gdt.h"
+
+// Built with -mgeneral-regs-only (see the Makefile), as GCC requires for
+// interrupt handlers.
+
+#define IDT_ENTRIES 256
+
+#define GATE_INTERRUPT 0x8E // Present, DPL 0, 64-bit interrupt gate
+
+struct idt_entry {
+    uint16_t offset_lo;
+    uint16_t selector;
+    uint8_t ist;
+    uint8_t type;
+    uint16_t offset_mid;
+    uint32_t offset_hi;
+    uint32_t reserved;
+} __attribute__((packed));
+
+struct idt_ptr {
+    uint16_t limit;
+    uint64_t base;
+} __attribute__((packed));
+
+static struct idt_entry idt[IDT_ENTRIES] __attribute__((aligned(16)));
+
+static const char *exception_names[32] = {
+    "divide error", "debug", "NMI", "breakpoint", "overflow",
+    "bound range", "invalid opcode", "device not available",
+    "double fault", "coprocessor overrun", "invalid TSS",
+    "segment not present", "stack fault", "general protection",
+    "page fault", "reserved", "x87 error", "alignment check",
+    "machine check", "SIMD error", "virtualization", "control protection",
+    "reserved", "reserved", "reserved", "reserved", "reserved", "reserved",
+    "hypervisor injection", "VMM communication", "security", "reserved",
+};
+
+void idt_set_handler(int vector, uintptr_t handler) {
+    uint64_t addr = handler;
+
+    idt[vector].offset_lo = addr & 0xFFFF;
+    idt[vector].selector = GDT_KERNEL_CODE;
+    idt[vector].ist = 0;
+    idt[vector].type = GATE_INTERRUPT;
+    idt[vector].offset_mid = (addr >> 16) & 0xFFFF;
+    idt[vector].offset_hi = addr >> 32;
+    idt[vector].reserved = 0;
+}
+
+// Helper: Report an exception and stop
+static void exception(int vector, struct interrupt_frame *frame, uint64_t error) {
+    uint64_t cr2;
+    asm volatile ("mov %%cr2, %0" : "=r"(cr2));
+
+    panic("%s (vector %d) at rip=%lx err=%lx cr2=%lx rsp=%lx\n",
+          exception_names[vector], vector, frame->rip, error, cr2, frame->rsp);
+}
+
+#define EXCEPTION(n)                                                    \
+    __attribute__((interrupt))                                          \
+    static void exception_##n(struct interrupt_frame *frame) {          \
+        exception(n, frame, 0);                                         \
+    }
+
+#define EXCEPTION_ERR(n)                                                \
+    __attribute__((interrupt))                                          \
+    static void exception_##n(struct interrupt_frame *frame, uint64_t error) { \
+        exception(n, frame, error);                                     \
+    }
+
+EXCEPTION(0)  EXCEPTION(1)  EXCEPTION(2)  EXCEPTION(3)
+EXCEPTION(4)  EXCEPTION(5)  EXCEPTION(6)  EXCEPTION(7)
+EXCEPTION_ERR(8)  EXCEPTION(9)  EXCEPTION_ERR(10) EXCEPTION_ERR(11)
+EXCEPTION_ERR(12) EXCEPTION_ERR(13) EXCEPTION_ERR(14) EXCEPTION(15)
+EXCEPTION(16) EXCEPTION_ERR(17) EXCEPTION(18) EXCEPTION(19)
+EXCEPTION(20) EXCEPTION_ERR(21) EXCEPTION(22) EXCEPTION(23)
+EXCEPTION(24) EXCEPTION(25) EXCEPTION(26) EXCEPTION(27)
+EXCEPTION(28) EXCEPTION_ERR(29) EXCEPTION_ERR(30) EXCEPTION(31)
+
+#define HANDLER(n) (uintptr_t)exception_##n
+
+static const uintptr_t exception_handlers[32] = {
+    HANDLER(0),  HANDLER(1),  HANDLER(2),  HANDLER(3),
+    HANDLER(4),  HANDLER(5),  HANDLER(6),  HANDLER(7),
+    HANDLER(8),  HANDLER(9),  HANDLER(10), HANDLER(11),
+    HANDLER(12), HANDLER(13), HANDLER(14), HANDLER(15),
+    HANDLER(16), HANDLER(17), HANDLER(18), HANDLER(19),
+    HANDLER(20), HANDLER(21), HANDLER(22), HANDLER(23),
+    HANDLER(24), HANDLER(25), HANDLER(26), HANDLER(27),
+    HANDLER(28), HANDLER(29), HANDLER(30), HANDLER(31),
+};
+
+__attribute__((interrupt))
+static void irq_com1(struct interrupt_frame *frame) {
+    klog_uart_irq();
+    pic_eoi(PIC_IRQ_COM1);
+}
+
+// IRQ7 fires spuriously when a line drops before it's acknowledged, and
+// must not get an EOI
+__attribute__((interrupt))
+static void irq_spurious(struct interrupt_frame *frame) {
+}
+
+void idt_set_ist(int vector, int ist) {
+    idt[vector].ist = ist;
+}
+
+void idt_load(void) {
+    struct idt_ptr ptr = {
+        .limit = sizeof(idt) - 1,
+        .base = (uint64_t)idt,
+    };
+    asm volatile ("lidt %0" :: "m"(ptr));
+}
+
+void idt_init(void) {
+    for (int i = 0; i < 32; i++) {
+        idt_set_handler(i, exception_handlers[i]);
+    }
+    idt_set_ist(8, IST_DOUBLE_FAULT);
+
+    pic_init();
+    idt_set_handler(PIC_VECTOR_BASE + PIC_IRQ_COM1, (uintptr_t)irq_com1);
+    idt_set_handler(PIC_VECTOR_BASE + 7, (uintptr_t)irq_spurious);
+
+    idt_load();
+}
@@ -0,0 +1,141 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "../include/cpu.h"
+#include "../include/klog.h"
+#include "../include/cmdline.h"
+#include "../include/string.h"
+#include "../include/tsc.h"
+#include "../include/hpet.h"
+#include "../include/ktime.h"
+
+static const char *const clock_names[] = { "none", "tsc", "hpet" };
+
+// Counts to nanoseconds as (counts * mult) >> 32, everything ktime_get()
+// needs on one line
+static struct {
+    enum clocksource source;
+    uint64_t base;              // Count at ktime_init()
+    uint64_t mult;              // Nanoseconds per count, 32.32 fixed point
+    uint64_t khz;               // Count rate, for ktime_to_tsc()
+} clock __attribute__((aligned(CACHE_LINE_SIZE)));
+
+// Reads timed for the boot log
+#define READ_COST_ITERS 1000
+
+// Helper: The clocksource's raw count
+static inline uint64_t clock_read(enum clocksource source) {
+    return source == CLOCK_TSC ? rdtsc() : hpet_read();
+}
+
+// Helper: Scale a count to nanoseconds. Split in 32-bit halves so the
+// product can't overflow: the high half times mult stays below 2^64 for
+// centuries of uptime.
+static inline uint64_t scale(uint64_t counts, uint64_t mult) {
+    return (counts >> 32) * mult + (((counts & 0xFFFFFFFF) * mult) >> 32);
+}
+
+// Helper: The source named by clocksource=, CLOCK_NONE if there's no
+// (known) override
+static enum clocksource cmdline_source(void) {
+    size_t len;
+    const char *name = cmdline_get("clocksource", &len);
+    if (!name) {
+        return CLOCK_NONE;
+    }
+
+    for (size_t i = CLOCK_TSC; i < sizeof(clock_names) / sizeof(clock_names[0]); i++) {
+        if (len == strlen(clock_names[i]) && memcmp(name, clock_names[i], len) == 0) {
+            return (enum clocksource)i;
+        }
+    }
+
+    klog(KLOG_WARN, "KTIME: unknown clocksource= value, ignoring it\n");
+    return CLOCK_NONE;
+}
+
+// Helper: Cycles per ktime_get(), best of a few batches
+static uint64_t read_cost(void) {
+    uint64_t best = ~0ULL;
+
+    for (int run = 0; run < 3; run++) {
+        uint64_t start = rdtsc();
+        for (int i = 0; i < READ_COST_ITERS; i++) {
+            (void)ktime_get();
+        }
+        uint64_t cycles = (rdtsc() - start) / READ_COST_ITERS;
+        if (cycles < best) {
+            best = cycles;
+        }
+    }
+    return best;
+}
+
+void ktime_init(void) {
+    int have_hpet = hpet_init() == 0;
+    if (have_hpet) {
+        tsc_calibrate_hpet();
+    }
+
+    // What's usable, best first
+    int tsc_ok = tsc_khz() != 0;
+    int tsc_good = tsc_ok && tsc_invariant();
+    int hpet_ok = have_hpet && hpet_counter_64bit();
+
+    enum clocksource source = CLOCK_NONE;
+    if (tsc_good) {
+        source = CLOCK_TSC;
+    } else if (hpet_ok) {
+        source = CLOCK_HPET;
+    } else if (tsc_ok) {
+        klog(KLOG_WARN, "KTIME: TSC isn't invariant and there's no HPET, using it anyway\n");
+        source = CLOCK_TSC;
+    }
+
+    enum clocksource wanted = cmdline_source();
+    if ((wanted == CLOCK_TSC && tsc_ok) || (wanted == CLOCK_HPET && hpet_ok)) {
+        source = wanted;
+    } else if (wanted != CLOCK_NONE) {
+        klog(KLOG_WARN, "KTIME: clocksource=%s unavailable\n", clock_names[wanted]);
+    }
+
+    if (source == CLOCK_NONE) {
+        klog(KLOG_ERR, "KTIME: no clocksource, time stands still\n");
+        return;
+    }
+
+    if (source == CLOCK_TSC) {
+        clock.khz = tsc_khz();
+        clock.mult = (1000000UL << 32) / clock.khz;
+    } else {
+        clock.khz = 1000000000000UL / hpet_period_fs();
+        clock.mult = (hpet_period_fs() << 32) / 1000000;
+    }
+
+    clock.base = clock_read(source);
+    clock.source = source;
+
+    klog(KLOG_INFO, "KTIME: clocksource %s at %lu kHz, %lu cycles per read\n",
+         clock_names[source], clock.khz, read_cost());
+}
+
+uint64_t ktime_get(void) {
+    enum clocksource source = clock.source;
+
+    if (source == CLOCK_NONE) {
+        return 0;
+    }
+    return scale(clock_read(source) - clock.base, clock.mult);
+}
+
+enum clocksource ktime_clocksource(void) {
+    return clock.source;
+}
+
+const char *ktime_clocksource_name(void) {
+    return clock_names[clock.source];
+}
+
+uint64_t ktime_to_tsc(uint64_t ns) {
+    // Division is fine here, this is for arming timers
+    return clock.base + ns / 1000000 * clock.khz + ns % 1000000 * clock.khz / 1000000;
+}
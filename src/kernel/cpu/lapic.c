@@ -0,0 +1,258 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "../include/cpu.h"
+#include "../include/klog.h"
+#include "../include/vmm.h"
+#include "../include/idt.h"
+#include "../include/ktime.h"
+#include "../include/lapic.h"
+
+// Built with -mgeneral-regs-only (see the Makefile) for the spurious and
+// timer interrupt handlers.
+
+#define MSR_APIC_BASE      0x1B
+#define APIC_BASE_BSP      (1ULL << 8)
+#define APIC_BASE_X2APIC   (1ULL << 10)
+#define APIC_BASE_ENABLE   (1ULL << 11)
+#define APIC_BASE_ADDR     0x000FFFFFFFFFF000UL
+
+// x2APIC registers are MSRs, one per 16-byte MMIO register
+#define MSR_X2APIC_BASE    0x800
+#define MSR_X2APIC_ICR     0x830
+
+#define MSR_TSC_DEADLINE   0x6E0
+
+#define CPUID_1_TSC_DEADLINE (1U << 24)
+
+#define SVR_ENABLE         (1U << 8)
+#define ICR_DELIVERY_BUSY  (1U << 12)
+#define ICR_LEVEL_ASSERT   (1U << 14)
+
+#define TIMER_ONESHOT      (0U << 17)
+#define TIMER_TSC_DEADLINE (2U << 17)
+#define TIMER_DIV_1        0xB
+
+// One-shot calibration window
+#define TIMER_CAL_NS       10000000ULL
+
+static volatile uint32_t *mmio = NULL;
+static int x2apic = 0;
+static int ready = 0;
+
+// Timer setup, the same on every CPU
+static int tsc_deadline = 0;
+static uint64_t timer_khz = 0;          // One-shot count rate, 0 if unknown
+static void (*timer_fn)(void) = NULL;
+
+uint32_t lapic_read(uint32_t reg) {
+    if (x2apic) {
+        return rdmsr(MSR_X2APIC_BASE + (reg >> 4));
+    }
+    return mmio[reg / 4];
+}
+
+void lapic_write(uint32_t reg, uint32_t value) {
+    if (x2apic) {
+        wrmsr(MSR_X2APIC_BASE + (reg >> 4), value);
+        return;
+    }
+    mmio[reg / 4] = value;
+}
+
+uint32_t lapic_id(void) {
+    uint32_t id = lapic_read(LAPIC_ID);
+    return x2apic ? id : id >> 24;
+}
+
+void lapic_eoi(void) {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector) {
+    uint32_t low = vector | ICR_LEVEL_ASSERT;
+
+    if (x2apic) {
+        wrmsr(MSR_X2APIC_ICR, ((uint64_t)apic_id << 32) | low);
+        return;
+    }
+
+    uint64_t flags = local_irq_save();
+    lapic_write(LAPIC_ICR_HI, apic_id << 24);
+    lapic_write(LAPIC_ICR_LO, low);
+    while (lapic_read(LAPIC_ICR_LO) & ICR_DELIVERY_BUSY) {
+        cpu_relax();
+    }
+    local_irq_restore(flags);
+}
+
+// Raised when an interrupt goes away before it's delivered, never EOI'd
+__attribute__((interrupt))
+static void lapic_spurious(struct interrupt_frame *frame) {
+}
+
+__attribute__((interrupt))
+static void lapic_timer_irq(struct interrupt_frame *frame) {
+    lapic_eoi();
+    if (timer_fn) {
+        timer_fn();
+    }
+}
+
+void lapic_timer_set_handler(void (*fn)(void)) {
+    timer_fn = fn;
+}
+
+void lapic_timer_arm(uint64_t deadline) {
+    if (tsc_deadline) {
+        // 0 disarms, so a deadline at the very start of time becomes 1
+        uint64_t tsc = ktime_to_tsc(deadline);
+        wrmsr(MSR_TSC_DEADLINE, tsc ? tsc : 1);
+        return;
+    }
+    if (!timer_khz) {
+        return;
+    }
+
+    uint64_t now = ktime_get();
+    uint64_t ns = deadline > now ? deadline - now : 0;
+    uint64_t count = ns / 1000000 * timer_khz + ns % 1000000 * timer_khz / 1000000;
+
+    // Too far out for 32 bits fires early, the handler re-arms
+    if (count > 0xFFFFFFFF) {
+        count = 0xFFFFFFFF;
+    }
+    lapic_write(LAPIC_TIMER_INIT, count ? (uint32_t)count : 1);
+}
+
+void lapic_timer_cancel(void) {
+    if (tsc_deadline) {
+        wrmsr(MSR_TSC_DEADLINE, 0);
+    } else {
+        lapic_write(LAPIC_TIMER_INIT, 0);
+    }
+}
+
+int lapic_timer_available(void) {
+    return ready && (tsc_deadline || timer_khz);
+}
+
+int lapic_timer_tsc_deadline(void) {
+    return tsc_deadline;
+}
+
+// Helper: Pick the timer mode and measure the one-shot rate, on the BSP
+static void lapic_timer_setup(void) {
+    uint32_t a, b, c, d;
+
+    cpuid(1, 0, &a, &b, &c, &d);
+    if ((c & CPUID_1_TSC_DEADLINE) && ktime_clocksource() == CLOCK_TSC) {
+        tsc_deadline = 1;
+        klog(KLOG_INFO, "LAPIC: timer in TSC-deadline mode\n");
+        return;
+    }
+
+    if (ktime_clocksource() == CLOCK_NONE) {
+        klog(KLOG_WARN, "LAPIC: no clocksource, timer disabled\n");
+        return;
+    }
+
+    // Count down from the top for a while, masked so it can't fire
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | TIMER_ONESHOT);
+    lapic_write(LAPIC_TIMER_DIV, TIMER_DIV_1);
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+
+    uint64_t start = ktime_get();
+    uint64_t now;
+    do {
+        cpu_relax();
+        now = ktime_get();
+    } while (now - start < TIMER_CAL_NS);
+
+    uint32_t left = lapic_read(LAPIC_TIMER_CUR);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+
+    timer_khz = (uint64_t)(0xFFFFFFFF - left) * 1000000 / (now - start);
+    klog(KLOG_INFO, "LAPIC: timer in one-shot mode at %lu kHz\n", timer_khz);
+}
+
+// Helper: Point the calling CPU's timer at its vector, disarmed
+static void lapic_timer_init_cpu(void) {
+    if (tsc_deadline) {
+        lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR | TIMER_TSC_DEADLINE);
+        wrmsr(MSR_TSC_DEADLINE, 0);
+
+        // The LVT write must land before any deadline write (SDM 10.5.4.1)
+        asm volatile ("mfence" ::: "memory");
+    } else if (timer_khz) {
+        lapic_write(LAPIC_TIMER_DIV, TIMER_DIV_1);
+        lapic_write(LAPIC_TIMER_INIT, 0);
+        lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR | TIMER_ONESHOT);
+    } else {
+        lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    }
+}
+
+// Helper: Find the LAPIC and map its registers, on the first call
+static int lapic_setup(void) {
+    uint32_t a, b, c, d;
+
+    cpuid(1, 0, &a, &b, &c, &d);
+    if (!((d >> 9) & 1)) {
+        klog(KLOG_ERR, "LAPIC: not present\n");
+        return -1;
+    }
+
+    uint64_t base = rdmsr(MSR_APIC_BASE);
+    x2apic = (base & APIC_BASE_X2APIC) != 0;
+
+    if (!x2apic) {
+        mmio = vmm_map_mmio(base & APIC_BASE_ADDR, 0x1000);
+        if (!mmio) {
+            return -1;
+        }
+    }
+
+    idt_set_handler(LAPIC_SPURIOUS_VECTOR, (uintptr_t)lapic_spurious);
+    idt_set_handler(LAPIC_TIMER_VECTOR, (uintptr_t)lapic_timer_irq);
+
+    klog(KLOG_INFO, "LAPIC: %s mode at 0x%lX\n", x2apic ? "x2APIC" : "xAPIC",
+         base & APIC_BASE_ADDR);
+    return 0;
+}
+
+int lapic_init(void) {
+    int first = !ready;
+
+    if (!ready) {
+        if (lapic_setup() != 0) {
+            return -1;
+        }
+        ready = 1;
+    }
+
+    uint64_t base = rdmsr(MSR_APIC_BASE);
+
+    if (!(base & APIC_BASE_ENABLE)) {
+        wrmsr(MSR_APIC_BASE, base | APIC_BASE_ENABLE);
+    }
+
+    // Accept every priority, nothing is routed here we'd want to hold off
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+
+    // The BSP keeps whatever LINT setup the firmware gave it, LINT0 is
+    // how the PIC's interrupts arrive
+    if (!(base & APIC_BASE_BSP)) {
+        lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+        lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_MASKED);
+    }
+
+    lapic_write(LAPIC_SVR, SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+
+    if (first) {
+        lapic_timer_setup();
+    }
+    lapic_timer_init_cpu();
+    return 0;
+}
@@ -0,0 +1,55 @@
+#include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/pmm.h"
+#include "../include/string.h"
+#include "../include/percpu.h"
+
+#define PAGE_SIZE 4096
+
+// From the linker script: the template, and the BSP's copy in .bss
+extern char __percpu_start[];
+extern char __percpu_end[];
+extern char __percpu_bsp[];
+
+uint64_t percpu_offsets[MAX_CPUS];
+
+DEFINE_PER_CPU(unsigned int, cpu_number);
+DEFINE_PER_CPU(uint64_t, this_cpu_off);
+
+// Helper: Fill a fresh copy from the template and number it
+static void percpu_setup(unsigned int cpu, char *copy) {
+    uint64_t offset = (uint64_t)copy - (uint64_t)__percpu_start;
+
+    memcpy(copy, __percpu_start, __percpu_end - __percpu_start);
+    percpu_offsets[cpu] = offset;
+    per_cpu(cpu_number, cpu) = cpu;
+    per_cpu(this_cpu_off, cpu) = offset;
+}
+
+void percpu_init_bsp(void) {
+    percpu_setup(0, __percpu_bsp);
+    percpu_load(0);
+}
+
+int percpu_alloc(unsigned int cpu) {
+    uint64_t size = __percpu_end - __percpu_start;
+    unsigned int order = 0;
+
+    while ((uint64_t)PAGE_SIZE << order < size) {
+        order++;
+    }
+
+    char *copy = pmm_alloc_pages(order);
+    if (!copy) {
+        return -1;
+    }
+
+    percpu_setup(cpu, copy);
+    return 0;
+}
+
+void percpu_load(unsigned int cpu) {
+    // Copies live in the kernel image or the HHDM, both in the upper
+    // half, so the distance from the template is a canonical address
+    wrmsr(MSR_GS_BASE, percpu_offsets[cpu]);
+}
@@ -0,0 +1,57 @@
+#include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/pic.h"
+
+#define PIC1_CMD  0x20
+#define PIC1_DATA 0x21
+#define PIC2_CMD  0xA0
+#define PIC2_DATA 0xA1
+
+#define PIC_EOI 0x20
+
+#define ICW1_INIT 0x11 // Edge triggered, cascade, ICW4 follows
+#define ICW4_8086 0x01
+
+// Helper: Give the PIC time to settle between init words
+static inline void io_wait(void) {
+    outb(0x80, 0);
+}
+
+void pic_init(void) {
+    outb(PIC1_CMD, ICW1_INIT);
+    io_wait();
+    outb(PIC2_CMD, ICW1_INIT);
+    io_wait();
+    outb(PIC1_DATA, PIC_VECTOR_BASE);
+    io_wait();
+    outb(PIC2_DATA, PIC_VECTOR_BASE + 8);
+    io_wait();
+    outb(PIC1_DATA, 0x04);      // Slave on IRQ2
+    io_wait();
+    outb(PIC2_DATA, 0x02);      // Cascade identity
+    io_wait();
+    outb(PIC1_DATA, ICW4_8086);
+    io_wait();
+    outb(PIC2_DATA, ICW4_8086);
+    io_wait();
+
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+}
+
+void pic_unmask(int irq) {
+    uint16_t port = irq < 8 ? PIC1_DATA : PIC2_DATA;
+    outb(port, inb(port) & ~(1 << (irq & 7)));
+}
+
+void pic_mask(int irq) {
+    uint16_t port = irq < 8 ? PIC1_DATA : PIC2_DATA;
+    outb(port, inb(port) | (1 << (irq & 7)));
+}
+
+void pic_eoi(int irq) {
+    if (irq >= 8) {
+        outb(PIC2_CMD, PIC_EOI);
+    }
+    outb(PIC1_CMD, PIC_EOI);
+}
@@ -0,0 +1,432 @@
+#include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/klog.h"
+#include "../include/serial.h"
+#include "../include/limine_requests.h"
+#include "../include/pmm.h"
+#include "../include/gdt.h"
+#include "../include/idt.h"
+#include "../include/lapic.h"
+#include "../include/fpu.h"
+#include "../include/tsc.h"
+#include "../include/percpu.h"
+#include "../include/spinlock.h"
+#include "../include/timer.h"
+#include "../include/shrinker.h"
+#include "../include/smp.h"
+
+// Built with -mgeneral-regs-only (see the Makefile) for the IPI handler.
+
+#define PAGE_SIZE 4096
+
+// 16 KiB kernel stack per AP, plus a page for double faults
+#define AP_STACK_ORDER 2
+#define DF_STACK_SIZE  PAGE_SIZE
+
+// How long the BSP waits for the APs to report in
+#define AP_BOOT_TIMEOUT_MS 1000
+
+// Increments per CPU in the boot time counter test
+#define COUNTER_TEST_ITERS 100000
+
+unsigned int nr_cpus = 1;
+
+static struct cpu cpus[MAX_CPUS];
+static uint64_t df_stack_tops[MAX_CPUS];
+static unsigned int cpus_online = 1;
+static uint64_t kernel_cr3 = 0;
+
+// The BSP's double fault stack, the PMM isn't up when it needs one
+static uint8_t bsp_df_stack[DF_STACK_SIZE] __attribute__((aligned(16)));
+
+// Work posted by smp_call_all(), one call at a time
+static spinlock_t call_lock = SPINLOCK_INIT;
+static void (*call_fn)(void *);
+static void *call_arg;
+static unsigned int call_pending;
+
+// Rendezvous for smp_stop_machine(): CPUs parked so far, and whether the
+// work is done
+static spinlock_t stop_lock = SPINLOCK_INIT;
+static void (*stop_fn)(void *);
+static void *stop_arg;
+static unsigned int stop_owner;
+static unsigned int stop_arrived;
+static int stop_done;
+
+// The flush tlb_shootdown() has in flight, with a bit per CPU that still
+// has to do it
+static DEFINE_LOCK_STAT(tlb_lock_stat, "tlb_shootdown");
+static spinlock_t tlb_lock = SPINLOCK_INIT_STAT(&tlb_lock_stat);
+static uint64_t tlb_vaddr;
+static uint64_t tlb_pages;
+static uint64_t tlb_pending;
+
+_Static_assert(MAX_CPUS <= 64, "tlb_pending has a bit per CPU");
+
+// The AP entry code below finds struct cpu through extra_argument and
+// loads cpu->stack_top first thing
+_Static_assert(__builtin_offsetof(struct limine_mp_info, extra_argument) == 24,
+               "ap_entry expects extra_argument at 24");
+_Static_assert(__builtin_offsetof(struct cpu, stack_top) == 0,
+               "ap_entry expects stack_top at 0");
+
+// Limine jumps to goto_address with the limine_mp_info in RDI, on a small
+// stack of its own. Move to the AP's kernel stack before any C runs.
+asm (".pushsection .text\n"
+     ".type ap_entry, @function\n"
+     "ap_entry:\n"
+     "    movq 24(%rdi), %rdi\n"
+     "    movq (%rdi), %rsp\n"
+     "    xorl %ebp, %ebp\n"
+     "    call ap_main\n"
+     "1:  cli\n"
+     "    hlt\n"
+     "    jmp 1b\n"
+     ".popsection");
+
+void ap_entry(struct limine_mp_info *info);
+
+// Helper: Load a CPU's GDT and TSS and its per-CPU area
+static void cpu_setup(struct cpu *c) {
+    gdt_init(c->id, df_stack_tops[c->id]);
+    percpu_load(c->id);
+}
+
+void smp_early_init(void) {
+    struct cpu *c = &cpus[0];
+
+    c->id = 0;
+    c->online = 1;
+    df_stack_tops[0] = (uint64_t)bsp_df_stack + sizeof(bsp_df_stack);
+
+    percpu_init_bsp();
+    cpu_setup(c);
+}
+
+// First C code on an AP, on its own stack. Never returns: once the CPU is
+// online it idles until an IPI or one of its timers brings work.
+__attribute__((used, noreturn))
+static void ap_main(struct cpu *c) {
+    // Same address space as the BSP, whatever Limine started us with
+    asm volatile ("mov %0, %%cr3" :: "r"(kernel_cr3) : "memory");
+
+    cpu_setup(c);
+    idt_load();
+    fpu_init_ap();
+
+    if (lapic_init() == 0 && lapic_id() == c->lapic_id) {
+        timers_init_ap();
+        __atomic_store_n(&c->online, 1, __ATOMIC_RELEASE);
+        __atomic_fetch_add(&cpus_online, 1, __ATOMIC_RELEASE);
+    }
+
+    for (;;) {
+        reclaim_poll();
+        cpu_idle();
+    }
+}
+
+__attribute__((interrupt))
+static void smp_call_ipi(struct interrupt_frame *frame) {
+    void (*fn)(void *) = call_fn;
+    void *arg = call_arg;
+    lapic_eoi();
+
+    // The work can take locks whose holders wait for this CPU to answer a
+    // TLB shootdown, so it runs with interrupts on. No second call can
+    // arrive before call_pending drops.
+    local_irq_enable();
+    fn(arg);
+    local_irq_disable();
+
+    __atomic_fetch_sub(&call_pending, 1, __ATOMIC_RELEASE);
+}
+
+void smp_call_all(void (*fn)(void *), void *arg) {
+    spin_lock(&call_lock);
+
+    unsigned int self = cpu_id();
+    unsigned int targets = 0;
+
+    for (unsigned int i = 0; i < nr_cpus; i++) {
+        if (i != self && cpus[i].online) {
+            targets++;
+        }
+    }
+
+    call_fn = fn;
+    call_arg = arg;
+    __atomic_store_n(&call_pending, targets, __ATOMIC_RELAXED);
+
+    // x2APIC ICR writes aren't serializing, the work must be visible first
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    for (unsigned int i = 0; i < nr_cpus; i++) {
+        if (i != self && cpus[i].online) {
+            lapic_send_ipi(cpus[i].lapic_id, SMP_CALL_VECTOR);
+        }
+    }
+
+    fn(arg);
+
+    while (__atomic_load_n(&call_pending, __ATOMIC_ACQUIRE)) {
+        cpu_relax();
+    }
+
+    spin_unlock(&call_lock);
+}
+
+// Helper: Do the flush in flight if it is still waiting for this CPU
+static void tlb_service(void) {
+    uint64_t bit = 1ULL << cpu_id();
+
+    if (__atomic_load_n(&tlb_pending, __ATOMIC_ACQUIRE) & bit) {
+        flush_tlb_range(__atomic_load_n(&tlb_vaddr, __ATOMIC_RELAXED),
+                        __atomic_load_n(&tlb_pages, __ATOMIC_RELAXED));
+        __atomic_fetch_and(&tlb_pending, ~bit, __ATOMIC_RELEASE);
+    }
+}
+
+__attribute__((interrupt))
+static void tlb_ipi(struct interrupt_frame *frame) {
+    tlb_service();
+    lapic_eoi();
+}
+
+void tlb_shootdown(uint64_t vaddr, uint64_t pages) {
+    if (smp_online() <= 1) {
+        return;
+    }
+
+    // Two CPUs may shoot down at once, and this one may have interrupts
+    // off, so answer the other flush while waiting for the lock. They stay
+    // off until it's dropped: an interrupt handler freeing memory can
+    // shoot down too, and must not find its own CPU holding the lock.
+    uint64_t irq = local_irq_save();
+    while (!spin_trylock(&tlb_lock)) {
+        tlb_service();
+        cpu_relax();
+    }
+
+    unsigned int self = cpu_id();
+    uint64_t targets = 0;
+    for (unsigned int i = 0; i < nr_cpus; i++) {
+        if (i != self && cpus[i].online) {
+            targets |= 1ULL << i;
+        }
+    }
+
+    __atomic_store_n(&tlb_vaddr, vaddr, __ATOMIC_RELAXED);
+    __atomic_store_n(&tlb_pages, pages, __ATOMIC_RELAXED);
+    __atomic_store_n(&tlb_pending, targets, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    for (unsigned int i = 0; i < nr_cpus; i++) {
+        if (targets & (1ULL << i)) {
+            lapic_send_ipi(cpus[i].lapic_id, SMP_TLB_VECTOR);
+        }
+    }
+
+    while (__atomic_load_n(&tlb_pending, __ATOMIC_ACQUIRE)) {
+        cpu_relax();
+    }
+
+    spin_unlock(&tlb_lock);
+    local_irq_restore(irq);
+}
+
+// Helper: Runs on every CPU through smp_call_all(). The owner waits for
+// the others to park with interrupts off, runs the work and lets them go.
+// Parked CPUs keep answering TLB shootdowns, which a CPU may be waiting
+// on with interrupts off before it can take the call.
+static void stop_rendezvous(void *arg) {
+    (void)arg;
+    uint64_t flags = local_irq_save();
+
+    __atomic_fetch_add(&stop_arrived, 1, __ATOMIC_ACQ_REL);
+
+    if (cpu_id() == stop_owner) {
+        while (__atomic_load_n(&stop_arrived, __ATOMIC_ACQUIRE) < smp_online()) {
+            tlb_service();
+            cpu_relax();
+        }
+        stop_fn(stop_arg);
+        __atomic_store_n(&stop_done, 1, __ATOMIC_RELEASE);
+    } else {
+        while (!__atomic_load_n(&stop_done, __ATOMIC_ACQUIRE)) {
+            tlb_service();
+            cpu_relax();
+        }
+    }
+
+    // Serialize so code the work rewrote is fetched anew
+    uint32_t a, b, c, d;
+    cpuid(0, 0, &a, &b, &c, &d);
+
+    local_irq_restore(flags);
+}
+
+void smp_stop_machine(void (*fn)(void *), void *arg) {
+    spin_lock(&stop_lock);
+
+    stop_fn = fn;
+    stop_arg = arg;
+    stop_owner = cpu_id();
+    __atomic_store_n(&stop_arrived, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stop_done, 0, __ATOMIC_RELAXED);
+
+    smp_call_all(stop_rendezvous, NULL);
+
+    spin_unlock(&stop_lock);
+}
+
+unsigned int smp_online(void) {
+    return __atomic_load_n(&cpus_online, __ATOMIC_ACQUIRE);
+}
+
+struct counter_slot {
+    uint64_t count;
+    uint32_t lapic_id;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static struct counter_slot counter_slots[MAX_CPUS];
+static uint64_t counter_shared;
+
+// Each CPU bumps the slot cpu_id() names and a shared counter. cpu_id()
+// is read on every pass, so a CPU that picks up another's GS base, or a
+// slot two CPUs share, shows up in the totals.
+static void counter_test(void *arg) {
+    uint64_t iters = (uint64_t)arg;
+
+    for (uint64_t i = 0; i < iters; i++) {
+        counter_slots[cpu_id()].count++;
+        __atomic_fetch_add(&counter_shared, 1, __ATOMIC_RELAXED);
+    }
+    counter_slots[cpu_id()].lapic_id = lapic_id();
+}
+
+// Helper: Run counter_test() everywhere and check every slot
+static void smp_counter_test(void) {
+    uint64_t start = rdtsc();
+    smp_call_all(counter_test, (void *)COUNTER_TEST_ITERS);
+    uint64_t ns = tsc_cycles_to_ns(rdtsc() - start);
+
+    int failed = 0;
+    unsigned int online = 0;
+    for (unsigned int i = 0; i < nr_cpus; i++) {
+        if (!cpus[i].online) {
+            continue;
+        }
+        online++;
+
+        struct counter_slot *slot = &counter_slots[i];
+        if (slot->count != COUNTER_TEST_ITERS || slot->lapic_id != cpus[i].lapic_id) {
+            klog(KLOG_ERR, "SMP: CPU %u counted %lu (APIC %u), expected %d (APIC %u)\n",
+                 i, slot->count, slot->lapic_id, COUNTER_TEST_ITERS, cpus[i].lapic_id);
+            failed = 1;
+        }
+    }
+
+    if (counter_shared != (uint64_t)online * COUNTER_TEST_ITERS) {
+        klog(KLOG_ERR, "SMP: shared counter at %lu, expected %lu\n",
+             counter_shared, (uint64_t)online * COUNTER_TEST_ITERS);
+        failed = 1;
+    }
+
+    if (!failed) {
+        klog(KLOG_INFO, "SMP: per-CPU counter test passed, %u CPUs x %d in %lu us\n",
+             online, COUNTER_TEST_ITERS, ns / 1000);
+    }
+}
+
+void smp_init(void) {
+    struct limine_mp_response *mp = mp_request.response;
+    struct limine_mp_info *launch[MAX_CPUS];
+
+    kernel_cr3 = read_cr3();
+
+    if (lapic_init() != 0) {
+        klog(KLOG_WARN, "SMP: no local APIC, staying on the BSP\n");
+        return;
+    }
+    cpus[0].lapic_id = lapic_id();
+    idt_set_handler(SMP_CALL_VECTOR, (uintptr_t)smp_call_ipi);
+    idt_set_handler(SMP_TLB_VECTOR, (uintptr_t)tlb_ipi);
+
+    if (!mp || mp->cpu_count <= 1) {
+        klog(KLOG_INFO, "SMP: 1 CPU\n");
+        return;
+    }
+
+    if (mp->cpu_count > MAX_CPUS) {
+        klog(KLOG_WARN, "SMP: %lu CPUs, only starting %d\n", mp->cpu_count, MAX_CPUS);
+    }
+
+    // Number the APs and give each its stacks before starting any, so
+    // they don't have to allocate (nothing here is SMP safe yet)
+    unsigned int n = 1;
+    for (uint64_t i = 0; i < mp->cpu_count && n < MAX_CPUS; i++) {
+        struct limine_mp_info *info = mp->cpus[i];
+        if (info->lapic_id == mp->bsp_lapic_id) {
+            continue;
+        }
+
+        void *stack = pmm_alloc_pages(AP_STACK_ORDER);
+        void *df_stack = pmm_alloc();
+        if (!stack || !df_stack || percpu_alloc(n) != 0) {
+            klog(KLOG_ERR, "SMP: out of memory for AP stacks, %u CPUs only\n", n);
+            if (stack) {
+                pmm_free_pages(stack, AP_STACK_ORDER);
+            }
+            if (df_stack) {
+                pmm_free(df_stack);
+            }
+            break;
+        }
+
+        struct cpu *c = &cpus[n];
+        c->id = n;
+        c->lapic_id = info->lapic_id;
+        c->stack_top = (uint64_t)stack + (PAGE_SIZE << AP_STACK_ORDER);
+        df_stack_tops[n] = (uint64_t)df_stack + DF_STACK_SIZE;
+
+        info->extra_argument = (uint64_t)c;
+        launch[n] = info;
+        n++;
+    }
+    nr_cpus = n;
+
+    // Each AP leaves Limine's wait loop as soon as its goto_address is
+    // written, so all of them start together and boot in parallel
+    uint64_t start = rdtsc();
+    for (unsigned int i = 1; i < n; i++) {
+        __atomic_store_n(&launch[i]->goto_address, ap_entry, __ATOMIC_SEQ_CST);
+    }
+
+    uint64_t khz = tsc_khz() ? tsc_khz() : 3000000;
+    uint64_t timeout = khz * AP_BOOT_TIMEOUT_MS;
+    while (smp_online() < n && rdtsc() - start < timeout) {
+        cpu_relax();
+    }
+    uint64_t ns = tsc_cycles_to_ns(rdtsc() - start);
+
+    for (unsigned int i = 1; i < n; i++) {
+        if (!__atomic_load_n(&cpus[i].online, __ATOMIC_ACQUIRE)) {
+            klog(KLOG_ERR, "SMP: CPU %u (APIC %u) didn't come up\n", i, cpus[i].lapic_id);
+        }
+    }
+    klog(KLOG_INFO, "SMP: %u of %u CPUs online in %lu us\n", smp_online(), n, ns / 1000);
+
+    smp_counter_test();
+}
+
+void smp_dump(void) {
+    for (unsigned int i = 0; i < nr_cpus; i++) {
+        serial_puts("CPU ");
+        serial_put_dec(i);
+        serial_puts(": APIC ");
+        serial_put_dec(cpus[i].lapic_id);
+        serial_puts(cpus[i].online ? ", online\n" : ", offline\n");
+    }
+}
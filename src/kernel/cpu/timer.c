@@ -0,0 +1,449 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "../include/cpu.h"
+#include "../include/percpu.h"
+#include "../include/spinlock.h"
+#include "../include/list.h"
+#include "../include/hist.h"
+#include "../include/serial.h"
+#include "../include/klog.h"
+#include "../include/ktime.h"
+#include "../include/lapic.h"
+#include "../include/timer.h"
+
+// Wheel geometry: four levels of 64 slots. A level-n slot spans 64^n
+// ticks, so with 1 ms ticks the levels reach 64 ms, 4 s, 4.5 min and 4.6
+// hours. Anything further out waits in the last slot of the top level
+// and cascades back to the top when it comes round.
+#define WHEEL_BITS   6
+#define WHEEL_SIZE   (1 << WHEEL_BITS)
+#define WHEEL_MASK   (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+
+#define WHEEL_SPAN   (1ULL << (WHEEL_LEVELS * WHEEL_BITS))
+
+#define TIMER_NEVER  (~0ULL)
+
+// One per CPU. `clk` is the next tick to process, every tick before it
+// has run. The wheel is only advanced when a timer interrupt comes, so
+// while nothing is due clk falls behind, and an add fast-forwards it.
+struct timer_base {
+    spinlock_t lock;            // Taken irqsave, the interrupt takes it too
+    uint64_t clk;
+    uint64_t pending[WHEEL_LEVELS];     // Bit per non-empty slot
+    struct list_head wheel[WHEEL_LEVELS][WHEEL_SIZE];
+    struct list_head hires;     // Sorted by expires
+    uint64_t armed;             // Deadline in the LAPIC, TIMER_NEVER if none
+    int ready;
+
+    // Statistics
+    uint64_t adds;
+    uint64_t expired;
+    uint64_t cascaded;          // Timers moved down a level
+    uint64_t interrupts;
+    uint64_t reprograms;
+    uint64_t wakeups;           // Times cpu_idle() woke up
+    uint64_t idle_ns;
+
+    // Where the previous timer_dump_stats() left off
+    uint64_t last_dump;
+    uint64_t last_wakeups;
+    uint64_t last_idle_ns;
+};
+
+static DEFINE_PER_CPU_ALIGNED(struct timer_base, timer_bases);
+
+static DEFINE_LOCK_STAT(timer_lock_stat, "timer_base");
+
+// timer_add() cost, whole call
+static struct lat_hist timer_add_lat = LAT_HIST_INIT("timer_add");
+
+// Helper: First tick at or after a deadline
+static inline uint64_t ns_to_tick(uint64_t ns) {
+    return ns / TIMER_TICK_NS + (ns % TIMER_TICK_NS != 0);
+}
+
+// Helper: Rotate a slot bitmap right, so slot `from` becomes bit 0
+static inline uint64_t rotate(uint64_t bits, unsigned int from) {
+    from &= WHEEL_MASK;
+    return from ? (bits >> from) | (bits << (WHEEL_SIZE - from)) : bits;
+}
+
+// Helper: Put a wheel timer in its slot relative to base->clk, lock held
+static void wheel_insert(struct timer_base *base, struct timer *timer) {
+    uint64_t tick = ns_to_tick(timer->expires);
+    uint64_t delta = tick > base->clk ? tick - base->clk : 0;
+
+    // Overdue ones run with the tick being processed
+    if (tick < base->clk) {
+        tick = base->clk;
+    }
+    if (delta >= WHEEL_SPAN) {
+        delta = WHEEL_SPAN - 1;
+        tick = base->clk + delta;
+    }
+
+    unsigned int level = 0;
+    while (delta >= (1ULL << ((level + 1) * WHEEL_BITS))) {
+        level++;
+    }
+
+    unsigned int idx = (tick >> (level * WHEEL_BITS)) & WHEEL_MASK;
+    list_add_tail(&timer->link, &base->wheel[level][idx]);
+    base->pending[level] |= 1ULL << idx;
+    timer->slot = level * WHEEL_SIZE + idx;
+}
+
+// Helper: Put a timer on the sorted hires list, lock held
+static void hires_insert(struct timer_base *base, struct timer *timer) {
+    struct list_head *pos;
+
+    list_for_each(pos, &base->hires) {
+        if (list_entry(pos, struct timer, link)->expires > timer->expires) {
+            break;
+        }
+    }
+    list_add_tail(&timer->link, pos);
+    timer->slot = -1;
+}
+
+// Helper: Take a timer off whatever list it's on, lock held
+static void timer_unlink(struct timer_base *base, struct timer *timer) {
+    list_del(&timer->link);
+
+    if (timer->slot >= 0) {
+        unsigned int level = timer->slot / WHEEL_SIZE;
+        unsigned int idx = timer->slot % WHEEL_SIZE;
+        if (list_empty(&base->wheel[level][idx])) {
+            base->pending[level] &= ~(1ULL << idx);
+        }
+    }
+}
+
+// Helper: Tick at which the wheel next has something to do, running a
+// level-0 slot or cascading a higher one, TIMER_NEVER if it's empty
+static uint64_t wheel_next_tick(struct timer_base *base) {
+    uint64_t next = TIMER_NEVER;
+
+    for (unsigned int level = 0; level < WHEEL_LEVELS; level++) {
+        if (!base->pending[level]) {
+            continue;
+        }
+
+        // A level-n slot is handled at the start of its 64^n-tick unit:
+        // the current unit if clk sits right on its start, else the next
+        unsigned int shift = level * WHEEL_BITS;
+        uint64_t first = base->clk >> shift;
+        if (base->clk & ((1ULL << shift) - 1)) {
+            first++;
+        }
+
+        uint64_t d = __builtin_ctzll(rotate(base->pending[level], first));
+        uint64_t tick = (first + d) << shift;
+        if (tick < next) {
+            next = tick;
+        }
+    }
+    return next;
+}
+
+// Helper: Move clk up to `tick` when no wheel work lies in between, so
+// new timers aren't placed relative to a stale clk, lock held
+static void wheel_forward(struct timer_base *base, uint64_t tick) {
+    uint64_t next = wheel_next_tick(base);
+
+    if (tick > next) {
+        tick = next;
+    }
+    if (tick > base->clk) {
+        base->clk = tick;
+    }
+}
+
+// Helper: Move every timer of one slot onto `to`, emptying the slot
+static void slot_detach(struct timer_base *base, unsigned int level, unsigned int idx,
+                        struct list_head *to) {
+    struct list_head *slot = &base->wheel[level][idx];
+
+    list_init(to);
+    while (!list_empty(slot)) {
+        list_move(slot->prev, to);
+    }
+    base->pending[level] &= ~(1ULL << idx);
+}
+
+// Helper: Re-insert every timer of one slot, relative to clk, lock held
+static void wheel_cascade(struct timer_base *base, unsigned int level, unsigned int idx) {
+    struct list_head moving;
+
+    slot_detach(base, level, idx, &moving);
+    while (!list_empty(&moving)) {
+        struct timer *timer = list_first_entry(&moving, struct timer, link);
+        list_del(&timer->link);
+        wheel_insert(base, timer);
+        base->cascaded++;
+    }
+}
+
+// Helper: Program the LAPIC for the earliest timer, lock held
+static void timer_program(struct timer_base *base) {
+    uint64_t next = TIMER_NEVER;
+
+    if (!list_empty(&base->hires)) {
+        next = list_first_entry(&base->hires, struct timer, link)->expires;
+    }
+
+    uint64_t tick = wheel_next_tick(base);
+    if (tick != TIMER_NEVER && tick * TIMER_TICK_NS < next) {
+        next = tick * TIMER_TICK_NS;
+    }
+
+    if (next == base->armed) {
+        return;
+    }
+    base->armed = next;
+    base->reprograms++;
+
+    if (next == TIMER_NEVER) {
+        lapic_timer_cancel();
+    } else {
+        lapic_timer_arm(next);
+    }
+}
+
+// Helper: Run one expired timer, dropping the lock around the callback
+// so it can re-add itself. Returns the new flags.
+static uint64_t timer_run(struct timer_base *base, struct timer *timer, uint64_t flags) {
+    timer_unlink(base, timer);
+    base->expired++;
+
+    spin_unlock_irqrestore(&base->lock, flags);
+    timer->fn(timer);
+    return spin_lock_irqsave(&base->lock);
+}
+
+// Helper: Run every timer due by now, then program the next one
+static void timers_run(struct timer_base *base) {
+    uint64_t flags = spin_lock_irqsave(&base->lock);
+    uint64_t now = ktime_get();
+    uint64_t now_tick = now / TIMER_TICK_NS;
+
+    // The deadline that got us here is used up
+    base->armed = TIMER_NEVER;
+
+    for (;;) {
+        // Skip the ticks with nothing to do, however long we slept
+        wheel_forward(base, now_tick + 1);
+        if (base->clk > now_tick) {
+            break;
+        }
+
+        uint64_t tick = base->clk;
+        unsigned int idx = tick & WHEEL_MASK;
+
+        // Start of a level-0 round: bring the next slot of each level
+        // down, as far up as the round boundary goes. Timers due on this
+        // very tick land in slot idx, so clk only moves on afterwards.
+        if (idx == 0) {
+            for (unsigned int level = 1; level < WHEEL_LEVELS; level++) {
+                unsigned int slot = (tick >> (level * WHEEL_BITS)) & WHEEL_MASK;
+                wheel_cascade(base, level, slot);
+                if (slot != 0) {
+                    break;
+                }
+            }
+        }
+        base->clk = tick + 1;
+
+        if (!(base->pending[0] & (1ULL << idx))) {
+            continue;
+        }
+
+        // Detach the slot: callbacks may add timers, and cancel any of
+        // these, while the lock is dropped
+        struct list_head expired;
+        slot_detach(base, 0, idx, &expired);
+
+        while (!list_empty(&expired)) {
+            struct timer *timer = list_first_entry(&expired, struct timer, link);
+
+            // Clamped to the wheel's span, not actually due yet
+            if (ns_to_tick(timer->expires) > tick) {
+                list_del(&timer->link);
+                wheel_insert(base, timer);
+                continue;
+            }
+            flags = timer_run(base, timer, flags);
+        }
+    }
+
+    // Hires timers last, and re-reading the head each time picks up any
+    // the wheel callbacks added
+    while (!list_empty(&base->hires)) {
+        struct timer *timer = list_first_entry(&base->hires, struct timer, link);
+        if (timer->expires > now) {
+            break;
+        }
+        flags = timer_run(base, timer, flags);
+    }
+
+    timer_program(base);
+    spin_unlock_irqrestore(&base->lock, flags);
+}
+
+// LAPIC timer interrupt
+static void timer_interrupt(void) {
+    struct timer_base *base = this_cpu_ptr(timer_bases);
+
+    base->interrupts++;
+    timers_run(base);
+}
+
+void timer_init(struct timer *timer, void (*fn)(struct timer *), unsigned int flags) {
+    list_init(&timer->link);
+    timer->expires = 0;
+    timer->fn = fn;
+    timer->base = NULL;
+    timer->slot = -1;
+    timer->flags = flags;
+}
+
+void timer_add(struct timer *timer, uint64_t expires) {
+    uint64_t start = lat_start();
+    struct timer_base *base = this_cpu_ptr(timer_bases);
+
+    timer_cancel(timer);
+
+    uint64_t flags = spin_lock_irqsave(&base->lock);
+    uint64_t now = ktime_get();
+
+    timer->expires = expires;
+    __atomic_store_n(&timer->base, base, __ATOMIC_RELEASE);
+
+    uint64_t event;
+    if ((timer->flags & TIMER_HIRES) || expires < now + TIMER_TICK_NS) {
+        hires_insert(base, timer);
+        event = expires;
+    } else {
+        wheel_forward(base, now / TIMER_TICK_NS + 1);
+        wheel_insert(base, timer);
+        event = ns_to_tick(expires) * TIMER_TICK_NS;
+    }
+    base->adds++;
+
+    // Only a new earliest deadline needs the LAPIC touched
+    if (event < base->armed) {
+        timer_program(base);
+    }
+
+    spin_unlock_irqrestore(&base->lock, flags);
+    lat_record(&timer_add_lat, start);
+}
+
+int timer_cancel(struct timer *timer) {
+    struct timer_base *base = __atomic_load_n(&timer->base, __ATOMIC_ACQUIRE);
+    if (!base) {
+        return 0;
+    }
+
+    // A timer only changes base through timer_add() by its one owner, so
+    // the base can't change under us. A stale LAPIC deadline is left
+    // alone, it costs one early wakeup.
+    uint64_t flags = spin_lock_irqsave(&base->lock);
+    int pending = !list_empty(&timer->link);
+    if (pending) {
+        timer_unlink(base, timer);
+    }
+    spin_unlock_irqrestore(&base->lock, flags);
+
+    return pending;
+}
+
+int timer_pending(struct timer *timer) {
+    return !list_empty(&timer->link);
+}
+
+// Helper: Set up the calling CPU's timer base
+static void timer_base_init(void) {
+    struct timer_base *base = this_cpu_ptr(timer_bases);
+
+    spin_lock_init(&base->lock, &timer_lock_stat);
+    base->clk = ktime_get() / TIMER_TICK_NS;
+    for (unsigned int level = 0; level < WHEEL_LEVELS; level++) {
+        base->pending[level] = 0;
+        for (unsigned int idx = 0; idx < WHEEL_SIZE; idx++) {
+            list_init(&base->wheel[level][idx]);
+        }
+    }
+    list_init(&base->hires);
+    base->armed = TIMER_NEVER;
+    base->last_dump = ktime_get();
+    __atomic_store_n(&base->ready, 1, __ATOMIC_RELEASE);
+}
+
+void timers_init(void) {
+    lapic_timer_set_handler(timer_interrupt);
+    timer_base_init();
+}
+
+void timers_init_ap(void) {
+    timer_base_init();
+}
+
+void cpu_idle(void) {
+    if (!lapic_timer_available()) {
+        cpu_relax();
+        return;
+    }
+
+    struct timer_base *base = this_cpu_ptr(timer_bases);
+    uint64_t start = ktime_get();
+
+    // STI holds interrupts off for one more instruction, so a wakeup
+    // can't slip in between it and the HLT
+    asm volatile ("sti\n\thlt" ::: "memory");
+
+    base->wakeups++;
+    base->idle_ns += ktime_get() - start;
+}
+
+void timer_dump_stats(void) {
+    uint64_t now = ktime_get();
+
+    serial_puts("timers: cpu adds expired cascaded interrupts reprograms wakeups/s idle%\n");
+
+    for (unsigned int cpu = 0; cpu < cpu_count(); cpu++) {
+        struct timer_base *base = per_cpu_ptr(timer_bases, cpu);
+        if (!__atomic_load_n(&base->ready, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+
+        // Racy reads of another CPU's counters, fine for a rough rate
+        uint64_t wakeups = base->wakeups;
+        uint64_t idle_ns = base->idle_ns;
+        uint64_t span = now > base->last_dump ? now - base->last_dump : 0;
+
+        serial_put_dec(cpu);
+        serial_puts(" ");
+        serial_put_dec(base->adds);
+        serial_puts(" ");
+        serial_put_dec(base->expired);
+        serial_puts(" ");
+        serial_put_dec(base->cascaded);
+        serial_puts(" ");
+        serial_put_dec(base->interrupts);
+        serial_puts(" ");
+        serial_put_dec(base->reprograms);
+        serial_puts(" ");
+        serial_put_dec(span ? (wakeups - base->last_wakeups) * 1000000000 / span : 0);
+        serial_puts(" ");
+        serial_put_dec(span ? (idle_ns - base->last_idle_ns) * 100 / span : 0);
+        serial_puts("\n");
+
+        base->last_dump = now;
+        base->last_wakeups = wakeups;
+        base->last_idle_ns = idle_ns;
+    }
+
+    lat_hist_dump(&timer_add_lat);
+}
@@ -0,0 +1,189 @@
+#include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/klog.h"
+#include "../include/hpet.h"
+#include "../include/tsc.h"
+
+// PIT channel 2 is gated through the keyboard controller's port B and its
+// output can be read back there, so it can time a one-shot without an IRQ
+#define PIT_HZ        1193182
+#define PIT_CH2       0x42
+#define PIT_CMD       0x43
+#define PIT_PORT_B    0x61
+#define PORT_B_GATE2  0x01
+#define PORT_B_SPKR   0x02
+#define PORT_B_OUT2   0x20
+
+// Calibration: best of a few short one-shots, taking the shortest so a
+// stray SMI or host preemption only ever makes a run longer
+#define CAL_MS   10
+#define CAL_RUNS 5
+
+// Give up on a PIT that never counts down (a few seconds worth)
+#define CAL_SPIN_LIMIT 100000000ULL
+
+static uint64_t khz = 0;
+
+#define CPUID_EXT_POWER   0x80000007
+#define POWER_INVARIANT_TSC (1U << 8)
+
+// Helper: TSC rate from CPUID, 0 if the CPU doesn't say
+static uint64_t cpuid_khz(void) {
+    uint32_t a, b, c, d;
+
+    cpuid(0, 0, &a, &b, &c, &d);
+    uint32_t max = a;
+
+    if (max >= 0x15) {
+        cpuid(0x15, 0, &a, &b, &c, &d);
+        if (a && b && c) {
+            return (uint64_t)c * b / a / 1000;
+        }
+    }
+    if (max >= 0x16) {
+        cpuid(0x16, 0, &a, &b, &c, &d);
+        if (a & 0xFFFF) {
+            return (uint64_t)(a & 0xFFFF) * 1000;
+        }
+    }
+    return 0;
+}
+
+// Helper: Cycles across one CAL_MS one-shot of PIT channel 2, 0 if the
+// PIT didn't finish
+static uint64_t pit_oneshot(void) {
+    const uint16_t latch = PIT_HZ / (1000 / CAL_MS);
+
+    uint64_t flags = local_irq_save();
+    uint8_t port_b = inb(PIT_PORT_B);
+
+    // Gate on, speaker off, then mode 0 (interrupt on terminal count)
+    outb(PIT_PORT_B, (port_b & ~PORT_B_SPKR) | PORT_B_GATE2);
+    outb(PIT_CMD, 0xB0);
+    outb(PIT_CH2, latch & 0xFF);
+    outb(PIT_CH2, latch >> 8);
+
+    uint64_t start = rdtsc();
+    uint64_t spins = 0;
+    while (!(inb(PIT_PORT_B) & PORT_B_OUT2)) {
+        if (++spins == CAL_SPIN_LIMIT) {
+            break;
+        }
+    }
+    uint64_t cycles = rdtsc() - start;
+
+    outb(PIT_PORT_B, port_b);
+    local_irq_restore(flags);
+
+    return spins == CAL_SPIN_LIMIT ? 0 : cycles;
+}
+
+// Helper: TSC rate measured against the PIT, 0 if it didn't work
+static uint64_t pit_khz(void) {
+    uint64_t best = 0;
+
+    for (int i = 0; i < CAL_RUNS; i++) {
+        uint64_t cycles = pit_oneshot();
+        if (!cycles) {
+            return 0;
+        }
+        if (!best || cycles < best) {
+            best = cycles;
+        }
+    }
+    return best / CAL_MS;
+}
+
+// Helper: TSC rate over one CAL_MS window timed by the HPET, 0 if the
+// HPET didn't advance
+static uint64_t hpet_window_khz(uint64_t mask) {
+    uint64_t ticks = CAL_MS * 1000000000000UL / hpet_period_fs();
+
+    uint64_t flags = local_irq_save();
+    uint64_t h0 = hpet_read();
+    uint64_t t0 = rdtsc();
+    uint64_t h1, spins = 0;
+
+    do {
+        h1 = hpet_read();
+        if (++spins == CAL_SPIN_LIMIT) {
+            break;
+        }
+    } while (((h1 - h0) & mask) < ticks);
+
+    uint64_t t1 = rdtsc();
+    local_irq_restore(flags);
+
+    // Both ends read the HPET first, so its (slow) read cost cancels out
+    uint64_t ns = ((h1 - h0) & mask) * hpet_period_fs() / 1000000;
+    return spins == CAL_SPIN_LIMIT || !ns ? 0 : (t1 - t0) * 1000000 / ns;
+}
+
+void tsc_calibrate_hpet(void) {
+    uint64_t mask = hpet_counter_64bit() ? ~0ULL : 0xFFFFFFFFULL;
+    uint64_t runs[CAL_RUNS];
+
+    for (int i = 0; i < CAL_RUNS; i++) {
+        runs[i] = hpet_window_khz(mask);
+        if (!runs[i]) {
+            klog(KLOG_WARN, "TSC: HPET calibration failed, keeping %lu kHz\n", khz);
+            return;
+        }
+    }
+
+    // Median, unlike the PIT's one-sided error these can go either way
+    for (int i = 1; i < CAL_RUNS; i++) {
+        for (int j = i; j > 0 && runs[j - 1] > runs[j]; j--) {
+            uint64_t tmp = runs[j];
+            runs[j] = runs[j - 1];
+            runs[j - 1] = tmp;
+        }
+    }
+
+    uint64_t previous = khz;
+    uint64_t spread_ppm = (runs[CAL_RUNS - 1] - runs[0]) * 1000000 / runs[CAL_RUNS / 2];
+    khz = runs[CAL_RUNS / 2];
+
+    klog(KLOG_INFO, "TSC: %lu kHz (HPET calibrated, runs within %lu ppm, was %lu)\n",
+         khz, spread_ppm, previous);
+}
+
+int tsc_invariant(void) {
+    uint32_t a, b, c, d;
+
+    cpuid(0x80000000, 0, &a, &b, &c, &d);
+    if (a < CPUID_EXT_POWER) {
+        return 0;
+    }
+
+    cpuid(CPUID_EXT_POWER, 0, &a, &b, &c, &d);
+    return (d & POWER_INVARIANT_TSC) != 0;
+}
+
+void tsc_init(void) {
+    uint64_t measured = pit_khz();
+    uint64_t reported = cpuid_khz();
+
+    if (measured) {
+        khz = measured;
+        klog(KLOG_INFO, "TSC: %lu kHz (PIT calibrated, CPUID says %lu)\n", khz, reported);
+    } else if (reported) {
+        khz = reported;
+        klog(KLOG_INFO, "TSC: %lu kHz (CPUID)\n", khz);
+    } else {
+        klog(KLOG_WARN, "TSC: Rate unknown, times will be in cycles only\n");
+    }
+}
+
+uint64_t tsc_khz(void) {
+    return khz;
+}
+
+uint64_t tsc_cycles_to_ns(uint64_t cycles) {
+    if (!khz) {
+        return 0;
+    }
+
+    // Split so cycles * 10^6 can't overflow
+    return cycles / khz * 1000000 + cycles % khz * 1000000 / khz;
+}
@@ -0,0 +1,389 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/serial.h"
+#include "../include/spinlock.h"
+#include "../include/heapprof.h"
+
+#define HEAPPROF_MAX_DEPTH 16
+#define HEAPPROF_SITES     512     // Distinct call stacks tracked
+#define HEAPPROF_SAMPLES   4096    // Live sampled allocations tracked, power of two
+
+struct heapprof_site {
+    uint64_t hash;              // 0 means the slot is unused
+    int depth;
+    uint64_t frames[HEAPPROF_MAX_DEPTH];
+    uint64_t live_count;        // Sampled allocations still live
+    uint64_t live_bytes;        // Estimated bytes they stand for
+    uint64_t total_count;       // Every sample ever taken here
+    uint64_t total_bytes;
+};
+
+struct heapprof_sample {
+    uint64_t ptr;               // 0 means the slot is unused
+    uint64_t weight;            // Estimated bytes this sample stands for
+    int site;
+};
+
+// Each CPU counts down to its next sample on its own, so the common
+// unsampled allocation touches no shared line and takes no lock
+struct heapprof_cpu {
+    int64_t bytes_until_sample;
+    uint64_t rng_state;
+    uint32_t generation;        // Start this countdown was drawn for
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+int heapprof_active = 0;
+
+static int running = 0;
+static uint64_t interval = HEAPPROF_DEFAULT_INTERVAL;
+static uint32_t generation = 0;    // Bumped by every heapprof_start()
+static uint64_t live_samples = 0;
+static uint64_t dropped = 0;
+
+static struct heapprof_site sites[HEAPPROF_SITES];
+static struct heapprof_sample samples[HEAPPROF_SAMPLES];
+static struct heapprof_cpu cpus[MAX_CPUS];
+
+// Live samples per home slot of samples[], read without the lock so a
+// free of an untracked pointer can return early. A pointer's own sample
+// is inserted before kmalloc() hands it out, so its free always sees it.
+static uint16_t home_count[HEAPPROF_SAMPLES];
+
+// Guards sites[], samples[] and the counters, taken only when a sample
+// is taken or a free may hit one. Allocations in interrupt handlers get
+// sampled too, so it is held with interrupts off.
+static spinlock_t heapprof_lock = SPINLOCK_INIT;
+
+// Fixed point with 32 fractional bits
+#define FX_ONE (1ULL << 32)
+#define FX_LN2 2977044472ULL   // ln(2) * 2^32
+#define FX_LOG2_C 1488668977ULL // 0.3466 * 2^32, log2 curve correction
+
+// Helper: xorshift64* generator
+static uint64_t rng_next(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+// Helper: -ln(u / 2^32) for u in (0, 2^32), in FX
+static uint64_t fx_neg_ln(uint32_t u) {
+    // log2(u) = msb + log2(1 + f), with log2(1 + f) ~= f + c*f*(1 - f)
+    int msb = 31 - __builtin_clz(u);
+    uint64_t f = ((uint64_t)(u - (1U << msb)) << 32) >> msb;
+    uint64_t bow = ((f >> 16) * ((FX_ONE - f) >> 16) >> 16) * (FX_LOG2_C >> 16);
+    uint64_t log2_fx = ((uint64_t)msb << 32) + f + bow;
+
+    // -ln(u / 2^32) = (32 - log2(u)) * ln(2)
+    uint64_t neg_log2 = (32ULL << 32) - log2_fx;
+    return ((neg_log2 >> 16) * FX_LN2) >> 16;
+}
+
+// Helper: e^-x for x in FX
+static uint64_t fx_exp_neg(uint64_t x) {
+    // e^-x = 2^-k * e^-r with x = k*ln(2) + r
+    uint64_t k = x / FX_LN2;
+    uint64_t r = x - k * FX_LN2;
+    if (k >= 32) {
+        return 0;
+    }
+
+    // Taylor series for e^-r, r < ln(2) so this converges fast
+    uint64_t sum = FX_ONE;
+    uint64_t term = FX_ONE;
+    for (int i = 1; i <= 10; i++) {
+        term = ((term >> 16) * (r >> 16)) / i;
+        if (i & 1) {
+            sum -= term;
+        } else {
+            sum += term;
+        }
+    }
+
+    return sum >> k;
+}
+
+// Helper: Draw bytes until the next sample, exponential with mean interval
+static int64_t next_sample_gap(struct heapprof_cpu *pc) {
+    uint32_t u = (uint32_t)rng_next(&pc->rng_state);
+    if (u == 0) {
+        u = 1;
+    }
+    return (int64_t)(((fx_neg_ln(u) >> 16) * interval) >> 16) + 1;
+}
+
+// Helper: Bytes a sampled allocation of `size` stands for. It was picked
+// with probability 1 - e^(-size/interval), so weigh it by the inverse.
+static uint64_t sample_weight(uint64_t size) {
+    if (size >= interval * 32 || size >= (1ULL << 31)) {
+        return size;
+    }
+
+    uint64_t x = (size << 32) / interval;
+    uint64_t p = FX_ONE - fx_exp_neg(x);
+    if (p == 0) {
+        return interval;
+    }
+    return (size << 32) / p;
+}
+
+// Helper: Record the return addresses above `frame`
+static int capture_stack(void *frame, uint64_t *frames) {
+    uint64_t *fp = frame;
+    int depth = 0;
+
+    while (fp && depth < HEAPPROF_MAX_DEPTH) {
+        // Only trust aligned frames in the higher half
+        if (((uint64_t)fp & 7) || (uint64_t)fp < 0xFFFF800000000000ULL) {
+            break;
+        }
+
+        uint64_t ret = fp[1];
+        if (ret == 0) {
+            break;
+        }
+        frames[depth++] = ret;
+
+        uint64_t *next = (uint64_t *)fp[0];
+        if (next <= fp) {
+            break;  // Stacks grow down, so callers must be above us
+        }
+        fp = next;
+    }
+
+    return depth;
+}
+
+// Helper: Find or create the site for a stack, -1 if the table is full
+static int site_lookup(uint64_t *frames, int depth) {
+    // FNV-1a over the return addresses
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (int i = 0; i < depth; i++) {
+        hash = (hash ^ frames[i]) * 0x100000001B3ULL;
+    }
+    if (hash == 0) {
+        hash = 1;
+    }
+
+    for (int n = 0; n < HEAPPROF_SITES; n++) {
+        int i = (hash + n) % HEAPPROF_SITES;
+        struct heapprof_site *site = &sites[i];
+
+        if (site->hash == 0) {
+            site->hash = hash;
+            site->depth = depth;
+            for (int f = 0; f < depth; f++) {
+                site->frames[f] = frames[f];
+            }
+            return i;
+        }
+
+        if (site->hash == hash && site->depth == depth) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static inline uint64_t sample_slot(uint64_t ptr) {
+    return (ptr >> 4) * 0x9E3779B97F4A7C15ULL >> 52 & (HEAPPROF_SAMPLES - 1);
+}
+
+// Helper: Remember a live sample, 0 on success
+static int sample_insert(uint64_t ptr, uint64_t weight, int site) {
+    uint64_t i = sample_slot(ptr);
+
+    for (int n = 0; n < HEAPPROF_SAMPLES; n++) {
+        struct heapprof_sample *s = &samples[i];
+        if (s->ptr == 0) {
+            s->ptr = ptr;
+            s->weight = weight;
+            s->site = site;
+            __atomic_store_n(&home_count[sample_slot(ptr)],
+                             home_count[sample_slot(ptr)] + 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+        i = (i + 1) & (HEAPPROF_SAMPLES - 1);
+    }
+
+    return -1;
+}
+
+// Helper: Remove slot i, shifting later entries of the probe run back
+static void sample_remove(uint64_t i) {
+    uint64_t j = i;
+    uint64_t gone = sample_slot(samples[i].ptr);
+
+    __atomic_store_n(&home_count[gone], home_count[gone] - 1, __ATOMIC_RELAXED);
+
+    for (;;) {
+        samples[i].ptr = 0;
+
+        for (;;) {
+            j = (j + 1) & (HEAPPROF_SAMPLES - 1);
+            if (samples[j].ptr == 0) {
+                return;
+            }
+
+            // Move j into the hole unless its home slot lies in (i, j]
+            uint64_t home = sample_slot(samples[j].ptr);
+            if (i <= j ? (i < home && home <= j) : (i < home || home <= j)) {
+                continue;
+            }
+            break;
+        }
+
+        samples[i] = samples[j];
+        i = j;
+    }
+}
+
+// Every CPU draws a fresh countdown on its next allocation
+void heapprof_start(uint64_t new_interval) {
+    uint64_t irq = spin_lock_irqsave(&heapprof_lock);
+
+    interval = new_interval ? new_interval : HEAPPROF_DEFAULT_INTERVAL;
+    __atomic_store_n(&generation, generation + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+    heapprof_active = 1;
+
+    spin_unlock_irqrestore(&heapprof_lock, irq);
+}
+
+// Stop taking samples. Frees are still tracked until the last live
+// sample is gone so the tables stay accurate.
+void heapprof_stop(void) {
+    uint64_t irq = spin_lock_irqsave(&heapprof_lock);
+    __atomic_store_n(&running, 0, __ATOMIC_RELAXED);
+    heapprof_active = live_samples != 0;
+    spin_unlock_irqrestore(&heapprof_lock, irq);
+}
+
+int heapprof_running(void) {
+    return __atomic_load_n(&running, __ATOMIC_RELAXED);
+}
+
+void heapprof_on_alloc(void *ptr, size_t size, void *frame) {
+    if (!ptr || !__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    // Interrupts off so a handler on this CPU can't interleave with the
+    // countdown update
+    uint64_t irq = local_irq_save();
+    struct heapprof_cpu *pc = &cpus[cpu_id()];
+    uint32_t gen = __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+
+    if (pc->generation != gen) {
+        pc->generation = gen;
+        if (pc->rng_state == 0) {
+            pc->rng_state = (rdtsc() ^ ((uint64_t)cpu_id() << 48)) | 1;
+        }
+        pc->bytes_until_sample = next_sample_gap(pc);
+    }
+
+    pc->bytes_until_sample -= (int64_t)size;
+    if (pc->bytes_until_sample > 0) {
+        local_irq_restore(irq);
+        return;
+    }
+
+    // Take the sample, then draw the next gap
+    while (pc->bytes_until_sample <= 0) {
+        pc->bytes_until_sample += next_sample_gap(pc);
+    }
+
+    uint64_t frames[HEAPPROF_MAX_DEPTH];
+    int depth = capture_stack(frame, frames);
+    uint64_t weight = sample_weight(size);
+
+    spin_lock(&heapprof_lock);
+
+    int site = site_lookup(frames, depth);
+    if (site < 0 || sample_insert((uint64_t)ptr, weight, site) != 0) {
+        dropped++;
+        spin_unlock_irqrestore(&heapprof_lock, irq);
+        return;
+    }
+
+    sites[site].live_count++;
+    sites[site].live_bytes += weight;
+    sites[site].total_count++;
+    sites[site].total_bytes += weight;
+    live_samples++;
+
+    spin_unlock_irqrestore(&heapprof_lock, irq);
+}
+
+void heapprof_on_free(void *ptr) {
+    // No live sample shares this pointer's home slot, so it wasn't sampled
+    if (!ptr || !__atomic_load_n(&home_count[sample_slot((uint64_t)ptr)], __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    uint64_t irq = spin_lock_irqsave(&heapprof_lock);
+
+    uint64_t i = sample_slot((uint64_t)ptr);
+    for (int n = 0; n < HEAPPROF_SAMPLES && samples[i].ptr; n++) {
+        if (samples[i].ptr == (uint64_t)ptr) {
+            struct heapprof_site *site = &sites[samples[i].site];
+            site->live_count--;
+            site->live_bytes -= samples[i].weight;
+            live_samples--;
+
+            sample_remove(i);
+            break;
+        }
+        i = (i + 1) & (HEAPPROF_SAMPLES - 1);
+    }
+
+    if (!running && live_samples == 0) {
+        heapprof_active = 0;
+    }
+
+    spin_unlock_irqrestore(&heapprof_lock, irq);
+}
+
+// One line per site with live samples:
+//   HEAPPROF live_bytes=<n> live_samples=<n> total_bytes=<n> stack=<addr>,<addr>...
+void heapprof_dump(void) {
+    uint64_t irq = spin_lock_irqsave(&heapprof_lock);
+
+    serial_puts("HEAPPROF_BEGIN interval=");
+    serial_put_dec(interval);
+    serial_puts(" running=");
+    serial_put_dec(running);
+    serial_puts(" live_samples=");
+    serial_put_dec(live_samples);
+    serial_puts(" dropped=");
+    serial_put_dec(dropped);
+    serial_puts("\n");
+
+    for (int i = 0; i < HEAPPROF_SITES; i++) {
+        struct heapprof_site *site = &sites[i];
+        if (site->hash == 0 || site->live_count == 0) {
+            continue;
+        }
+
+        serial_puts("HEAPPROF live_bytes=");
+        serial_put_dec(site->live_bytes);
+        serial_puts(" live_samples=");
+        serial_put_dec(site->live_count);
+        serial_puts(" total_bytes=");
+        serial_put_dec(site->total_bytes);
+        serial_puts(" stack=");
+        for (int f = 0; f < site->depth; f++) {
+            if (f) {
+                serial_puts(",");
+            }
+            serial_put_hex(site->frames[f]);
+        }
+        serial_puts("\n");
+    }
+
+    serial_puts("HEAPPROF_END\n");
+    spin_unlock_irqrestore(&heapprof_lock, irq);
+}
@@ -0,0 +1,142 @@
+#include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/serial.h"
+#include "../include/kmon.h"
+#include "../include/kalloc.h"
+#include "../include/pmm.h"
+#include "../include/vmm.h"
+#include "../include/heapprof.h"
+#include "../include/shrinker.h"
+#include "../include/klog.h"
+#include "../include/trace.h"
+#include "../include/sink.h"
+#include "../include/smp.h"
+#include "../include/lockstat.h"
+#include "../include/ktime.h"
+#include "../include/timer.h"
+
+// Pages pre-zeroed per pass of the idle loop
+#define KMON_ZERO_BATCH 16
+
+// How often an idle monitor wakes to look for a key, the UART's receive
+// side has no interrupt
+#define KMON_POLL_NS 50000000ULL
+
+static void kmon_help(void) {
+    serial_puts("kmon commands:\n");
+    serial_puts("  s  slabinfo\n");
+    serial_puts("  b  buddyinfo and PMM counters\n");
+    serial_puts("  l  latency histograms\n");
+    serial_puts("  p  start/stop the heap profiler\n");
+    serial_puts("  d  dump the heap profile\n");
+    serial_puts("  r  reclaim counters and shrinkers\n");
+    serial_puts("  k  klog counters\n");
+    serial_puts("  t  start/stop tracing every event\n");
+    serial_puts("  x  dump the trace rings (raw binary)\n");
+    serial_puts("  m  replay the in-memory log\n");
+    serial_puts("  c  CPUs\n");
+    serial_puts("  o  lock statistics\n");
+    serial_puts("  i  timers and idle wakeups\n");
+    serial_puts("  0-4  klog level (panic, err, warn, info, debug)\n");
+    serial_puts("  h  this help\n");
+}
+
+// Handle one pending command, if any
+void kmon_poll(void) {
+    int c = serial_getc_nonblock();
+
+    switch (c) {
+    case 's':
+        kmem_dump_slabinfo();
+        break;
+    case 'b':
+        pmm_dump_stats();
+        break;
+    case 'l':
+        kalloc_dump_latency();
+        vmm_dump_stats();
+        break;
+    case 'p':
+        if (heapprof_running()) {
+            heapprof_stop();
+            serial_puts("heapprof: stopped\n");
+        } else {
+            heapprof_start(HEAPPROF_DEFAULT_INTERVAL);
+            serial_puts("heapprof: sampling\n");
+        }
+        break;
+    case 'd':
+        heapprof_dump();
+        break;
+    case 'r':
+        reclaim_dump_stats();
+        break;
+    case 'k':
+        klog_dump_stats();
+        break;
+    case 't':
+        if (trace_running()) {
+            trace_stop();
+            serial_puts("trace: stopped\n");
+        } else if (trace_start(TRACE_ALL) == 0) {
+            serial_puts("trace: recording\n");
+        }
+        break;
+    case 'x':
+        trace_dump();
+        break;
+    case 'm':
+        memlog_dump();
+        break;
+    case 'c':
+        smp_dump();
+        break;
+    case 'o':
+        lockstat_dump();
+        break;
+    case 'i':
+        timer_dump_stats();
+        break;
+    case '0':
+    case '1':
+    case '2':
+    case '3':
+    case '4':
+        klog_set_level(c - '0');
+        klog_dump_stats();
+        break;
+    case 'h':
+    case '?':
+        kmon_help();
+        break;
+    default:
+        break;
+    }
+}
+
+// Helper: Wake the monitor for the next look at the UART. Waking up is
+// the whole job, kmon_run() does the rest.
+static void kmon_tick(struct timer *timer) {
+    timer_add(timer, ktime_get() + KMON_POLL_NS);
+}
+
+// Sit in the monitor forever, used once boot is done. This is also the
+// BSP's idle loop, so background reclaim and page pre-zeroing run from
+// here. Once there's nothing left to zero it sleeps, waking for the UART
+// poll timer or any other interrupt.
+void kmon_run(void) {
+    struct timer poll;
+
+    serial_puts("kmon: press 'h' for help\n");
+
+    timer_init(&poll, kmon_tick, 0);
+    timer_add(&poll, ktime_get() + KMON_POLL_NS);
+
+    for (;;) {
+        kmon_poll();
+        reclaim_poll();
+        if (!pmm_zero_idle(KMON_ZERO_BATCH)) {
+            cpu_idle();
+        }
+    }
+}
@@ -0,0 +1,165 @@
+#include <stdarg.h>
+#include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/pmm.h"
+#include "../include/serial.h"
+#include "../include/format.h"
+#include "../include/klog.h"
+#include "../include/trace.h"
+#include "../include/tsc.h"
+#include "../include/smp.h"
+
+// Events per CPU, 2^TRACE_RING_ORDER pages of them
+#define TRACE_RING_ORDER  5
+#define TRACE_RING_EVENTS ((4096 << TRACE_RING_ORDER) / sizeof(struct trace_event))
+
+#define CR0_WP (1ULL << 16)
+
+// Bumped when struct trace_event or the framing changes
+#define TRACE_VERSION 1
+
+extern const struct trace_site __trace_sites_start[];
+extern const struct trace_site __trace_sites_end[];
+
+struct trace_cpu {
+    struct trace_event *ring;
+    uint64_t head;              // Events ever recorded, ring index is head % size
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static struct trace_cpu trace_cpus[MAX_CPUS];
+static uint32_t enabled = 0;
+
+static const uint8_t nop5[5] = { 0x0F, 0x1F, 0x44, 0x00, 0x00 };
+
+// What patch_sites() rewrites
+struct trace_patch {
+    uint32_t mask;              // Events whose sites change
+    int on;
+};
+
+// Helper: Turn every site of the events in a trace_patch on or off, run
+// through smp_stop_machine() so no other CPU executes a site mid-write.
+// Kernel text is mapped read-only, so write protection is lifted around
+// the writes.
+static void patch_sites(void *arg) {
+    const struct trace_patch *patch = arg;
+    uint64_t cr0 = read_cr0();
+    write_cr0(cr0 & ~CR0_WP);
+
+    for (const struct trace_site *site = __trace_sites_start; site < __trace_sites_end; site++) {
+        if (!(patch->mask & (1u << site->id))) {
+            continue;
+        }
+
+        uint8_t *code = (uint8_t *)site->addr;
+        if (patch->on) {
+            int32_t rel = (int32_t)(site->target - (site->addr + 5));
+            code[0] = 0xE9;
+            __builtin_memcpy(&code[1], &rel, sizeof(rel));
+        } else {
+            __builtin_memcpy(code, nop5, sizeof(nop5));
+        }
+    }
+
+    write_cr0(cr0);
+}
+
+// Helper: Patch the sites of every event in mask at once
+static void patch_events(uint32_t mask, int on) {
+    struct trace_patch patch = { .mask = mask, .on = on };
+
+    if (mask) {
+        smp_stop_machine(patch_sites, &patch);
+    }
+}
+
+void trace_record(int id, uint64_t arg0, uint64_t arg1) {
+    int cpu = cpu_id();
+    struct trace_cpu *tc = &trace_cpus[cpu];
+
+    if (!tc->ring) {
+        return;
+    }
+
+    // Interrupts on this CPU may record too, claim the slot atomically
+    uint64_t n = __atomic_fetch_add(&tc->head, 1, __ATOMIC_RELAXED);
+    struct trace_event *ev = &tc->ring[n % TRACE_RING_EVENTS];
+
+    ev->tsc = rdtsc();
+    ev->id = (uint16_t)id;
+    ev->cpu = (uint16_t)cpu;
+    ev->reserved = 0;
+    ev->arg0 = arg0;
+    ev->arg1 = arg1;
+}
+
+int trace_start(uint32_t mask) {
+    trace_stop();
+
+    for (unsigned int cpu = 0; cpu < cpu_count(); cpu++) {
+        struct trace_cpu *tc = &trace_cpus[cpu];
+        if (!tc->ring) {
+            tc->ring = pmm_alloc_pages(TRACE_RING_ORDER);
+            if (!tc->ring) {
+                klog(KLOG_ERR, "TRACE: No memory for the cpu %u ring\n", cpu);
+                return -1;
+            }
+        }
+        tc->head = 0;
+    }
+
+    enabled = mask & TRACE_ALL;
+    patch_events(enabled, 1);
+    return 0;
+}
+
+void trace_stop(void) {
+    patch_events(enabled, 0);
+    enabled = 0;
+}
+
+int trace_running(void) {
+    return enabled != 0;
+}
+
+// Helper: A framing line of the dump, to the UART only like the events
+__attribute__((format(printf, 1, 2)))
+static void dump_line(const char *fmt, ...) {
+    char line[128];
+    va_list ap;
+
+    va_start(ap, fmt);
+    int len = kvsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+
+    serial_write(line, len);
+}
+
+void trace_dump(void) {
+    trace_stop();
+
+    dump_line("TRACE_BEGIN version=%u cpus=%u event_size=%zu tsc_khz=%lu\n",
+              TRACE_VERSION, cpu_count(), sizeof(struct trace_event), tsc_khz());
+
+    for (unsigned int cpu = 0; cpu < cpu_count(); cpu++) {
+        struct trace_cpu *tc = &trace_cpus[cpu];
+        uint64_t head = tc->ring ? tc->head : 0;
+        uint64_t count = head < TRACE_RING_EVENTS ? head : TRACE_RING_EVENTS;
+
+        dump_line("TRACE_CPU cpu=%u count=%lu lost=%lu\n", cpu, count, head - count);
+
+        // Oldest first, in at most two runs as the ring may have wrapped
+        uint64_t start = (head - count) % TRACE_RING_EVENTS;
+        uint64_t first = count < TRACE_RING_EVENTS - start ? count : TRACE_RING_EVENTS - start;
+
+        if (first) {
+            serial_write((const char *)&tc->ring[start], first * sizeof(struct trace_event));
+        }
+        if (count > first) {
+            serial_write((const char *)tc->ring, (count - first) * sizeof(struct trace_event));
+        }
+        serial_write("\n", 1);
+    }
+
+    dump_line("TRACE_END\n");
+}
@@ -0,0 +1,38 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <stdint.h>
+
+// Just enough ACPI to find static tables: no AML, nothing is parsed
+// beyond the root tables.
+
+// Every system description table starts with this
+struct acpi_sdt_header {
+    char signature[4];
+    uint32_t length;            // Whole table, header included
+    uint8_t revision;
+    uint8_t checksum;           // Makes all bytes of the table sum to 0
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed));
+
+// Generic Address Structure, how tables point at registers
+struct acpi_gas {
+    uint8_t space_id;
+    uint8_t bit_width;
+    uint8_t bit_offset;
+    uint8_t access_size;
+    uint64_t address;
+} __attribute__((packed));
+
+#define ACPI_SPACE_MEMORY 0
+
+// Find a table by its 4-character signature, through the RSDP Limine
+// hands us. Returns it mapped whole, or NULL if there's none or its
+// checksum is wrong. Needs the VMM, and tables stay mapped for good.
+const struct acpi_sdt_header *acpi_find_table(const char *signature);
+
+#endif /* ACPI_H */
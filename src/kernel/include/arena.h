@@ -0,0 +1,57 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Arena (region) allocator for objects that all die together. Allocation
+// bumps a pointer inside page-allocator chunks, there is no per-object
+// free: rewind to a mark or destroy the whole arena instead.
+
+struct arena;
+struct arena_chunk;
+
+// arena_create() flags
+#define ARENA_GROW (1 << 0) // Chain new chunks when the current one is full
+
+// Position in an arena to rewind to later
+typedef struct {
+    struct arena_chunk *chunk;
+    size_t used;
+} arena_mark_t;
+
+// `size` is the capacity of the first chunk, rounded up to whole pages.
+// The arena header lives in that chunk. Chunks are capped at
+// 2^PMM_MAX_ORDER pages, and so is any single allocation.
+struct arena *arena_create(size_t size, int flags);
+
+// Frees every chunk, O(chunks)
+void arena_destroy(struct arena *arena);
+
+// `align` of 0 picks the default, otherwise it must be a power of two.
+// Returns NULL when the arena is full and can't grow.
+void *arena_alloc(struct arena *arena, size_t size, size_t align);
+
+// Same, but the memory is zeroed
+void *arena_zalloc(struct arena *arena, size_t size, size_t align);
+
+arena_mark_t arena_mark(struct arena *arena);
+
+// Drop everything allocated since `mark`, chunks added since are freed
+void arena_rewind(struct arena *arena, arena_mark_t mark);
+
+// Rewind to empty, keeping only the first chunk
+void arena_reset(struct arena *arena);
+
+// Per-CPU scratch arenas for temporary allocations that don't outlive the
+// function using them. Pair every begin with an end on the same CPU, they
+// nest. `arena` is NULL if the scratch arena couldn't be created.
+typedef struct {
+    struct arena *arena;
+    arena_mark_t mark;
+} arena_scratch_t;
+
+arena_scratch_t arena_scratch_begin(void);
+void arena_scratch_end(arena_scratch_t scratch);
+
+#endif /* ARENA_H */
@@ -0,0 +1,36 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+// Print one result line:
+//   BENCH <suite> <name> param=<n> ops=<n> cycles=<n> cyc/op=<n> ns/op=<n.nn>
+// ns/op is left out when the TSC rate is unknown.
+void bench_report(const char *suite, const char *name, uint64_t param,
+                  uint64_t ops, uint64_t cycles);
+
+// Print a single extra measurement:
+//   BENCH <suite> <name> param=<n> <key>=<value>
+void bench_report_value(const char *suite, const char *name, uint64_t param,
+                        const char *key, uint64_t value);
+
+// Run the suites named by the `bench` command line flag, then exit QEMU
+// through isa-debug-exit. A bare `bench` (or bench=all) runs everything,
+// bench=pmm,kmem just those. Does nothing without the flag.
+void bench_main(void);
+
+// Individual suites
+void bench_pmm(void);
+void bench_vmm(void);
+void bench_kmem(void);
+void bench_krealloc(void);
+void bench_kmalloc_large(void);
+void bench_arena(void);
+void bench_string(void);
+void bench_simd(void);
+void bench_sink(void);
+void bench_fbcon(void);
+void bench_lock(void);
+void bench_timer(void);
+
+#endif /* BENCH_H */
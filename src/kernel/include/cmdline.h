@@ -0,0 +1,19 @@
+#ifndef CMDLINE_H
+#define CMDLINE_H
+
+#include <stddef.h>
+
+// Kernel command line from Limine: space separated `key` or `key=value`
+// words. Copied at cmdline_init(), usable any time after.
+void cmdline_init(void);
+
+// Value of key=value, with its length in *len. NULL if the key is missing;
+// a bare `key` gives an empty value.
+const char *cmdline_get(const char *key, size_t *len);
+
+// Whether a comma separated value list contains item, e.g. log=uart,mem
+int cmdline_list_has(const char *list, size_t len, const char *item);
+
+const char *cmdline_raw(void);
+
+#endif /* CMDLINE_H */
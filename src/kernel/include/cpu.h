@@ -0,0 +1,189 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdint.h>
+
+// Upper bound on the number of CPUs the kernel keeps state for
+#define MAX_CPUS 32
+
+// L1 cache line size, used to keep per-CPU data on separate lines
+#define CACHE_LINE_SIZE 64
+
+// Read the time stamp counter
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *a,
+                         uint32_t *b, uint32_t *c, uint32_t *d) {
+    asm volatile ("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d)
+                  : "a"(leaf), "c"(subleaf));
+}
+
+#define MSR_GS_BASE 0xC0000101
+
+// Only touch MSRs CPUID says exist, anything else faults
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    asm volatile ("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    asm volatile ("wrmsr" :: "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+static inline uint64_t read_cr0(void) {
+    uint64_t v;
+    asm volatile ("mov %%cr0, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr0(uint64_t v) {
+    asm volatile ("mov %0, %%cr0" :: "r"(v) : "memory");
+}
+
+#ifdef LITHIUM_HOST
+// Hosted build of the memory code (tools/host): the shim keeps a simulated
+// CR3 and turns TLB flushes into updates of the host mappings
+uint64_t host_read_cr3(void);
+void host_invlpg(uint64_t vaddr);
+
+static inline uint64_t read_cr3(void) {
+    return host_read_cr3();
+}
+
+static inline void invlpg(uint64_t vaddr) {
+    host_invlpg(vaddr);
+}
+
+// The shim has no full flush, it reloads a page at a time
+static inline void flush_tlb_range(uint64_t vaddr, uint64_t pages) {
+    for (uint64_t i = 0; i < pages; i++) {
+        host_invlpg(vaddr + i * 4096);
+    }
+}
+#else
+static inline uint64_t read_cr3(void) {
+    uint64_t cr3;
+    asm volatile ("mov %%cr3, %0" : "=r"(cr3));
+    return cr3;
+}
+
+// Flush the TLB entry for one page
+static inline void invlpg(uint64_t vaddr) {
+    asm volatile ("invlpg (%0)" :: "r"(vaddr) : "memory");
+}
+
+// Past this many pages reloading CR3 is cheaper than an invlpg each
+#define TLB_FLUSH_ALL_PAGES 32
+
+// Flush a range of pages. The full flush keeps global entries, which is
+// fine, the kernel never maps anything global that it later unmaps.
+static inline void flush_tlb_range(uint64_t vaddr, uint64_t pages) {
+    if (pages > TLB_FLUSH_ALL_PAGES) {
+        asm volatile ("mov %0, %%cr3" :: "r"(read_cr3()) : "memory");
+        return;
+    }
+    for (uint64_t i = 0; i < pages; i++) {
+        invlpg(vaddr + i * 4096);
+    }
+}
+#endif
+
+// Port I/O
+static inline void outb(uint16_t port, uint8_t val) {
+    asm volatile ("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static inline uint8_t inb(uint16_t port) {
+    uint8_t ret;
+    asm volatile ("inb %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+#ifdef LITHIUM_HOST
+// User space can't mask interrupts, and the hosted code never runs in one
+static inline void local_irq_enable(void) {
+}
+
+static inline void local_irq_disable(void) {
+}
+
+static inline uint64_t local_irq_save(void) {
+    return 0;
+}
+
+static inline void local_irq_restore(uint64_t flags) {
+    (void)flags;
+}
+
+static inline int irqs_enabled(void) {
+    return 1;
+}
+#else
+static inline void local_irq_enable(void) {
+    asm volatile ("sti" ::: "memory");
+}
+
+static inline void local_irq_disable(void) {
+    asm volatile ("cli" ::: "memory");
+}
+
+// Disable interrupts, returning the previous RFLAGS for local_irq_restore()
+static inline uint64_t local_irq_save(void) {
+    uint64_t flags;
+    asm volatile ("pushfq\n\tpopq %0\n\tcli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static inline void local_irq_restore(uint64_t flags) {
+    asm volatile ("pushq %0\n\tpopfq" :: "r"(flags) : "memory", "cc");
+}
+
+// Whether this CPU takes interrupts right now (RFLAGS.IF)
+static inline int irqs_enabled(void) {
+    uint64_t flags;
+    asm volatile ("pushfq\n\tpopq %0" : "=r"(flags) :: "memory");
+    return (flags & 0x200) != 0;
+}
+#endif
+
+// Spin-wait hint for busy loops
+static inline void cpu_relax(void) {
+    asm volatile ("pause" ::: "memory");
+}
+
+#ifdef LITHIUM_HOST
+// The hosted memory code runs single threaded, as CPU 0
+static inline unsigned int cpu_id(void) {
+    return 0;
+}
+
+static inline unsigned int cpu_count(void) {
+    return 1;
+}
+#else
+// CPUs the kernel brought up or is bringing up, set once by smp_init()
+extern unsigned int nr_cpus;
+
+// The CPU's number, a per-CPU variable (see percpu.h)
+extern unsigned int cpu_number;
+
+// Index of the executing CPU: this_cpu_read(cpu_number), spelled out as
+// percpu.h builds on this header
+static inline unsigned int cpu_id(void) {
+    unsigned int id;
+    asm volatile ("movl %%gs:%1, %0" : "=r"(id) : "m"(cpu_number));
+    return id;
+}
+
+// Number of CPUs, valid as an upper bound for per-CPU arrays
+static inline unsigned int cpu_count(void) {
+    return nr_cpus;
+}
+#endif
+
+#endif /* CPU_H */
@@ -0,0 +1,19 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC32C (Castagnoli), as used by iSCSI, ext4 and btrfs. Start with
+// crc = 0 and feed the result back in to continue a running checksum.
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+// Individual variants, for benchmarks. The SSE4.2 crc32 instruction works
+// on general purpose registers, so neither needs an FPU section.
+uint32_t crc32c_sw(uint32_t crc, const void *buf, size_t len);
+uint32_t crc32c_hw(uint32_t crc, const void *buf, size_t len);
+
+// Whether crc32c() uses the crc32 instruction
+int crc32c_hw_available(void);
+
+#endif /* CRC32C_H */
@@ -0,0 +1,27 @@
+#ifndef FBCON_H
+#define FBCON_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Text console on the Limine framebuffer, the "fb" log sink. Text is
+// drawn into a shadow buffer in normal memory from glyphs pre-rendered in
+// the framebuffer's pixel format, and only changed spans are copied out to
+// the (slow, uncached) framebuffer at the end of each write.
+
+// Whether Limine gave us a framebuffer we can drive (32 bpp RGB)
+int fbcon_present(void);
+
+// Allocate the shadow buffer, needs kmalloc. Replays the in-memory log so
+// the console starts with the boot messages. Writes before this are
+// dropped.
+void fbcon_init(void);
+
+// Sink writer
+void fbcon_write(const char *s, size_t n);
+
+// Text grid size, 0 before fbcon_init()
+int fbcon_cols(void);
+int fbcon_rows(void);
+
+#endif /* FBCON_H */
@@ -0,0 +1,14 @@
+#ifndef FONT_H
+#define FONT_H
+
+#include <stdint.h>
+
+// Built-in console font, printable ASCII only
+#define FONT_WIDTH  8
+#define FONT_HEIGHT 8
+#define FONT_FIRST  0x20
+#define FONT_GLYPHS 95
+
+extern const uint8_t font8x8[FONT_GLYPHS][8];
+
+#endif /* FONT_H */
@@ -0,0 +1,15 @@
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <stdarg.h>
+#include <stddef.h>
+
+// Minimal printf-style formatting. Supports %d %i %u %x %X %p %s %c %%,
+// the '0' and '-' flags, a field width and the l, ll and z length
+// modifiers. Output is always NUL terminated and truncated to fit; the
+// return value is the number of characters stored, excluding the NUL.
+int kvsnprintf(char *buf, size_t size, const char *fmt, va_list ap);
+int ksnprintf(char *buf, size_t size, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+#endif /* FORMAT_H */
@@ -0,0 +1,32 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include <stdint.h>
+
+// The kernel is built without SSE/x87 code generation. Code that wants
+// vector registers wraps their use in kernel_fpu_begin()/kernel_fpu_end(),
+// which save and restore the extended state in a per-CPU area.
+//
+// Sections nest, including from interrupt handlers: each level saves the
+// state of the level below it. There is no scheduler yet, so nothing can
+// be preempted away from the CPU inside a section.
+
+// Probe the features and set up CR0/CR4/XCR0, on the BSP
+void fpu_init(void);
+
+// The same register setup on an AP, with what fpu_init() found
+void fpu_init_ap(void);
+
+void kernel_fpu_begin(void);
+void kernel_fpu_end(void);
+
+// CPU features known to fpu_init()
+#define FPU_XSAVE    (1 << 0)
+#define FPU_XSAVEOPT (1 << 1)
+#define FPU_AVX      (1 << 2)
+#define FPU_AVX2     (1 << 3)
+#define FPU_SSE42    (1 << 4)
+
+int fpu_features(void);
+
+#endif /* FPU_H */
@@ -0,0 +1,20 @@
+#ifndef GDT_H
+#define GDT_H
+
+#include <stdint.h>
+
+// Selectors in every CPU's GDT
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_TSS         0x18
+
+// Interrupt stack table slot for the double fault handler, so a kernel
+// stack overflow still gets reported
+#define IST_DOUBLE_FAULT 1
+
+// Build and load the GDT and TSS for a CPU, replacing the bootloader's.
+// The data segments are reloaded, which clears the GS base, so set that
+// up afterwards. `df_stack_top` is the top of the double fault stack.
+void gdt_init(unsigned int cpu, uint64_t df_stack_top);
+
+#endif /* GDT_H */
@@ -0,0 +1,30 @@
+#ifndef HEAPPROF_H
+#define HEAPPROF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Sampling heap profiler for kmalloc. Allocations are sampled on a Poisson
+// process over allocated bytes, so on average one sample is taken every
+// `interval` bytes, and each sample keeps the caller's frame pointer chain.
+// Live bytes per call site are estimated from the samples still alive.
+
+#define HEAPPROF_DEFAULT_INTERVAL (512 * 1024)
+
+// Non-zero while sampling, or while sampled allocations are still live
+extern int heapprof_active;
+
+void heapprof_start(uint64_t interval);
+void heapprof_stop(void);
+int heapprof_running(void);
+
+// Hooks for the allocator, only call these when heapprof_active is set.
+// `frame` is the allocator entry point's frame, whose return address is
+// the call site.
+void heapprof_on_alloc(void *ptr, size_t size, void *frame);
+void heapprof_on_free(void *ptr);
+
+// Dump live call sites over serial, symbolize with tools/heapprof.py
+void heapprof_dump(void);
+
+#endif /* HEAPPROF_H */
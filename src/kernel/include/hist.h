@@ -0,0 +1,51 @@
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdint.h>
+#include "cpu.h"
+
+// Latency histogram with power-of-two cycle buckets: bucket i counts
+// samples that took [2^i, 2^(i+1)) TSC cycles. Kept per CPU so recording
+// never bounces a cache line between cores.
+#define HIST_BUCKETS 40
+
+struct lat_hist_cpu {
+    uint64_t buckets[HIST_BUCKETS];
+    uint64_t samples;
+    uint64_t total;             // Sum of all samples in cycles
+    uint64_t max;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+struct lat_hist {
+    const char *name;
+    struct lat_hist_cpu cpu[MAX_CPUS];
+};
+
+#define LAT_HIST_INIT(n) { .name = (n) }
+
+static inline uint64_t lat_start(void) {
+    return rdtsc();
+}
+
+// Record the time since `start`, taken with lat_start()
+static inline void lat_record(struct lat_hist *hist, uint64_t start) {
+    uint64_t delta = rdtsc() - start;
+    struct lat_hist_cpu *h = &hist->cpu[cpu_id()];
+
+    unsigned int bucket = delta ? 63 - __builtin_clzll(delta) : 0;
+    if (bucket >= HIST_BUCKETS) {
+        bucket = HIST_BUCKETS - 1;
+    }
+
+    h->buckets[bucket]++;
+    h->samples++;
+    h->total += delta;
+    if (delta > h->max) {
+        h->max = delta;
+    }
+}
+
+// Print a histogram summed over all CPUs
+void lat_hist_dump(struct lat_hist *hist);
+
+#endif /* HIST_H */
@@ -0,0 +1,25 @@
+#ifndef HPET_H
+#define HPET_H
+
+#include <stdint.h>
+
+// High Precision Event Timer, found through ACPI. Only its main counter
+// is used: as the reference for TSC calibration and as the fallback
+// clocksource (see ktime.h). The comparators and legacy routing are left
+// alone, the PIT keeps IRQ0.
+
+// Find the HPET, map it and start the main counter. Needs the VMM.
+// Returns -1 if there's none.
+int hpet_init(void);
+
+// Main counter. Only meaningful after hpet_init() returned 0.
+uint64_t hpet_read(void);
+
+// Length of one counter tick in femtoseconds, 0 without an HPET
+uint64_t hpet_period_fs(void);
+
+// Whether the main counter is 64 bits wide. A 32-bit one wraps every few
+// minutes, fine for calibration but not as a clocksource.
+int hpet_counter_64bit(void);
+
+#endif /* HPET_H */
@@ -0,0 +1,30 @@
+#ifndef IDT_H
+#define IDT_H
+
+#include <stdint.h>
+
+// Frame the CPU pushes on an interrupt, for __attribute__((interrupt))
+// handlers
+struct interrupt_frame {
+    uint64_t rip;
+    uint64_t cs;
+    uint64_t rflags;
+    uint64_t rsp;
+    uint64_t ss;
+};
+
+// Load an IDT with every exception routed to panic(), set up the PIC and
+// the COM1 interrupt. Interrupts stay disabled until the caller enables
+// them. Uses the selectors of gdt_init()'s GDT.
+void idt_init(void);
+
+// Install a handler for a vector, as an interrupt gate
+void idt_set_handler(int vector, uintptr_t handler);
+
+// Run a vector's handler on a stack from the TSS's interrupt stack table
+void idt_set_ist(int vector, int ist);
+
+// Load the shared IDT on the calling CPU, for APs after idt_init()
+void idt_load(void);
+
+#endif /* IDT_H */
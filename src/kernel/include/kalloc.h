@@ -6,18 +6,85 @@
 struct slab;
 struct kmem_cache;
 
+// Object constructor, run once per object before it is first handed out.
+// Objects keep their constructed state across kmem_cache_free()/alloc().
+typedef void (*kmem_ctor_t)(void *obj);
+
+// kmem_cache_create() flags
+#define KMC_NOMAGAZINE     (1 << 0) // Bypass the per-CPU magazine layer
+#define KMC_HWCACHE_ALIGN  (1 << 1) // Align objects to a cache line
+#define KMC_BITMAP         (1 << 2) // Track free objects in a per-slab bitmap
+                                    // instead of a freelist through them
+
+// Bitmap slabs never write to free objects, are built in O(1) without a
+// ctor and catch double frees that reach the slab layer. Objects parked in
+// magazines aren't checked, combine with KMC_NOMAGAZINE to catch all.
+
+// `name` must stay valid for the lifetime of the cache. `align` of 0 picks
+// the default, otherwise it must be a power of two.
+struct kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align,
+                                     kmem_ctor_t ctor, int flags);
+
+// Returns -1 and leaves the cache alone if it still has live objects
+int kmem_cache_destroy(struct kmem_cache *cache);
+
+// Number of fully free slabs the cache keeps cached (default 1). Lowering
+// it gives the excess back to the page allocator right away.
+void kmem_cache_set_empty_keep(struct kmem_cache *cache, size_t keep);
+
 void *kmem_cache_alloc(struct kmem_cache *cache);
 
+// kmalloc_flags()/kmem_cache_alloc_flags() flags
+#define KM_ZERO    (1 << 0) // Zeroed memory, skipped when already known zero
+#define KM_ATOMIC  (1 << 1) // Never reclaim, may dip into the page reserve
+#define KM_NOFAIL  (1 << 2) // Retry (reclaiming unless KM_ATOMIC) until it works
+#define KM_DMA32   (1 << 3) // Physically contiguous below 4 GiB, page granular
+
+// Interrupt handlers allocate with KM_ATOMIC and may free anything.
+// Without it an allocation can reclaim, which interrupt handlers must not.
+
+// NUMA node hint. There is a single node for now, so it is accepted and
+// ignored.
+#define KM_NODE_SHIFT 16
+#define KM_NODE(n)    (((n) + 1) << KM_NODE_SHIFT)
+
+void *kmem_cache_alloc_flags(struct kmem_cache *cache, int flags);
+
 void kmem_cache_free(struct kmem_cache *cache, void *ptr);
 
+// Allocate `n` objects into out[], returns n or 0 if memory ran out (in
+// which case nothing is left allocated)
+size_t kmem_cache_alloc_bulk(struct kmem_cache *cache, size_t n, void **out);
+
+// Free `n` objects of the same cache. NULL entries are skipped, and ptrs[]
+// is used as scratch space so its contents are undefined afterwards.
+void kmem_cache_free_bulk(struct kmem_cache *cache, size_t n, void **ptrs);
+
 void kalloc_init(void);
 
 void *kmalloc(size_t size);
 
+// kmalloc() with KM_* flags, free with kfree(). krealloc() doesn't carry
+// the flags over to a moved block.
+void *kmalloc_flags(size_t size, int flags);
+
+static inline void *kzalloc(size_t size) {
+    return kmalloc_flags(size, KM_ZERO);
+}
+
 void *krealloc(void *ptr, size_t new_size);
 
+// Page-mapped memory that is only virtually contiguous. Large kmalloc()s
+// are physically contiguous and come from the HHDM when possible, this
+// always takes the mapped path. Free with kfree().
+void *vmalloc(size_t size);
+
 void kfree(void *ptr);
 
 void test_kalloc();
 
+// Statistics, printed over serial
+void kmem_dump_slabinfo(void);
+void kalloc_dump_latency(void);
+
 #endif /* KALLOC_H */
\ No newline at end of file
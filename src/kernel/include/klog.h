@@ -0,0 +1,59 @@
+#ifndef KLOG_H
+#define KLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Kernel log. klog() formats into a lock-free ring buffer and returns; the
+// UART drains it from its transmit interrupt, a FIFO load at a time.
+
+#define KLOG_PANIC 0
+#define KLOG_ERR   1
+#define KLOG_WARN  2
+#define KLOG_INFO  3
+#define KLOG_DEBUG 4
+
+// Messages above this level are compiled out entirely, arguments and all.
+// Set it with `make KLOG_LEVEL=4` to build the debug messages in.
+#ifndef KLOG_LEVEL
+#define KLOG_LEVEL KLOG_INFO
+#endif
+
+#define klog(level, ...)                                \
+    do {                                                \
+        if ((level) <= KLOG_LEVEL) {                    \
+            klog_write((level), __VA_ARGS__);           \
+        }                                               \
+    } while (0)
+
+void klog_write(int level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+// Runtime filter on top of KLOG_LEVEL, defaults to KLOG_INFO
+void klog_set_level(int level);
+int klog_get_level(void);
+
+// Switch to interrupt driven output, once the IDT is up
+void klog_init(void);
+
+// Whether queued output hasn't reached the UART yet
+int klog_pending(void);
+
+// Push everything queued out of the UART before returning
+void klog_flush(void);
+
+// Flush, then send s polled, with nothing else reaching the FIFO between
+// or during. The UART sink's write.
+void klog_write_sync(const char *s, size_t n);
+
+// THRE interrupt handler
+void klog_uart_irq(void);
+
+void klog_dump_stats(void);
+
+// Log at KLOG_PANIC, flush synchronously and halt. From here on klog()
+// writes straight through to the UART.
+__attribute__((noreturn, format(printf, 1, 2)))
+void panic(const char *fmt, ...);
+
+#endif /* KLOG_H */
@@ -0,0 +1,8 @@
+#ifndef KMON_H
+#define KMON_H
+
+// Kernel monitor: single-key debug commands read from the serial port
+void kmon_poll(void);
+void kmon_run(void);
+
+#endif /* KMON_H */
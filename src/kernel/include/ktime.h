@@ -0,0 +1,40 @@
+#ifndef KTIME_H
+#define KTIME_H
+
+#include <stdint.h>
+
+// Kernel time: nanoseconds since ktime_init(), monotonic and the same on
+// every CPU. The clocksource is picked once at boot:
+//
+//   tsc   invariant TSC, calibrated against the HPET or else the PIT.
+//         A few cycles more than a bare rdtsc.
+//   hpet  the HPET's main counter when the TSC can't be trusted. An
+//         uncached MMIO read, so hundreds of cycles or more.
+//
+// `clocksource=tsc` or `clocksource=hpet` on the command line overrides
+// the choice, as long as the source exists. ktime_get() returns 0 until
+// ktime_init() and on machines with neither.
+
+// Find the HPET, recalibrate the TSC and pick the clocksource, logging
+// the read cost. Needs the VMM, before smp_init() (the LAPIC timer is
+// calibrated against this).
+void ktime_init(void);
+
+uint64_t ktime_get(void);
+
+enum clocksource {
+    CLOCK_NONE,
+    CLOCK_TSC,
+    CLOCK_HPET,
+};
+
+enum clocksource ktime_clocksource(void);
+
+// Name of the clocksource in use, "none" without one
+const char *ktime_clocksource_name(void);
+
+// TSC value at which ktime_get() reads ns, for TSC-deadline timers. Only
+// meaningful with the tsc clocksource.
+uint64_t ktime_to_tsc(uint64_t ns);
+
+#endif /* KTIME_H */
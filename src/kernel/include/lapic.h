@@ -0,0 +1,67 @@
+#ifndef LAPIC_H
+#define LAPIC_H
+
+#include <stdint.h>
+
+// Register offsets in xAPIC MMIO layout, x2APIC mode is handled inside
+#define LAPIC_ID          0x020
+#define LAPIC_TPR         0x080
+#define LAPIC_EOI         0x0B0
+#define LAPIC_SVR         0x0F0
+#define LAPIC_ICR_LO      0x300
+#define LAPIC_ICR_HI      0x310
+#define LAPIC_LVT_TIMER   0x320
+#define LAPIC_LVT_LINT0   0x350
+#define LAPIC_LVT_LINT1   0x360
+#define LAPIC_LVT_ERROR   0x370
+#define LAPIC_TIMER_INIT  0x380
+#define LAPIC_TIMER_CUR   0x390
+#define LAPIC_TIMER_DIV   0x3E0
+
+#define LAPIC_LVT_MASKED  (1U << 16)
+
+#define LAPIC_TIMER_VECTOR    0xEF
+#define LAPIC_SPURIOUS_VECTOR 0xFF
+
+// Enable the calling CPU's local APIC. The first call, on the BSP, finds
+// it and maps the registers, so it needs the VMM. APs also get their
+// LINT pins masked, only the BSP takes the PIC's interrupts. Returns -1
+// if there's no usable LAPIC.
+int lapic_init(void);
+
+uint32_t lapic_read(uint32_t reg);
+void lapic_write(uint32_t reg, uint32_t value);
+
+// APIC ID of the calling CPU
+uint32_t lapic_id(void);
+
+// Acknowledge the interrupt being handled
+void lapic_eoi(void);
+
+// Send a fixed interrupt to one CPU by APIC ID
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector);
+
+// Per-CPU one-shot timer on ktime_get()'s timeline. TSC-deadline mode
+// when the CPU has it and the TSC is the clocksource, otherwise the
+// LAPIC's own count-down, calibrated against ktime_get() at the first
+// lapic_init() (so after ktime_init()).
+
+// Called from the timer interrupt, with interrupts off, on the CPU whose
+// deadline passed. Set it before arming anything.
+void lapic_timer_set_handler(void (*fn)(void));
+
+// Fire once ktime_get() reaches `deadline` on the calling CPU, replacing
+// whatever was armed. A deadline already past fires straight away.
+void lapic_timer_arm(uint64_t deadline);
+
+// Disarm the calling CPU's timer
+void lapic_timer_cancel(void);
+
+// Whether there's a timer at all: no LAPIC or no clocksource means
+// lapic_timer_arm() does nothing
+int lapic_timer_available(void);
+
+// Whether the timer runs in TSC-deadline mode
+int lapic_timer_tsc_deadline(void);
+
+#endif /* LAPIC_H */
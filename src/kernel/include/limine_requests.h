@@ -6,5 +6,9 @@
 extern volatile struct limine_memmap_request memmap_request;
 extern volatile struct limine_hhdm_request hhdm_request;
 extern volatile struct limine_executable_address_request exec_addr_request;
+extern volatile struct limine_executable_cmdline_request cmdline_request;
+extern volatile struct limine_framebuffer_request framebuffer_request;
+extern volatile struct limine_mp_request mp_request;
+extern volatile struct limine_rsdp_request rsdp_request;
 
 #endif /* LIMINE_REQUESTS_H */
\ No newline at end of file
@@ -0,0 +1,62 @@
+#ifndef LIST_H
+#define LIST_H
+
+#include <stddef.h>
+
+// Intrusive circular doubly-linked list. Embed a struct list_head in the
+// element and get back to the element with list_entry().
+struct list_head {
+    struct list_head *next;
+    struct list_head *prev;
+};
+
+#define container_of(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+
+#define list_first_entry(head, type, member) \
+    list_entry((head)->next, type, member)
+
+#define list_for_each(pos, head) \
+    for (pos = (head)->next; pos != (head); pos = pos->next)
+
+static inline void list_init(struct list_head *head) {
+    head->next = head;
+    head->prev = head;
+}
+
+static inline int list_empty(const struct list_head *head) {
+    return head->next == head;
+}
+
+// Insert `node` right after `head`
+static inline void list_add(struct list_head *node, struct list_head *head) {
+    node->next = head->next;
+    node->prev = head;
+    head->next->prev = node;
+    head->next = node;
+}
+
+// Insert `node` right before `head`, i.e. at the tail
+static inline void list_add_tail(struct list_head *node, struct list_head *head) {
+    node->next = head;
+    node->prev = head->prev;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+static inline void list_del(struct list_head *node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->next = node;
+    node->prev = node;
+}
+
+// Unlink `node` and add it at the head of another list
+static inline void list_move(struct list_head *node, struct list_head *head) {
+    list_del(node);
+    list_add(node, head);
+}
+
+#endif /* LIST_H */
@@ -0,0 +1,81 @@
+#ifndef LOCKSTAT_H
+#define LOCKSTAT_H
+
+#include <stdint.h>
+#include "cpu.h"
+#include "hist.h"
+
+// Lock statistics, built in with `make LOCKSTAT=1`. A lock points at a
+// struct lock_stat, which counts acquisitions and how many of them had to
+// wait, and keeps a histogram of the waits in cycles. Locks of the same
+// kind (every slab cache's lock, say) can share one, which makes it a
+// lock class. Classes register themselves on first use, lockstat_dump()
+// prints every one seen so far.
+//
+// Without LOCKSTAT a lock_stat is only a name and every hook compiles
+// away, so locks can name their class unconditionally.
+
+#ifdef LOCKSTAT
+struct lock_stat_cpu {
+    uint64_t acquisitions;
+    uint64_t contended;         // Acquisitions that found the lock held
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+struct lock_stat {
+    const char *name;
+    struct lock_stat *next;     // Link in the list of registered classes
+    int registered;
+    struct lock_stat_cpu cpu[MAX_CPUS];
+    struct lat_hist wait;       // Contended waits only
+};
+
+#define LOCK_STAT_INIT(n) { .name = (n), .wait = LAT_HIST_INIT(n) }
+
+void lockstat_register(struct lock_stat *stat);
+
+// Account one acquisition. `wait_start` is the lat_start() taken before
+// spinning, 0 if the lock was free.
+static inline void lockstat_acquired(struct lock_stat *stat, uint64_t wait_start) {
+    if (!stat) {
+        return;
+    }
+    if (__builtin_expect(!__atomic_load_n(&stat->registered, __ATOMIC_ACQUIRE), 0)) {
+        lockstat_register(stat);
+    }
+
+    struct lock_stat_cpu *c = &stat->cpu[cpu_id()];
+    c->acquisitions++;
+    if (wait_start) {
+        c->contended++;
+        lat_record(&stat->wait, wait_start);
+    }
+}
+
+static inline uint64_t lockstat_wait_start(void) {
+    return lat_start();
+}
+#else
+struct lock_stat {
+    const char *name;
+};
+
+#define LOCK_STAT_INIT(n) { .name = (n) }
+
+static inline void lockstat_acquired(struct lock_stat *stat, uint64_t wait_start) {
+    (void)stat;
+    (void)wait_start;
+}
+
+static inline uint64_t lockstat_wait_start(void) {
+    return 0;
+}
+#endif
+
+// Define a lock class, hand it to SPINLOCK_INIT_STAT() and friends
+#define DEFINE_LOCK_STAT(var, n) \
+    __attribute__((unused)) struct lock_stat var = LOCK_STAT_INIT(n)
+
+// Print every registered class, nothing without LOCKSTAT
+void lockstat_dump(void);
+
+#endif /* LOCKSTAT_H */
@@ -0,0 +1,79 @@
+#ifndef PERCPU_H
+#define PERCPU_H
+
+#include <stdint.h>
+#include "cpu.h"
+
+// Per-CPU variables. DEFINE_PER_CPU() places a variable in the .percpu
+// section (see src/linker.ld), which is only a template: at boot every
+// CPU gets its own copy, and its GS base is set to the distance from the
+// template to that copy. The variable's own address, GS-relative, then
+// lands in the running CPU's copy, so this_cpu_read(), this_cpu_write()
+// and this_cpu_add() are a single instruction each, with no cpu_id()
+// lookup and nothing shared between CPUs.
+//
+// this_cpu_*() take integers and pointers; for anything bigger go through
+// this_cpu_ptr(). Copies are cache line aligned, and variables that are
+// written a lot should be DEFINE_PER_CPU_ALIGNED() so they don't share a
+// line with something another CPU reads through per_cpu().
+
+#define DEFINE_PER_CPU(type, name) \
+    __attribute__((section(".percpu"))) __typeof__(type) name
+
+#define DEFINE_PER_CPU_ALIGNED(type, name) \
+    __attribute__((section(".percpu"), aligned(CACHE_LINE_SIZE))) __typeof__(type) name
+
+#define DECLARE_PER_CPU(type, name) extern __typeof__(type) name
+
+#ifdef LITHIUM_HOST
+// Hosted builds run as CPU 0 on the template itself
+#define per_cpu_ptr(var, cpu) (&(var))
+#define this_cpu_ptr(var) (&(var))
+#define this_cpu_read(var) (var)
+#define this_cpu_write(var, val) ((var) = (val))
+#define this_cpu_add(var, val) ((var) += (val))
+#else
+// Distance from the template to each CPU's copy, also the GS bases
+extern uint64_t percpu_offsets[MAX_CPUS];
+
+DECLARE_PER_CPU(uint64_t, this_cpu_off);
+
+// Another CPU's copy of a variable
+#define per_cpu_ptr(var, cpu) \
+    ((__typeof__(&(var)))((uintptr_t)&(var) + percpu_offsets[cpu]))
+
+#define this_cpu_ptr(var) \
+    ((__typeof__(&(var)))((uintptr_t)&(var) + this_cpu_read(this_cpu_off)))
+
+#define this_cpu_read(var) __extension__ ({                             \
+    __typeof__(var) __val;                                              \
+    asm volatile ("mov %%gs:%1, %0" : "=r"(__val) : "m"(var));          \
+    __val;                                                              \
+})
+
+// Register operands only: the operand size comes from the register, an
+// immediate against a memory operand wouldn't have one
+#define this_cpu_write(var, val) \
+    asm volatile ("mov %1, %%gs:%0" : "=m"(var) : "r"((__typeof__(var))(val)))
+
+// Atomic against interrupts on this CPU, not against other CPUs
+#define this_cpu_add(var, val) \
+    asm volatile ("add %1, %%gs:%0" : "+m"(var) : "r"((__typeof__(var))(val)) : "cc")
+#endif
+
+#define per_cpu(var, cpu) (*per_cpu_ptr(var, cpu))
+#define this_cpu_inc(var) this_cpu_add(var, 1)
+#define this_cpu_sub(var, val) this_cpu_add(var, -(val))
+
+// Set up the BSP's copy, in the space the linker script reserves for it,
+// and load its GS base. Before anything uses per-CPU data.
+void percpu_init_bsp(void);
+
+// Copy the template for an AP, returns -1 when out of memory
+int percpu_alloc(unsigned int cpu);
+
+// Point the calling CPU's GS base at its copy. Reloading the segment
+// registers clears it, so after gdt_init().
+void percpu_load(unsigned int cpu);
+
+#endif /* PERCPU_H */
@@ -0,0 +1,18 @@
+#ifndef PIC_H
+#define PIC_H
+
+#include <stdint.h>
+
+// Legacy 8259 pair, remapped above the exception vectors
+#define PIC_VECTOR_BASE 0x20
+
+#define PIC_IRQ_COM1 4
+
+// Remap and mask every line
+void pic_init(void);
+
+void pic_unmask(int irq);
+void pic_mask(int irq);
+void pic_eoi(int irq);
+
+#endif /* PIC_H */
@@ -0,0 +1,18 @@
+#ifndef PMC_H
+#define PMC_H
+
+#include <stdint.h>
+
+// Last level cache miss counting with architectural performance monitoring
+// counter 0. Emulators usually don't provide a PMU, pmc_available() says
+// whether the counter can be used at all.
+int pmc_available(void);
+
+// Zero the counter and start counting LLC misses in ring 0 and 3
+void pmc_llc_start(void);
+
+uint64_t pmc_llc_read(void);
+
+void pmc_stop(void);
+
+#endif /* PMC_H */
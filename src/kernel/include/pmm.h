@@ -4,8 +4,48 @@
 #include <stdint.h>
 #include "limine.h"
 
+// Largest buddy block is 2^PMM_MAX_ORDER pages (4 MiB)
+#define PMM_MAX_ORDER 10
+
 void pmm_init(struct limine_memmap_response *memmap, uint64_t _hhdm_offset);
 void *pmm_alloc(void);
 void pmm_free(void *ptr);
 
-#endif
\ No newline at end of file
+// pmm_alloc_pages_flags() flags
+#define PMM_ATOMIC      (1 << 0) // Never reclaim, may use the reserve below min
+#define PMM_ZERO        (1 << 1) // Return zeroed memory
+#define PMM_PREFER_ZERO (1 << 2) // Take a known-zero block if there is one
+#define PMM_DMA32       (1 << 3) // Entire block below 4 GiB
+
+// Physically contiguous blocks of 2^order pages, returned as HHDM addresses
+void *pmm_alloc_pages(unsigned int order);
+void *pmm_alloc_pages_flags(unsigned int order, int flags);
+void pmm_free_pages(void *ptr, unsigned int order);
+int pmm_block_order(void *ptr);
+
+// Grow the allocated block at ptr to new_order where it stands, claiming
+// its free buddies above it. Fails, leaving it alone, if any of them is
+// in use or ptr isn't aligned for new_order. Returns 0 on success.
+int pmm_grow_block(void *ptr, unsigned int new_order);
+
+// Turn the allocated block at ptr into 2^order single pages, each freed
+// on its own with pmm_free() from then on
+void pmm_split_block(void *ptr);
+
+// Whether the block at ptr was all zero when it was handed out
+int pmm_block_zeroed(void *ptr);
+
+// Pre-zero free memory from the idle loop so PMM_ZERO is free later
+uint64_t pmm_zero_idle(uint64_t budget);
+
+// Free page accounting for reclaim
+#define PMM_WMARK_MIN  0
+#define PMM_WMARK_LOW  1
+#define PMM_WMARK_HIGH 2
+
+uint64_t pmm_free_page_count(void);
+uint64_t pmm_watermark(int which);
+
+void pmm_dump_stats(void);
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef QEMU_H
+#define QEMU_H
+
+#include <stdint.h>
+#include "cpu.h"
+
+// QEMU's isa-debug-exit device (-device isa-debug-exit,iobase=0xf4,iosize=0x04)
+// ends the emulator with exit status (code << 1) | 1. Without the device
+// the write is ignored and this returns.
+#define QEMU_DEBUG_EXIT_PORT 0xF4
+
+static inline void qemu_debug_exit(uint8_t code) {
+    outb(QEMU_DEBUG_EXIT_PORT, code);
+}
+
+#endif /* QEMU_H */
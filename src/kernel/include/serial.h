@@ -1,6 +1,7 @@
 #ifndef SERIAL_H
 #define SERIAL_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 void serial_init(void);
@@ -8,5 +9,17 @@ void serial_putc(char c);
 void serial_puts(const char *s);
 void serial_put_hex(uint64_t value);
 void serial_put_dec(uint64_t value);
+int serial_getc_nonblock(void);
+
+// The UART sink itself, polling, bypasses the other sinks
+void serial_write(const char *s, size_t n);
+
+// Raw transmit helpers for klog: the 16550 takes up to 16 bytes once
+// serial_tx_ready() says the FIFO is empty
+#define SERIAL_FIFO_SIZE 16
+
+int serial_tx_ready(void);
+void serial_tx(char c);
+void serial_tx_irq(int enable);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,44 @@
+#ifndef SHRINKER_H
+#define SHRINKER_H
+
+#include <stdint.h>
+#include "list.h"
+
+// A shrinker lets a cache give memory back when physical memory runs low.
+// count() estimates how many pages could be freed right now, scan() tries
+// to free up to nr_to_scan pages and returns how many it actually freed.
+// flush(), if set, runs first in every pass and moves what per-CPU caches
+// hold to where count() and scan() can see it.
+struct shrinker {
+    const char *name;
+    void (*flush)(struct shrinker *shrinker);
+    uint64_t (*count)(struct shrinker *shrinker);
+    uint64_t (*scan)(struct shrinker *shrinker, uint64_t nr_to_scan);
+
+    // Owned by the reclaim code
+    struct list_head link;
+    uint64_t calls;
+    uint64_t freed;
+};
+
+void register_shrinker(struct shrinker *shrinker);
+void unregister_shrinker(struct shrinker *shrinker);
+
+// Run shrinkers until `target` pages were freed or none has anything
+// left, returns pages freed. Used on allocation failure and below the
+// min watermark. If another CPU is reclaiming, waits for its pass to end
+// and runs one of its own. Never from an interrupt handler; with
+// interrupts off it neither waits nor reaches other CPUs' caches, and
+// with them on no lock may be held that some CPU waits for with
+// interrupts off (a pass sends IPIs).
+uint64_t reclaim_direct(uint64_t target);
+
+// Ask for background reclaim up to the high watermark. There are no
+// kernel threads yet, so reclaim_poll() does the work from every CPU's
+// idle loop, whichever gets to it first.
+void reclaim_wake(void);
+void reclaim_poll(void);
+
+void reclaim_dump_stats(void);
+
+#endif /* SHRINKER_H */
@@ -0,0 +1,33 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Vector versions of hot kernel loops. The variants live in translation
+// units built with SSE2 or AVX2 enabled (see the Makefile); everything
+// else is still built without vector code generation.
+
+// Pick variants from the features fpu_init() found, call after it
+void simd_init(void);
+
+// 4 KiB page helpers, both pointers page aligned. These open their own
+// kernel_fpu_begin()/kernel_fpu_end() section; to batch several pages into
+// one section call the variants below directly.
+void simd_clear_page(void *dst);
+void simd_copy_page(void *dst, const void *src);
+
+// Which variant simd_*_page() use
+#define SIMD_NONE 0 // String library, before simd_init()
+#define SIMD_SSE2 1
+#define SIMD_AVX2 2
+
+int simd_level(void);
+
+// Individual variants, only inside a kernel_fpu_begin() section
+void clear_page_sse2(void *dst);
+void copy_page_sse2(void *dst, const void *src);
+void clear_page_avx2(void *dst);
+void copy_page_avx2(void *dst, const void *src);
+
+#endif /* SIMD_H */
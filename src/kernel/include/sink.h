@@ -0,0 +1,39 @@
+#ifndef SINK_H
+#define SINK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Log sinks behind the serial and klog APIs. Every enabled sink gets all
+// output. Pick them with log=<sink>[,<sink>...] on the kernel command
+// line; the default is log=uart,mem,fb.
+#define SINK_UART     (1 << 0) // COM1, drained from its interrupt by klog
+#define SINK_DEBUGCON (1 << 1) // QEMU/Bochs port 0xE9, no status polling
+#define SINK_MEMORY   (1 << 2) // In-memory ring, see memlog_dump()
+#define SINK_FBCON    (1 << 3) // Framebuffer console, from fbcon_init()
+#define SINK_NR       4
+#define SINK_ALL      ((1 << SINK_NR) - 1)
+
+// Read log= and probe the sinks. Until then only the UART is enabled.
+void sink_init(void);
+
+// Write to every enabled sink in mask, synchronously
+void sink_write(int mask, const char *s, size_t n);
+
+int sink_enabled(void);
+void sink_set_enabled(int mask);
+
+// Single sink writers, for benchmarks
+void sink_write_one(int sink, const char *s, size_t n);
+const char *sink_name(int sink);
+
+// Memory sink contents
+#define MEMLOG_SIZE (64 * 1024)
+
+// Copy out up to n of the newest bytes, oldest first, returns bytes copied
+size_t memlog_read(char *dst, size_t n);
+
+// Replay the memory log to the other sinks
+void memlog_dump(void);
+
+#endif /* SINK_H */
@@ -0,0 +1,70 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include "cpu.h"
+
+// Multiprocessor bring-up through Limine's MP request. Every CPU runs on
+// its own kernel stack with its own GDT, TSS and per-CPU area (see
+// percpu.h) and loads the shared IDT. Once up, APs sit in cpu_idle()
+// (see timer.h) and only wake for work sent with smp_call_all(), to
+// answer a tlb_shootdown() or to run their own timers. Each wakeup also
+// gives background reclaim a chance to run (see shrinker.h).
+
+// What the BSP keeps about each CPU
+struct cpu {
+    uint64_t stack_top;         // Loaded by the AP entry code, keep first
+    unsigned int id;            // Logical CPU number, the BSP is 0
+    uint32_t lapic_id;
+    volatile int online;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+// IPI vectors for smp_call_all() and tlb_shootdown()
+#define SMP_CALL_VECTOR 0xF0
+#define SMP_TLB_VECTOR  0xF1
+
+// Give the BSP its GDT, TSS and per-CPU area. First thing in _start,
+// nothing may call cpu_id() before it.
+void smp_early_init(void);
+
+// Start all APs at once and wait for them to report in, then check that
+// every CPU counts into its own slot. Needs the PMM and VMM.
+void smp_init(void);
+
+#ifdef LITHIUM_HOST
+// The hosted memory code runs as the only CPU
+static inline void smp_call_all(void (*fn)(void *), void *arg) {
+    fn(arg);
+}
+
+static inline void tlb_shootdown(uint64_t vaddr, uint64_t pages) {
+    (void)vaddr;
+    (void)pages;
+}
+#else
+// Run fn(arg) on every online CPU, the caller included, and wait for all
+// of them. Concurrent callers take turns. Call with interrupts enabled
+// and, as for tlb_shootdown(), no lock held that some CPU might wait for
+// with interrupts off. fn runs with interrupts enabled everywhere too.
+void smp_call_all(void (*fn)(void *), void *arg);
+
+// Run fn(arg) on this CPU while every other online CPU waits in an IPI
+// handler with interrupts off, then have each execute a serializing
+// instruction before it resumes. For rewriting code other CPUs may be
+// running. Same calling rules as smp_call_all(); fn runs with interrupts
+// off and must not wait for another CPU, TLB shootdowns included.
+void smp_stop_machine(void (*fn)(void *), void *arg);
+
+// Flush the translations of `pages` pages from vaddr on every other online
+// CPU with one IPI each, and wait until they all have. The caller flushes
+// its own. Must not be called with a lock held that some CPU might wait
+// for with interrupts off.
+void tlb_shootdown(uint64_t vaddr, uint64_t pages);
+#endif
+
+// Number of CPUs that reported in
+unsigned int smp_online(void);
+
+// CPU list for the kernel monitor
+void smp_dump(void);
+
+#endif /* SMP_H */
@@ -0,0 +1,344 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "cpu.h"
+#include "lockstat.h"
+
+// Kernel locks, all of them busy waiting:
+//
+//   spinlock_t  ticket lock, FIFO fair. Waiters spin reading one shared
+//               word, fine while a handful of CPUs contend.
+//   mcs_lock_t  queued (MCS) lock. Every waiter spins on its own node,
+//               so a release touches one other CPU's cache line however
+//               many are waiting. For locks that see real contention.
+//   rwlock_t    readers share, a writer excludes everyone. A waiting
+//               writer holds back new readers so it can't starve.
+//
+// None of them disables interrupts by itself. A lock that an interrupt
+// handler also takes must be held with the _irqsave variants everywhere,
+// or the handler can spin on a lock its own CPU holds. Nothing nests
+// recursively, read locks included (a writer waiting in between would
+// deadlock the second read_lock()).
+//
+// Every lock can carry a lock_stat (see lockstat.h) for `make LOCKSTAT=1`.
+
+// Pause loops per ticket ahead of the next in line, so waiters far back
+// in the queue stay off the lock's cache line until their turn gets close
+#define SPIN_BACKOFF_PER_TICKET 16
+
+typedef struct {
+    union {
+        uint32_t word;
+        struct {
+            uint16_t owner;     // Ticket being served
+            uint16_t next;      // Next ticket to hand out
+        } tickets;
+    };
+#ifdef LOCKSTAT
+    struct lock_stat *stat;
+#endif
+} spinlock_t;
+
+#ifdef LOCKSTAT
+#define SPINLOCK_INIT_STAT(s) { .word = 0, .stat = (s) }
+#define LOCK_STAT_OF(lock) ((lock)->stat)
+#else
+#define SPINLOCK_INIT_STAT(s) { .word = 0 }
+#define LOCK_STAT_OF(lock) ((struct lock_stat *)NULL)
+#endif
+
+#define SPINLOCK_INIT SPINLOCK_INIT_STAT(NULL)
+
+static inline void spin_lock_init(spinlock_t *lock, struct lock_stat *stat) {
+    lock->word = 0;
+#ifdef LOCKSTAT
+    lock->stat = stat;
+#else
+    (void)stat;
+#endif
+}
+
+static inline int spin_trylock(spinlock_t *lock) {
+    uint32_t old = __atomic_load_n(&lock->word, __ATOMIC_RELAXED);
+
+    // Free when the ticket being served is the next one handed out
+    if ((old & 0xFFFF) != (old >> 16)) {
+        return 0;
+    }
+    if (!__atomic_compare_exchange_n(&lock->word, &old, old + 0x10000, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+
+    lockstat_acquired(LOCK_STAT_OF(lock), 0);
+    return 1;
+}
+
+static inline void spin_lock(spinlock_t *lock) {
+    uint16_t ticket = __atomic_fetch_add(&lock->tickets.next, 1, __ATOMIC_ACQUIRE);
+    uint16_t owner = __atomic_load_n(&lock->tickets.owner, __ATOMIC_ACQUIRE);
+    uint64_t wait_start = 0;
+
+    if (owner != ticket) {
+        wait_start = lockstat_wait_start();
+        do {
+            unsigned int ahead = (uint16_t)(ticket - owner);
+            for (unsigned int i = (ahead - 1) * SPIN_BACKOFF_PER_TICKET + 1; i; i--) {
+                cpu_relax();
+            }
+            owner = __atomic_load_n(&lock->tickets.owner, __ATOMIC_ACQUIRE);
+        } while (owner != ticket);
+    }
+
+    lockstat_acquired(LOCK_STAT_OF(lock), wait_start);
+}
+
+static inline void spin_unlock(spinlock_t *lock) {
+    // Only the holder writes owner, no locked op needed
+    uint16_t owner = __atomic_load_n(&lock->tickets.owner, __ATOMIC_RELAXED);
+    __atomic_store_n(&lock->tickets.owner, (uint16_t)(owner + 1), __ATOMIC_RELEASE);
+}
+
+static inline int spin_is_locked(spinlock_t *lock) {
+    uint32_t word = __atomic_load_n(&lock->word, __ATOMIC_RELAXED);
+    return (word & 0xFFFF) != (word >> 16);
+}
+
+// Interrupts stay off while the lock is held. Returns the flags for
+// spin_unlock_irqrestore().
+static inline uint64_t spin_lock_irqsave(spinlock_t *lock) {
+    uint64_t flags = local_irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t *lock, uint64_t flags) {
+    spin_unlock(lock);
+    local_irq_restore(flags);
+}
+
+// MCS lock. Each acquirer brings a node, normally on its stack, which
+// must stay put until the matching unlock.
+struct mcs_node {
+    struct mcs_node *next;
+    int locked;                 // Set by the previous holder on handover
+};
+
+typedef struct {
+    struct mcs_node *tail;      // Last waiter, NULL when free
+#ifdef LOCKSTAT
+    struct lock_stat *stat;
+#endif
+} mcs_lock_t;
+
+#ifdef LOCKSTAT
+#define MCS_LOCK_INIT_STAT(s) { .tail = NULL, .stat = (s) }
+#else
+#define MCS_LOCK_INIT_STAT(s) { .tail = NULL }
+#endif
+
+#define MCS_LOCK_INIT MCS_LOCK_INIT_STAT(NULL)
+
+static inline void mcs_lock_init(mcs_lock_t *lock, struct lock_stat *stat) {
+    lock->tail = NULL;
+#ifdef LOCKSTAT
+    lock->stat = stat;
+#else
+    (void)stat;
+#endif
+}
+
+static inline int mcs_trylock(mcs_lock_t *lock, struct mcs_node *node) {
+    struct mcs_node *expected = NULL;
+
+    node->next = NULL;
+    node->locked = 0;
+    if (!__atomic_compare_exchange_n(&lock->tail, &expected, node, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+
+    lockstat_acquired(LOCK_STAT_OF(lock), 0);
+    return 1;
+}
+
+static inline void mcs_lock(mcs_lock_t *lock, struct mcs_node *node) {
+    node->next = NULL;
+    node->locked = 0;
+
+    struct mcs_node *prev = __atomic_exchange_n(&lock->tail, node, __ATOMIC_ACQ_REL);
+    uint64_t wait_start = 0;
+
+    if (prev) {
+        // Queue behind prev and spin on our own node until it hands over
+        wait_start = lockstat_wait_start();
+        __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+        while (!__atomic_load_n(&node->locked, __ATOMIC_ACQUIRE)) {
+            cpu_relax();
+        }
+    }
+
+    lockstat_acquired(LOCK_STAT_OF(lock), wait_start);
+}
+
+static inline void mcs_unlock(mcs_lock_t *lock, struct mcs_node *node) {
+    struct mcs_node *next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+
+    if (!next) {
+        // Nobody queued: free the lock, unless someone swapped the tail
+        // in the meantime and is about to link themselves behind us
+        struct mcs_node *expected = node;
+        if (__atomic_compare_exchange_n(&lock->tail, &expected, NULL, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return;
+        }
+        while (!(next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE))) {
+            cpu_relax();
+        }
+    }
+
+    __atomic_store_n(&next->locked, 1, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t mcs_lock_irqsave(mcs_lock_t *lock, struct mcs_node *node) {
+    uint64_t flags = local_irq_save();
+    mcs_lock(lock, node);
+    return flags;
+}
+
+static inline void mcs_unlock_irqrestore(mcs_lock_t *lock, struct mcs_node *node,
+                                         uint64_t flags) {
+    mcs_unlock(lock, node);
+    local_irq_restore(flags);
+}
+
+// Reader-writer lock: a reader count plus two flag bits in one word
+#define RW_WRITER  (1U << 31)   // Held by a writer
+#define RW_WAITING (1U << 30)   // A writer waits, no new readers
+
+typedef struct {
+    uint32_t value;
+#ifdef LOCKSTAT
+    struct lock_stat *stat;
+#endif
+} rwlock_t;
+
+#ifdef LOCKSTAT
+#define RWLOCK_INIT_STAT(s) { .value = 0, .stat = (s) }
+#else
+#define RWLOCK_INIT_STAT(s) { .value = 0 }
+#endif
+
+#define RWLOCK_INIT RWLOCK_INIT_STAT(NULL)
+
+static inline void rwlock_init(rwlock_t *lock, struct lock_stat *stat) {
+    lock->value = 0;
+#ifdef LOCKSTAT
+    lock->stat = stat;
+#else
+    (void)stat;
+#endif
+}
+
+// Helper: One attempt at a read lock, without statistics
+static inline int rwlock_try_read(rwlock_t *lock) {
+    uint32_t old = __atomic_load_n(&lock->value, __ATOMIC_RELAXED);
+
+    if (old & (RW_WRITER | RW_WAITING)) {
+        return 0;
+    }
+    return __atomic_compare_exchange_n(&lock->value, &old, old + 1, 0,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+// Helper: One attempt at a write lock, claiming it clears the waiting bit
+static inline int rwlock_try_write(rwlock_t *lock) {
+    uint32_t old = __atomic_load_n(&lock->value, __ATOMIC_RELAXED);
+
+    if (old & ~RW_WAITING) {
+        return 0;
+    }
+    return __atomic_compare_exchange_n(&lock->value, &old, RW_WRITER, 0,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline int read_trylock(rwlock_t *lock) {
+    if (!rwlock_try_read(lock)) {
+        return 0;
+    }
+    lockstat_acquired(LOCK_STAT_OF(lock), 0);
+    return 1;
+}
+
+static inline void read_lock(rwlock_t *lock) {
+    uint64_t wait_start = 0;
+
+    if (!rwlock_try_read(lock)) {
+        wait_start = lockstat_wait_start();
+        do {
+            cpu_relax();
+        } while (!rwlock_try_read(lock));
+    }
+
+    lockstat_acquired(LOCK_STAT_OF(lock), wait_start);
+}
+
+static inline void read_unlock(rwlock_t *lock) {
+    __atomic_fetch_sub(&lock->value, 1, __ATOMIC_RELEASE);
+}
+
+static inline int write_trylock(rwlock_t *lock) {
+    if (!rwlock_try_write(lock)) {
+        return 0;
+    }
+    lockstat_acquired(LOCK_STAT_OF(lock), 0);
+    return 1;
+}
+
+static inline void write_lock(rwlock_t *lock) {
+    uint64_t wait_start = 0;
+
+    if (!rwlock_try_write(lock)) {
+        wait_start = lockstat_wait_start();
+        do {
+            // Keep new readers out while the current ones drain
+            if (!(__atomic_load_n(&lock->value, __ATOMIC_RELAXED) & RW_WAITING)) {
+                __atomic_fetch_or(&lock->value, RW_WAITING, __ATOMIC_RELAXED);
+            }
+            cpu_relax();
+        } while (!rwlock_try_write(lock));
+    }
+
+    lockstat_acquired(LOCK_STAT_OF(lock), wait_start);
+}
+
+static inline void write_unlock(rwlock_t *lock) {
+    // Another writer may have set RW_WAITING meanwhile, keep it
+    __atomic_fetch_and(&lock->value, ~RW_WRITER, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t read_lock_irqsave(rwlock_t *lock) {
+    uint64_t flags = local_irq_save();
+    read_lock(lock);
+    return flags;
+}
+
+static inline void read_unlock_irqrestore(rwlock_t *lock, uint64_t flags) {
+    read_unlock(lock);
+    local_irq_restore(flags);
+}
+
+static inline uint64_t write_lock_irqsave(rwlock_t *lock) {
+    uint64_t flags = local_irq_save();
+    write_lock(lock);
+    return flags;
+}
+
+static inline void write_unlock_irqrestore(rwlock_t *lock, uint64_t flags) {
+    write_unlock(lock);
+    local_irq_restore(flags);
+}
+
+#endif /* SPINLOCK_H */
@@ -0,0 +1,44 @@
+#ifndef STRING_H
+#define STRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Freestanding mem*/str* routines. GCC may also emit calls to memcpy,
+// memmove, memset and memcmp on its own, so these must always exist.
+
+// Pick the fastest variants for this CPU, call once early in boot. Until
+// then the portable loops are used.
+void string_init(void);
+
+void *memcpy(void *dst, const void *src, size_t n);
+void *memmove(void *dst, const void *src, size_t n);
+void *memset(void *dst, int c, size_t n);
+int memcmp(const void *a, const void *b, size_t n);
+
+size_t strlen(const char *s);
+int strcmp(const char *a, const char *b);
+int strncmp(const char *a, const char *b, size_t n);
+
+// 4 KiB page helpers, both pointers page aligned
+void copy_page(void *dst, const void *src);
+void clear_page(void *dst);
+
+// Zero with non-temporal stores, for memory that won't be read soon (idle
+// pre-zeroing, very large clears). dst must be 8-byte aligned and n a
+// multiple of 64.
+void clear_nt(void *dst, size_t n);
+
+// CPU features the variants were picked from
+#define STRING_ERMS (1 << 0) // Enhanced rep movsb/stosb
+#define STRING_FSRM (1 << 1) // Fast short rep movsb
+
+int string_features(void);
+
+// Individual variants, for benchmarks
+void *memcpy_rep(void *dst, const void *src, size_t n);
+void *memcpy_loop(void *dst, const void *src, size_t n);
+void *memset_rep(void *dst, int c, size_t n);
+void *memset_loop(void *dst, int c, size_t n);
+
+#endif /* STRING_H */
@@ -0,0 +1,67 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+#include "list.h"
+
+// Kernel timers, on ktime_get()'s nanosecond timeline. Each CPU keeps
+// its own timers and runs them from its LAPIC timer interrupt, with
+// interrupts off. There's no periodic tick: the LAPIC is programmed for
+// whichever timer is due first, and an idle CPU sleeps until then.
+//
+// Ordinary timers go into a hierarchical timing wheel with TIMER_TICK_NS
+// resolution: insert and cancel are O(1) whatever the timeout, and long
+// timeouts move down a level at a time as they get close (cascading).
+// Timers flagged TIMER_HIRES, or due within a tick, go on a sorted list
+// instead and fire at their exact deadline.
+
+#define TIMER_TICK_NS 1000000ULL
+
+// Fire at the exact deadline rather than on a tick boundary
+#define TIMER_HIRES 0x1
+
+struct timer_base;
+
+struct timer {
+    struct list_head link;      // In a wheel slot or the hires list
+    uint64_t expires;           // ktime_get() deadline in ns
+    void (*fn)(struct timer *timer);
+    struct timer_base *base;    // CPU it was last added on
+    int slot;                   // Wheel slot it sits in, -1 for hires
+    unsigned int flags;
+};
+
+// Set up a timer before its first timer_add(). fn gets the timer back,
+// container_of() finds whatever it's embedded in.
+void timer_init(struct timer *timer, void (*fn)(struct timer *), unsigned int flags);
+
+// Queue the timer on the calling CPU to fire once ktime_get() reaches
+// `expires` (the next tick boundary for wheel timers). A pending timer is
+// moved. A timer has one owner: concurrent timer_add()s of the same timer
+// aren't supported.
+void timer_add(struct timer *timer, uint64_t expires);
+
+// Dequeue the timer from any CPU. Returns 1 if it was pending, 0 if it
+// had already fired or was never added. Doesn't wait for a callback that
+// is already running.
+int timer_cancel(struct timer *timer);
+
+int timer_pending(struct timer *timer);
+
+// Hook the timer interrupt and set up the BSP's timers. After
+// ktime_init(), before smp_init().
+void timers_init(void);
+
+// Set up the calling AP's timers
+void timers_init_ap(void);
+
+// Sleep until the next interrupt, this CPU's next timer included, and
+// account the time as idle. Busy waits a moment instead when there's no
+// LAPIC timer to wake us.
+void cpu_idle(void);
+
+// Per-CPU timer and idle counters for the kernel monitor, rates since
+// the previous call
+void timer_dump_stats(void);
+
+#endif /* TIMER_H */
@@ -0,0 +1,79 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Static tracepoints. Each trace() site is a 5-byte nop until its event is
+// enabled, then it's patched into a jump to code that records a fixed-size
+// binary event with a TSC timestamp into a per-CPU ring. Disabled sites
+// cost one nop and nothing else.
+//
+// Event ids and argument meanings are shared with tools/tracedecode.py,
+// keep the two in step.
+
+#define TRACE_PMM_ALLOC   0 // block, order
+#define TRACE_PMM_FREE    1 // block, order
+#define TRACE_VMM_MAP     2 // vaddr, phys
+#define TRACE_VMM_UNMAP   3 // vaddr, pages
+#define TRACE_VMM_FLUSH   4 // vaddr, pages
+#define TRACE_SLAB_GROW   5 // slab, object size
+#define TRACE_SLAB_SHRINK 6 // slab, object size
+#define TRACE_KMALLOC     7 // ptr, size
+#define TRACE_KFREE       8 // ptr
+#define TRACE_NR          9
+
+#define TRACE_ALL ((1u << TRACE_NR) - 1)
+
+struct trace_event {
+    uint64_t tsc;
+    uint16_t id;
+    uint16_t cpu;
+    uint32_t reserved;
+    uint64_t arg0;
+    uint64_t arg1;
+};
+
+// Where the record call sits, one entry per site in .trace_sites
+struct trace_site {
+    uint64_t addr;
+    uint64_t target;
+    uint64_t id;
+};
+
+// Patched from a nop to a jump to `on` when the event is enabled. Must be
+// inlined so every call site gets its own nop and site entry.
+static inline __attribute__((always_inline)) int trace_site_enabled(int id) {
+    asm goto ("1: .byte 0x0f, 0x1f, 0x44, 0x00, 0x00\n\t"
+              ".pushsection .trace_sites, \"a\"\n\t"
+              ".balign 8\n\t"
+              ".quad 1b, %l[on], %c0\n\t"
+              ".popsection"
+              :: "i"(id) :: on);
+    return 0;
+on:
+    return 1;
+}
+
+void trace_record(int id, uint64_t arg0, uint64_t arg1);
+
+#define trace(id, a, b)                                                 \
+    do {                                                                \
+        if (trace_site_enabled(id)) {                                   \
+            trace_record((id), (uint64_t)(a), (uint64_t)(b));           \
+        }                                                               \
+    } while (0)
+
+// Allocate the rings and enable the events in mask (bit per event id).
+// Returns -1 if the rings couldn't be allocated.
+int trace_start(uint32_t mask);
+void trace_stop(void);
+int trace_running(void);
+
+// Stop tracing and stream every ring over the UART as raw binary, framed
+// by TRACE_BEGIN/TRACE_CPU/TRACE_END text lines. Only the UART gets the
+// dump, whatever log= says, so the memory log and the framebuffer console
+// never see the binary. Capture with a raw serial backend (e.g.
+// -serial file:trace.log) and feed to tools/tracedecode.py.
+void trace_dump(void);
+
+#endif /* TRACE_H */
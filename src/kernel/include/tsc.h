@@ -0,0 +1,25 @@
+#ifndef TSC_H
+#define TSC_H
+
+#include <stdint.h>
+
+// Measure the TSC rate, against the PIT or else from CPUID. Call once
+// during boot, before anything converts cycles to time.
+void tsc_init(void);
+
+// Measure the rate again against the HPET, which is both more precise
+// and independent of port I/O timing, and log how far the runs spread.
+// Called by ktime_init() when there's an HPET.
+void tsc_calibrate_hpet(void);
+
+// Whether the TSC ticks at a constant rate through P- and C-states
+// (CPUID's invariant TSC bit), which makes it usable as a clocksource
+int tsc_invariant(void);
+
+// TSC rate in kHz, 0 if it couldn't be determined
+uint64_t tsc_khz(void);
+
+// Convert a TSC cycle count to nanoseconds, 0 without a known rate
+uint64_t tsc_cycles_to_ns(uint64_t cycles);
+
+#endif /* TSC_H */
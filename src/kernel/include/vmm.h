@@ -6,6 +6,7 @@
 #define VMM_PRESENT  (1ULL << 0)
 #define VMM_WRITE    (1ULL << 1)
 #define VMM_USER     (1ULL << 2)
+#define VMM_NOCACHE  (3ULL << 3)  // PWT and PCD, uncached for MMIO
 #define VMM_NX       (1ULL << 63)
 
 void vmm_init(void);
@@ -15,4 +16,22 @@ void vmm_dump_pml4(void);
 int vmm_map(uint64_t v_addr, uint64_t phys, uint64_t flags);
 int vmm_unmap(uint64_t v_addr);
 
+// Unmap every mapped page in [v_addr, v_addr + pages pages) with a single
+// TLB flush and shootdown for the lot, returns how many were mapped. Each
+// page's physical address goes to release(), if given, once no CPU can
+// reach it any more.
+uint64_t vmm_unmap_range(uint64_t v_addr, uint64_t pages, void (*release)(uint64_t phys));
+int vmm_translate(uint64_t v_addr, uint64_t *phys);
+
+// Map `size` bytes at `phys` outside the HHDM with the given VMM_* flags,
+// returns the virtual address or NULL. Whole pages are mapped, so the
+// rest of the last page is reachable too. Boot time only, mappings are
+// never removed.
+void *vmm_map_phys(uint64_t phys, uint64_t size, uint64_t flags);
+
+// vmm_map_phys() for device registers: writable, uncached, no execute
+void *vmm_map_mmio(uint64_t phys, uint64_t size);
+
+void vmm_dump_stats(void);
+
 #endif
\ No newline at end of file
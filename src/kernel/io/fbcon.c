@@ -0,0 +1,276 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/spinlock.h"
+#include "../include/limine_requests.h"
+#include "../include/kalloc.h"
+#include "../include/string.h"
+#include "../include/font.h"
+#include "../include/sink.h"
+#include "../include/klog.h"
+#include "../include/fbcon.h"
+
+#define FBCON_FG 0xAAAAAA
+#define FBCON_BG 0x000000
+
+#define TAB_WIDTH 8
+
+struct fbcon {
+    uint8_t *fb;                // Real framebuffer
+    uint64_t fb_pitch;
+    uint32_t *shadow;           // Same pixels, normal memory, pitch = width
+    int top;                    // Shadow text row shown at the top, rows
+                                // wrap around so scrolling moves nothing
+    int width;
+    int height;
+    int cols;
+    int rows;
+    int col;                    // Cursor
+    int row;
+    int *dirty_lo;              // Per text row, first and one past last
+    int *dirty_hi;              // changed column; lo >= hi means clean
+};
+
+static struct fbcon con;
+static spinlock_t con_lock = SPINLOCK_INIT;
+static int ready = 0;
+
+// Glyphs expanded to whole pixels in the framebuffer format
+static uint32_t glyphs[FONT_GLYPHS][FONT_HEIGHT][FONT_WIDTH];
+static uint32_t bg_pixel;
+
+// Helper: The framebuffer to use, NULL if there isn't a usable one
+static struct limine_framebuffer *fb_get(void) {
+    struct limine_framebuffer_response *resp = framebuffer_request.response;
+
+    if (!resp || resp->framebuffer_count == 0) {
+        return NULL;
+    }
+
+    struct limine_framebuffer *fb = resp->framebuffers[0];
+    if (fb->bpp != 32 || fb->memory_model != LIMINE_FRAMEBUFFER_RGB) {
+        return NULL;
+    }
+    return fb;
+}
+
+// Helper: 0xRRGGBB to the framebuffer's pixel layout
+static uint32_t fb_pixel(struct limine_framebuffer *fb, uint32_t rgb) {
+    uint32_t r = (rgb >> 16) & 0xFF;
+    uint32_t g = (rgb >> 8) & 0xFF;
+    uint32_t b = rgb & 0xFF;
+
+    return ((r >> (8 - fb->red_mask_size)) << fb->red_mask_shift) |
+           ((g >> (8 - fb->green_mask_size)) << fb->green_mask_shift) |
+           ((b >> (8 - fb->blue_mask_size)) << fb->blue_mask_shift);
+}
+
+int fbcon_present(void) {
+    return fb_get() != NULL;
+}
+
+int fbcon_cols(void) {
+    return ready ? con.cols : 0;
+}
+
+int fbcon_rows(void) {
+    return ready ? con.rows : 0;
+}
+
+void fbcon_init(void) {
+    struct limine_framebuffer *fb = fb_get();
+    if (!fb || !(sink_enabled() & SINK_FBCON)) {
+        return;
+    }
+
+    con.fb = fb->address;
+    con.fb_pitch = fb->pitch;
+    con.width = (int)fb->width;
+    con.height = (int)fb->height;
+    con.cols = con.width / FONT_WIDTH;
+    con.rows = con.height / FONT_HEIGHT;
+
+    con.shadow = kmalloc((size_t)con.width * con.height * sizeof(uint32_t));
+    con.dirty_lo = kmalloc(con.rows * sizeof(int));
+    con.dirty_hi = kmalloc(con.rows * sizeof(int));
+    if (!con.shadow || !con.dirty_lo || !con.dirty_hi) {
+        klog(KLOG_ERR, "FBCON: No memory for the shadow buffer\n");
+        kfree(con.shadow);
+        kfree(con.dirty_lo);
+        kfree(con.dirty_hi);
+        return;
+    }
+
+    uint32_t fg = fb_pixel(fb, FBCON_FG);
+    bg_pixel = fb_pixel(fb, FBCON_BG);
+    for (int c = 0; c < FONT_GLYPHS; c++) {
+        for (int y = 0; y < FONT_HEIGHT; y++) {
+            for (int x = 0; x < FONT_WIDTH; x++) {
+                glyphs[c][y][x] = (font8x8[c][y] >> x) & 1 ? fg : bg_pixel;
+            }
+        }
+    }
+
+    // Start from a clean screen, everything dirty
+    for (int i = 0; i < con.width * con.height; i++) {
+        con.shadow[i] = bg_pixel;
+    }
+    for (int r = 0; r < con.rows; r++) {
+        con.dirty_lo[r] = 0;
+        con.dirty_hi[r] = con.cols;
+    }
+    // Pixel rows below the last text row are never drawn, blank them once
+    for (int y = con.rows * FONT_HEIGHT; y < con.height; y++) {
+        uint32_t *line = (uint32_t *)(con.fb + (size_t)y * con.fb_pitch);
+        for (int x = 0; x < con.width; x++) {
+            line[x] = bg_pixel;
+        }
+    }
+
+    con.top = 0;
+    con.col = 0;
+    con.row = 0;
+    ready = 1;
+
+    // Replay the end of the boot log, about a screenful is all that shows
+    if (sink_enabled() & SINK_MEMORY) {
+        size_t want = (size_t)con.cols * con.rows;
+        if (want > MEMLOG_SIZE) {
+            want = MEMLOG_SIZE;
+        }
+
+        char *tail = kmalloc(want);
+        if (tail) {
+            fbcon_write(tail, memlog_read(tail, want));
+            kfree(tail);
+        }
+    }
+
+    klog(KLOG_INFO, "FBCON: %dx%d, %dx%d text\n", con.width, con.height, con.cols, con.rows);
+}
+
+// Helper: Widen a row's dirty span
+static inline void mark_dirty(int row, int lo, int hi) {
+    if (lo < con.dirty_lo[row]) {
+        con.dirty_lo[row] = lo;
+    }
+    if (hi > con.dirty_hi[row]) {
+        con.dirty_hi[row] = hi;
+    }
+}
+
+// Helper: First pixel of a text row in the shadow buffer
+static inline uint32_t *row_pixels(int row) {
+    int phys = (con.top + row) % con.rows;
+    return con.shadow + (size_t)phys * FONT_HEIGHT * con.width;
+}
+
+// Helper: Draw one cell into the shadow buffer
+static void draw_glyph(int col, int row, char ch) {
+    int g = (uint8_t)ch - FONT_FIRST;
+    if (g < 0 || g >= FONT_GLYPHS) {
+        g = '?' - FONT_FIRST;
+    }
+
+    uint32_t *dst = row_pixels(row) + col * FONT_WIDTH;
+    for (int y = 0; y < FONT_HEIGHT; y++) {
+        memcpy(dst, glyphs[g][y], sizeof(glyphs[g][y]));
+        dst += con.width;
+    }
+    mark_dirty(row, col, col + 1);
+}
+
+// Helper: Scroll up a text row. The shadow rows form a ring, so this only
+// moves where the top is and blanks the new bottom row; the pixels move
+// when the flush copies every row to its new place on screen.
+static void scroll(void) {
+    con.top = (con.top + 1) % con.rows;
+
+    uint32_t *last = row_pixels(con.rows - 1);
+    for (size_t i = 0; i < (size_t)FONT_HEIGHT * con.width; i++) {
+        last[i] = bg_pixel;
+    }
+
+    for (int r = 0; r < con.rows; r++) {
+        con.dirty_lo[r] = 0;
+        con.dirty_hi[r] = con.cols;
+    }
+}
+
+// Helper: Start a new line, scrolling at the bottom
+static void newline(void) {
+    con.col = 0;
+    if (++con.row == con.rows) {
+        scroll();
+        con.row = con.rows - 1;
+    }
+}
+
+// Helper: Copy the dirty spans to the framebuffer
+static void flush(void) {
+    for (int r = 0; r < con.rows; r++) {
+        int lo = con.dirty_lo[r];
+        int hi = con.dirty_hi[r];
+        if (lo >= hi) {
+            continue;
+        }
+
+        size_t bytes = (size_t)(hi - lo) * FONT_WIDTH * sizeof(uint32_t);
+        const uint32_t *src = row_pixels(r) + lo * FONT_WIDTH;
+        uint8_t *dst = con.fb + (size_t)r * FONT_HEIGHT * con.fb_pitch + lo * FONT_WIDTH * sizeof(uint32_t);
+
+        for (int y = 0; y < FONT_HEIGHT; y++) {
+            memcpy(dst, src, bytes);
+            src += con.width;
+            dst += con.fb_pitch;
+        }
+
+        con.dirty_lo[r] = con.cols;
+        con.dirty_hi[r] = 0;
+    }
+}
+
+void fbcon_write(const char *s, size_t n) {
+    if (!ready) {
+        return;
+    }
+
+    uint64_t flags = local_irq_save();
+    spin_lock(&con_lock);
+
+    for (size_t i = 0; i < n; i++) {
+        char ch = s[i];
+
+        switch (ch) {
+        case '\n':
+            newline();
+            break;
+        case '\r':
+            con.col = 0;
+            break;
+        case '\t':
+            do {
+                draw_glyph(con.col++, con.row, ' ');
+            } while (con.col % TAB_WIDTH && con.col < con.cols);
+            break;
+        case '\b':
+            if (con.col > 0) {
+                con.col--;
+            }
+            break;
+        default:
+            draw_glyph(con.col++, con.row, ch);
+            break;
+        }
+
+        if (con.col >= con.cols) {
+            newline();
+        }
+    }
+
+    // One flush per write, however many lines scrolled past
+    flush();
+
+    spin_unlock(&con_lock);
+    local_irq_restore(flags);
+}
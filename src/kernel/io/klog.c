@@ -0,0 +1,291 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/spinlock.h"
+#include "../include/serial.h"
+#include "../include/format.h"
+#include "../include/string.h"
+#include "../include/pic.h"
+#include "../include/sink.h"
+#include "../include/klog.h"
+
+// Ring of records, each a 4-byte header followed by the text padded to 4
+// bytes. Producers reserve space by moving head with a CAS, fill it in and
+// publish the header last; the single drainer consumes from tail in order
+// and zeroes what it consumed, so an unpublished header always reads 0.
+#define KLOG_BUF_SIZE (64 * 1024)
+#define KLOG_BUF_MASK (KLOG_BUF_SIZE - 1)
+
+// Longest message, longer ones are truncated
+#define KLOG_LINE_MAX 256
+
+#define KLOG_COMMIT 0x80000000u
+#define KLOG_LEN    0x0000FFFFu
+
+static uint8_t ring[KLOG_BUF_SIZE] __attribute__((aligned(8)));
+static uint64_t head = 0;   // Reserved up to, producers
+static uint64_t tail = 0;   // Consumed up to, drainer only
+
+// The drainer's current record, being fed to the FIFO
+static spinlock_t drain_lock = SPINLOCK_INIT;
+static char out[KLOG_LINE_MAX];
+static int out_pos = 0;
+static int out_len = 0;
+
+static int level = KLOG_INFO;
+static int irq_mode = 0;
+static int panicking = 0;
+
+static uint64_t written = 0;
+static uint64_t dropped = 0;
+static uint64_t irqs = 0;
+
+// Helper: Record size for len bytes of text
+static inline uint64_t record_size(uint32_t len) {
+    return 4 + ((len + 3) & ~3u);
+}
+
+// Helper: Copy text into the ring with wrap around
+static void ring_copy_in(uint64_t pos, const char *s, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) {
+        ring[(pos + i) & KLOG_BUF_MASK] = (uint8_t)s[i];
+    }
+}
+
+// Helper: Reserve, fill and publish one record. Fails when the ring is
+// full rather than waiting, the message is counted as dropped.
+static int ring_push(const char *s, uint32_t len) {
+    uint64_t need = record_size(len);
+    uint64_t h = __atomic_load_n(&head, __ATOMIC_RELAXED);
+
+    do {
+        uint64_t t = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+        if (h + need - t > KLOG_BUF_SIZE) {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(&head, &h, h + need, 1,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    ring_copy_in(h + 4, s, len);
+    __atomic_store_n((uint32_t *)&ring[h & KLOG_BUF_MASK], KLOG_COMMIT | len,
+                     __ATOMIC_RELEASE);
+    __atomic_fetch_add(&written, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+// Helper: Move the oldest published record into out[], drain_lock held.
+// Stops at a record that is reserved but not yet published.
+static int ring_pop(void) {
+    uint64_t t = tail;
+
+    if (t == __atomic_load_n(&head, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+
+    uint32_t hdr = __atomic_load_n((uint32_t *)&ring[t & KLOG_BUF_MASK], __ATOMIC_ACQUIRE);
+    if (!(hdr & KLOG_COMMIT)) {
+        return 0;
+    }
+
+    uint32_t len = hdr & KLOG_LEN;
+    uint64_t size = record_size(len);
+    for (uint32_t i = 0; i < len; i++) {
+        out[i] = (char)ring[(t + 4 + i) & KLOG_BUF_MASK];
+    }
+    for (uint64_t i = 0; i < size; i += 4) {
+        *(uint32_t *)&ring[(t + i) & KLOG_BUF_MASK] = 0;
+    }
+
+    out_pos = 0;
+    out_len = (int)len;
+    __atomic_store_n(&tail, t + size, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// Helper: Load up to one FIFO's worth into the UART, which must be empty.
+// Returns whether anything was sent.
+static int drain_fifo(void) {
+    int n = 0;
+
+    while (n < SERIAL_FIFO_SIZE) {
+        if (out_pos == out_len && !ring_pop()) {
+            break;
+        }
+        serial_tx(out[out_pos++]);
+        n++;
+    }
+    return n;
+}
+
+// Helper: Drain everything, then send s, polling the UART, drain_lock held
+static void drain_sync(const char *s, size_t n) {
+    for (;;) {
+        while (!serial_tx_ready()) {
+            cpu_relax();
+        }
+        if (!drain_fifo()) {
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < n; ) {
+        while (!serial_tx_ready()) {
+            cpu_relax();
+        }
+        for (int k = 0; k < SERIAL_FIFO_SIZE && i < n; k++) {
+            serial_tx(s[i++]);
+        }
+    }
+}
+
+// Helper: drain_sync() with interrupts off and drain_lock held, so
+// neither the THRE interrupt nor another CPU loads the FIFO meanwhile
+static void drain_sync_locked(const char *s, size_t n) {
+    uint64_t flags = local_irq_save();
+
+    if (panicking) {
+        // Whoever held the lock isn't coming back
+        drain_sync(s, n);
+    } else {
+        spin_lock(&drain_lock);
+        drain_sync(s, n);
+        spin_unlock(&drain_lock);
+    }
+
+    local_irq_restore(flags);
+}
+
+// Helper: Whether the drainer can make progress right now, rather than
+// merely something being reserved. drain_lock held.
+static int drain_ready(void) {
+    uint64_t t = tail;
+
+    if (out_pos != out_len) {
+        return 1;
+    }
+    if (t == __atomic_load_n(&head, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    return __atomic_load_n((uint32_t *)&ring[t & KLOG_BUF_MASK], __ATOMIC_ACQUIRE) & KLOG_COMMIT;
+}
+
+int klog_pending(void) {
+    return out_pos != out_len ||
+           __atomic_load_n(&tail, __ATOMIC_RELAXED) != __atomic_load_n(&head, __ATOMIC_RELAXED);
+}
+
+void klog_flush(void) {
+    drain_sync_locked(NULL, 0);
+}
+
+void klog_write_sync(const char *s, size_t n) {
+    drain_sync_locked(s, n);
+}
+
+void klog_uart_irq(void) {
+    irqs++;
+
+    if (!spin_trylock(&drain_lock)) {
+        return;
+    }
+
+    // Turn the interrupt off before looking for more, so a producer that
+    // publishes after we find nothing turns it back on after us. A record
+    // that is reserved but unpublished leaves it off too: its producer may
+    // be the code this interrupt cut into, and it kicks once it publishes.
+    if (!drain_fifo()) {
+        serial_tx_irq(0);
+        if (drain_ready()) {
+            serial_tx_irq(1);
+        }
+    }
+
+    spin_unlock(&drain_lock);
+}
+
+// Helper: Get a freshly published record moving
+static void kick(void) {
+    if (panicking || !irq_mode) {
+        klog_flush();
+        return;
+    }
+
+    // Raises an interrupt straight away if the FIFO is already empty
+    serial_tx_irq(1);
+}
+
+void klog_write(int lvl, const char *fmt, ...) {
+    if (lvl > level) {
+        return;
+    }
+
+    char line[KLOG_LINE_MAX];
+    va_list ap;
+
+    va_start(ap, fmt);
+    int len = kvsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+
+    // The other sinks are cheap enough to write straight away
+    sink_write(SINK_ALL & ~SINK_UART, line, (size_t)len);
+
+    if ((sink_enabled() & SINK_UART) && ring_push(line, (uint32_t)len)) {
+        kick();
+    }
+}
+
+void klog_set_level(int lvl) {
+    level = lvl;
+}
+
+int klog_get_level(void) {
+    return level;
+}
+
+void klog_init(void) {
+    pic_unmask(PIC_IRQ_COM1);
+    irq_mode = 1;
+
+    // Anything queued before now was written synchronously already
+    if (klog_pending()) {
+        serial_tx_irq(1);
+    }
+}
+
+void klog_dump_stats(void) {
+    serial_puts("klog: level=");
+    serial_put_dec(level);
+    serial_puts(" compiled=");
+    serial_put_dec(KLOG_LEVEL);
+    serial_puts(" written=");
+    serial_put_dec(written);
+    serial_puts(" dropped=");
+    serial_put_dec(dropped);
+    serial_puts(" irqs=");
+    serial_put_dec(irqs);
+    serial_puts(" mode=");
+    serial_puts(irq_mode ? "irq\n" : "sync\n");
+}
+
+void panic(const char *fmt, ...) {
+    char line[KLOG_LINE_MAX];
+    va_list ap;
+
+    local_irq_disable();
+    panicking = 1;
+
+    va_start(ap, fmt);
+    kvsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+
+    // Older messages first, then this one straight to the UART
+    klog_flush();
+    serial_puts("PANIC: ");
+    serial_puts(line);
+
+    for (;;) {
+        asm volatile ("cli; hlt");
+    }
+}
@@ -1,16 +1,14 @@
+#include <stddef.h>
 #include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/klog.h"
+#include "../include/serial.h"
+#include "../include/sink.h"
+#include "../include/string.h"
 
 #define COM1 0x3F8
 
-static inline void outb(uint16_t port, uint8_t val) {
-    asm volatile ("outb %0, %1" : : "a"(val), "Nd"(port));
-}
-
-static inline uint8_t inb(uint16_t port) {
-    uint8_t ret;
-    asm volatile ("inb %1, %0" : "=a"(ret) : "Nd"(port));
-    return ret;
-}
+#define IER_THRE 0x02 // Interrupt when the transmit FIFO empties
 
 void serial_init(void) {
     outb(COM1 + 1, 0x00);    // Disable interrupts
@@ -26,47 +24,74 @@ static int serial_is_transmit_empty(void) {
     return inb(COM1 + 5) & 0x20;
 }
 
-void serial_putc(char c) {
-    while (!serial_is_transmit_empty());
+static int serial_received(void) {
+    return inb(COM1 + 5) & 0x01;
+}
+
+// Read a character if one is waiting, -1 otherwise
+int serial_getc_nonblock(void) {
+    if (!serial_received()) {
+        return -1;
+    }
+    return inb(COM1);
+}
+
+// Transmit side for klog, which owns the FIFO once it's interrupt driven
+int serial_tx_ready(void) {
+    return serial_is_transmit_empty();
+}
+
+void serial_tx(char c) {
     outb(COM1, c);
 }
 
+void serial_tx_irq(int enable) {
+    outb(COM1 + 1, enable ? IER_THRE : 0x00);
+}
+
+// The UART sink: synchronous output, a FIFO load per wait. klog owns the
+// FIFO, so it goes out through klog after anything still queued there,
+// keeping the two streams in order.
+void serial_write(const char *s, size_t n) {
+    klog_write_sync(s, n);
+}
+
+// Everything below goes to every enabled sink, see sink.h
+void serial_putc(char c) {
+    sink_write(SINK_ALL, &c, 1);
+}
+
 void serial_puts(const char *s) {
-    while (*s) {
-        serial_putc(*s++);
-    }
+    sink_write(SINK_ALL, s, strlen(s));
 }
 
 void serial_put_hex(uint64_t value) {
     const char *digits = "0123456789ABCDEF";
-    serial_puts("0x");
-    
+    char buffer[18];
+    int n = 0;
+
+    buffer[n++] = '0';
+    buffer[n++] = 'x';
+
     int started = 0;
     for (int i = 60; i >= 0; i -= 4) {
         int digit = (value >> i) & 0xF;
         if (digit != 0 || started || i == 0) {
-            serial_putc(digits[digit]);
+            buffer[n++] = digits[digit];
             started = 1;
         }
     }
+    sink_write(SINK_ALL, buffer, n);
 }
 
 void serial_put_dec(uint64_t value) {
-    if (value == 0) {
-        serial_putc('0');
-        return;
-    }
-    
     char buffer[20];
-    int i = 0;
-    
-    while (value > 0) {
-        buffer[i++] = '0' + (value % 10);
+    int i = sizeof(buffer);
+
+    do {
+        buffer[--i] = '0' + (value % 10);
         value /= 10;
-    }
-    
-    // Print in reverse
-    while (i > 0) {
-        serial_putc(buffer[--i]);
-    }
-}
\ No newline at end of file
+    } while (value > 0);
+
+    sink_write(SINK_ALL, &buffer[i], sizeof(buffer) - i);
+}
@@ -0,0 +1,137 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/serial.h"
+#include "../include/cmdline.h"
+#include "../include/klog.h"
+#include "../include/fbcon.h"
+#include "../include/sink.h"
+
+#define DEBUGCON_PORT 0xE9
+
+struct log_sink {
+    const char *name;
+    int (*probe)(void);                         // NULL if always present
+    void (*write)(const char *s, size_t n);
+};
+
+static char memlog[MEMLOG_SIZE];
+static uint64_t memlog_head = 0;                // Bytes ever written
+
+static int enabled = SINK_UART;
+
+// Reads back 0xE9 when the port is wired up, 0xFF otherwise
+static int debugcon_probe(void) {
+    return inb(DEBUGCON_PORT) == DEBUGCON_PORT;
+}
+
+static void debugcon_write(const char *s, size_t n) {
+    asm volatile ("rep outsb" : "+S"(s), "+c"(n) : "d"(DEBUGCON_PORT) : "memory");
+}
+
+// Writers claim their range first, so interrupts logging at the same time
+// don't overlap. Old text is overwritten once the ring wraps.
+static void memlog_write(const char *s, size_t n) {
+    uint64_t pos = __atomic_fetch_add(&memlog_head, n, __ATOMIC_RELAXED);
+
+    for (size_t i = 0; i < n; i++) {
+        memlog[(pos + i) % MEMLOG_SIZE] = s[i];
+    }
+}
+
+static struct log_sink sinks[SINK_NR] = {
+    { "uart",     NULL,           serial_write },
+    { "debugcon", debugcon_probe, debugcon_write },
+    { "mem",      NULL,           memlog_write },
+    { "fb",       fbcon_present,  fbcon_write },
+};
+
+void sink_init(void) {
+    size_t len;
+    const char *list = cmdline_get("log", &len);
+    int want = SINK_UART | SINK_MEMORY | SINK_FBCON;
+
+    if (list) {
+        want = 0;
+        for (int i = 0; i < SINK_NR; i++) {
+            if (cmdline_list_has(list, len, sinks[i].name)) {
+                want |= 1 << i;
+            }
+        }
+    }
+
+    int have = 0;
+    for (int i = 0; i < SINK_NR; i++) {
+        if ((want & (1 << i)) && (!sinks[i].probe || sinks[i].probe())) {
+            have |= 1 << i;
+        }
+    }
+
+    // Say where output went, on whatever is left
+    if (!have) {
+        have = SINK_UART;
+    }
+    enabled = have;
+
+    // Only complain about what was asked for by name
+    for (int i = 0; list && i < SINK_NR; i++) {
+        if ((want & ~have) & (1 << i)) {
+            klog(KLOG_WARN, "SINK: %s not present, skipped\n", sinks[i].name);
+        }
+    }
+}
+
+void sink_write(int mask, const char *s, size_t n) {
+    int m = enabled & mask;
+
+    for (int i = 0; i < SINK_NR; i++) {
+        if (m & (1 << i)) {
+            sinks[i].write(s, n);
+        }
+    }
+}
+
+void sink_write_one(int sink, const char *s, size_t n) {
+    sinks[sink].write(s, n);
+}
+
+const char *sink_name(int sink) {
+    return sinks[sink].name;
+}
+
+int sink_enabled(void) {
+    return enabled;
+}
+
+void sink_set_enabled(int mask) {
+    enabled = mask & SINK_ALL;
+}
+
+size_t memlog_read(char *dst, size_t n) {
+    uint64_t head = __atomic_load_n(&memlog_head, __ATOMIC_RELAXED);
+    uint64_t avail = head < MEMLOG_SIZE ? head : MEMLOG_SIZE;
+
+    if (n > avail) {
+        n = avail;
+    }
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = memlog[(head - n + i) % MEMLOG_SIZE];
+    }
+    return n;
+}
+
+void memlog_dump(void) {
+    uint64_t head = __atomic_load_n(&memlog_head, __ATOMIC_RELAXED);
+    uint64_t start = head < MEMLOG_SIZE ? 0 : head - MEMLOG_SIZE;
+    char chunk[128];
+
+    serial_puts("MEMLOG_BEGIN\n");
+    for (uint64_t pos = start; pos < head; ) {
+        size_t n = 0;
+        while (n < sizeof(chunk) && pos < head) {
+            chunk[n++] = memlog[pos++ % MEMLOG_SIZE];
+        }
+        sink_write(SINK_ALL & ~SINK_MEMORY, chunk, n);
+    }
+    serial_puts("MEMLOG_END\n");
+}
@@ -14,18 +14,38 @@
 #include "include/vmm.h"
 #include "include/limine_requests.h"
 #include "include/kalloc.h"
-
-static void hcf() {
-    for (;;) asm("hlt");
-}
+#include "include/bench.h"
+#include "include/kmon.h"
+#include "include/string.h"
+#include "include/fpu.h"
+#include "include/simd.h"
+#include "include/cpu.h"
+#include "include/idt.h"
+#include "include/klog.h"
+#include "include/cmdline.h"
+#include "include/sink.h"
+#include "include/fbcon.h"
+#include "include/tsc.h"
+#include "include/smp.h"
+#include "include/ktime.h"
+#include "include/timer.h"
 
 void _start(void) {
+    smp_early_init();
     serial_init();
+    string_init();
+    cmdline_init();
+    sink_init();
+    idt_init();
+    klog_init();
+    local_irq_enable();
     serial_puts("\nWelcome to Lithium!\n");
+    fpu_init();
+    simd_init();
+    tsc_init();
     
     if (!memmap_request.response || !hhdm_request.response || !exec_addr_request.response) {
-        serial_puts("PANIC: Missing responses!\n");
-        hcf();
+        panic("Missing responses!\n");
     }
 
     serial_puts("\n === Lithium Kernel Memory Layout === \n");
@@ -44,12 +64,13 @@ void _start(void) {
     pmm_init(memmap_request.response, hhdm_request.response->offset);
     vmm_init();
     kalloc_init();
+    ktime_init();
+    timers_init();
+    smp_init();
+    fbcon_init();
 
-    void *ktptr1 = kmalloc((size_t)128);
-    void *ktptr2 = kmalloc((size_t)2048);
-    
-    kfree(ktptr2);
-    kfree(ktptr1);
+    // Only with `bench` on the command line, exits QEMU when done
+    bench_main();
 
-    hcf();
+    kmon_run();
 }
\ No newline at end of file
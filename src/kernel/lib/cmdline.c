@@ -0,0 +1,72 @@
+#include <stddef.h>
+#include "../include/limine_requests.h"
+#include "../include/string.h"
+#include "../include/cmdline.h"
+
+#define CMDLINE_MAX 512
+
+static char cmdline[CMDLINE_MAX];
+
+void cmdline_init(void) {
+    if (!cmdline_request.response || !cmdline_request.response->cmdline) {
+        return;
+    }
+
+    const char *src = cmdline_request.response->cmdline;
+    size_t n = 0;
+    while (src[n] && n < CMDLINE_MAX - 1) {
+        cmdline[n] = src[n];
+        n++;
+    }
+    cmdline[n] = '\0';
+}
+
+const char *cmdline_raw(void) {
+    return cmdline;
+}
+
+const char *cmdline_get(const char *key, size_t *len) {
+    size_t klen = strlen(key);
+    const char *p = cmdline;
+
+    while (*p) {
+        while (*p == ' ') {
+            p++;
+        }
+
+        const char *word = p;
+        while (*p && *p != ' ') {
+            p++;
+        }
+        size_t wlen = p - word;
+
+        if (wlen >= klen && strncmp(word, key, klen) == 0) {
+            if (wlen == klen) {
+                *len = 0;
+                return word + wlen;
+            }
+            if (word[klen] == '=') {
+                *len = wlen - klen - 1;
+                return word + klen + 1;
+            }
+        }
+    }
+    return NULL;
+}
+
+int cmdline_list_has(const char *list, size_t len, const char *item) {
+    size_t ilen = strlen(item);
+    size_t i = 0;
+
+    while (i < len) {
+        size_t start = i;
+        while (i < len && list[i] != ',') {
+            i++;
+        }
+        if (i - start == ilen && strncmp(&list[start], item, ilen) == 0) {
+            return 1;
+        }
+        i++;
+    }
+    return 0;
+}
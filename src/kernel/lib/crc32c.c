@@ -0,0 +1,79 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/crc32c.h"
+
+// Built with -mcrc32 (see the Makefile) for the crc32 builtins, which only
+// touch general purpose registers. crc32c_hw() is still only called once
+// CPUID says the instruction exists.
+
+// Reflected Castagnoli polynomial
+#define CRC32C_POLY 0x82F63B78
+
+static uint32_t table[256];
+static int hw = -1;
+
+// Helper: Fill the byte table and probe for SSE4.2 on first use
+static void crc32c_setup(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c >> 1) ^ (CRC32C_POLY & -(c & 1));
+        }
+        table[i] = c;
+    }
+
+    uint32_t a, b, c, d;
+    cpuid(1, 0, &a, &b, &c, &d);
+    hw = (c >> 20) & 1;
+}
+
+uint32_t crc32c_sw(uint32_t crc, const void *buf, size_t len) {
+    const uint8_t *p = buf;
+
+    if (hw < 0) {
+        crc32c_setup();
+    }
+
+    crc = ~crc;
+    while (len--) {
+        crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+uint32_t crc32c_hw(uint32_t crc, const void *buf, size_t len) {
+    const uint8_t *p = buf;
+    uint64_t c = ~crc;
+
+    // Byte steps up to 8-byte alignment, then a quadword per instruction
+    while (len && ((uintptr_t)p & 7)) {
+        c = __builtin_ia32_crc32qi((uint32_t)c, *p++);
+        len--;
+    }
+    while (len >= 8) {
+        uint64_t v;
+        __builtin_memcpy(&v, p, sizeof(v));
+        c = __builtin_ia32_crc32di(c, v);
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        c = __builtin_ia32_crc32qi((uint32_t)c, *p++);
+    }
+    return ~(uint32_t)c;
+}
+
+int crc32c_hw_available(void) {
+    if (hw < 0) {
+        crc32c_setup();
+    }
+    return hw;
+}
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len) {
+    if (crc32c_hw_available()) {
+        return crc32c_hw(crc, buf, len);
+    }
+    return crc32c_sw(crc, buf, len);
+}
@@ -0,0 +1,164 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "../include/format.h"
+
+struct out {
+    char *buf;
+    size_t size;
+    size_t len;
+};
+
+// Helper: Append one character, dropping it if the buffer is full
+static inline void put(struct out *o, char c) {
+    if (o->len + 1 < o->size) {
+        o->buf[o->len++] = c;
+    }
+}
+
+// Helper: Emit a string padded to width
+static void put_padded(struct out *o, const char *s, size_t n, int width,
+                       int left, char pad) {
+    int fill = width > (int)n ? width - (int)n : 0;
+
+    if (!left) {
+        while (fill-- > 0) {
+            put(o, pad);
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        put(o, s[i]);
+    }
+    if (left) {
+        while (fill-- > 0) {
+            put(o, ' ');
+        }
+    }
+}
+
+// Helper: Format an unsigned number in base 10 or 16
+static void put_number(struct out *o, uint64_t v, int base, int upper, int neg,
+                       int width, int left, char pad) {
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char tmp[24];
+    int i = sizeof(tmp);
+
+    do {
+        tmp[--i] = digits[v % base];
+        v /= base;
+    } while (v);
+
+    if (neg) {
+        // The sign goes before zero padding, after space padding
+        if (pad == '0') {
+            put(o, '-');
+            width--;
+        } else {
+            tmp[--i] = '-';
+        }
+    }
+    put_padded(o, &tmp[i], sizeof(tmp) - i, width, left, pad);
+}
+
+int kvsnprintf(char *buf, size_t size, const char *fmt, va_list ap) {
+    struct out o = { buf, size, 0 };
+
+    if (size == 0) {
+        return 0;
+    }
+
+    for (; *fmt; fmt++) {
+        if (*fmt != '%') {
+            put(&o, *fmt);
+            continue;
+        }
+        fmt++;
+
+        int left = 0;
+        char pad = ' ';
+        for (;; fmt++) {
+            if (*fmt == '-') {
+                left = 1;
+            } else if (*fmt == '0') {
+                pad = '0';
+            } else {
+                break;
+            }
+        }
+        if (left) {
+            pad = ' ';
+        }
+
+        int width = 0;
+        while (*fmt >= '0' && *fmt <= '9') {
+            width = width * 10 + (*fmt++ - '0');
+        }
+
+        int longs = 0;
+        while (*fmt == 'l' || *fmt == 'z') {
+            longs++;
+            fmt++;
+        }
+
+        switch (*fmt) {
+        case 'd':
+        case 'i': {
+            int64_t v = longs ? va_arg(ap, int64_t) : va_arg(ap, int);
+            uint64_t u = v < 0 ? -(uint64_t)v : (uint64_t)v;
+            put_number(&o, u, 10, 0, v < 0, width, left, pad);
+            break;
+        }
+        case 'u':
+        case 'x':
+        case 'X': {
+            uint64_t v = longs ? va_arg(ap, uint64_t) : va_arg(ap, unsigned int);
+            put_number(&o, v, *fmt == 'u' ? 10 : 16, *fmt == 'X', 0, width, left, pad);
+            break;
+        }
+        case 'p':
+            put(&o, '0');
+            put(&o, 'x');
+            put_number(&o, (uint64_t)(uintptr_t)va_arg(ap, void *), 16, 0, 0, width, left, pad);
+            break;
+        case 's': {
+            const char *s = va_arg(ap, const char *);
+            size_t n = 0;
+            if (!s) {
+                s = "(null)";
+            }
+            while (s[n]) {
+                n++;
+            }
+            put_padded(&o, s, n, width, left, ' ');
+            break;
+        }
+        case 'c': {
+            char c = (char)va_arg(ap, int);
+            put_padded(&o, &c, 1, width, left, ' ');
+            break;
+        }
+        case '%':
+            put(&o, '%');
+            break;
+        case '\0':
+            fmt--;
+            break;
+        default:
+            put(&o, '%');
+            put(&o, *fmt);
+            break;
+        }
+    }
+
+    buf[o.len] = '\0';
+    return (int)o.len;
+}
+
+int ksnprintf(char *buf, size_t size, const char *fmt, ...) {
+    va_list ap;
+
+    va_start(ap, fmt);
+    int n = kvsnprintf(buf, size, fmt, ap);
+    va_end(ap);
+    return n;
+}
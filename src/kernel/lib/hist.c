@@ -0,0 +1,47 @@
+#include <stdint.h>
+#include "../include/serial.h"
+#include "../include/hist.h"
+
+void lat_hist_dump(struct lat_hist *hist) {
+    uint64_t buckets[HIST_BUCKETS] = { 0 };
+    uint64_t samples = 0;
+    uint64_t total = 0;
+    uint64_t max = 0;
+
+    for (int c = 0; c < MAX_CPUS; c++) {
+        struct lat_hist_cpu *h = &hist->cpu[c];
+
+        for (int i = 0; i < HIST_BUCKETS; i++) {
+            buckets[i] += h->buckets[i];
+        }
+        samples += h->samples;
+        total += h->total;
+        if (h->max > max) {
+            max = h->max;
+        }
+    }
+
+    serial_puts("latency ");
+    serial_puts(hist->name);
+    serial_puts(": samples=");
+    serial_put_dec(samples);
+    serial_puts(" avg=");
+    serial_put_dec(samples ? total / samples : 0);
+    serial_puts(" max=");
+    serial_put_dec(max);
+    serial_puts(" cycles\n");
+
+    // Only print the populated buckets
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        if (!buckets[i]) {
+            continue;
+        }
+        serial_puts("  [");
+        serial_put_dec(i ? 1ULL << i : 0);
+        serial_puts(", ");
+        serial_put_dec(1ULL << (i + 1));
+        serial_puts(") ");
+        serial_put_dec(buckets[i]);
+        serial_puts("\n");
+    }
+}
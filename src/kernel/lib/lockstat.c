@@ -0,0 +1,57 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "../include/serial.h"
+#include "../include/lockstat.h"
+
+#ifdef LOCKSTAT
+// Every class that saw an acquisition, newest first
+static struct lock_stat *classes = NULL;
+
+void lockstat_register(struct lock_stat *stat) {
+    int expected = 0;
+
+    // Several CPUs can get here for the same class, one of them adds it
+    if (!__atomic_compare_exchange_n(&stat->registered, &expected, 1, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    struct lock_stat *head = __atomic_load_n(&classes, __ATOMIC_RELAXED);
+    do {
+        stat->next = head;
+    } while (!__atomic_compare_exchange_n(&classes, &head, stat, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+void lockstat_dump(void) {
+    serial_puts("lockstat: name acquisitions contended contended%\n");
+
+    for (struct lock_stat *stat = __atomic_load_n(&classes, __ATOMIC_ACQUIRE); stat;
+         stat = stat->next) {
+        uint64_t acquisitions = 0;
+        uint64_t contended = 0;
+
+        for (int i = 0; i < MAX_CPUS; i++) {
+            acquisitions += stat->cpu[i].acquisitions;
+            contended += stat->cpu[i].contended;
+        }
+
+        serial_puts(stat->name);
+        serial_puts(" ");
+        serial_put_dec(acquisitions);
+        serial_puts(" ");
+        serial_put_dec(contended);
+        serial_puts(" ");
+        serial_put_dec(acquisitions ? contended * 100 / acquisitions : 0);
+        serial_puts("\n");
+
+        if (contended) {
+            lat_hist_dump(&stat->wait);
+        }
+    }
+}
+#else
+void lockstat_dump(void) {
+    serial_puts("lockstat: not built in, rebuild with `make LOCKSTAT=1`\n");
+}
+#endif
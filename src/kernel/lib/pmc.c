@@ -0,0 +1,66 @@
+#include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/pmc.h"
+
+#define MSR_PERFEVTSEL0     0x186
+#define MSR_PMC0            0x0C1
+#define MSR_PERF_GLOBAL_CTRL 0x38F
+
+// Architectural "LLC Misses" event
+#define PMC_EVENT_LLC_MISS  0x412E
+
+#define PERFEVTSEL_USR      (1ULL << 16)
+#define PERFEVTSEL_OS       (1ULL << 17)
+#define PERFEVTSEL_EN       (1ULL << 22)
+
+// -1 until probed
+static int pmc_version = -1;
+
+int pmc_available(void) {
+    if (pmc_version >= 0) {
+        return pmc_version > 0;
+    }
+
+    uint32_t a, b, c, d;
+    pmc_version = 0;
+
+    cpuid(0, 0, &a, &b, &c, &d);
+    if (a < 0x0A) {
+        return 0;
+    }
+
+    // EAX[7:0] version, EAX[15:8] counters, EAX[31:24] length of the EBX
+    // event vector. A set EBX bit means that event is missing (4 = LLC miss).
+    cpuid(0x0A, 0, &a, &b, &c, &d);
+    uint32_t version = a & 0xFF;
+    uint32_t counters = (a >> 8) & 0xFF;
+    uint32_t ev_len = a >> 24;
+
+    if (version == 0 || counters == 0 || ev_len <= 4 || (b & (1 << 4))) {
+        return 0;
+    }
+
+    pmc_version = version;
+    return 1;
+}
+
+void pmc_llc_start(void) {
+    if (!pmc_available()) return;
+
+    wrmsr(MSR_PERFEVTSEL0, 0);
+    wrmsr(MSR_PMC0, 0);
+    if (pmc_version >= 2) {
+        wrmsr(MSR_PERF_GLOBAL_CTRL, rdmsr(MSR_PERF_GLOBAL_CTRL) | 1);
+    }
+    wrmsr(MSR_PERFEVTSEL0, PMC_EVENT_LLC_MISS | PERFEVTSEL_USR | PERFEVTSEL_OS | PERFEVTSEL_EN);
+}
+
+uint64_t pmc_llc_read(void) {
+    if (!pmc_available()) return 0;
+    return rdmsr(MSR_PMC0);
+}
+
+void pmc_stop(void) {
+    if (!pmc_available()) return;
+    wrmsr(MSR_PERFEVTSEL0, 0);
+}
@@ -0,0 +1,51 @@
+#include <stdint.h>
+#include "../include/fpu.h"
+#include "../include/string.h"
+#include "../include/simd.h"
+
+static int level = SIMD_NONE;
+
+void simd_init(void) {
+    int f = fpu_features();
+
+    if (f & FPU_AVX2) {
+        level = SIMD_AVX2;
+    } else {
+        // SSE2 is part of x86_64
+        level = SIMD_SSE2;
+    }
+}
+
+int simd_level(void) {
+    return level;
+}
+
+void simd_clear_page(void *dst) {
+    if (level == SIMD_NONE) {
+        clear_page(dst);
+        return;
+    }
+
+    kernel_fpu_begin();
+    if (level == SIMD_AVX2) {
+        clear_page_avx2(dst);
+    } else {
+        clear_page_sse2(dst);
+    }
+    kernel_fpu_end();
+}
+
+void simd_copy_page(void *dst, const void *src) {
+    if (level == SIMD_NONE) {
+        copy_page(dst, src);
+        return;
+    }
+
+    kernel_fpu_begin();
+    if (level == SIMD_AVX2) {
+        copy_page_avx2(dst, src);
+    } else {
+        copy_page_sse2(dst, src);
+    }
+    kernel_fpu_end();
+}
@@ -0,0 +1,38 @@
+#include <stdint.h>
+#include "../include/simd.h"
+
+// Built with -mavx2 (see the Makefile). Only call these between
+// kernel_fpu_begin() and kernel_fpu_end(). GCC ends each function with
+// vzeroupper, so legacy SSE code afterwards doesn't pay a transition.
+
+typedef long long v4di __attribute__((vector_size(32)));
+
+#define PAGE_SIZE 4096
+
+void clear_page_avx2(void *dst) {
+    v4di *d = (v4di *)dst;
+    v4di zero = { 0, 0, 0, 0 };
+
+    for (int i = 0; i < PAGE_SIZE / 32; i += 4) {
+        d[i + 0] = zero;
+        d[i + 1] = zero;
+        d[i + 2] = zero;
+        d[i + 3] = zero;
+    }
+}
+
+void copy_page_avx2(void *dst, const void *src) {
+    v4di *d = (v4di *)dst;
+    const v4di *s = (const v4di *)src;
+
+    for (int i = 0; i < PAGE_SIZE / 32; i += 4) {
+        v4di a = s[i + 0];
+        v4di b = s[i + 1];
+        v4di c = s[i + 2];
+        v4di e = s[i + 3];
+        d[i + 0] = a;
+        d[i + 1] = b;
+        d[i + 2] = c;
+        d[i + 3] = e;
+    }
+}
@@ -0,0 +1,37 @@
+#include <stdint.h>
+#include "../include/simd.h"
+
+// Built with -msse2 (see the Makefile). Only call these between
+// kernel_fpu_begin() and kernel_fpu_end().
+
+typedef long long v2di __attribute__((vector_size(16)));
+
+#define PAGE_SIZE 4096
+
+void clear_page_sse2(void *dst) {
+    v2di *d = (v2di *)dst;
+    v2di zero = { 0, 0 };
+
+    for (int i = 0; i < PAGE_SIZE / 16; i += 4) {
+        d[i + 0] = zero;
+        d[i + 1] = zero;
+        d[i + 2] = zero;
+        d[i + 3] = zero;
+    }
+}
+
+void copy_page_sse2(void *dst, const void *src) {
+    v2di *d = (v2di *)dst;
+    const v2di *s = (const v2di *)src;
+
+    for (int i = 0; i < PAGE_SIZE / 16; i += 4) {
+        v2di a = s[i + 0];
+        v2di b = s[i + 1];
+        v2di c = s[i + 2];
+        v2di e = s[i + 3];
+        d[i + 0] = a;
+        d[i + 1] = b;
+        d[i + 2] = c;
+        d[i + 3] = e;
+    }
+}
@@ -0,0 +1,315 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/string.h"
+
+// This file is built with -fno-tree-loop-distribute-patterns (see the
+// Makefile), otherwise GCC turns the loops below into calls to themselves.
+
+// Below this rep movsb/stosb startup costs more than it saves, unless the
+// CPU has FSRM
+#define REP_THRESHOLD      128
+#define REP_THRESHOLD_FSRM 16
+
+// memset(0) at least this big bypasses the caches, it wouldn't fit them
+// anyway
+#define MEMSET_NT_THRESHOLD (4 * 1024 * 1024)
+
+static int features = 0;
+static size_t rep_threshold = (size_t)-1;
+
+void string_init(void) {
+    uint32_t a, b, c, d;
+
+    cpuid(0, 0, &a, &b, &c, &d);
+    if (a >= 7) {
+        cpuid(7, 0, &a, &b, &c, &d);
+        if (b & (1 << 9)) {
+            features |= STRING_ERMS;
+        }
+        if (d & (1 << 4)) {
+            features |= STRING_FSRM;
+        }
+    }
+
+    if (features & STRING_FSRM) {
+        rep_threshold = REP_THRESHOLD_FSRM;
+    } else if (features & STRING_ERMS) {
+        rep_threshold = REP_THRESHOLD;
+    }
+}
+
+int string_features(void) {
+    return features;
+}
+
+// Helper: Unaligned 8-byte load/store
+static inline uint64_t load64(const void *p) {
+    uint64_t v;
+    __builtin_memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void store64(void *p, uint64_t v) {
+    __builtin_memcpy(p, &v, sizeof(v));
+}
+
+// Helper: Copies of up to 16 bytes with two possibly overlapping moves
+static inline void copy_small(uint8_t *d, const uint8_t *s, size_t n) {
+    if (n >= 8) {
+        uint64_t head = load64(s);
+        uint64_t tail = load64(s + n - 8);
+        store64(d, head);
+        store64(d + n - 8, tail);
+    } else if (n >= 4) {
+        uint32_t head, tail;
+        __builtin_memcpy(&head, s, 4);
+        __builtin_memcpy(&tail, s + n - 4, 4);
+        __builtin_memcpy(d, &head, 4);
+        __builtin_memcpy(d + n - 4, &tail, 4);
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            d[i] = s[i];
+        }
+    }
+}
+
+// Helper: Sets of up to 16 bytes, same trick
+static inline void set_small(uint8_t *d, uint64_t v, size_t n) {
+    if (n >= 8) {
+        store64(d, v);
+        store64(d + n - 8, v);
+    } else if (n >= 4) {
+        uint32_t w = (uint32_t)v;
+        __builtin_memcpy(d, &w, 4);
+        __builtin_memcpy(d + n - 4, &w, 4);
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            d[i] = (uint8_t)v;
+        }
+    }
+}
+
+void *memcpy_rep(void *dst, const void *src, size_t n) {
+    void *ret = dst;
+    asm volatile ("rep movsb"
+                  : "+D"(dst), "+S"(src), "+c"(n)
+                  :: "memory");
+    return ret;
+}
+
+// Forward copy, 64 bytes per iteration
+void *memcpy_loop(void *dst, const void *src, size_t n) {
+    uint8_t *d = (uint8_t *)dst;
+    const uint8_t *s = (const uint8_t *)src;
+
+    if (n <= 16) {
+        copy_small(d, s, n);
+        return dst;
+    }
+
+    // The last 16 bytes are copied up front by address, which covers the
+    // tail the loops leave behind. Only safe because this copies forward
+    // and src/dst don't overlap.
+    uint64_t t0 = load64(s + n - 16);
+    uint64_t t1 = load64(s + n - 8);
+
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        uint64_t w0 = load64(s + i);
+        uint64_t w1 = load64(s + i + 8);
+        uint64_t w2 = load64(s + i + 16);
+        uint64_t w3 = load64(s + i + 24);
+        uint64_t w4 = load64(s + i + 32);
+        uint64_t w5 = load64(s + i + 40);
+        uint64_t w6 = load64(s + i + 48);
+        uint64_t w7 = load64(s + i + 56);
+        store64(d + i, w0);
+        store64(d + i + 8, w1);
+        store64(d + i + 16, w2);
+        store64(d + i + 24, w3);
+        store64(d + i + 32, w4);
+        store64(d + i + 40, w5);
+        store64(d + i + 48, w6);
+        store64(d + i + 56, w7);
+    }
+    for (; i + 8 <= n; i += 8) {
+        store64(d + i, load64(s + i));
+    }
+
+    store64(d + n - 16, t0);
+    store64(d + n - 8, t1);
+    return dst;
+}
+
+void *memcpy(void *dst, const void *src, size_t n) {
+    if (n <= 16) {
+        copy_small((uint8_t *)dst, (const uint8_t *)src, n);
+        return dst;
+    }
+    if (n >= rep_threshold) {
+        return memcpy_rep(dst, src, n);
+    }
+    return memcpy_loop(dst, src, n);
+}
+
+void *memmove(void *dst, const void *src, size_t n) {
+    uint8_t *d = (uint8_t *)dst;
+    const uint8_t *s = (const uint8_t *)src;
+
+    // Forward copies are fine unless dst starts inside src
+    if (d <= s || d >= s + n) {
+        return memcpy(dst, src, n);
+    }
+
+    // Backwards, a word at a time. std; rep movsb is slow nearly everywhere.
+    while (n >= 8) {
+        n -= 8;
+        store64(d + n, load64(s + n));
+    }
+    while (n > 0) {
+        n--;
+        d[n] = s[n];
+    }
+    return dst;
+}
+
+void *memset_rep(void *dst, int c, size_t n) {
+    void *ret = dst;
+    asm volatile ("rep stosb"
+                  : "+D"(dst), "+c"(n)
+                  : "a"(c)
+                  : "memory");
+    return ret;
+}
+
+void *memset_loop(void *dst, int c, size_t n) {
+    uint8_t *d = (uint8_t *)dst;
+    uint64_t v = 0x0101010101010101ULL * (uint8_t)c;
+
+    if (n <= 16) {
+        set_small(d, v, n);
+        return dst;
+    }
+
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        store64(d + i, v);
+        store64(d + i + 8, v);
+        store64(d + i + 16, v);
+        store64(d + i + 24, v);
+        store64(d + i + 32, v);
+        store64(d + i + 40, v);
+        store64(d + i + 48, v);
+        store64(d + i + 56, v);
+    }
+    for (; i + 8 <= n; i += 8) {
+        store64(d + i, v);
+    }
+
+    // Overlapping store covers the last few bytes
+    store64(d + n - 8, v);
+    return dst;
+}
+
+void clear_nt(void *dst, size_t n) {
+    uint64_t *d = (uint64_t *)dst;
+
+    for (size_t i = 0; i < n / 8; i += 8) {
+        asm volatile (
+            "movnti %1, 0(%0)\n\t"
+            "movnti %1, 8(%0)\n\t"
+            "movnti %1, 16(%0)\n\t"
+            "movnti %1, 24(%0)\n\t"
+            "movnti %1, 32(%0)\n\t"
+            "movnti %1, 40(%0)\n\t"
+            "movnti %1, 48(%0)\n\t"
+            "movnti %1, 56(%0)"
+            :: "r"(d + i), "r"(0ULL) : "memory");
+    }
+
+    // Non-temporal stores are weakly ordered
+    asm volatile ("sfence" ::: "memory");
+}
+
+void *memset(void *dst, int c, size_t n) {
+    if (n <= 16) {
+        set_small((uint8_t *)dst, 0x0101010101010101ULL * (uint8_t)c, n);
+        return dst;
+    }
+
+    // Huge clears would only evict everything else from the caches
+    if (c == 0 && n >= MEMSET_NT_THRESHOLD && !((uint64_t)dst & 7) && !(n & 63)) {
+        clear_nt(dst, n);
+        return dst;
+    }
+
+    if (n >= rep_threshold) {
+        return memset_rep(dst, c, n);
+    }
+    return memset_loop(dst, c, n);
+}
+
+int memcmp(const void *a, const void *b, size_t n) {
+    const uint8_t *x = (const uint8_t *)a;
+    const uint8_t *y = (const uint8_t *)b;
+    size_t i = 0;
+
+    // Skip equal words, then find the differing byte
+    for (; i + 8 <= n; i += 8) {
+        if (load64(x + i) != load64(y + i)) {
+            break;
+        }
+    }
+    for (; i < n; i++) {
+        if (x[i] != y[i]) {
+            return x[i] - y[i];
+        }
+    }
+    return 0;
+}
+
+size_t strlen(const char *s) {
+    size_t n = 0;
+    while (s[n]) {
+        n++;
+    }
+    return n;
+}
+
+int strcmp(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return (uint8_t)*a - (uint8_t)*b;
+}
+
+int strncmp(const char *a, const char *b, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (a[i] != b[i] || !a[i]) {
+            return (uint8_t)a[i] - (uint8_t)b[i];
+        }
+    }
+    return 0;
+}
+
+void copy_page(void *dst, const void *src) {
+    size_t n = 4096 / 8;
+    asm volatile ("rep movsq"
+                  : "+D"(dst), "+S"(src), "+c"(n)
+                  :: "memory");
+}
+
+void clear_page(void *dst) {
+    if (features & STRING_ERMS) {
+        memset_rep(dst, 0, 4096);
+        return;
+    }
+
+    size_t n = 4096 / 8;
+    asm volatile ("rep stosq"
+                  : "+D"(dst), "+c"(n)
+                  : "a"(0ULL)
+                  : "memory");
+}
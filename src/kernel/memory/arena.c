@@ -0,0 +1,213 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "../include/cpu.h"
+#include "../include/serial.h"
+#include "../include/pmm.h"
+#include "../include/string.h"
+#include "../include/arena.h"
+#include "../include/percpu.h"
+
+// Chunks come straight from the buddy allocator, so they are physically
+// contiguous and addressed through the HHDM
+struct arena_chunk {
+    struct arena_chunk *prev;   // Chunk allocated before this one
+    unsigned int order;         // Size of this chunk as a buddy order
+    size_t size;                // Bytes in the chunk, header included
+    size_t used;                // Bytes handed out, header included
+};
+
+struct arena {
+    struct arena_chunk *current; // Chunk being bumped into
+    struct arena_chunk *first;   // Holds this header, freed last
+    int flags;
+    unsigned int next_order;     // Order for the next chunk when growing
+    uint64_t chunks;             // Chunks currently held
+};
+
+#define ARENA_PAGE_SIZE 4096ULL
+
+#define ARENA_ALIGN_UP(x, a) (((x) + (a) - 1) & ~((uint64_t)(a) - 1))
+
+// Default alignment, enough for any kernel type
+#define ARENA_MIN_ALIGN 16
+
+// Capacity of the first chunk of a per-CPU scratch arena
+#define ARENA_SCRATCH_SIZE (64 * 1024)
+
+static DEFINE_PER_CPU(struct arena *, scratch_arena);
+
+// Helper: Smallest buddy order holding `bytes`
+static unsigned int bytes_to_order(size_t bytes) {
+    unsigned int order = 0;
+    while ((ARENA_PAGE_SIZE << order) < bytes) {
+        order++;
+    }
+    return order;
+}
+
+// Helper: Get a fresh chunk of 2^order pages
+static struct arena_chunk *chunk_alloc(unsigned int order) {
+    if (order > PMM_MAX_ORDER) {
+        return NULL;
+    }
+
+    struct arena_chunk *chunk = pmm_alloc_pages(order);
+    if (!chunk) {
+        return NULL;
+    }
+
+    chunk->prev = NULL;
+    chunk->order = order;
+    chunk->size = ARENA_PAGE_SIZE << order;
+    chunk->used = sizeof(struct arena_chunk);
+    return chunk;
+}
+
+struct arena *arena_create(size_t size, int flags) {
+    size_t header = sizeof(struct arena_chunk) + sizeof(struct arena);
+    struct arena_chunk *chunk = chunk_alloc(bytes_to_order(size + header));
+    if (!chunk) {
+        serial_puts("ARENA: Failed to allocate first chunk!\n");
+        return NULL;
+    }
+
+    struct arena *arena = (struct arena *)(chunk + 1);
+    chunk->used = header;
+
+    arena->current = chunk;
+    arena->first = chunk;
+    arena->flags = flags;
+    arena->next_order = chunk->order;
+    arena->chunks = 1;
+
+    return arena;
+}
+
+void arena_destroy(struct arena *arena) {
+    if (!arena) return;
+
+    // The header sits in the first chunk, so that one goes last
+    struct arena_chunk *chunk = arena->current;
+    while (chunk) {
+        struct arena_chunk *prev = chunk->prev;
+        pmm_free_pages(chunk, chunk->order);
+        chunk = prev;
+    }
+}
+
+// Helper: Chain a new chunk that fits `size` bytes at `align`
+static struct arena_chunk *arena_grow(struct arena *arena, size_t size, size_t align) {
+    if (!(arena->flags & ARENA_GROW)) {
+        return NULL;
+    }
+
+    // Double the chunk size each time so big arenas need few chunks
+    if (arena->next_order < PMM_MAX_ORDER) {
+        arena->next_order++;
+    }
+
+    size_t need = ARENA_ALIGN_UP(sizeof(struct arena_chunk), align) + size;
+    unsigned int order = bytes_to_order(need);
+    if (order < arena->next_order) {
+        order = arena->next_order;
+    }
+
+    struct arena_chunk *chunk = chunk_alloc(order);
+    if (!chunk) {
+        return NULL;
+    }
+
+    chunk->prev = arena->current;
+    arena->current = chunk;
+    arena->chunks++;
+
+    return chunk;
+}
+
+void *arena_alloc(struct arena *arena, size_t size, size_t align) {
+    if (align == 0) {
+        align = ARENA_MIN_ALIGN;
+    }
+
+    if (align & (align - 1)) {
+        serial_puts("ARENA: Alignment is not a power of two!\n");
+        return NULL;
+    }
+
+    // Fast path: bump inside the current chunk
+    struct arena_chunk *chunk = arena->current;
+    uint64_t base = (uint64_t)chunk;
+    uint64_t offset = ARENA_ALIGN_UP(base + chunk->used, align) - base;
+
+    if (offset + size > chunk->size) {
+        chunk = arena_grow(arena, size, align);
+        if (!chunk) {
+            return NULL;
+        }
+
+        base = (uint64_t)chunk;
+        offset = ARENA_ALIGN_UP(base + chunk->used, align) - base;
+    }
+
+    chunk->used = offset + size;
+    return (void *)(base + offset);
+}
+
+void *arena_zalloc(struct arena *arena, size_t size, size_t align) {
+    void *ptr = arena_alloc(arena, size, align);
+    if (!ptr) {
+        return NULL;
+    }
+    return memset(ptr, 0, size);
+}
+
+arena_mark_t arena_mark(struct arena *arena) {
+    arena_mark_t mark = { arena->current, arena->current->used };
+    return mark;
+}
+
+void arena_rewind(struct arena *arena, arena_mark_t mark) {
+    // Free chunks chained after the mark was taken
+    while (arena->current != mark.chunk) {
+        struct arena_chunk *chunk = arena->current;
+        if (chunk == arena->first) {
+            serial_puts("ARENA: Rewind to a mark from another arena!\n");
+            return;
+        }
+
+        arena->current = chunk->prev;
+        arena->chunks--;
+        pmm_free_pages(chunk, chunk->order);
+    }
+
+    arena->current->used = mark.used;
+    arena->next_order = arena->current->order;
+}
+
+void arena_reset(struct arena *arena) {
+    arena_mark_t mark = { arena->first, sizeof(struct arena_chunk) + sizeof(struct arena) };
+    arena_rewind(arena, mark);
+}
+
+arena_scratch_t arena_scratch_begin(void) {
+    arena_scratch_t scratch = { NULL, { NULL, 0 } };
+    struct arena **slot = this_cpu_ptr(scratch_arena);
+
+    // Created on first use, then kept for the CPU's lifetime
+    if (!*slot) {
+        *slot = arena_create(ARENA_SCRATCH_SIZE, ARENA_GROW);
+        if (!*slot) {
+            return scratch;
+        }
+    }
+
+    scratch.arena = *slot;
+    scratch.mark = arena_mark(*slot);
+    return scratch;
+}
+
+void arena_scratch_end(arena_scratch_t scratch) {
+    if (scratch.arena) {
+        arena_rewind(scratch.arena, scratch.mark);
+    }
+}
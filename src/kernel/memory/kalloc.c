@@ -1,18 +1,50 @@
 #include <stdint.h>
 #include <stddef.h>
 #include "../include/serial.h"
+#include "../include/klog.h"
 #include "../include/pmm.h"
 #include "../include/vmm.h"
 #include "../include/limine_requests.h"
+#include "../include/cpu.h"
+#include "../include/spinlock.h"
+#include "../include/kalloc.h"
+#include "../include/list.h"
+#include "../include/hist.h"
+#include "../include/heapprof.h"
+#include "../include/shrinker.h"
+#include "../include/smp.h"
+#include "../include/trace.h"
+#include "../include/string.h"
 
 // Forward declarations (used before definitions in this file)
 void *kmalloc(size_t size);
 void  kfree(void *ptr);
 void *krealloc(void *ptr, size_t new_size);
 
-static void *kmalloc_large(size_t size);
+static void *kmalloc_large(size_t size, int pmm_flags);
 static void  kfree_large(void *ptr);
 static int   is_large_alloc(void *ptr);
+static int   is_contig_alloc(void *ptr);
+static void  do_kfree(void *ptr);
+
+// Locking, outermost first. No lock is held across a call that may end
+// up in reclaim (a page allocation without PMM_ATOMIC), since reclaim
+// destroys slabs and takes these again.
+//
+//   cache_list_lock   rwlock, the list of caches
+//   cache->slab_lock  the cache's slab lists and the slabs on them
+//   cache->depot.lock MCS, the cache's depot of magazines
+//   slab_va_lock      heap_current and the stack of recycled slab addresses
+//   large_lock        rwlock, the large window's free extents and headers
+//
+// then vmm_lock and pmm_lock. A depot lock is never held together with
+// a slab lock. The per-CPU magazines need no lock, only their own CPU
+// touches them, and it does so with interrupts off.
+//
+// Interrupt handlers may allocate with KM_ATOMIC and free. Every lock
+// below cache_list_lock is taken with interrupts off, and none is held
+// across a TLB shootdown: slabs are unmapped after slab_lock is dropped,
+// since a CPU spinning on it with interrupts off can't answer the IPI.
 
 // SLAB metadata stored at the start of each page
 struct slab {
@@ -20,46 +52,169 @@ struct slab {
     void *freelist;             // Head of free object list
     int free_count;             // Number of free objects
     int total_count;            // Total objects in slab
-    struct slab *next;
+    int fresh;                  // Objects from here on were never handed out
+    int zeroed;                 // Page came from the PMM known to be zero
+    struct list_head link;      // Link in the cache's partial/full/empty list
     uint64_t phys_addr;         // Physical address of slab page
+    uint64_t free_map[];        // KMC_BITMAP caches: set bit = free object
+};
+
+// Magazine: a fixed-capacity stack of object pointers (Bonwick '01)
+struct kmem_magazine {
+    struct kmem_magazine *next; // Link in the depot lists
+    int rounds;                 // Objects currently held
+    int size;                   // Capacity of objs[]
+    void *objs[];
+};
+
+// Per-CPU magazine pair, one cache line per CPU
+struct kmem_cpu_cache {
+    struct kmem_magazine *loaded;   // Magazine alloc/free operate on
+    struct kmem_magazine *previous; // Either full or empty, swapped with loaded
+    uint64_t allocs;                // Objects handed out on this CPU
+    uint64_t frees;                 // Objects given back on this CPU
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+// Global pool of full and empty magazines for one cache
+struct kmem_depot {
+    mcs_lock_t lock;
+    struct kmem_magazine *full;
+    struct kmem_magazine *empty;
+    int nfull;
+    int nempty;
+    int mag_type;               // Index into mag_types[] for new magazines
+    uint64_t accesses;          // Depot lock acquisitions this window
+    uint64_t contended;         // ...of which found the lock held
 };
 
 // Cache for specific obj size
 struct kmem_cache {
     const char *name;
     size_t object_sz;           // Size of each object
+    size_t align;               // Alignment of each object
+    size_t stride;              // Distance between objects in a slab
+    size_t obj_offset;          // Offset of the first object in a slab
+    size_t free_off;            // Offset of the freelist link in an object
+    size_t map_words;           // Words of free_map[] in KMC_BITMAP slabs
+    uint64_t stride_recip;      // 2^32 / stride rounded up, to divide by stride
     size_t objects_per_slab;    // How many objects fit in a slab
-    struct slab *partial;       // Slabs with some free objects
-    struct slab *full;          // Slabs with no free objects
+    int flags;
+    kmem_ctor_t ctor;           // Run once per object when a slab is built
+    struct kmem_cache *next;    // Link in cache_list
+    spinlock_t slab_lock;       // Everything below, up to empty_keep
+    struct list_head partial;   // Slabs with some free objects
+    struct list_head full;      // Slabs with no free objects
+    struct list_head empty;     // Slabs with every object free
+    uint64_t grows;             // Slabs created
+    uint64_t shrinks;           // Slabs destroyed
+    size_t nr_partial;
+    size_t nr_full;
+    size_t nr_empty;
+    size_t empty_keep;          // Empty slabs kept around before freeing
+    struct kmem_depot depot;
+    struct kmem_cpu_cache cpu[MAX_CPUS];
 };
 
+#define KMEM_ALIGN_UP(x, a) (((x) + (a) - 1) & ~((size_t)(a) - 1))
+
+// Empty slabs a cache keeps in reserve unless told otherwise
+#define KMEM_DEFAULT_EMPTY_KEEP 1
+
+// How far kmem_cache_free_bulk() scans for objects of the same slab
+#define KMEM_BULK_LOOKAHEAD 128
+
+// Smallest object alignment handed out
+#define KMEM_MIN_ALIGN sizeof(void *)
+
 // Large allocation header (for >4KB allocations)
 #define LARGE_ALLOC_MAGIC 0x4C41524745414C4CULL /* "LARGEALL" */
 
-// Large allocation header (for >4KB allocations)
+// Large allocation header (for >4KB allocations). Physical pages aren't
+// tracked here, they are looked up in the page tables when needed.
 struct large_alloc {
     uint64_t magic;             // Sanity check
     uint64_t vaddr;             // Base virtual address returned to caller
-    size_t size;                // Total size in bytes
+    size_t size;                // Requested size in bytes
     size_t num_pages;           // Number of pages allocated
-    struct large_alloc *next;
-    uint64_t phys_addrs[];      // Flexible array of physical addrs
+    struct large_alloc *next;   // Hash bucket chain
 };
 
-
-#define NUM_CACHES 10
+#define NUM_CACHES 9
 static struct kmem_cache caches[NUM_CACHES];
 
-// Cache sizes in bytes
+// Cache sizes in bytes. Anything larger than the last one no longer fits
+// a single-page slab next to its header and goes to kmalloc_large().
 static const size_t cache_sizes[NUM_CACHES] = {
-    16, 32, 64, 128, 256, 512, 1024, 2048, 3072, 4096
+    16, 32, 64, 128, 256, 512, 1024, 2048, 3072
 };
 
-// List of large allocations
-static struct large_alloc *large_allocs = NULL;
+static const char *cache_names[NUM_CACHES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128", "kmalloc-256",
+    "kmalloc-512", "kmalloc-1024", "kmalloc-2048", "kmalloc-3072"
+};
+
+#define KMALLOC_MAX_CACHE_SIZE 3072
+
+// Largest kmalloc served as one physically contiguous block through the
+// HHDM. Bigger requests, or ones the buddy allocator can't satisfy, fall
+// back to page-mapped memory.
+#define KMALLOC_CONTIG_MAX_ORDER PMM_MAX_ORDER
+
+// kmalloc()/kfree() latency, always on
+static struct lat_hist kmalloc_lat = LAT_HIST_INIT("kmalloc");
+
+// KM_ZERO slab allocations that needed no clearing
+static uint64_t kmalloc_zero_skipped = 0;
+
+// Failed retries before a KM_NOFAIL allocation complains
+#define KMALLOC_NOFAIL_WARN 1000
+static struct lat_hist kfree_lat = LAT_HIST_INIT("kfree");
+
+// Cache that struct kmem_cache itself is allocated from
+static struct kmem_cache cache_cache;
+
+// Lock classes, every cache's slab and depot locks are counted together
+static DEFINE_LOCK_STAT(slab_lock_stat, "slab");
+static DEFINE_LOCK_STAT(depot_lock_stat, "depot");
+static DEFINE_LOCK_STAT(cache_list_lock_stat, "cache_list");
+static DEFINE_LOCK_STAT(slab_va_lock_stat, "slab_va");
+static DEFINE_LOCK_STAT(large_lock_stat, "large_alloc");
+
+// Every cache in the system, for statistics and reclaim
+static struct kmem_cache *cache_list = NULL;
+static rwlock_t cache_list_lock = RWLOCK_INIT_STAT(&cache_list_lock_stat);
+
+// Magazine capacities, smallest first. A depot that sees contention moves
+// its cache up to the next size so CPUs visit it less often.
+#define MAG_TYPES 4
+static const int mag_types[MAG_TYPES] = { 15, 31, 63, 127 };
+static const char *mag_names[MAG_TYPES] = {
+    "kmem_magazine-15", "kmem_magazine-31", "kmem_magazine-63", "kmem_magazine-127"
+};
+static struct kmem_cache mag_caches[MAG_TYPES];
+
+// Depot accesses per contention sample, and contended accesses in a window
+// that trigger a resize
+#define MAG_RESIZE_WINDOW    1024
+#define MAG_RESIZE_THRESHOLD 16
+
+// Big objects get small magazines so a CPU can't hoard too much memory
+#define MAG_MAX_TYPE_LARGE_OBJ 1
+
+// Large allocation headers, hashed by address
+#define LARGE_HASH_SIZE 64
+static struct large_alloc *large_hash[LARGE_HASH_SIZE];
+static struct kmem_cache large_cache;
+
+// Covers large_hash[] and va_free[]
+static rwlock_t large_lock = RWLOCK_INIT_STAT(&large_lock_stat);
+
+static inline struct large_alloc **large_bucket(uint64_t vaddr) {
+    return &large_hash[(vaddr >> 12) % LARGE_HASH_SIZE];
+}
 
 static struct large_alloc *large_find(uint64_t vaddr, struct large_alloc ***link_out) {
-    struct large_alloc **link = &large_allocs;
+    struct large_alloc **link = large_bucket(vaddr);
 
     while (*link) {
         if ((*link)->vaddr == vaddr) {
@@ -74,278 +229,1496 @@ static struct large_alloc *large_find(uint64_t vaddr, struct large_alloc ***link
     return NULL;
 }
 
+static void large_insert(struct large_alloc *alloc) {
+    struct large_alloc **bucket = large_bucket(alloc->vaddr);
+    alloc->next = *bucket;
+    *bucket = alloc;
+}
+
+// Tossing the heap in virtual mem after the kernel. Slab pages are carved
+// off the bottom window, large allocations get the window above it. The
+// host build (tools/host) moves the whole thing into user space.
+#ifndef HEAP_BASE
+#define HEAP_BASE        0xFFFFFFFF90000000ULL
+#endif
+#define HEAP_START       HEAP_BASE
+#define LARGE_HEAP_START (HEAP_BASE + 0x10000000ULL)
+#define LARGE_HEAP_END   (HEAP_BASE + 0x60000000ULL)
+static uint64_t heap_current = HEAP_START;
+static spinlock_t slab_va_lock = SPINLOCK_INIT_STAT(&slab_va_lock_stat);
+
+// Slab pages given back are recycled instead of bumping heap_current
+// forever. Their addresses are stacked in pages reached through the HHDM.
+struct slab_va_page {
+    struct slab_va_page *next;
+    uint64_t count;
+    uint64_t va[(4096 - 16) / sizeof(uint64_t)];
+};
+
+#define SLAB_VA_PER_PAGE ((4096 - 16) / sizeof(uint64_t))
+
+static struct slab_va_page *slab_va_free = NULL;
+
+// Free ranges of the large allocation window, sorted by base and always
+// coalesced, so the range right after a live allocation, if it's free,
+// starts exactly where that allocation ends
+#define VA_MAX_EXTENTS 256
+
+struct va_extent {
+    uint64_t base;
+    uint64_t size;
+};
+
+static struct va_extent va_free[VA_MAX_EXTENTS] = {
+    { LARGE_HEAP_START, LARGE_HEAP_END - LARGE_HEAP_START }
+};
+static int va_nfree = 1;
+
+// Helper: Remove extent i from va_free
+static void va_remove(int i) {
+    for (int j = i; j < va_nfree - 1; j++) {
+        va_free[j] = va_free[j + 1];
+    }
+    va_nfree--;
+}
+
+// Helper: First-fit a VA range from the large window, 0 if none
+static uint64_t va_alloc(uint64_t size) {
+    for (int i = 0; i < va_nfree; i++) {
+        if (va_free[i].size >= size) {
+            uint64_t base = va_free[i].base;
+            va_free[i].base += size;
+            va_free[i].size -= size;
+            if (va_free[i].size == 0) {
+                va_remove(i);
+            }
+            return base;
+        }
+    }
+
+    return 0;
+}
+
+// Helper: Claim [base, base + size) if a free extent starts right at base
+static int va_claim(uint64_t base, uint64_t size) {
+    for (int i = 0; i < va_nfree && va_free[i].base <= base; i++) {
+        if (va_free[i].base == base && va_free[i].size >= size) {
+            va_free[i].base += size;
+            va_free[i].size -= size;
+            if (va_free[i].size == 0) {
+                va_remove(i);
+            }
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+// Helper: Give a VA range back, merging with its neighbours
+static void va_release(uint64_t base, uint64_t size) {
+    int i = 0;
+    while (i < va_nfree && va_free[i].base < base) {
+        i++;
+    }
+
+    int merge_prev = i > 0 && va_free[i - 1].base + va_free[i - 1].size == base;
+    int merge_next = i < va_nfree && base + size == va_free[i].base;
+
+    if (merge_prev && merge_next) {
+        va_free[i - 1].size += size + va_free[i].size;
+        va_remove(i);
+    } else if (merge_prev) {
+        va_free[i - 1].size += size;
+    } else if (merge_next) {
+        va_free[i].base = base;
+        va_free[i].size += size;
+    } else if (va_nfree < VA_MAX_EXTENTS) {
+        for (int j = va_nfree; j > i; j--) {
+            va_free[j] = va_free[j - 1];
+        }
+        va_free[i].base = base;
+        va_free[i].size = size;
+        va_nfree++;
+    } else {
+        klog(KLOG_ERR, "KALLOC: VA extent table full, leaking range\n");
+    }
+}
+
+// Forward declare functions
+void *kmalloc(size_t size);
+void  kfree(void *ptr);
+void *krealloc(void *ptr, size_t new_size);
+
+// Helper: Stack a slab address for reuse and give its page back. When the
+// stack is full the page itself becomes the next stack page instead of
+// going back to the PMM.
+static void slab_va_release(uint64_t v_addr, void *page) {
+    uint64_t irq = spin_lock_irqsave(&slab_va_lock);
+
+    if (!slab_va_free || slab_va_free->count == SLAB_VA_PER_PAGE) {
+        struct slab_va_page *stack = page;
+        stack->next = slab_va_free;
+        stack->count = 0;
+        slab_va_free = stack;
+        stack->va[stack->count++] = v_addr;
+        spin_unlock_irqrestore(&slab_va_lock, irq);
+        return;
+    }
+    slab_va_free->va[slab_va_free->count++] = v_addr;
+
+    spin_unlock_irqrestore(&slab_va_lock, irq);
+
+    pmm_free(page);
+}
+
+// Helper: Map a fresh page at a free slab heap address. The page comes
+// first, so a failure after that has one to hand back with the address.
+static void *heap_alloc_page(uint64_t *out_phys, int pmm_flags) {
+    void *phys_virt = pmm_alloc_pages_flags(0, pmm_flags);
+    if (!phys_virt) {
+        klog(KLOG_ERR, "KALLOC: Out of physical memory!\n");
+        return NULL;
+    }
+    uint64_t phys = (uint64_t)phys_virt - hhdm_request.response->offset;
+
+    uint64_t v_addr;
+    struct slab_va_page *empty_stack = NULL;
+
+    uint64_t irq = spin_lock_irqsave(&slab_va_lock);
+
+    if (slab_va_free) {
+        // Reuse a page address from a destroyed slab
+        struct slab_va_page *stack = slab_va_free;
+        v_addr = stack->va[--stack->count];
+
+        if (stack->count == 0) {
+            slab_va_free = stack->next;
+            empty_stack = stack;
+        }
+    } else {
+        if (heap_current + 4096 > LARGE_HEAP_START) {
+            spin_unlock_irqrestore(&slab_va_lock, irq);
+            klog(KLOG_ERR, "KALLOC: Slab heap window exhausted!\n");
+            pmm_free(phys_virt);
+            return NULL;
+        }
+
+        v_addr = heap_current;
+        heap_current += 4096;
+    }
+
+    spin_unlock_irqrestore(&slab_va_lock, irq);
+
+    if (empty_stack) {
+        pmm_free(empty_stack);
+    }
+
+    if (vmm_map(v_addr, phys, VMM_WRITE) != 0) {
+        klog(KLOG_ERR, "KALLOC: Failed to map heap page!\n");
+        slab_va_release(v_addr, phys_virt);
+        return NULL;
+    }
+
+    if (out_phys) {
+        *out_phys = phys;
+    }
+
+    return (void *)v_addr;
+}
+
+// Helper: Create a new slab for a cache. Nothing is written past the
+// header, objects are handed out from `fresh` and constructed on first use,
+// so this is O(1) in the number of objects.
+static struct slab *slab_create(struct kmem_cache *cache, int pmm_flags) {
+    uint64_t phys_addr;
+    void *slab_mem = heap_alloc_page(&phys_addr, pmm_flags);
+    if (!slab_mem)
+        return NULL;
+
+    struct slab *slab = (struct slab *)slab_mem;
+    slab->zeroed = pmm_block_zeroed((void *)(phys_addr + hhdm_request.response->offset));
+    slab->cache = cache;
+    slab->freelist = NULL;
+    slab->free_count = cache->objects_per_slab;
+    slab->total_count = cache->objects_per_slab;
+    slab->fresh = 0;
+    slab->phys_addr = phys_addr;
+
+    if (cache->flags & KMC_BITMAP) {
+        size_t n = cache->objects_per_slab;
+        for (size_t w = 0; w < cache->map_words; w++) {
+            size_t bits = n - w * 64;
+            slab->free_map[w] = bits >= 64 ? ~0ULL : (1ULL << bits) - 1;
+        }
+    }
+
+    trace(TRACE_SLAB_GROW, slab, cache->object_sz);
+    return slab;
+}
+
+// Helper: Take an empty slab off the empty list onto `to`, for
+// slab_release() once slab_lock is dropped (slab_lock held)
+static void slab_unlink(struct kmem_cache *cache, struct slab *slab, struct list_head *to) {
+    list_move(&slab->link, to);
+    cache->nr_empty--;
+    cache->shrinks++;
+    trace(TRACE_SLAB_SHRINK, slab, cache->object_sz);
+}
+
+// Helper: Unmap an unlinked slab and give its page back. The unmap waits
+// on a TLB shootdown, so slab_lock must not be held.
+static void slab_release(struct slab *slab) {
+    uint64_t v_addr = (uint64_t)slab;
+    uint64_t phys = slab->phys_addr;
+
+    vmm_unmap(v_addr);
+    slab_va_release(v_addr, (void *)(phys + hhdm_request.response->offset));
+}
+
+// Helper: Release a list of unlinked slabs, returns how many
+static uint64_t slab_release_list(struct list_head *list) {
+    uint64_t n = 0;
+
+    while (!list_empty(list)) {
+        struct slab *slab = list_first_entry(list, struct slab, link);
+        list_del(&slab->link);
+        slab_release(slab);
+        n++;
+    }
+    return n;
+}
+
+// Helper: Init a cache, returns -1 if the layout doesn't fit a slab
+static int kmem_cache_init(struct kmem_cache *cache, const char *name, size_t object_size,
+                           size_t align, kmem_ctor_t ctor, int flags) {
+    if (object_size == 0 || (align & (align - 1)) != 0) {
+        return -1;
+    }
+
+    if (align < KMEM_MIN_ALIGN) {
+        align = KMEM_MIN_ALIGN;
+    }
+    if ((flags & KMC_HWCACHE_ALIGN) && align < CACHE_LINE_SIZE) {
+        align = CACHE_LINE_SIZE;
+    }
+
+    cache->name = name;
+    cache->object_sz = object_size;
+    cache->align = align;
+    cache->flags = flags;
+    cache->ctor = ctor;
+    cache->next = NULL;
+    spin_lock_init(&cache->slab_lock, &slab_lock_stat);
+    list_init(&cache->partial);
+    list_init(&cache->full);
+    list_init(&cache->empty);
+    cache->grows = 0;
+    cache->shrinks = 0;
+    cache->nr_partial = 0;
+    cache->nr_full = 0;
+    cache->nr_empty = 0;
+    cache->empty_keep = KMEM_DEFAULT_EMPTY_KEEP;
+
+    // Without a ctor the freelist link overlays the free object, otherwise
+    // it goes after it so constructed state is never clobbered. Bitmap
+    // slabs keep no link in objects at all.
+    size_t footprint = object_size;
+    if (flags & KMC_BITMAP) {
+        cache->free_off = 0;
+    } else if (ctor) {
+        cache->free_off = KMEM_ALIGN_UP(object_size, sizeof(void *));
+        footprint = cache->free_off + sizeof(void *);
+    } else {
+        cache->free_off = 0;
+        if (footprint < sizeof(void *)) {
+            footprint = sizeof(void *);
+        }
+    }
+
+    cache->stride = KMEM_ALIGN_UP(footprint, align);
+    cache->stride_recip = (1ULL << 32) / cache->stride + 1;
+    cache->map_words = 0;
+
+    // The bitmap's size depends on the object count and takes room from
+    // the objects, grow it until they agree
+    for (;;) {
+        size_t header = sizeof(struct slab) + cache->map_words * sizeof(uint64_t);
+        cache->obj_offset = KMEM_ALIGN_UP(header, align);
+
+        if (cache->obj_offset >= 4096) {
+            return -1;
+        }
+
+        cache->objects_per_slab = (4096 - cache->obj_offset) / cache->stride;
+
+        size_t words = (cache->objects_per_slab + 63) / 64;
+        if (!(flags & KMC_BITMAP) || words <= cache->map_words) {
+            break;
+        }
+        cache->map_words = words;
+    }
+
+    if (cache->objects_per_slab == 0) {
+        return -1;
+    }
+
+    mcs_lock_init(&cache->depot.lock, &depot_lock_stat);
+    cache->depot.full = NULL;
+    cache->depot.empty = NULL;
+    cache->depot.nfull = 0;
+    cache->depot.nempty = 0;
+    cache->depot.mag_type = 0;
+    cache->depot.accesses = 0;
+    cache->depot.contended = 0;
+
+    for (int i = 0; i < MAX_CPUS; i++) {
+        cache->cpu[i].loaded = NULL;
+        cache->cpu[i].previous = NULL;
+        cache->cpu[i].allocs = 0;
+        cache->cpu[i].frees = 0;
+    }
+
+    return 0;
+}
+
+// Helper: Add a cache to cache_list
+static void kmem_cache_register(struct kmem_cache *cache) {
+    write_lock(&cache_list_lock);
+    cache->next = cache_list;
+    cache_list = cache;
+    write_unlock(&cache_list_lock);
+}
+
+// Helper: Remove a cache from cache_list
+static void kmem_cache_unregister(struct kmem_cache *cache) {
+    write_lock(&cache_list_lock);
+
+    struct kmem_cache **link = &cache_list;
+    while (*link && *link != cache) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = cache->next;
+    }
+
+    write_unlock(&cache_list_lock);
+}
+
+// Helper: Slab to allocate from, a partial one if possible (slab_lock
+// held, *irq from spin_lock_irqsave()). Growing the cache drops the lock
+// while the page is allocated.
+static struct slab *slab_get(struct kmem_cache *cache, int pmm_flags, uint64_t *irq) {
+    struct slab *slab;
+
+    if (!list_empty(&cache->partial)) {
+        slab = list_first_entry(&cache->partial, struct slab, link);
+    } else if (!list_empty(&cache->empty)) {
+        // Start on a reserve slab
+        slab = list_first_entry(&cache->empty, struct slab, link);
+        list_move(&slab->link, &cache->partial);
+        cache->nr_empty--;
+        cache->nr_partial++;
+    } else {
+        // No partial slabs, create a new one. Another CPU may grow the
+        // cache meanwhile, which only means a spare partial slab.
+        spin_unlock_irqrestore(&cache->slab_lock, *irq);
+        slab = slab_create(cache, pmm_flags);
+        *irq = spin_lock_irqsave(&cache->slab_lock);
+
+        if (!slab) {
+            return NULL;
+        }
+        list_add(&slab->link, &cache->partial);
+        cache->nr_partial++;
+        cache->grows++;
+    }
+
+    return slab;
+}
+
+// Helper: First hand-out of the object at index idx. Runs the ctor, and
+// says whether the object is still all zero.
+static inline int slab_first_use(struct kmem_cache *cache, struct slab *slab,
+                                 void *obj, int idx) {
+    slab->fresh = idx + 1;
+
+    if (cache->ctor) {
+        cache->ctor(obj);
+        return 0;
+    }
+    return slab->zeroed;
+}
+
+// Helper: Take one free object off a slab (free_count > 0). List moves
+// are left to the caller. *zeroed (if given) says whether the object is
+// known to be all zero.
+static inline void *slab_take(struct kmem_cache *cache, struct slab *slab, int *zeroed) {
+    uint8_t *objects = (uint8_t *)slab + cache->obj_offset;
+    int zero = 0;
+
+    if (cache->flags & KMC_BITMAP) {
+        // First set bit of the first non-empty word, tzcnt/bsf
+        for (size_t w = 0; w < cache->map_words; w++) {
+            uint64_t word = slab->free_map[w];
+            if (word) {
+                slab->free_map[w] = word & (word - 1);
+                slab->free_count--;
+
+                // The lowest free index is past everything handed out
+                // before only if the object was never used
+                int idx = w * 64 + __builtin_ctzll(word);
+                void *obj = objects + idx * cache->stride;
+                if (idx >= slab->fresh) {
+                    zero = slab_first_use(cache, slab, obj, idx);
+                }
+
+                if (zeroed) *zeroed = zero;
+                return obj;
+            }
+        }
+        return NULL;
+    }
+
+    void *obj = slab->freelist;
+    if (obj) {
+        // Update freelist to next free object
+        slab->freelist = *(void **)((uint8_t *)obj + cache->free_off);
+    } else if (slab->fresh < slab->total_count) {
+        obj = objects + slab->fresh * cache->stride;
+        zero = slab_first_use(cache, slab, obj, slab->fresh);
+    } else {
+        return NULL;
+    }
+
+    slab->free_count--;
+    if (zeroed) *zeroed = zero;
+    return obj;
+}
+
+// Helper: Put one object back on its slab, list moves are left to the
+// caller. Bitmap slabs reject pointers that aren't allocated objects.
+static inline int slab_put(struct kmem_cache *cache, struct slab *slab, void *ptr) {
+    if (cache->flags & KMC_BITMAP) {
+        uint64_t off = (uint64_t)ptr - (uint64_t)slab - cache->obj_offset;
+        uint64_t idx = (off * cache->stride_recip) >> 32;
+
+        // Bounded by the objects, not the page: the tail slack past the
+        // last one can hold stride-aligned pointers too
+        if (off >= (uint64_t)slab->total_count * cache->stride || idx * cache->stride != off ||
+            (slab->free_map[idx / 64] & (1ULL << (idx % 64)))) {
+            klog(KLOG_ERR, "KALLOC: Bad or double free in %s!\n", cache->name);
+            return -1;
+        }
+
+        slab->free_map[idx / 64] |= 1ULL << (idx % 64);
+        slab->free_count++;
+        return 0;
+    }
+
+    *(void **)((uint8_t *)ptr + cache->free_off) = slab->freelist;
+    slab->freelist = ptr;
+    slab->free_count++;
+    return 0;
+}
+
+// Helper: Move a slab to the right list after objects came back to it
+static void slab_settle(struct kmem_cache *cache, struct slab *slab, int was_full) {
+    // If slab was full, move it back to partial list
+    if (was_full && slab->free_count > 0) {
+        list_move(&slab->link, &cache->partial);
+        cache->nr_full--;
+        cache->nr_partial++;
+    }
+
+    // If the slab is now completely empty, park it. Any beyond empty_keep
+    // are freed by slab_trim() once the lock is dropped.
+    if (slab->free_count == slab->total_count) {
+        list_move(&slab->link, &cache->empty);
+        cache->nr_partial--;
+        cache->nr_empty++;
+    }
+}
+
+// Helper: Pop an object straight from the slab layer
+static void *slab_alloc(struct kmem_cache *cache, int pmm_flags, int *zeroed) {
+    uint64_t irq = spin_lock_irqsave(&cache->slab_lock);
+
+    struct slab *slab = slab_get(cache, pmm_flags, &irq);
+    if (!slab) {
+        spin_unlock_irqrestore(&cache->slab_lock, irq);
+        return NULL;
+    }
+
+    void *obj = slab_take(cache, slab, zeroed);
+    if (!obj) {
+        spin_unlock_irqrestore(&cache->slab_lock, irq);
+        klog(KLOG_ERR, "KALLOC: Slab has no free object but free_count > 0!\n");
+        return NULL;
+    }
+
+    // If slab is now full, move it to full list
+    if (slab->free_count == 0) {
+        list_move(&slab->link, &cache->full);
+        cache->nr_partial--;
+        cache->nr_full++;
+    }
+
+    spin_unlock_irqrestore(&cache->slab_lock, irq);
+    return obj;
+}
+
+// Helper: Push an object back to its slab (slab_lock held)
+static void slab_free_locked(struct kmem_cache *cache, void *ptr) {
+    uint64_t slab_addr = (uint64_t)ptr & ~0xFFFULL;
+    struct slab *slab = (struct slab *)slab_addr;
+
+    int was_full = (slab->free_count == 0);
+
+    if (slab_put(cache, slab, ptr) == 0) {
+        slab_settle(cache, slab, was_full);
+    }
+}
+
+// Helper: Free empty slabs beyond `keep`, returns how many went
+static uint64_t slab_trim_to(struct kmem_cache *cache, size_t keep) {
+    struct list_head doomed;
+
+    // Unlocked look first, frees call this every time
+    if (__atomic_load_n(&cache->nr_empty, __ATOMIC_RELAXED) <= keep) {
+        return 0;
+    }
+
+    list_init(&doomed);
+    uint64_t irq = spin_lock_irqsave(&cache->slab_lock);
+    while (cache->nr_empty > keep) {
+        slab_unlink(cache, list_first_entry(&cache->empty, struct slab, link), &doomed);
+    }
+    spin_unlock_irqrestore(&cache->slab_lock, irq);
+
+    return slab_release_list(&doomed);
+}
+
+// Helper: Free empty slabs beyond what the cache wants to keep
+static void slab_trim(struct kmem_cache *cache) {
+    slab_trim_to(cache, __atomic_load_n(&cache->empty_keep, __ATOMIC_RELAXED));
+}
+
+// Helper: Push an object straight back to its slab
+static void slab_free(struct kmem_cache *cache, void *ptr) {
+    uint64_t irq = spin_lock_irqsave(&cache->slab_lock);
+    slab_free_locked(cache, ptr);
+    spin_unlock_irqrestore(&cache->slab_lock, irq);
+    slab_trim(cache);
+}
+
+// Helper: Take the depot lock with interrupts off, sampling contention
+// to size magazines. Returns the flags for depot_unlock().
+static uint64_t depot_lock(struct kmem_cache *cache, struct mcs_node *node) {
+    struct kmem_depot *depot = &cache->depot;
+    uint64_t irq = local_irq_save();
+
+    if (!mcs_trylock(&depot->lock, node)) {
+        mcs_lock(&depot->lock, node);
+        depot->contended++;
+    }
+
+    if (++depot->accesses < MAG_RESIZE_WINDOW) {
+        return irq;
+    }
+
+    // Contended enough this window: hand out bigger magazines from now on
+    int max_type = cache->object_sz >= 1024 ? MAG_MAX_TYPE_LARGE_OBJ : MAG_TYPES - 1;
+    if (depot->contended > MAG_RESIZE_THRESHOLD && depot->mag_type < max_type) {
+        depot->mag_type++;
+    }
+
+    depot->accesses = 0;
+    depot->contended = 0;
+    return irq;
+}
+
+static void depot_unlock(struct kmem_cache *cache, struct mcs_node *node, uint64_t irq) {
+    mcs_unlock_irqrestore(&cache->depot.lock, node, irq);
+}
+
+// Helper: Pop a magazine from a depot list (depot lock held)
+static struct kmem_magazine *depot_pop(struct kmem_magazine **list, int *count) {
+    struct kmem_magazine *mag = *list;
+
+    if (mag) {
+        *list = mag->next;
+        (*count)--;
+    }
+
+    return mag;
+}
+
+// Helper: Push a magazine onto a depot list (depot lock held)
+static void depot_push(struct kmem_magazine **list, int *count, struct kmem_magazine *mag) {
+    mag->next = *list;
+    *list = mag;
+    (*count)++;
+}
+
+// Helper: Return a magazine's rounds to the slab layer and free it
+static void magazine_destroy(struct kmem_cache *cache, struct kmem_magazine *mag) {
+    uint64_t irq = spin_lock_irqsave(&cache->slab_lock);
+    for (int i = 0; i < mag->rounds; i++) {
+        slab_free_locked(cache, mag->objs[i]);
+    }
+    spin_unlock_irqrestore(&cache->slab_lock, irq);
+    slab_trim(cache);
+
+    for (int t = 0; t < MAG_TYPES; t++) {
+        if (mag_types[t] == mag->size) {
+            kmem_cache_free(&mag_caches[t], mag);
+            return;
+        }
+    }
+}
+
+// Helper: Destroy a chain of magazines detached from a depot
+static void magazine_destroy_list(struct kmem_cache *cache, struct kmem_magazine *mag) {
+    while (mag) {
+        struct kmem_magazine *next = mag->next;
+        magazine_destroy(cache, mag);
+        mag = next;
+    }
+}
+
+// Helper: Flush every magazine of a cache back to its slabs. Only for a
+// cache no CPU uses any more.
+static void kmem_cache_drain(struct kmem_cache *cache) {
+    for (int i = 0; i < MAX_CPUS; i++) {
+        struct kmem_cpu_cache *cc = &cache->cpu[i];
+
+        if (cc->loaded) {
+            magazine_destroy(cache, cc->loaded);
+            cc->loaded = NULL;
+        }
+        if (cc->previous) {
+            magazine_destroy(cache, cc->previous);
+            cc->previous = NULL;
+        }
+    }
+
+    // Detach the depot's magazines, they are destroyed outside its lock
+    struct kmem_depot *depot = &cache->depot;
+    struct mcs_node node;
+    uint64_t irq = mcs_lock_irqsave(&depot->lock, &node);
+
+    struct kmem_magazine *full = depot->full;
+    struct kmem_magazine *empty = depot->empty;
+    depot->full = depot->empty = NULL;
+    depot->nfull = depot->nempty = 0;
+
+    mcs_unlock_irqrestore(&depot->lock, &node, irq);
+
+    magazine_destroy_list(cache, full);
+    magazine_destroy_list(cache, empty);
+}
+
+// Helper: Allocate an object from a cache. *zeroed (if given) says whether
+// it is known to be all zero, which only fresh slab objects can be.
+static inline void *cache_alloc(struct kmem_cache *cache, int pmm_flags, int *zeroed) {
+    if (zeroed) {
+        *zeroed = 0;
+    }
+
+    if (!(cache->flags & KMC_NOMAGAZINE)) {
+        // The magazines are this CPU's alone. With interrupts off a handler
+        // allocating here never sees one half swapped.
+        uint64_t irq = local_irq_save();
+        struct kmem_cpu_cache *cc = &cache->cpu[cpu_id()];
+
+        for (;;) {
+            // Fast path: a round in the loaded magazine
+            struct kmem_magazine *loaded = cc->loaded;
+            if (loaded && loaded->rounds > 0) {
+                void *obj = loaded->objs[--loaded->rounds];
+                cc->allocs++;
+                local_irq_restore(irq);
+                return obj;
+            }
+
+            // Previous magazine is full, swap it in
+            if (cc->previous && cc->previous->rounds > 0) {
+                cc->loaded = cc->previous;
+                cc->previous = loaded;
+                continue;
+            }
+
+            // Both empty, exchange the previous one for a full one from the depot
+            struct mcs_node node;
+            uint64_t dirq = depot_lock(cache, &node);
+            struct kmem_magazine *full = depot_pop(&cache->depot.full, &cache->depot.nfull);
+            if (full) {
+                if (cc->previous) {
+                    depot_push(&cache->depot.empty, &cache->depot.nempty, cc->previous);
+                }
+                cc->previous = loaded;
+                cc->loaded = full;
+            }
+            depot_unlock(cache, &node, dirq);
+
+            if (!full) {
+                break;
+            }
+        }
+
+        local_irq_restore(irq);
+    }
+
+    // Depot has nothing cached, go to the slab layer
+    void *obj = slab_alloc(cache, pmm_flags, zeroed);
+    if (obj) {
+        __atomic_fetch_add(&cache->cpu[cpu_id()].allocs, 1, __ATOMIC_RELAXED);
+    }
+    return obj;
+}
+
+// Helper: PMM flags carrying out what KM_* flags ask of a page allocation
+static int km_to_pmm(int flags) {
+    int pmm_flags = 0;
+
+    if (flags & KM_ATOMIC) {
+        pmm_flags |= PMM_ATOMIC;
+    }
+    if (flags & KM_ZERO) {
+        pmm_flags |= PMM_ZERO;
+    }
+    if (flags & KM_DMA32) {
+        pmm_flags |= PMM_DMA32;
+    }
+    return pmm_flags;
+}
+
+// Helper: Slab allocation honoring KM_* flags. For KM_ZERO the slab page is
+// taken from the pre-zeroed pool if possible, so objects from fresh slabs
+// don't need clearing.
+static void *cache_alloc_flags(struct kmem_cache *cache, int flags) {
+    int pmm_flags = km_to_pmm(flags) & ~(PMM_ZERO | PMM_DMA32);
+    if (flags & KM_ZERO) {
+        pmm_flags |= PMM_PREFER_ZERO;
+    }
+
+    int zeroed;
+    void *obj = cache_alloc(cache, pmm_flags, &zeroed);
+
+    if (obj && (flags & KM_ZERO)) {
+        if (zeroed) {
+            __atomic_fetch_add(&kmalloc_zero_skipped, 1, __ATOMIC_RELAXED);
+        } else {
+            memset(obj, 0, cache->object_sz);
+        }
+    }
+    return obj;
+}
+
+// Allocate an object from a cache
+void *kmem_cache_alloc(struct kmem_cache *cache) {
+    return cache_alloc(cache, 0, NULL);
+}
+
+// Allocate an object with KM_* flags (zone hints don't apply to caches)
+void *kmem_cache_alloc_flags(struct kmem_cache *cache, int flags) {
+    return cache_alloc_flags(cache, flags);
+}
+
+// Free an object back to its cache
+void kmem_cache_free(struct kmem_cache *cache, void *ptr) {
+    if (!ptr) return;
+    
+    // Find which slab this object belongs to by rounding down
+    uint64_t slab_addr = (uint64_t)ptr & ~0xFFFULL;
+    struct slab *slab = (struct slab *)slab_addr;
+    
+    // Sanity check
+    if (slab->cache != cache) {
+        klog(KLOG_ERR, "KALLOC: Object freed to wrong cache!\n");
+        return;
+    }
+
+    struct kmem_cpu_cache *cc = &cache->cpu[cpu_id()];
+
+    if (cache->flags & KMC_NOMAGAZINE) {
+        __atomic_fetch_add(&cc->frees, 1, __ATOMIC_RELAXED);
+        slab_free(cache, ptr);
+        return;
+    }
+
+    // Interrupts off around the magazines, as in cache_alloc()
+    uint64_t irq = local_irq_save();
+
+    for (;;) {
+        // Fast path: room in the loaded magazine
+        struct kmem_magazine *loaded = cc->loaded;
+        if (loaded && loaded->rounds < loaded->size) {
+            cc->frees++;
+            loaded->objs[loaded->rounds++] = ptr;
+            local_irq_restore(irq);
+            return;
+        }
+
+        // Previous magazine is empty, swap it in
+        if (cc->previous && cc->previous->rounds == 0) {
+            cc->loaded = cc->previous;
+            cc->previous = loaded;
+            continue;
+        }
+
+        // Both full, exchange the previous one for an empty one from the depot
+        struct mcs_node node;
+        uint64_t dirq = depot_lock(cache, &node);
+        struct kmem_magazine *empty = depot_pop(&cache->depot.empty, &cache->depot.nempty);
+        if (empty) {
+            if (cc->previous) {
+                depot_push(&cache->depot.full, &cache->depot.nfull, cc->previous);
+            }
+            cc->previous = loaded;
+            cc->loaded = empty;
+        }
+        int mag_type = cache->depot.mag_type;
+        depot_unlock(cache, &node, dirq);
+
+        if (empty) {
+            continue;
+        }
+
+        // No empty magazines cached, make one and retry. A free may come
+        // from an interrupt handler, so it never reclaims.
+        local_irq_restore(irq);
+        struct kmem_magazine *mag = cache_alloc(&mag_caches[mag_type], PMM_ATOMIC, NULL);
+        if (!mag) {
+            break;
+        }
+        mag->rounds = 0;
+        mag->size = mag_types[mag_type];
+
+        dirq = depot_lock(cache, &node);
+        depot_push(&cache->depot.empty, &cache->depot.nempty, mag);
+        depot_unlock(cache, &node, dirq);
+
+        irq = local_irq_save();
+    }
+
+    // Out of memory for magazines, go to the slab layer
+    __atomic_fetch_add(&cc->frees, 1, __ATOMIC_RELAXED);
+    slab_free(cache, ptr);
+}
+
+// Helper: Take up to `n` objects from one slab in a single step, returns
+// how many were taken. The slab moves lists at most once.
+static size_t slab_alloc_bulk(struct kmem_cache *cache, size_t n, void **out) {
+    uint64_t irq = spin_lock_irqsave(&cache->slab_lock);
+
+    struct slab *slab = slab_get(cache, 0, &irq);
+    if (!slab) {
+        spin_unlock_irqrestore(&cache->slab_lock, irq);
+        return 0;
+    }
+
+    size_t taken = 0;
+    while (taken < n && slab->free_count > 0) {
+        void *obj = slab_take(cache, slab, NULL);
+        if (!obj) {
+            break;
+        }
+        out[taken++] = obj;
+    }
+
+    if (slab->free_count == 0) {
+        list_move(&slab->link, &cache->full);
+        cache->nr_partial--;
+        cache->nr_full++;
+    }
+
+    spin_unlock_irqrestore(&cache->slab_lock, irq);
+    return taken;
+}
+
+// Allocate `n` objects into out[]. Returns n, or 0 with nothing allocated
+// if memory ran out.
+size_t kmem_cache_alloc_bulk(struct kmem_cache *cache, size_t n, void **out) {
+    struct kmem_cpu_cache *cc = &cache->cpu[cpu_id()];
+    size_t done = 0;
+
+    // Empty cached magazines first, the same way kmem_cache_alloc() does,
+    // interrupts off while they're touched
+    uint64_t irq = local_irq_save();
+    while (!(cache->flags & KMC_NOMAGAZINE) && done < n) {
+        struct kmem_magazine *loaded = cc->loaded;
+        if (loaded && loaded->rounds > 0) {
+            while (loaded->rounds > 0 && done < n) {
+                out[done++] = loaded->objs[--loaded->rounds];
+            }
+            continue;
+        }
+
+        if (cc->previous && cc->previous->rounds > 0) {
+            cc->loaded = cc->previous;
+            cc->previous = loaded;
+            continue;
+        }
+
+        struct mcs_node node;
+        uint64_t dirq = depot_lock(cache, &node);
+        struct kmem_magazine *full = depot_pop(&cache->depot.full, &cache->depot.nfull);
+        if (full) {
+            if (cc->previous) {
+                depot_push(&cache->depot.empty, &cache->depot.nempty, cc->previous);
+            }
+            cc->previous = loaded;
+            cc->loaded = full;
+        }
+        depot_unlock(cache, &node, dirq);
+
+        if (!full) {
+            break;
+        }
+    }
+    local_irq_restore(irq);
+
+    // Then detach runs of objects straight from slabs
+    while (done < n) {
+        size_t got = slab_alloc_bulk(cache, n - done, out + done);
+        if (got == 0) {
+            __atomic_fetch_add(&cc->allocs, done, __ATOMIC_RELAXED);
+            kmem_cache_free_bulk(cache, done, out);
+            return 0;
+        }
+        done += got;
+    }
+
+    __atomic_fetch_add(&cc->allocs, n, __ATOMIC_RELAXED);
+    return n;
+}
+
+// Free `n` objects from the same cache. Objects are grouped by slab so
+// each slab is checked and relinked once. ptrs[] is clobbered.
+void kmem_cache_free_bulk(struct kmem_cache *cache, size_t n, void **ptrs) {
+    struct kmem_cpu_cache *cc = &cache->cpu[cpu_id()];
+    size_t i = 0;
+
+    __atomic_fetch_add(&cc->frees, n, __ATOMIC_RELAXED);
+
+    // Fill cached magazines first, interrupts off. Unlike kmem_cache_free()
+    // no new magazines are made, whatever doesn't fit goes to the slabs.
+    uint64_t irq = local_irq_save();
+    while (!(cache->flags & KMC_NOMAGAZINE) && i < n) {
+        struct kmem_magazine *loaded = cc->loaded;
+        if (loaded && loaded->rounds < loaded->size) {
+            while (loaded->rounds < loaded->size && i < n) {
+                void *ptr = ptrs[i++];
+                if (!ptr) continue;
+
+                if (((struct slab *)((uint64_t)ptr & ~0xFFFULL))->cache != cache) {
+                    klog(KLOG_ERR, "KALLOC: Object freed to wrong cache!\n");
+                    continue;
+                }
+                loaded->objs[loaded->rounds++] = ptr;
+            }
+            continue;
+        }
+
+        if (cc->previous && cc->previous->rounds == 0) {
+            cc->loaded = cc->previous;
+            cc->previous = loaded;
+            continue;
+        }
+
+        struct mcs_node node;
+        uint64_t dirq = depot_lock(cache, &node);
+        struct kmem_magazine *empty = depot_pop(&cache->depot.empty, &cache->depot.nempty);
+        if (empty) {
+            if (cc->previous) {
+                depot_push(&cache->depot.full, &cache->depot.nfull, cc->previous);
+            }
+            cc->previous = loaded;
+            cc->loaded = empty;
+        }
+        depot_unlock(cache, &node, dirq);
+
+        if (!empty) {
+            break;
+        }
+    }
+    local_irq_restore(irq);
+
+    if (i == n) {
+        return;
+    }
+
+    // The rest goes back to slabs, each slab is checked and moved once
+    irq = spin_lock_irqsave(&cache->slab_lock);
+
+    for (; i < n; i++) {
+        void *head = ptrs[i];
+        if (!head) continue;
+
+        struct slab *slab = (struct slab *)((uint64_t)head & ~0xFFFULL);
+        if (slab->cache != cache) {
+            klog(KLOG_ERR, "KALLOC: Object freed to wrong cache!\n");
+            continue;
+        }
+
+        int was_full = (slab->free_count == 0);
+        slab_put(cache, slab, head);
+
+        // Pull in later objects from the same slab, looking a bounded
+        // distance ahead so huge batches don't go quadratic
+        size_t end = (n - i > KMEM_BULK_LOOKAHEAD) ? i + KMEM_BULK_LOOKAHEAD : n;
+        for (size_t j = i + 1; j < end; j++) {
+            void *ptr = ptrs[j];
+            if (!ptr || ((uint64_t)ptr & ~0xFFFULL) != (uint64_t)slab) {
+                continue;
+            }
+
+            slab_put(cache, slab, ptr);
+            ptrs[j] = NULL;
+        }
+
+        slab_settle(cache, slab, was_full);
+    }
+
+    spin_unlock_irqrestore(&cache->slab_lock, irq);
+    slab_trim(cache);
+}
+
+// Create a dedicated object cache
+struct kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align,
+                                     kmem_ctor_t ctor, int flags) {
+    struct kmem_cache *cache = kmem_cache_alloc(&cache_cache);
+    if (!cache) {
+        return NULL;
+    }
+
+    if (kmem_cache_init(cache, name, size, align, ctor, flags) != 0) {
+        klog(KLOG_ERR, "KALLOC: Bad layout for cache %s\n", name);
+        kmem_cache_free(&cache_cache, cache);
+        return NULL;
+    }
+
+    kmem_cache_register(cache);
+    return cache;
+}
+
+// Destroy a cache, every object must have been freed already
+int kmem_cache_destroy(struct kmem_cache *cache) {
+    if (!cache) {
+        return -1;
+    }
+
+    kmem_cache_drain(cache);
+
+    uint64_t irq = spin_lock_irqsave(&cache->slab_lock);
+    int live = cache->nr_full || cache->nr_partial;
+    spin_unlock_irqrestore(&cache->slab_lock, irq);
+
+    if (live) {
+        klog(KLOG_WARN, "KALLOC: Destroying cache %s with live objects!\n", cache->name);
+        return -1;
+    }
+
+    cache->empty_keep = 0;
+    slab_trim(cache);
+
+    kmem_cache_unregister(cache);
+    kmem_cache_free(&cache_cache, cache);
+    return 0;
+}
+
+// Set how many empty slabs a cache holds on to before giving pages back
+void kmem_cache_set_empty_keep(struct kmem_cache *cache, size_t keep) {
+    __atomic_store_n(&cache->empty_keep, keep, __ATOMIC_RELAXED);
+    slab_trim(cache);
+}
+
+// Helper: Return this CPU's magazines of every cache to the slabs. Runs
+// on each CPU through smp_call_all() from kmem_shrink_flush(), whose
+// caller holds cache_list_lock for reading until every CPU is done, so
+// the list is walked without taking it again.
+static void kmem_cpu_flush(void *arg) {
+    (void)arg;
+
+    for (struct kmem_cache *cache = cache_list; cache; cache = cache->next) {
+        if (cache->flags & KMC_NOMAGAZINE) {
+            continue;
+        }
+
+        uint64_t irq = local_irq_save();
+        struct kmem_cpu_cache *cc = &cache->cpu[cpu_id()];
+
+        struct kmem_magazine *loaded = cc->loaded;
+        struct kmem_magazine *previous = cc->previous;
+        cc->loaded = NULL;
+        cc->previous = NULL;
+        local_irq_restore(irq);
+
+        if (loaded) {
+            magazine_destroy(cache, loaded);
+        }
+        if (previous) {
+            magazine_destroy(cache, previous);
+        }
+    }
+}
+
+// Helper: Give back everything in a cache's depot and its empty slabs.
+// The per-CPU magazines were flushed by kmem_shrink_flush() already.
+static uint64_t kmem_cache_reap(struct kmem_cache *cache) {
+    uint64_t shrinks = cache->shrinks;
+
+    if (!(cache->flags & KMC_NOMAGAZINE)) {
+        struct kmem_depot *depot = &cache->depot;
+        struct mcs_node node;
+        uint64_t irq = mcs_lock_irqsave(&depot->lock, &node);
+
+        struct kmem_magazine *full = depot->full;
+        struct kmem_magazine *empty = depot->empty;
+        depot->full = depot->empty = NULL;
+        depot->nfull = depot->nempty = 0;
+
+        mcs_unlock_irqrestore(&depot->lock, &node, irq);
+
+        magazine_destroy_list(cache, full);
+        magazine_destroy_list(cache, empty);
+    }
+
+    // Under memory pressure the reserve of empty slabs goes too
+    slab_trim_to(cache, 0);
+
+    // Other CPUs' slabs destroyed meanwhile count too, close enough
+    return __atomic_load_n(&cache->shrinks, __ATOMIC_RELAXED) - shrinks;
+}
+
+// Helper: Flush every CPU's magazines, so what they cached counts and can
+// be reaped. Other CPUs are reached by IPI; with interrupts off only this
+// CPU's magazines go. Caches are flushed newest first, so magazines freed
+// into the magazine caches are flushed after them.
+static void kmem_shrink_flush(struct shrinker *shrinker) {
+    (void)shrinker;
+
+    read_lock(&cache_list_lock);
+    if (irqs_enabled()) {
+        smp_call_all(kmem_cpu_flush, NULL);
+    } else {
+        kmem_cpu_flush(NULL);
+    }
+    read_unlock(&cache_list_lock);
+}
+
+// Helper: Pages the slab shrinker could free, cached rounds are counted as
+// if they would fill whole slabs. Per-CPU magazines only count once
+// kmem_shrink_flush() has emptied them.
+static uint64_t kmem_shrink_count(struct shrinker *shrinker) {
+    (void)shrinker;
+    uint64_t pages = 0;
+
+    read_lock(&cache_list_lock);
+
+    for (struct kmem_cache *cache = cache_list; cache; cache = cache->next) {
+        uint64_t rounds = 0;
+
+        if (!(cache->flags & KMC_NOMAGAZINE)) {
+            // The depot lock keeps other CPUs from popping and freeing a
+            // magazine mid-walk
+            struct kmem_depot *depot = &cache->depot;
+            struct mcs_node node;
+            uint64_t irq = mcs_lock_irqsave(&depot->lock, &node);
+
+            for (struct kmem_magazine *mag = depot->full; mag; mag = mag->next) {
+                rounds += mag->rounds;
+            }
+
+            mcs_unlock_irqrestore(&depot->lock, &node, irq);
+        }
+
+        pages += __atomic_load_n(&cache->nr_empty, __ATOMIC_RELAXED) +
+                 rounds / cache->objects_per_slab;
+    }
+
+    read_unlock(&cache_list_lock);
+    return pages;
+}
+
+// Helper: Reap caches until enough pages came back. cache_list has the
+// newest caches first, so the magazine caches and cache_cache are reaped
+// after the caches whose magazines end up freed into them.
+static uint64_t kmem_shrink_scan(struct shrinker *shrinker, uint64_t nr_to_scan) {
+    (void)shrinker;
+    uint64_t freed = 0;
+
+    read_lock(&cache_list_lock);
+
+    for (struct kmem_cache *cache = cache_list; cache && freed < nr_to_scan;
+         cache = cache->next) {
+        freed += kmem_cache_reap(cache);
+    }
+
+    read_unlock(&cache_list_lock);
+    return freed;
+}
+
+static struct shrinker kmem_shrinker = {
+    .name = "slab",
+    .flush = kmem_shrink_flush,
+    .count = kmem_shrink_count,
+    .scan = kmem_shrink_scan,
+};
+
+// Helper: Give a page unmapped by vmm_unmap_range() back to the PMM
+static void large_release_page(uint64_t phys) {
+    pmm_free((void *)(phys + hhdm_request.response->offset));
+}
+
+// Helper: Back [vaddr, vaddr + num_pages pages) with fresh physical pages
+static int large_map_pages(uint64_t vaddr, size_t num_pages, int pmm_flags) {
+    for (size_t i = 0; i < num_pages; i++) {
+        void *phys_virt = pmm_alloc_pages_flags(0, pmm_flags);
+        uint64_t phys = (uint64_t)phys_virt - hhdm_request.response->offset;
+
+        if (!phys_virt || vmm_map(vaddr + (i * 4096), phys, VMM_WRITE) != 0) {
+            // Cleanup on failure
+            if (phys_virt) {
+                pmm_free(phys_virt);
+            }
+            vmm_unmap_range(vaddr, i, large_release_page);
+            return -1;
+        }
+    }
 
-// Tossing the heap in virtual mem after the kernel
-#define HEAP_START 0xFFFFFFFF90000000ULL
-static uint64_t heap_current = HEAP_START;
+    return 0;
+}
 
-// Forward declare functions
-void *kmalloc(size_t size);
-void  kfree(void *ptr);
-void *krealloc(void *ptr, size_t new_size);
+// Helper: Unmap pages and give them back to the PMM, one TLB shootdown
+// for the whole range
+static void large_unmap_pages(uint64_t vaddr, size_t num_pages) {
+    vmm_unmap_range(vaddr, num_pages, large_release_page);
+}
 
-// Helper: Alloc virtual address range for heap
-static void *heap_alloc_pages(size_t num_pages, uint64_t *out_phys) {
-    uint64_t v_addr = heap_current;
-    heap_current += num_pages * 4096;
-    
-    uint64_t first_phys = 0;
-    
+// Helper: Move the pages behind one VA range to another, no data is copied
+static int large_remap_pages(uint64_t from, uint64_t to, size_t num_pages) {
+    // Map everything at the new address first so failure is easy to undo
     for (size_t i = 0; i < num_pages; i++) {
-        void *phys_virt = pmm_alloc();
-        if (!phys_virt) {
-            serial_puts("KALLOC: Out of physical memory!\n");
-            return NULL;
-        }
+        uint64_t phys;
+        vmm_translate(from + (i * 4096), &phys);
 
-        uint64_t phys = (uint64_t)phys_virt - hhdm_request.response->offset;
-        
-        if (i == 0) {
-            first_phys = phys;
-        }
-        
-        if (vmm_map(v_addr + (i * 4096), phys, VMM_WRITE) != 0) {
-            serial_puts("KALLOC: Failed to map heap page!\n");
-            return NULL;
+        if (vmm_map(to + (i * 4096), phys, VMM_WRITE) != 0) {
+            vmm_unmap_range(to, i, NULL);
+            return -1;
         }
     }
-    
-    if (out_phys) {
-        *out_phys = first_phys;
-    }
 
-    return (void *)v_addr;
+    vmm_unmap_range(from, num_pages, NULL);
+
+    return 0;
 }
 
-// Helper: Create a new slab for a cache
-static struct slab *slab_create(struct kmem_cache *cache) {
-    uint64_t phys_addr;
-    void *slab_mem = heap_alloc_pages(1, &phys_addr);
-    if (!slab_mem)
-        return NULL;
+// Helper: Smallest buddy order that covers size bytes
+static unsigned int size_to_order(size_t size) {
+    unsigned int order = 0;
+    while ((4096ULL << order) < size) {
+        order++;
+    }
+    return order;
+}
 
-    struct slab *slab = (struct slab *)slab_mem;
-    slab->cache = cache;
-    slab->free_count = cache->objects_per_slab;
-    slab->total_count = cache->objects_per_slab;
-    slab->next = NULL;
-    slab->phys_addr = phys_addr;
+// Allocate large memory as one physically contiguous block, addressed
+// through the HHDM so no page tables are touched
+static void *kmalloc_contig(size_t size, int pmm_flags) {
+    unsigned int order = size_to_order(size);
+    if (order > KMALLOC_CONTIG_MAX_ORDER) {
+        return NULL;
+    }
+    return pmm_alloc_pages_flags(order, pmm_flags);
+}
 
-    // Objects after slab header 
-    size_t header_size = sizeof(struct slab);
-    size_t aligned_header = (header_size + 15) & ~15;
-    void *objects_start = (uint8_t *)slab_mem + aligned_header;
+// Check if pointer is a block from kmalloc_contig()
+static int is_contig_alloc(void *ptr) {
+    // Everything the heap maps itself lives above HEAP_START
+    if ((uint64_t)ptr >= HEAP_START) {
+        return 0;
+    }
+    return pmm_block_order(ptr) >= 0;
+}
 
-    // Building the freelist
-    slab->freelist = objects_start;
-    uint8_t *obj = (uint8_t *)objects_start;
+// Allocate large (>4KB) memory directly via pages
+static void *kmalloc_large(size_t size, int pmm_flags) {
+    // Calculate number of pages needed
+    size_t num_pages = (size + 4095) / 4096;
     
-    for (size_t i = 0; i < cache->objects_per_slab - 1; i++) {
-        void **next_ptr = (void **)obj;
-        *next_ptr = obj + cache->object_sz;
-        obj += cache->object_sz;
+    struct large_alloc *alloc = cache_alloc(&large_cache, pmm_flags & PMM_ATOMIC, NULL);
+    if (!alloc) {
+        return NULL;
     }
-
-    // The last object points to nil
-    void **last = (void **)obj;
-    *last = NULL;
     
-    return slab;
-}
+    // Reserve the VA range and back it with pages, the latter outside the
+    // lock as it may reclaim
+    uint64_t irq = write_lock_irqsave(&large_lock);
+    uint64_t v_addr = va_alloc(num_pages * 4096);
+    write_unlock_irqrestore(&large_lock, irq);
 
-// Helper: Destroy the slab and return memory to VMM/PMM
-static void slab_destroy(struct kmem_cache *cache, struct slab *slab) {
-    // Remove from partial list
-    if (cache->partial == slab) {
-        cache->partial = slab->next;
-    } else {
-        struct slab *prev = cache->partial;
-        while (prev && prev->next != slab) {
-            prev = prev->next;
-        }
-        if (prev) {
-            prev->next = slab->next;
-        }
+    if (!v_addr) {
+        klog(KLOG_ERR, "KALLOC: Large heap window exhausted!\n");
+        kmem_cache_free(&large_cache, alloc);
+        return NULL;
     }
 
-    uint64_t v_addr = (uint64_t)slab;
-    uint64_t phys = slab->phys_addr;
+    if (large_map_pages(v_addr, num_pages, pmm_flags) != 0) {
+        irq = write_lock_irqsave(&large_lock);
+        va_release(v_addr, num_pages * 4096);
+        write_unlock_irqrestore(&large_lock, irq);
+        kmem_cache_free(&large_cache, alloc);
+        return NULL;
+    }
     
-    // Unmap the virtual page
-    vmm_unmap(v_addr);
+    alloc->magic = LARGE_ALLOC_MAGIC;
+    alloc->vaddr = v_addr;
+    alloc->size = size;
+    alloc->num_pages = num_pages;
+
+    irq = write_lock_irqsave(&large_lock);
+    large_insert(alloc);
+    write_unlock_irqrestore(&large_lock, irq);
     
-    // Free the physical page back to PMM
-    void *phys_virt = (void *)(phys + hhdm_request.response->offset);
-    pmm_free(phys_virt);
-} 
+    return (void *)v_addr;
+}
 
-// Helper: Init a cache
-static void kmem_cache_init(struct kmem_cache *cache, const char *name, size_t object_size) {
-    cache->name = name;
-    cache->object_sz = object_size;
-    cache->partial = NULL;
-    cache->full = NULL;
+// Helper: Give a VA range back to the large window
+static void va_release_locked(uint64_t base, uint64_t size) {
+    uint64_t irq = write_lock_irqsave(&large_lock);
+    va_release(base, size);
+    write_unlock_irqrestore(&large_lock, irq);
+}
 
-    size_t usable_size = 4096 - sizeof(struct slab) - 16;
-    cache->objects_per_slab = usable_size / object_size;
-    
-    if (cache->objects_per_slab == 0) {
-        cache->objects_per_slab = 1;
+// Resize a large allocation without copying its contents. The header
+// belongs to the caller, only the window and the hash need large_lock.
+static void *krealloc_large(struct large_alloc *alloc, size_t new_size) {
+    size_t new_pages = (new_size + 4095) / 4096;
+    size_t old_pages = alloc->num_pages;
+    uint64_t old_end = alloc->vaddr + old_pages * 4096;
+
+    // Shrinking, or growing within the last page: give back any tail pages
+    if (new_pages <= old_pages) {
+        uint64_t new_end = alloc->vaddr + new_pages * 4096;
+        large_unmap_pages(new_end, old_pages - new_pages);
+        va_release_locked(new_end, (old_pages - new_pages) * 4096);
+
+        alloc->num_pages = new_pages;
+        alloc->size = new_size;
+        return (void *)alloc->vaddr;
     }
-}
 
-// Allocate an object from a cache
-void *kmem_cache_alloc(struct kmem_cache *cache) {
-    struct slab *slab = cache->partial;
-    
-    if (!slab) {
-        // No partial slabs, create a new one
-        slab = slab_create(cache);
-        if (!slab) {
+    size_t extra = new_pages - old_pages;
+
+    // Grow in place when the VA right after us is free
+    uint64_t irq = write_lock_irqsave(&large_lock);
+    int claimed = va_claim(old_end, extra * 4096) == 0;
+    write_unlock_irqrestore(&large_lock, irq);
+
+    if (claimed) {
+        if (large_map_pages(old_end, extra, 0) != 0) {
+            va_release_locked(old_end, extra * 4096);
             return NULL;
         }
-        slab->next = cache->partial;
-        cache->partial = slab;
+
+        alloc->num_pages = new_pages;
+        alloc->size = new_size;
+        return (void *)alloc->vaddr;
     }
-    
-    // Pop it from freelist
-    void *obj = slab->freelist;
-    if (!obj) {
-        serial_puts("KALLOC: Slab freelist empty but free_count > 0!\n");
+
+    // Otherwise move: remap the existing pages to a bigger range and back
+    // only the new tail with fresh pages
+    irq = write_lock_irqsave(&large_lock);
+    uint64_t new_vaddr = va_alloc(new_pages * 4096);
+    write_unlock_irqrestore(&large_lock, irq);
+
+    if (!new_vaddr) {
+        klog(KLOG_ERR, "KALLOC: Large heap window exhausted!\n");
         return NULL;
     }
-    
-    // Update freelist to next free object
-    void **next_ptr = (void **)obj;
-    slab->freelist = *next_ptr;
-    slab->free_count--;
-    
-    // If slab is now full, move it to full list
-    if (slab->free_count == 0) {
-        cache->partial = slab->next;
-        slab->next = cache->full;
-        cache->full = slab;
+
+    if (large_map_pages(new_vaddr + old_pages * 4096, extra, 0) != 0) {
+        va_release_locked(new_vaddr, new_pages * 4096);
+        return NULL;
     }
-    
-    return obj;
-}
 
-// Free an object back to its cache
-void kmem_cache_free(struct kmem_cache *cache, void *ptr) {
-    if (!ptr) return;
-    
-    // Find which slab this object belongs to by rounding down
-    uint64_t slab_addr = (uint64_t)ptr & ~0xFFFULL;
-    struct slab *slab = (struct slab *)slab_addr;
-    
-    // Sanity check
-    if (slab->cache != cache) {
-        serial_puts("KALLOC: Object freed to wrong cache!\n");
-        return;
+    if (large_remap_pages(alloc->vaddr, new_vaddr, old_pages) != 0) {
+        large_unmap_pages(new_vaddr + old_pages * 4096, extra);
+        va_release_locked(new_vaddr, new_pages * 4096);
+        return NULL;
     }
 
-    int was_full = (slab->free_count == 0);
-    
-    // Push object back onto freelist
-    void **next_ptr = (void **)ptr;
-    *next_ptr = slab->freelist;
-    slab->freelist = ptr;
-    slab->free_count++;
-    
-    // If slab was full, move it back to partial list
-    if (was_full) {
-        if (cache->full == slab) {
-            cache->full = slab->next;
-        } else {
-            struct slab *prev = cache->full;
-            while (prev && prev->next != slab) {
-                prev = prev->next;
-            }
-            if (prev) {
-                prev->next = slab->next;
-            }
-        }
+    irq = write_lock_irqsave(&large_lock);
 
-        slab->next = cache->partial;
-        cache->partial = slab;
-    }
+    struct large_alloc **link = NULL;
+    large_find(alloc->vaddr, &link);
+    *link = alloc->next;
 
-    // If the slab is now completely empty, consider freeing it
-    if (slab->free_count == slab->total_count) {
-        int empty_count = 0;
-        struct slab *s = cache->partial;
+    va_release(alloc->vaddr, old_pages * 4096);
 
-        while (s) {
-            if (s->free_count == s->total_count) {
-                empty_count++;
-            }
+    alloc->vaddr = new_vaddr;
+    alloc->num_pages = new_pages;
+    alloc->size = new_size;
+    large_insert(alloc);
 
-            s = s->next;
-        }
+    write_unlock_irqrestore(&large_lock, irq);
+    return (void *)new_vaddr;
+}
 
-        // Keep at least one empty slab as reserve, free the rest
-        if (empty_count > 1) {
-            slab_destroy(cache, slab);
-        }
+// Grow a contiguous block past what its buddies allow by turning it into
+// a page-mapped allocation. Its pages are mapped at the new address as
+// they are, only the tail is new and nothing is copied.
+static void *krealloc_contig(void *ptr, size_t new_size) {
+    size_t old_pages = 1ULL << pmm_block_order(ptr);
+    size_t new_pages = (new_size + 4095) / 4096;
+    uint64_t phys = (uint64_t)ptr - hhdm_request.response->offset;
+
+    struct large_alloc *alloc = kmem_cache_alloc(&large_cache);
+    if (!alloc) {
+        return NULL;
     }
-}
 
-// Allocate large (>4KB) memory directly via pages
-static void *kmalloc_large(size_t size) {
-    // Calculate number of pages needed
-    size_t num_pages = (size + 4095) / 4096;
-    
-    // Allocate header + space for physical address array using a small cache
-    size_t header_size = sizeof(struct large_alloc) + (num_pages * sizeof(uint64_t));
-    if (header_size > 4096) {
-        serial_puts("KALLOC: large alloc header too big (>4KiB); allocation refused");
+    uint64_t irq = write_lock_irqsave(&large_lock);
+    uint64_t v_addr = va_alloc(new_pages * 4096);
+    write_unlock_irqrestore(&large_lock, irq);
+
+    if (!v_addr) {
+        klog(KLOG_ERR, "KALLOC: Large heap window exhausted!\n");
+        kmem_cache_free(&large_cache, alloc);
         return NULL;
     }
-    struct large_alloc *alloc = kmalloc(header_size);
-    if (!alloc) {
+
+    if (large_map_pages(v_addr + old_pages * 4096, new_pages - old_pages, 0) != 0) {
+        va_release_locked(v_addr, new_pages * 4096);
+        kmem_cache_free(&large_cache, alloc);
         return NULL;
     }
-    
-    // Allocate the pages
-    uint64_t v_addr = heap_current;
-    heap_current += num_pages * 4096;
-    
-    for (size_t i = 0; i < num_pages; i++) {
-        void *phys_virt = pmm_alloc();
-        if (!phys_virt) {
-            // Cleanup on failure
-            for (size_t j = 0; j < i; j++) {
-                vmm_unmap(v_addr + (j * 4096));
-                void *pv = (void *)(alloc->phys_addrs[j] + hhdm_request.response->offset);
-                pmm_free(pv);
-            }
-            kfree(alloc);
-            return NULL;
-        }
-        
-        uint64_t phys = (uint64_t)phys_virt - hhdm_request.response->offset;
-        alloc->phys_addrs[i] = phys;
-        
-        if (vmm_map(v_addr + (i * 4096), phys, VMM_WRITE) != 0) {
-            // Cleanup on failure
-            pmm_free(phys_virt);
-            for (size_t j = 0; j < i; j++) {
-                vmm_unmap(v_addr + (j * 4096));
-                void *pv = (void *)(alloc->phys_addrs[j] + hhdm_request.response->offset);
-                pmm_free(pv);
-            }
-            kfree(alloc);
+
+    for (size_t i = 0; i < old_pages; i++) {
+        if (vmm_map(v_addr + (i * 4096), phys + (i * 4096), VMM_WRITE) != 0) {
+            vmm_unmap_range(v_addr, i, NULL);
+            large_unmap_pages(v_addr + old_pages * 4096, new_pages - old_pages);
+            va_release_locked(v_addr, new_pages * 4096);
+            kmem_cache_free(&large_cache, alloc);
             return NULL;
         }
     }
-    
+
+    // kfree_large() gives pages back one at a time
+    pmm_split_block(ptr);
+
     alloc->magic = LARGE_ALLOC_MAGIC;
     alloc->vaddr = v_addr;
-    alloc->size = size;
-    alloc->num_pages = num_pages;
-    alloc->next = large_allocs;
-    large_allocs = alloc;
-    
+    alloc->size = new_size;
+    alloc->num_pages = new_pages;
+
+    irq = write_lock_irqsave(&large_lock);
+    large_insert(alloc);
+    write_unlock_irqrestore(&large_lock, irq);
+
     return (void *)v_addr;
 }
 
@@ -357,73 +1730,121 @@ static void kfree_large(void *ptr) {
 
     uint64_t vaddr = (uint64_t)ptr;
 
+    uint64_t irq = write_lock_irqsave(&large_lock);
+
     struct large_alloc **link = NULL;
     struct large_alloc *alloc = large_find(vaddr, &link);
 
     if (!alloc) {
-        serial_puts("kfree_large: pointer not found in large_allocs\\n");
+        write_unlock_irqrestore(&large_lock, irq);
+        klog(KLOG_ERR, "kfree_large: pointer not found in large_allocs\n");
         return;
     }
 
     if (alloc->magic != LARGE_ALLOC_MAGIC) {
-        serial_puts("kfree_large: bad magic (corrupt header?)\\n");
+        write_unlock_irqrestore(&large_lock, irq);
+        klog(KLOG_ERR, "kfree_large: bad magic (corrupt header?)\n");
         return;
     }
 
-    for (size_t i = 0; i < alloc->num_pages; i++) {
-        uint64_t page_vaddr = alloc->vaddr + (i * 4096ULL);
-        vmm_unmap(page_vaddr);
-
-        void *pv = (void *)(alloc->phys_addrs[i] + hhdm_request.response->offset);
-        pmm_free(pv);
-    }
-
-    // Unlink from list
+    // Unlink from hash
     if (link) {
         *link = alloc->next;
     }
 
-    // Free the header node (allocated via kmalloc)
-    kfree(alloc);
+    write_unlock_irqrestore(&large_lock, irq);
+
+    // The range only goes back once nothing maps it any more
+    large_unmap_pages(alloc->vaddr, alloc->num_pages);
+    va_release_locked(alloc->vaddr, alloc->num_pages * 4096);
+
+    // Free the header node
+    kmem_cache_free(&large_cache, alloc);
+}
+
+// Header of a large allocation, NULL if ptr isn't one
+static struct large_alloc *large_lookup(void *ptr) {
+    uint64_t vaddr = (uint64_t)ptr;
+
+    if (vaddr < LARGE_HEAP_START || vaddr >= LARGE_HEAP_END) {
+        return NULL;
+    }
+
+    uint64_t irq = read_lock_irqsave(&large_lock);
+    struct large_alloc *alloc = large_find(vaddr, NULL);
+    read_unlock_irqrestore(&large_lock, irq);
+
+    return alloc;
 }
 
 // Check if pointer is a large allocation
 static int is_large_alloc(void *ptr) {
-    if (!ptr) {
-        return 0;
-    }
-    return large_find((uint64_t)ptr, NULL) != NULL;
+    return large_lookup(ptr) != NULL;
 }
 
 // Initialize the kernel allocator
 void kalloc_init(void) {
-    serial_puts("Initializing kernel allocator (SLAB)...\n");
+    klog(KLOG_INFO, "Initializing kernel allocator (SLAB)...\n");
     
+    // Bootstrap caches come first and never use magazines themselves
+    kmem_cache_init(&cache_cache, "kmem_cache", sizeof(struct kmem_cache),
+                    CACHE_LINE_SIZE, NULL, KMC_NOMAGAZINE);
+    kmem_cache_register(&cache_cache);
+
+    for (int i = 0; i < MAG_TYPES; i++) {
+        size_t mag_size = sizeof(struct kmem_magazine) + mag_types[i] * sizeof(void *);
+        kmem_cache_init(&mag_caches[i], mag_names[i], mag_size, 0, NULL, KMC_NOMAGAZINE);
+        kmem_cache_register(&mag_caches[i]);
+    }
+
+    kmem_cache_init(&large_cache, "large_alloc", sizeof(struct large_alloc), 0, NULL, 0);
+    kmem_cache_register(&large_cache);
+
     for (int i = 0; i < NUM_CACHES; i++) {
-        kmem_cache_init(&caches[i], "kmalloc-cache", cache_sizes[i]);
+        kmem_cache_init(&caches[i], cache_names[i], cache_sizes[i], 16, NULL, 0);
+        kmem_cache_register(&caches[i]);
         
-        serial_puts("  Cache ");
-        serial_put_dec(cache_sizes[i]);
-        serial_puts(" bytes: ");
-        serial_put_dec(caches[i].objects_per_slab);
-        serial_puts(" objects per slab\n");
+        klog(KLOG_INFO, "  Cache %lu bytes: %lu objects per slab\n",
+             (uint64_t)cache_sizes[i], (uint64_t)caches[i].objects_per_slab);
     }
     
-    serial_puts("Kernel allocator ready!\n");
+    register_shrinker(&kmem_shrinker);
+
+    klog(KLOG_INFO, "Kernel allocator ready!\n");
 }
 
-// General purpose allocator
-void *kmalloc(size_t size) {
+// Page-mapped allocation, only virtually contiguous
+void *vmalloc(size_t size) {
+    if (size == 0) return NULL;
+    return kmalloc_large(size, 0);
+}
+
+// Helper: kmalloc() without the latency accounting
+static void *do_kmalloc(size_t size, int flags) {
     if (size == 0) return NULL;
+
+    int pmm_flags = km_to_pmm(flags);
+
+    // Below 4 GiB means physically contiguous, page granular
+    if (flags & KM_DMA32) {
+        return kmalloc_contig(size, pmm_flags);
+    }
     
-    // Large allocation?
-    if (size > 4096) {
-        return kmalloc_large(size);
+    // Large allocation? Prefer a contiguous block straight from the HHDM
+    if (size > KMALLOC_MAX_CACHE_SIZE) {
+        void *ptr = kmalloc_contig(size, pmm_flags);
+        if (ptr) {
+            return ptr;
+        }
+        return kmalloc_large(size, pmm_flags);
     }
     
     // Find smallest cache that fits
     for (int i = 0; i < NUM_CACHES; i++) {
         if (size <= cache_sizes[i]) {
+            if (flags) {
+                return cache_alloc_flags(&caches[i], flags);
+            }
             return kmem_cache_alloc(&caches[i]);
         }
     }
@@ -431,35 +1852,88 @@ void *kmalloc(size_t size) {
     return NULL;
 }
 
-// Reallocate memory
-void *krealloc(void *ptr, size_t new_size) {
+// Helper: Keep reclaiming and retrying a KM_NOFAIL allocation
+static void *kmalloc_nofail(size_t size, int flags) {
+    for (uint64_t tries = 1; ; tries++) {
+        if (!(flags & KM_ATOMIC)) {
+            reclaim_direct(size / 4096 + 1);
+        }
+
+        void *ptr = do_kmalloc(size, flags);
+        if (ptr) {
+            return ptr;
+        }
+
+        if (tries == KMALLOC_NOFAIL_WARN) {
+            klog(KLOG_WARN, "KALLOC: NOFAIL allocation of %zu bytes keeps failing!\n", size);
+        }
+        cpu_relax();
+    }
+}
+
+void *kmalloc(size_t size) {
+    uint64_t start = lat_start();
+    void *ptr = do_kmalloc(size, 0);
+    lat_record(&kmalloc_lat, start);
+    trace(TRACE_KMALLOC, ptr, size);
+
+    if (__builtin_expect(heapprof_active, 0)) {
+        heapprof_on_alloc(ptr, size, __builtin_frame_address(0));
+    }
+    return ptr;
+}
+
+void *kmalloc_flags(size_t size, int flags) {
+    uint64_t start = lat_start();
+    void *ptr = do_kmalloc(size, flags);
+    if (!ptr && (flags & KM_NOFAIL) && size > 0) {
+        ptr = kmalloc_nofail(size, flags);
+    }
+    lat_record(&kmalloc_lat, start);
+    trace(TRACE_KMALLOC, ptr, size);
+
+    if (__builtin_expect(heapprof_active, 0)) {
+        heapprof_on_alloc(ptr, size, __builtin_frame_address(0));
+    }
+    return ptr;
+}
+
+// Helper: krealloc() without profiler hooks
+static void *do_krealloc(void *ptr, size_t new_size) {
     if (!ptr) {
-        return kmalloc(new_size);
+        return do_kmalloc(new_size, 0);
     }
     
     if (new_size == 0) {
-        kfree(ptr);
+        do_kfree(ptr);
         return NULL;
     }
     
-    // Determine old size
-    size_t old_size = 0;
-    
-    if (is_large_alloc(ptr)) {
-        // Find in large alloc list
-        struct large_alloc *alloc = large_allocs;
-        while (alloc) {
-            // Need better tracking here
-            alloc = alloc->next;
-        }
-        // For now, just allocate new and copy
-        old_size = new_size; // Assume worst case
-    } else {
-        // Slab allocation - find which cache
-        uint64_t slab_addr = (uint64_t)ptr & ~0xFFFULL;
-        struct slab *slab = (struct slab *)slab_addr;
-        old_size = slab->cache->object_sz;
+    // Large blocks are resized by remapping, never copied
+    struct large_alloc *alloc = large_lookup(ptr);
+    if (alloc) {
+        return krealloc_large(alloc, new_size);
     }
+
+    // Contiguous blocks aren't copied either: the whole buddy block is
+    // ours, it grows into its free buddies where it can, and otherwise
+    // its pages move into the large window
+    if (is_contig_alloc(ptr)) {
+        if (new_size <= 4096ULL << pmm_block_order(ptr)) {
+            return ptr;
+        }
+
+        unsigned int order = size_to_order(new_size);
+        if (order <= KMALLOC_CONTIG_MAX_ORDER && pmm_grow_block(ptr, order) == 0) {
+            return ptr;
+        }
+        return krealloc_contig(ptr, new_size);
+    }
+
+    // Slab allocation - find which cache
+    uint64_t slab_addr = (uint64_t)ptr & ~0xFFFULL;
+    struct slab *slab = (struct slab *)slab_addr;
+    size_t old_size = slab->cache->object_sz;
     
     // If new size fits in same allocation, just return it
     if (new_size <= old_size) {
@@ -467,37 +1941,134 @@ void *krealloc(void *ptr, size_t new_size) {
     }
     
     // Allocate new block
-    void *new_ptr = kmalloc(new_size);
+    void *new_ptr = do_kmalloc(new_size, 0);
     if (!new_ptr) {
         return NULL;
     }
     
     // Copy old data
-    uint8_t *src = (uint8_t *)ptr;
-    uint8_t *dst = (uint8_t *)new_ptr;
-    for (size_t i = 0; i < old_size; i++) {
-        dst[i] = src[i];
-    }
+    memcpy(new_ptr, ptr, old_size);
     
     // Free old block
-    kfree(ptr);
+    do_kfree(ptr);
     
     return new_ptr;
 }
 
-// Free memory
-void kfree(void *ptr) {
-    if (!ptr) return;
-    
+// Reallocate memory
+void *krealloc(void *ptr, size_t new_size) {
+    void *new_ptr = do_krealloc(ptr, new_size);
+
+    // Shows up as a free and a fresh allocation, even when resized in place
+    if (new_ptr || new_size == 0) {
+        if (ptr) {
+            trace(TRACE_KFREE, ptr, 0);
+        }
+        if (new_ptr) {
+            trace(TRACE_KMALLOC, new_ptr, new_size);
+        }
+    }
+
+    // The old block is gone unless the resize failed
+    if (__builtin_expect(heapprof_active, 0) && (new_ptr || new_size == 0)) {
+        heapprof_on_free(ptr);
+        heapprof_on_alloc(new_ptr, new_size, __builtin_frame_address(0));
+    }
+    return new_ptr;
+}
+
+// Helper: kfree() without the latency accounting
+static void do_kfree(void *ptr) {
     if (is_large_alloc(ptr)) {
         kfree_large(ptr);
         return;
     }
+
+    if (is_contig_alloc(ptr)) {
+        pmm_free_pages(ptr, pmm_block_order(ptr));
+        return;
+    }
     
     // Round down to page boundary to find slab
     uint64_t slab_addr = (uint64_t)ptr & ~0xFFFULL;
     struct slab *slab = (struct slab *)slab_addr;
     kmem_cache_free(slab->cache, ptr);
+}
+
+// Free memory
+void kfree(void *ptr) {
+    if (!ptr) return;
 
-    serial_puts("Freed memory.\n");
-}
\ No newline at end of file
+    if (__builtin_expect(heapprof_active, 0)) {
+        heapprof_on_free(ptr);
+    }
+
+    trace(TRACE_KFREE, ptr, 0);
+
+    uint64_t start = lat_start();
+    do_kfree(ptr);
+    lat_record(&kfree_lat, start);
+}
+
+// Dump every cache, one line each, in the spirit of /proc/slabinfo
+void kmem_dump_slabinfo(void) {
+    serial_puts("slabinfo: name active_objs num_objs objsize objperslab "
+                "slabs partial full empty allocs frees grows shrinks util%\n");
+
+    read_lock(&cache_list_lock);
+
+    for (struct kmem_cache *cache = cache_list; cache; cache = cache->next) {
+        uint64_t allocs = 0;
+        uint64_t frees = 0;
+        for (int i = 0; i < MAX_CPUS; i++) {
+            allocs += cache->cpu[i].allocs;
+            frees += cache->cpu[i].frees;
+        }
+
+        uint64_t active = allocs - frees;
+        uint64_t slabs = cache->nr_partial + cache->nr_full + cache->nr_empty;
+        uint64_t num_objs = slabs * cache->objects_per_slab;
+        uint64_t util = slabs ? (active * cache->object_sz * 100) / (slabs * 4096) : 0;
+
+        serial_puts(cache->name);
+        serial_puts(" ");
+        serial_put_dec(active);
+        serial_puts(" ");
+        serial_put_dec(num_objs);
+        serial_puts(" ");
+        serial_put_dec(cache->object_sz);
+        serial_puts(" ");
+        serial_put_dec(cache->objects_per_slab);
+        serial_puts(" ");
+        serial_put_dec(slabs);
+        serial_puts(" ");
+        serial_put_dec(cache->nr_partial);
+        serial_puts(" ");
+        serial_put_dec(cache->nr_full);
+        serial_puts(" ");
+        serial_put_dec(cache->nr_empty);
+        serial_puts(" ");
+        serial_put_dec(allocs);
+        serial_puts(" ");
+        serial_put_dec(frees);
+        serial_puts(" ");
+        serial_put_dec(cache->grows);
+        serial_puts(" ");
+        serial_put_dec(cache->shrinks);
+        serial_puts(" ");
+        serial_put_dec(util);
+        serial_puts("\n");
+    }
+
+    read_unlock(&cache_list_lock);
+}
+
+// Dump kmalloc/kfree latency histograms
+void kalloc_dump_latency(void) {
+    lat_hist_dump(&kmalloc_lat);
+    lat_hist_dump(&kfree_lat);
+
+    serial_puts("kmalloc: zero_skipped=");
+    serial_put_dec(kmalloc_zero_skipped);
+    serial_puts("\n");
+}
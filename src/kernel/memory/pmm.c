@@ -3,20 +3,67 @@
 #include <stdint.h>
 #include "../include/limine.h"
 #include "../include/serial.h"
+#include "../include/klog.h"
 #include "../include/pmm.h"
+#include "../include/list.h"
+#include "../include/hist.h"
+#include "../include/shrinker.h"
+#include "../include/string.h"
+#include "../include/trace.h"
+#include "../include/spinlock.h"
 
 #define PAGE_SIZE 4096
 
-// Free page node - each free page points to the next
-typedef struct free_page {
-    struct free_page *next;
-} free_page_t;
+// Binary buddy allocator. Free blocks of 2^order pages sit on one list per
+// order, linked through the first page of the block itself.
+//
+// pmm_lock covers the free lists, page_info[] of free blocks and the
+// counters. It is an MCS lock, every CPU's page allocations end up here,
+// and is taken with interrupts off so PMM_ATOMIC allocations can come
+// from interrupt handlers. Nothing that might reclaim or clear pages runs
+// under it.
+typedef struct free_block {
+    struct list_head link;
+} free_block_t;
+
+static struct list_head free_lists[PMM_MAX_ORDER + 1];
+static uint64_t free_blocks[PMM_MAX_ORDER + 1];
+
+// One byte of state per physical page frame, indexed by PFN
+#define PG_ORDER_MASK 0x1F
+#define PG_FREE       (1 << 7)  // Head of a free block of the stored order
+#define PG_HEAD       (1 << 6)  // Head of an allocated block of the stored order
+#define PG_ZERO       (1 << 5)  // Block is known to be all zero
+
+static uint8_t *page_info = NULL;
+static uint64_t max_pfn = 0;
 
-static free_page_t *free_list_head = NULL;
 static uint64_t total_pages = 0;
 static uint64_t free_pages = 0;
 static uint64_t hhdm_offset = 0;
 
+// Free page watermarks. Dropping below low wakes background reclaim,
+// which works until high is reached. Below min, allocating callers run
+// reclaim themselves first.
+static uint64_t wmark_min = 0;
+static uint64_t wmark_low = 0;
+static uint64_t wmark_high = 0;
+
+// Physical address limit for PMM_DMA32
+#define DMA32_LIMIT_PFN (0x100000000ULL / PAGE_SIZE)
+
+// Statistics
+static uint64_t zero_hits = 0;
+static uint64_t zero_clears = 0;
+static uint64_t zero_idle_pages = 0;
+static uint64_t order_allocs[PMM_MAX_ORDER + 1];
+static uint64_t order_frees[PMM_MAX_ORDER + 1];
+static uint64_t alloc_failures = 0;
+static struct lat_hist pmm_alloc_lat = LAT_HIST_INIT("pmm_alloc");
+
+static DEFINE_LOCK_STAT(pmm_lock_stat, "pmm");
+static mcs_lock_t pmm_lock = MCS_LOCK_INIT_STAT(&pmm_lock_stat);
+
 // Align address down to page boundary
 static inline uint64_t align_down(uint64_t addr) {
     return addr & ~(PAGE_SIZE - 1);
@@ -32,7 +79,58 @@ static inline void *phys_to_virt(uint64_t phys) {
     return (void *)(phys + hhdm_offset);
 }
 
-// Add a memory region to the free list
+static inline uint64_t virt_to_pfn(void *ptr) {
+    return ((uint64_t)ptr - hhdm_offset) / PAGE_SIZE;
+}
+
+static inline free_block_t *pfn_to_block(uint64_t pfn) {
+    return (free_block_t *)phys_to_virt(pfn * PAGE_SIZE);
+}
+
+// Helper: Put a block on its free list. Known-zero blocks (zero but for
+// the list link) go to the tail
+// and dirty ones to the head, so ordinary allocations leave the zeroed
+// blocks for callers that want them.
+static void block_push(uint64_t pfn, unsigned int order, int zero) {
+    free_block_t *block = pfn_to_block(pfn);
+
+    if (zero) {
+        list_add_tail(&block->link, &free_lists[order]);
+        page_info[pfn] = PG_FREE | PG_ZERO | order;
+    } else {
+        list_add(&block->link, &free_lists[order]);
+        page_info[pfn] = PG_FREE | order;
+    }
+    free_blocks[order]++;
+}
+
+// Helper: Take a specific block off its free list
+static void block_remove(uint64_t pfn, unsigned int order) {
+    free_block_t *block = pfn_to_block(pfn);
+    list_del(&block->link);
+    free_blocks[order]--;
+    page_info[pfn] = 0;
+}
+
+// Helper: Free a block, merging with its buddy for as long as it's free
+static void block_free(uint64_t pfn, unsigned int order) {
+    while (order < PMM_MAX_ORDER) {
+        uint64_t buddy = pfn ^ (1ULL << order);
+
+        if (buddy >= max_pfn || (page_info[buddy] & ~PG_ZERO) != (PG_FREE | order)) {
+            break;
+        }
+
+        block_remove(buddy, order);
+        pfn &= ~(1ULL << order);
+        order++;
+    }
+
+    // Whatever was freed is dirty, and so is anything it merged into
+    block_push(pfn, order, 0);
+}
+
+// Add a memory region to the free lists
 static void add_region(uint64_t base, uint64_t length) {
     uint64_t page_aligned_base = align_up(base);
     uint64_t page_aligned_end = align_down(base + length);
@@ -41,70 +139,474 @@ static void add_region(uint64_t base, uint64_t length) {
         return; // Region too small
     }
     
-    uint64_t page_count = (page_aligned_end - page_aligned_base) / PAGE_SIZE;
+    uint64_t pfn = page_aligned_base / PAGE_SIZE;
+    uint64_t end_pfn = page_aligned_end / PAGE_SIZE;
+    uint64_t page_count = end_pfn - pfn;
     
-    // Add each page to the free list
-    for (uint64_t i = 0; i < page_count; i++) {
-        uint64_t page_addr = page_aligned_base + (i * PAGE_SIZE);
-        free_page_t *page = (free_page_t *)phys_to_virt(page_addr);
-        
-        // Push onto free list
-        page->next = free_list_head;
-        free_list_head = page;
-        free_pages++;
+    // Carve the region into the largest naturally aligned blocks
+    while (pfn < end_pfn) {
+        unsigned int order = PMM_MAX_ORDER;
+        while (order > 0 && ((pfn & ((1ULL << order) - 1)) || pfn + (1ULL << order) > end_pfn)) {
+            order--;
+        }
+
+        block_free(pfn, order);
+        pfn += 1ULL << order;
     }
     
+    free_pages += page_count;
     total_pages += page_count;
 }
 
 void pmm_init(struct limine_memmap_response *memmap, uint64_t _hhdm_offset) {
-    serial_puts("Initializing PMM...\n");
+    klog(KLOG_INFO, "Initializing PMM...\n");
     hhdm_offset = _hhdm_offset;
+
+    for (int i = 0; i <= PMM_MAX_ORDER; i++) {
+        list_init(&free_lists[i]);
+        free_blocks[i] = 0;
+    }
+
+    // Size the page frame table from the highest usable address
+    for (uint64_t i = 0; i < memmap->entry_count; i++) {
+        struct limine_memmap_entry *entry = memmap->entries[i];
+
+        if (entry->type == LIMINE_MEMMAP_USABLE) {
+            uint64_t end_pfn = align_down(entry->base + entry->length) / PAGE_SIZE;
+            if (end_pfn > max_pfn) {
+                max_pfn = end_pfn;
+            }
+        }
+    }
+
+    // Steal room for it from the first usable region big enough
+    uint64_t info_size = align_up(max_pfn);
+    uint64_t info_phys = 0;
+
+    for (uint64_t i = 0; i < memmap->entry_count; i++) {
+        struct limine_memmap_entry *entry = memmap->entries[i];
+        uint64_t base = align_up(entry->base);
+
+        if (entry->type == LIMINE_MEMMAP_USABLE &&
+            base + info_size <= align_down(entry->base + entry->length)) {
+            info_phys = base;
+            break;
+        }
+    }
+
+    if (!info_phys) {
+        klog(KLOG_ERR, "PMM: No room for the page frame table!\n");
+        return;
+    }
+
+    page_info = phys_to_virt(info_phys);
+    for (uint64_t pfn = 0; pfn < max_pfn; pfn++) {
+        page_info[pfn] = 0;
+    }
     
     // Parse memory map and add usable regions
     for (uint64_t i = 0; i < memmap->entry_count; i++) {
         struct limine_memmap_entry *entry = memmap->entries[i];
         
         if (entry->type == LIMINE_MEMMAP_USABLE) {
-            serial_puts("  Adding usable region: ");
-            serial_put_hex(entry->base);
-            serial_puts(" - ");
-            serial_put_hex(entry->base + entry->length);
-            serial_puts("\n");
-            add_region(entry->base, entry->length);
+            klog(KLOG_INFO, "  Adding usable region: 0x%lX - 0x%lX\n",
+                 entry->base, entry->base + entry->length);
+
+            uint64_t base = entry->base;
+            uint64_t length = entry->length;
+
+            // Skip the page frame table itself
+            if (align_up(base) == info_phys) {
+                length -= (info_phys + info_size) - base;
+                base = info_phys + info_size;
+            }
+
+            add_region(base, length);
         }
     }
     
-    serial_puts("PMM initialized: ");
-    serial_put_dec(free_pages);
-    serial_puts(" / ");
-    serial_put_dec(total_pages);
-    serial_puts(" pages free (");
-    serial_put_dec((free_pages * PAGE_SIZE) / (1024 * 1024));
-    serial_puts(" MB)\n");
+    // min is 1/256 of memory within [32, 4096] pages, low and high sit
+    // 25% and 50% above it
+    wmark_min = total_pages / 256;
+    if (wmark_min < 32) {
+        wmark_min = 32;
+    } else if (wmark_min > 4096) {
+        wmark_min = 4096;
+    }
+    wmark_low = wmark_min + wmark_min / 4;
+    wmark_high = wmark_min + wmark_min / 2;
+
+    klog(KLOG_INFO, "PMM initialized: %lu / %lu pages free (%lu MB)\n",
+         free_pages, total_pages, (free_pages * PAGE_SIZE) / (1024 * 1024));
 }
 
-// Allocate a physical page
-void *pmm_alloc(void) {
-    if (free_list_head == NULL) {
-        serial_puts("PMM: Out of memory!\n");
+// Helper: Pick a free block of the given order, NULL if none fits
+static free_block_t *buddy_pick(unsigned int order, int flags) {
+    struct list_head *list = &free_lists[order];
+
+    if (list_empty(list)) {
         return NULL;
     }
-    
-    free_page_t *page = free_list_head;
-    free_list_head = page->next;
-    free_pages--;
-    
-    serial_puts("Alloc OK.\n");
-    return (void *)page;
+
+    // Zeroed blocks sit at the tail
+    if (!(flags & PMM_DMA32)) {
+        if (flags & (PMM_ZERO | PMM_PREFER_ZERO)) {
+            return list_entry(list->prev, free_block_t, link);
+        }
+        return list_first_entry(list, free_block_t, link);
+    }
+
+    struct list_head *pos;
+    list_for_each(pos, list) {
+        free_block_t *block = list_entry(pos, free_block_t, link);
+        if (virt_to_pfn(block) + (1ULL << order) <= DMA32_LIMIT_PFN) {
+            return block;
+        }
+    }
+    return NULL;
+}
+
+// Helper: Take a block of 2^order pages off the buddy lists (pmm_lock
+// held). For PMM_ZERO, *clear says the caller must still zero the block,
+// which it does after dropping the lock.
+static void *buddy_alloc(unsigned int order, int flags, int *clear) {
+    // Find the smallest free block that is big enough
+    free_block_t *block = NULL;
+    unsigned int found = order;
+    while (found <= PMM_MAX_ORDER && !(block = buddy_pick(found, flags))) {
+        found++;
+    }
+
+    if (!block) {
+        return NULL;
+    }
+
+    uint64_t pfn = virt_to_pfn(block);
+    int zero = (page_info[pfn] & PG_ZERO) != 0;
+    block_remove(pfn, found);
+
+    // Split it down, handing the upper halves back
+    while (found > order) {
+        found--;
+        block_push(pfn + (1ULL << found), found, zero);
+    }
+
+    // A zeroed free block is zero apart from its list link
+    if (zero) {
+        block->link.next = NULL;
+        block->link.prev = NULL;
+    }
+
+    *clear = 0;
+    if (flags & PMM_ZERO) {
+        if (zero) {
+            zero_hits++;
+        } else {
+            *clear = 1;
+            zero_clears++;
+            zero = 1;
+        }
+    }
+
+    page_info[pfn] = PG_HEAD | (zero ? PG_ZERO : 0) | order;
+    free_pages -= 1ULL << order;
+    order_allocs[order]++;
+
+    return (void *)block;
+}
+
+// Helper: One locked attempt at the buddy lists, clearing the block
+// afterwards if PMM_ZERO needs it
+static void *pmm_alloc_locked(unsigned int order, int flags) {
+    struct mcs_node node;
+    void *block = NULL;
+    int clear = 0;
+
+    uint64_t irq = mcs_lock_irqsave(&pmm_lock, &node);
+
+    // The bottom half of the min watermark is kept for atomic allocations
+    if ((flags & PMM_ATOMIC) || free_pages >= wmark_min / 2 + (1ULL << order)) {
+        block = buddy_alloc(order, flags, &clear);
+    }
+
+    mcs_unlock_irqrestore(&pmm_lock, &node, irq);
+
+    if (clear) {
+        memset(block, 0, PAGE_SIZE << order);
+    }
+    return block;
+}
+
+// Allocate 2^order physically contiguous pages
+void *pmm_alloc_pages(unsigned int order) {
+    return pmm_alloc_pages_flags(order, 0);
+}
+
+void *pmm_alloc_pages_flags(unsigned int order, int flags) {
+    if (order > PMM_MAX_ORDER) {
+        return NULL;
+    }
+
+    uint64_t start = lat_start();
+    uint64_t count = 1ULL << order;
+
+    // Below the min watermark, make the caller help out before dipping in.
+    // The unlocked look at free_pages is only a hint.
+    uint64_t free_now = __atomic_load_n(&free_pages, __ATOMIC_RELAXED);
+    if (!(flags & PMM_ATOMIC) && free_now < wmark_min + count) {
+        reclaim_direct(wmark_min + count - free_now);
+    }
+
+    void *block = pmm_alloc_locked(order, flags);
+
+    // Nothing big enough, reclaim and try once more
+    if (!block && !(flags & PMM_ATOMIC)) {
+        reclaim_direct(count);
+        block = pmm_alloc_locked(order, flags);
+    }
+
+    if (!block) {
+        if (order == 0) {
+            klog(KLOG_ERR, "PMM: Out of memory!\n");
+        }
+        __atomic_fetch_add(&alloc_failures, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    // Getting low, have background reclaim top us back up
+    if (__atomic_load_n(&free_pages, __ATOMIC_RELAXED) < wmark_low) {
+        reclaim_wake();
+    }
+
+    lat_record(&pmm_alloc_lat, start);
+    trace(TRACE_PMM_ALLOC, block, order);
+
+    return block;
+}
+
+// Free a block from pmm_alloc_pages()
+void pmm_free_pages(void *ptr, unsigned int order) {
+    if (ptr == NULL) return;
+
+    uint64_t pfn = virt_to_pfn(ptr);
+    struct mcs_node node;
+    uint64_t irq = mcs_lock_irqsave(&pmm_lock, &node);
+
+    if (pfn >= max_pfn || (page_info[pfn] & ~PG_ZERO) != (PG_HEAD | order)) {
+        mcs_unlock_irqrestore(&pmm_lock, &node, irq);
+        klog(KLOG_ERR, "PMM: Bad or double free of 0x%lX\n", (uint64_t)ptr);
+        return;
+    }
+
+    free_pages += 1ULL << order;
+    order_frees[order]++;
+    block_free(pfn, order);
+
+    mcs_unlock_irqrestore(&pmm_lock, &node, irq);
+    trace(TRACE_PMM_FREE, ptr, order);
+}
+
+int pmm_block_zeroed(void *ptr) {
+    uint64_t pfn = virt_to_pfn(ptr);
+    return pfn < max_pfn && (page_info[pfn] & (PG_HEAD | PG_ZERO)) == (PG_HEAD | PG_ZERO);
+}
+
+// Helper: Put a block zeroed outside the lock back (pmm_lock held). If its
+// buddy was freed meanwhile the two must merge, and the zeroing is lost.
+static void block_return_zeroed(uint64_t pfn, unsigned int order) {
+    uint64_t buddy = pfn ^ (1ULL << order);
+
+    if (order < PMM_MAX_ORDER && buddy < max_pfn &&
+        (page_info[buddy] & ~PG_ZERO) == (PG_FREE | order)) {
+        block_free(pfn, order);
+    } else {
+        block_push(pfn, order, 1);
+    }
+}
+
+// Zero dirty free blocks until about `budget` pages were cleared, returns
+// pages cleared. Meant for the idle loop. Each block is taken off its list
+// for the clearing so the lock isn't held across it.
+uint64_t pmm_zero_idle(uint64_t budget) {
+    struct mcs_node node;
+    uint64_t done = 0;
+
+    for (unsigned int order = 0; order <= PMM_MAX_ORDER && done < budget; order++) {
+        while (done < budget) {
+            uint64_t irq = mcs_lock_irqsave(&pmm_lock, &node);
+
+            // Dirty blocks sit at the head, stop at the first zeroed one
+            if (list_empty(&free_lists[order])) {
+                mcs_unlock_irqrestore(&pmm_lock, &node, irq);
+                break;
+            }
+            free_block_t *block = list_first_entry(&free_lists[order], free_block_t, link);
+            uint64_t pfn = virt_to_pfn(block);
+            if (page_info[pfn] & PG_ZERO) {
+                mcs_unlock_irqrestore(&pmm_lock, &node, irq);
+                break;
+            }
+            block_remove(pfn, order);
+
+            mcs_unlock_irqrestore(&pmm_lock, &node, irq);
+
+            // Nobody is about to read it, keep it out of the caches
+            clear_nt(block, PAGE_SIZE << order);
+
+            irq = mcs_lock_irqsave(&pmm_lock, &node);
+            block_return_zeroed(pfn, order);
+            mcs_unlock_irqrestore(&pmm_lock, &node, irq);
+
+            done += 1ULL << order;
+        }
+    }
+
+    __atomic_fetch_add(&zero_idle_pages, done, __ATOMIC_RELAXED);
+    return done;
+}
+
+uint64_t pmm_free_page_count(void) {
+    return __atomic_load_n(&free_pages, __ATOMIC_RELAXED);
+}
+
+uint64_t pmm_watermark(int which) {
+    switch (which) {
+    case PMM_WMARK_MIN:
+        return wmark_min;
+    case PMM_WMARK_LOW:
+        return wmark_low;
+    default:
+        return wmark_high;
+    }
+}
+
+int pmm_grow_block(void *ptr, unsigned int new_order) {
+    uint64_t pfn = virt_to_pfn(ptr);
+    struct mcs_node node;
+
+    if (new_order > PMM_MAX_ORDER || (pfn & ((1ULL << new_order) - 1))) {
+        return -1;
+    }
+
+    uint64_t irq = mcs_lock_irqsave(&pmm_lock, &node);
+
+    if (pfn >= max_pfn || !(page_info[pfn] & PG_HEAD)) {
+        mcs_unlock_irqrestore(&pmm_lock, &node, irq);
+        klog(KLOG_ERR, "PMM: Grow of unallocated 0x%lX\n", (uint64_t)ptr);
+        return -1;
+    }
+
+    // Every buddy from the current order up must be free, whole. One that
+    // is split has an allocated part, or it would have merged back.
+    unsigned int order = page_info[pfn] & PG_ORDER_MASK;
+    for (unsigned int o = order; o < new_order; o++) {
+        uint64_t buddy = pfn + (1ULL << o);
+        if (buddy >= max_pfn || (page_info[buddy] & ~PG_ZERO) != (PG_FREE | o)) {
+            mcs_unlock_irqrestore(&pmm_lock, &node, irq);
+            return -1;
+        }
+    }
+
+    for (unsigned int o = order; o < new_order; o++) {
+        block_remove(pfn + (1ULL << o), o);
+    }
+
+    // Counted as a free of the old block and an allocation of the new one
+    if (new_order > order) {
+        free_pages -= (1ULL << new_order) - (1ULL << order);
+        order_frees[order]++;
+        order_allocs[new_order]++;
+        page_info[pfn] = PG_HEAD | new_order;
+    }
+
+    mcs_unlock_irqrestore(&pmm_lock, &node, irq);
+    return 0;
+}
+
+void pmm_split_block(void *ptr) {
+    uint64_t pfn = virt_to_pfn(ptr);
+    struct mcs_node node;
+    uint64_t irq = mcs_lock_irqsave(&pmm_lock, &node);
+
+    if (pfn >= max_pfn || !(page_info[pfn] & PG_HEAD)) {
+        mcs_unlock_irqrestore(&pmm_lock, &node, irq);
+        klog(KLOG_ERR, "PMM: Split of unallocated 0x%lX\n", (uint64_t)ptr);
+        return;
+    }
+
+    unsigned int order = page_info[pfn] & PG_ORDER_MASK;
+    for (uint64_t i = 0; i < (1ULL << order); i++) {
+        page_info[pfn + i] = PG_HEAD;
+    }
+    order_frees[order]++;
+    order_allocs[0] += 1ULL << order;
+
+    mcs_unlock_irqrestore(&pmm_lock, &node, irq);
+}
+
+// Order of the allocated block starting at ptr, -1 if it isn't one
+int pmm_block_order(void *ptr) {
+    uint64_t pfn = virt_to_pfn(ptr);
+
+    if ((uint64_t)ptr < hhdm_offset || pfn >= max_pfn || !(page_info[pfn] & PG_HEAD)) {
+        return -1;
+    }
+    return page_info[pfn] & PG_ORDER_MASK;
+}
+
+// Allocate a physical page
+void *pmm_alloc(void) {
+    return pmm_alloc_pages(0);
 }
 
 // Free a physical page
 void pmm_free(void *ptr) {
-    if (ptr == NULL) return;
-    
-    free_page_t *page = (free_page_t *)ptr;
-    page->next = free_list_head;
-    free_list_head = page;
-    free_pages++;
-}
\ No newline at end of file
+    pmm_free_pages(ptr, 0);
+}
+
+// Dump free blocks per order (like /proc/buddyinfo) and allocator counters
+void pmm_dump_stats(void) {
+    serial_puts("buddyinfo: free blocks per order 0..");
+    serial_put_dec(PMM_MAX_ORDER);
+    serial_puts("\n ");
+    for (int i = 0; i <= PMM_MAX_ORDER; i++) {
+        serial_puts(" ");
+        serial_put_dec(free_blocks[i]);
+    }
+    serial_puts("\n");
+
+    serial_puts("pmm: free_pages=");
+    serial_put_dec(free_pages);
+    serial_puts(" total_pages=");
+    serial_put_dec(total_pages);
+    serial_puts(" failures=");
+    serial_put_dec(alloc_failures);
+    serial_puts(" zero_hits=");
+    serial_put_dec(zero_hits);
+    serial_puts(" zero_clears=");
+    serial_put_dec(zero_clears);
+    serial_puts(" zero_idle_pages=");
+    serial_put_dec(zero_idle_pages);
+    serial_puts(" wmark_min=");
+    serial_put_dec(wmark_min);
+    serial_puts(" low=");
+    serial_put_dec(wmark_low);
+    serial_puts(" high=");
+    serial_put_dec(wmark_high);
+    serial_puts("\n");
+
+    for (int i = 0; i <= PMM_MAX_ORDER; i++) {
+        if (!order_allocs[i] && !order_frees[i]) {
+            continue;
+        }
+        serial_puts("  order ");
+        serial_put_dec(i);
+        serial_puts(": allocs=");
+        serial_put_dec(order_allocs[i]);
+        serial_puts(" frees=");
+        serial_put_dec(order_frees[i]);
+        serial_puts("\n");
+    }
+
+    lat_hist_dump(&pmm_alloc_lat);
+}
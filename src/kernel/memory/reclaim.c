@@ -0,0 +1,173 @@
+#include <stdint.h>
+#include "../include/cpu.h"
+#include "../include/spinlock.h"
+#include "../include/serial.h"
+#include "../include/list.h"
+#include "../include/pmm.h"
+#include "../include/shrinker.h"
+
+static struct list_head shrinkers = { &shrinkers, &shrinkers };
+
+// Guards the shrinker list. Walkers read it, (un)registering writes it.
+// Reclaim never runs in an interrupt handler, so writers keep interrupts
+// on and still answer the IPIs a pass sends while it holds the read side.
+static DEFINE_LOCK_STAT(shrinker_lock_stat, "shrinkers");
+static rwlock_t shrinker_lock = RWLOCK_INIT_STAT(&shrinker_lock_stat);
+
+// The CPU running a pass plus one, 0 when none is. One CPU reclaims at a
+// time, and the owner never re-enters the walk while it already holds
+// shrinker_lock.
+static unsigned int in_reclaim = 0;
+static int reclaim_pending = 0;
+
+// Statistics
+static uint64_t direct_runs = 0;
+static uint64_t direct_pages = 0;
+static uint64_t direct_stall_cycles = 0;
+static uint64_t background_runs = 0;
+static uint64_t background_pages = 0;
+static uint64_t wakeups = 0;
+
+void register_shrinker(struct shrinker *shrinker) {
+    shrinker->calls = 0;
+    shrinker->freed = 0;
+
+    write_lock(&shrinker_lock);
+    list_add_tail(&shrinker->link, &shrinkers);
+    write_unlock(&shrinker_lock);
+}
+
+void unregister_shrinker(struct shrinker *shrinker) {
+    write_lock(&shrinker_lock);
+    list_del(&shrinker->link);
+    write_unlock(&shrinker_lock);
+}
+
+// Helper: Claim the right to run a pass, 0 if some CPU holds it
+static int reclaim_begin(void) {
+    unsigned int idle = 0;
+    return __atomic_compare_exchange_n(&in_reclaim, &idle, cpu_id() + 1, 0,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static void reclaim_end(void) {
+    __atomic_store_n(&in_reclaim, 0, __ATOMIC_RELEASE);
+}
+
+// Helper: One pass over every shrinker, returns pages freed. Call
+// between reclaim_begin() and reclaim_end().
+static uint64_t shrink_all(uint64_t target) {
+    uint64_t freed = 0;
+    struct list_head *pos;
+
+    read_lock(&shrinker_lock);
+    list_for_each(pos, &shrinkers) {
+        if (freed >= target) {
+            break;
+        }
+
+        struct shrinker *shrinker = list_entry(pos, struct shrinker, link);
+        if (shrinker->flush) {
+            shrinker->flush(shrinker);
+        }
+        if (shrinker->count(shrinker) == 0) {
+            continue;
+        }
+
+        uint64_t got = shrinker->scan(shrinker, target - freed);
+        shrinker->calls++;
+        shrinker->freed += got;
+        freed += got;
+    }
+    read_unlock(&shrinker_lock);
+
+    return freed;
+}
+
+uint64_t reclaim_direct(uint64_t target) {
+    uint64_t start = rdtsc();
+
+    while (!reclaim_begin()) {
+        // Reclaim frees memory, and freeing must never recurse into
+        // reclaim. Nor can a CPU with interrupts off wait out a pass that
+        // needs it to answer IPIs.
+        unsigned int owner = __atomic_load_n(&in_reclaim, __ATOMIC_RELAXED);
+        if (owner == cpu_id() + 1 || !irqs_enabled()) {
+            return 0;
+        }
+
+        // The running pass may not free enough for us, run our own after
+        while (__atomic_load_n(&in_reclaim, __ATOMIC_ACQUIRE)) {
+            cpu_relax();
+        }
+    }
+
+    uint64_t freed = shrink_all(target);
+    reclaim_end();
+
+    __atomic_fetch_add(&direct_runs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&direct_pages, freed, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&direct_stall_cycles, rdtsc() - start, __ATOMIC_RELAXED);
+
+    return freed;
+}
+
+void reclaim_wake(void) {
+    if (!__atomic_exchange_n(&reclaim_pending, 1, __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(&wakeups, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void reclaim_poll(void) {
+    if (!__atomic_exchange_n(&reclaim_pending, 0, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    uint64_t free = pmm_free_page_count();
+    uint64_t high = pmm_watermark(PMM_WMARK_HIGH);
+
+    // A direct reclaim already running does the job
+    if (free >= high || !reclaim_begin()) {
+        return;
+    }
+
+    uint64_t freed = shrink_all(high - free);
+    reclaim_end();
+
+    __atomic_fetch_add(&background_runs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&background_pages, freed, __ATOMIC_RELAXED);
+}
+
+void reclaim_dump_stats(void) {
+    serial_puts("reclaim: direct_runs=");
+    serial_put_dec(direct_runs);
+    serial_puts(" direct_pages=");
+    serial_put_dec(direct_pages);
+    serial_puts(" direct_stall_cycles=");
+    serial_put_dec(direct_stall_cycles);
+    serial_puts(" background_runs=");
+    serial_put_dec(background_runs);
+    serial_puts(" background_pages=");
+    serial_put_dec(background_pages);
+    serial_puts(" wakeups=");
+    serial_put_dec(wakeups);
+    serial_puts("\n");
+
+    struct list_head *pos;
+
+    read_lock(&shrinker_lock);
+    list_for_each(pos, &shrinkers) {
+        struct shrinker *shrinker = list_entry(pos, struct shrinker, link);
+
+        serial_puts("  shrinker ");
+        serial_puts(shrinker->name);
+        serial_puts(": calls=");
+        serial_put_dec(shrinker->calls);
+        serial_puts(" freed=");
+        serial_put_dec(shrinker->freed);
+        serial_puts(" freeable=");
+        serial_put_dec(shrinker->count(shrinker));
+        serial_puts("\n");
+    }
+    read_unlock(&shrinker_lock);
+}
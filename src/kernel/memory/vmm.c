@@ -1,9 +1,16 @@
 #include <stdint.h>
 #include <stddef.h>
+#include "../include/cpu.h"
 #include "../include/serial.h"
+#include "../include/klog.h"
 #include "../include/limine_requests.h"
 #include "../include/vmm.h"
 #include "../include/pmm.h"
+#include "../include/hist.h"
+#include "../include/string.h"
+#include "../include/trace.h"
+#include "../include/spinlock.h"
+#include "../include/smp.h"
 
 #define PAGE_SIZE 4096
 
@@ -21,12 +28,21 @@
 
 #define PTE_GET_ADDR(pte) ((pte) & 0x000FFFFFFFFFF000ULL)
 
-// Helper: Read CR3 
-static inline uint64_t read_cr3(void) {
-    uint64_t cr3;
-    asm volatile ("mov %%cr3, %0" : "=r"(cr3));
-    return cr3;
-}
+// Window for device registers, handed out front to back and never freed
+#define MMIO_BASE 0xFFFFE00000000000ULL
+#define MMIO_SIZE 0x40000000ULL
+
+static uint64_t mmio_next = MMIO_BASE;
+
+static struct lat_hist vmm_map_lat = LAT_HIST_INIT("vmm_map");
+
+// Kernel page tables are shared by every CPU. Walks that only look take
+// vmm_lock for reading, anything that changes an entry takes it for
+// writing. Page tables come from the PMM with PMM_ATOMIC, reclaim would
+// end up in vmm_unmap() and take the lock again. Taken with interrupts
+// off, KM_ATOMIC slab growth maps pages from interrupt handlers.
+static DEFINE_LOCK_STAT(vmm_lock_stat, "vmm");
+static rwlock_t vmm_lock = RWLOCK_INIT_STAT(&vmm_lock_stat);
 
 // Helper: Converts a PHYS addr to VIRT
 static inline void *phys_to_virt(uint64_t phys) {
@@ -66,17 +82,15 @@ static uint64_t *get_or_create_table(uint64_t *table, uint64_t index, int alloc)
     if (!alloc)
         return NULL;
 
-    void *new_table_virt = pmm_alloc();
+    void *new_table_virt = pmm_alloc_pages_flags(0, PMM_ATOMIC);
     if (!new_table_virt) {
-        serial_puts("VMM: Failed to allocate page table!\n");
+        klog(KLOG_ERR, "VMM: Failed to allocate page table!\n");
         return NULL;
     }
 
     uint64_t new_table_phys = (uint64_t)new_table_virt - hhdm_request.response->offset;
     uint64_t *new_table_ptr = (uint64_t *)new_table_virt;
-    for (int i = 0; i < 512; i++) {
-        new_table_ptr[i] = 0;
-    }
+    clear_page(new_table_ptr);
 
     table[index] = new_table_phys | PTE_PRESENT | PTE_WRITE;
     return new_table_ptr;
@@ -191,12 +205,8 @@ void vmm_dump_pml4(void) {
 
 // Map a virtual address
 int vmm_map(uint64_t vaddr, uint64_t phys, uint64_t flags) {
-    serial_puts("vmm_map: ");
-    serial_put_hex(vaddr);
-    serial_puts(" -> ");
-    serial_put_hex(phys);
-    serial_puts("\n");
-    
+    uint64_t start = lat_start();
+
     uint64_t cr3 = read_cr3();
     uint64_t pml4_phys = cr3 & 0x000FFFFFFFFFF000ULL;
     
@@ -205,45 +215,45 @@ int vmm_map(uint64_t vaddr, uint64_t phys, uint64_t flags) {
     uint64_t pdpt_idx = (vaddr >> 30) & 0x1FF;
     uint64_t pd_idx   = (vaddr >> 21) & 0x1FF;
     uint64_t pt_idx   = (vaddr >> 12) & 0x1FF;
+
+    klog(KLOG_DEBUG, "vmm_map: 0x%lX -> 0x%lX PML4[%lu] PDPT[%lu] PD[%lu] PT[%lu]\n",
+         vaddr, phys, pml4_idx, pdpt_idx, pd_idx, pt_idx);
     
-    serial_puts("  Indices: PML4[");
-    serial_put_dec(pml4_idx);
-    serial_puts("] PDPT[");
-    serial_put_dec(pdpt_idx);
-    serial_puts("] PD[");
-    serial_put_dec(pd_idx);
-    serial_puts("] PT[");
-    serial_put_dec(pt_idx);
-    serial_puts("]\n");
-    
+    uint64_t irq = write_lock_irqsave(&vmm_lock);
+
     // Walk/create page table hierarchy
     uint64_t *pml4 = phys_to_virt(pml4_phys);
-    
-    serial_puts("  Getting PDPT...\n");
+    uint64_t *pt = NULL;
+
     uint64_t *pdpt = get_or_create_table(pml4, pml4_idx, 1);
-    if (!pdpt) return -1;
-    
-    serial_puts("  Getting PD...\n");
-    uint64_t *pd = get_or_create_table(pdpt, pdpt_idx, 1);
-    if (!pd) return -1;
-    
-    serial_puts("  Getting PT...\n");
-    uint64_t *pt = get_or_create_table(pd, pd_idx, 1);
-    if (!pt) return -1;
-    
-    serial_puts("  Mapping page...\n");
+    uint64_t *pd = pdpt ? get_or_create_table(pdpt, pdpt_idx, 1) : NULL;
+    if (pd) {
+        pt = get_or_create_table(pd, pd_idx, 1);
+    }
+
+    if (!pt) {
+        write_unlock_irqrestore(&vmm_lock, irq);
+        return -1;
+    }
+
     // Map the page
     pt[pt_idx] = (phys & 0x000FFFFFFFFFF000ULL) | flags | PTE_PRESENT;
-    
-    // Flush TLB for this address
-    asm volatile ("invlpg (%0)" :: "r"(vaddr) : "memory");
-    
-    serial_puts("vmm_map: success!\n");
+
+    // Flush TLB for this address. Only this CPU: the entry wasn't present
+    // before, and not-present entries are never cached.
+    invlpg(vaddr);
+
+    write_unlock_irqrestore(&vmm_lock, irq);
+    trace(TRACE_VMM_MAP, vaddr, phys);
+    trace(TRACE_VMM_FLUSH, vaddr, 1);
+
+    lat_record(&vmm_map_lat, start);
     return 0;
 }
 
-// Unmap virtual address
-int vmm_unmap(uint64_t vaddr) {
+// Helper: The last level entry for vaddr, NULL if a table above it is
+// missing (vmm_lock held)
+static uint64_t *find_pte(uint64_t vaddr) {
     uint64_t cr3 = read_cr3();
     uint64_t pml4_phys = cr3 & 0x000FFFFFFFFFF000ULL;
     
@@ -256,33 +266,176 @@ int vmm_unmap(uint64_t vaddr) {
     // Walk page tables (no allocation)
     uint64_t *pml4 = phys_to_virt(pml4_phys);
     if (!(pml4[pml4_idx] & PTE_PRESENT))
-        return -1;
+        return NULL;
     
     uint64_t *pdpt = phys_to_virt(PTE_GET_ADDR(pml4[pml4_idx]));
     if (!(pdpt[pdpt_idx] & PTE_PRESENT))
-        return -1;
+        return NULL;
     
     uint64_t *pd = phys_to_virt(PTE_GET_ADDR(pdpt[pdpt_idx]));
     if (!(pd[pd_idx] & PTE_PRESENT))
-        return -1;
+        return NULL;
     
     uint64_t *pt = phys_to_virt(PTE_GET_ADDR(pd[pd_idx]));
-    if (!(pt[pt_idx] & PTE_PRESENT))
+    return &pt[pt_idx];
+}
+
+// Unmap virtual address
+int vmm_unmap(uint64_t vaddr) {
+    uint64_t irq = write_lock_irqsave(&vmm_lock);
+
+    uint64_t *pte = find_pte(vaddr);
+    if (!pte || !(*pte & PTE_PRESENT)) {
+        write_unlock_irqrestore(&vmm_lock, irq);
         return -1;
+    }
     
     // Clear the entry
-    pt[pt_idx] = 0;
-    
-    // Flush TLB
-    asm volatile ("invlpg (%0)" :: "r"(vaddr) : "memory");
+    *pte = 0;
+    invlpg(vaddr);
+
+    write_unlock_irqrestore(&vmm_lock, irq);
+    trace(TRACE_VMM_UNMAP, vaddr, 1);
+
+    // Other CPUs may still have the old translation cached. Done before
+    // returning, callers free the page straight after.
+    tlb_shootdown(vaddr, 1);
+    trace(TRACE_VMM_FLUSH, vaddr, 1);
     
     return 0;
 }
 
+uint64_t vmm_unmap_range(uint64_t vaddr, uint64_t pages, void (*release)(uint64_t phys)) {
+    uint64_t unmapped = 0;
+
+    // Clear the present bits first. With release() the address stays in
+    // the entry, so it can be handed back once the flush is done.
+    uint64_t irq = write_lock_irqsave(&vmm_lock);
+    for (uint64_t i = 0; i < pages; i++) {
+        uint64_t *pte = find_pte(vaddr + i * PAGE_SIZE);
+        if (!pte || !(*pte & PTE_PRESENT)) {
+            continue;
+        }
+        *pte = release ? *pte & ~PTE_PRESENT : 0;
+        unmapped++;
+    }
+    write_unlock_irqrestore(&vmm_lock, irq);
+
+    if (!unmapped) {
+        return 0;
+    }
+    trace(TRACE_VMM_UNMAP, vaddr, pages);
+
+    // One flush for the whole range here and on every other CPU
+    flush_tlb_range(vaddr, pages);
+    tlb_shootdown(vaddr, pages);
+    trace(TRACE_VMM_FLUSH, vaddr, pages);
+
+    if (!release) {
+        return unmapped;
+    }
+
+    // Not-present entries are never cached, nothing reaches these pages
+    // now. The range is still the caller's, so nobody else maps into it.
+    for (uint64_t i = 0; i < pages; i++) {
+        irq = write_lock_irqsave(&vmm_lock);
+        uint64_t *pte = find_pte(vaddr + i * PAGE_SIZE);
+        uint64_t phys = pte ? PTE_GET_ADDR(*pte) : 0;
+        if (pte) {
+            *pte = 0;
+        }
+        write_unlock_irqrestore(&vmm_lock, irq);
+
+        if (phys) {
+            release(phys);
+        }
+    }
+
+    return unmapped;
+}
+
+// Helper: Walk the page tables for vaddr (vmm_lock held)
+static int translate(uint64_t vaddr, uint64_t *phys) {
+    uint64_t cr3 = read_cr3();
+    uint64_t pml4_phys = cr3 & 0x000FFFFFFFFFF000ULL;
+
+    // Extract indices
+    uint64_t pml4_idx = (vaddr >> 39) & 0x1FF;
+    uint64_t pdpt_idx = (vaddr >> 30) & 0x1FF;
+    uint64_t pd_idx   = (vaddr >> 21) & 0x1FF;
+    uint64_t pt_idx   = (vaddr >> 12) & 0x1FF;
+
+    uint64_t *pml4 = phys_to_virt(pml4_phys);
+    if (!(pml4[pml4_idx] & PTE_PRESENT))
+        return -1;
+
+    uint64_t *pdpt = phys_to_virt(PTE_GET_ADDR(pml4[pml4_idx]));
+    uint64_t pdpte = pdpt[pdpt_idx];
+    if (!(pdpte & PTE_PRESENT))
+        return -1;
+
+    if (pdpte & PTE_HUGE) {
+        *phys = (pdpte & 0x000FFFFFC0000000ULL) + (vaddr & 0x3FFFFFFFULL);
+        return 0;
+    }
+
+    uint64_t *pd = phys_to_virt(PTE_GET_ADDR(pdpte));
+    uint64_t pde = pd[pd_idx];
+    if (!(pde & PTE_PRESENT))
+        return -1;
+
+    if (pde & PTE_HUGE) {
+        *phys = (pde & 0x000FFFFFFFE00000ULL) + (vaddr & 0x1FFFFFULL);
+        return 0;
+    }
+
+    uint64_t *pt = phys_to_virt(PTE_GET_ADDR(pde));
+    if (!(pt[pt_idx] & PTE_PRESENT))
+        return -1;
+
+    *phys = PTE_GET_ADDR(pt[pt_idx]) + (vaddr & 0xFFF);
+    return 0;
+}
+
+// Translate a virtual address, returns -1 if it isn't mapped
+int vmm_translate(uint64_t vaddr, uint64_t *phys) {
+    uint64_t irq = read_lock_irqsave(&vmm_lock);
+    int ret = translate(vaddr, phys);
+    read_unlock_irqrestore(&vmm_lock, irq);
+    return ret;
+}
+
+void *vmm_map_phys(uint64_t phys, uint64_t size, uint64_t flags) {
+    uint64_t offset = phys & (PAGE_SIZE - 1);
+    uint64_t pages = (offset + size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    // Claim the range first, a failed mapping just leaves a hole
+    uint64_t base = __atomic_fetch_add(&mmio_next, pages * PAGE_SIZE, __ATOMIC_RELAXED);
+    if (base + pages * PAGE_SIZE > MMIO_BASE + MMIO_SIZE) {
+        klog(KLOG_ERR, "VMM: MMIO window full\n");
+        return NULL;
+    }
+
+    for (uint64_t i = 0; i < pages; i++) {
+        uint64_t page = (phys - offset) + i * PAGE_SIZE;
+        if (vmm_map(base + i * PAGE_SIZE, page, flags) != 0) {
+            return NULL;
+        }
+    }
+
+    return (void *)(base + offset);
+}
+
+void *vmm_map_mmio(uint64_t phys, uint64_t size) {
+    return vmm_map_phys(phys, size, VMM_WRITE | VMM_NOCACHE | VMM_NX);
+}
+
+void vmm_dump_stats(void) {
+    lat_hist_dump(&vmm_map_lat);
+}
+
 void vmm_init(void) {
-    serial_puts("VMM initalized (prepared by Limine page tables)\n");
+    klog(KLOG_INFO, "VMM initalized (prepared by Limine page tables)\n");
     uint64_t cr3 = read_cr3();
-    serial_puts("CR3 (PML4): ");
-    serial_put_hex(cr3 & 0x000FFFFFFFFFF000ULL);
-    serial_puts("\n");
+    klog(KLOG_INFO, "CR3 (PML4): 0x%lX\n", (uint64_t)(cr3 & 0x000FFFFFFFFFF000ULL));
 }
\ No newline at end of file
@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+#
+# Compare two benchmark runs, e.g. the output of `make bench` against the
+# stored baseline. Reads the BENCH lines of both (see include/bench.h),
+# matches results by suite, name and param and compares ns/op, or cyc/op
+# when either run didn't know the TSC rate.
+#
+#   tools/benchcmp.py [--threshold PCT] [--strict] baseline.txt new.txt
+#
+# Anything slower by more than the threshold (default 10%) is flagged, and
+# --strict turns that into a failing exit status. Works on mmbench output
+# (make host-bench) as well.
+#
+# SPDX-License-Identifier: GPL-3.0-Only
+
+import argparse
+import re
+import sys
+
+LINE = re.compile(r"^BENCH (\S+) (\S+) param=(\d+) (.*)$")
+
+
+def parse(path):
+    results = {}
+    config = None
+
+    with open(path, errors="replace") as f:
+        for line in f:
+            line = line.strip()
+            if line.startswith("BENCH_CONFIG "):
+                config = line[len("BENCH_CONFIG "):]
+                continue
+
+            m = LINE.match(line)
+            if not m:
+                continue
+
+            fields = dict(kv.split("=", 1) for kv in m.group(4).split() if "=" in kv)
+            # Extra measurements (bench_report_value) have no timing
+            if "cyc/op" not in fields:
+                continue
+
+            key = (m.group(1), m.group(2), int(m.group(3)))
+            results[key] = fields
+
+    return config, results
+
+
+def metric(base, new):
+    if "ns/op" in base and "ns/op" in new:
+        return "ns/op", float(base["ns/op"]), float(new["ns/op"])
+    return "cyc/op", float(base["cyc/op"]), float(new["cyc/op"])
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Compare Lithium benchmark runs")
+    ap.add_argument("baseline")
+    ap.add_argument("new")
+    ap.add_argument("--threshold", type=float, default=10.0,
+                    help="percent slowdown counted as a regression")
+    ap.add_argument("--strict", action="store_true",
+                    help="exit with 1 if anything regressed")
+    args = ap.parse_args()
+
+    try:
+        base_config, base = parse(args.baseline)
+    except FileNotFoundError:
+        print(f"benchcmp: no baseline at {args.baseline}, "
+              "run `make bench-baseline` to keep this run as one")
+        return 0
+
+    new_config, new = parse(args.new)
+    if not new:
+        print(f"benchcmp: no BENCH lines in {args.new}")
+        return 1
+
+    if base_config != new_config:
+        print(f"benchcmp: note, configs differ\n  baseline: {base_config}\n  new:      {new_config}")
+
+    regressed = improved = 0
+    print(f"{'suite':<14} {'name':<18} {'param':>8} {'unit':>7} "
+          f"{'baseline':>12} {'new':>12} {'delta':>8}")
+
+    for key in sorted(new):
+        if key not in base:
+            continue
+
+        unit, old_v, new_v = metric(base[key], new[key])
+        delta = (new_v - old_v) / old_v * 100 if old_v else 0.0
+
+        mark = ""
+        if delta > args.threshold:
+            mark = "  REGRESSED"
+            regressed += 1
+        elif delta < -args.threshold:
+            mark = "  improved"
+            improved += 1
+
+        suite, name, param = key
+        print(f"{suite:<14} {name:<18} {param:>8} {unit:>7} "
+              f"{old_v:>12.2f} {new_v:>12.2f} {delta:>+7.1f}%{mark}")
+
+    only_base = sorted(set(base) - set(new))
+    only_new = sorted(set(new) - set(base))
+    for suite, name, param in only_base:
+        print(f"{suite:<14} {name:<18} {param:>8}  missing from the new run")
+    for suite, name, param in only_new:
+        print(f"{suite:<14} {name:<18} {param:>8}  not in the baseline")
+
+    print(f"benchcmp: {len(set(base) & set(new))} compared, {regressed} regressed, "
+          f"{improved} improved (threshold {args.threshold:g}%)")
+
+    return 1 if args.strict and regressed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+#
+# Symbolize a Lithium heap profile dump against kernel.elf.
+#
+# Capture the serial log after pressing 'd' in kmon, then:
+#   tools/heapprof.py kernel.elf serial.log
+#
+# SPDX-License-Identifier: GPL-3.0-Only
+
+import re
+import subprocess
+import sys
+from collections import defaultdict
+
+
+def parse(lines):
+    sites = []
+    for line in lines:
+        m = re.match(r"HEAPPROF live_bytes=(\d+) live_samples=(\d+) "
+                     r"total_bytes=(\d+) stack=(\S*)", line.strip())
+        if not m:
+            continue
+        stack = [int(a, 16) for a in m.group(4).split(",") if a]
+        sites.append((int(m.group(1)), int(m.group(2)), int(m.group(3)), stack))
+    return sites
+
+
+def symbolize(elf, addrs):
+    if not addrs:
+        return {}
+    # Return addresses point after the call, step back into it
+    query = ["0x%x" % (a - 1) for a in addrs]
+    out = subprocess.run(["addr2line", "-f", "-C", "-e", elf] + query,
+                         capture_output=True, text=True, check=True).stdout.splitlines()
+    return {a: "%s (%s)" % (out[2 * i], out[2 * i + 1]) for i, a in enumerate(addrs)}
+
+
+def main():
+    if len(sys.argv) < 2:
+        print("usage: heapprof.py kernel.elf [dump]", file=sys.stderr)
+        sys.exit(1)
+
+    elf = sys.argv[1]
+    src = open(sys.argv[2]) if len(sys.argv) > 2 else sys.stdin
+    sites = parse(src)
+
+    addrs = sorted({a for s in sites for a in s[3]})
+    names = symbolize(elf, addrs)
+
+    # Merge sites by their immediate caller for the summary
+    by_caller = defaultdict(int)
+    for live, _, _, stack in sites:
+        by_caller[names.get(stack[0], "?") if stack else "?"] += live
+
+    total = sum(s[0] for s in sites)
+    print("Estimated live bytes: %d\n" % total)
+
+    print("By caller:")
+    for name, live in sorted(by_caller.items(), key=lambda kv: -kv[1]):
+        print("  %12d  %5.1f%%  %s" % (live, 100.0 * live / max(total, 1), name))
+
+    print("\nBy stack:")
+    for live, samples, alloc_total, stack in sorted(sites, key=lambda s: -s[0]):
+        print("  %d bytes live (%d samples, %d allocated)" % (live, samples, alloc_total))
+        for a in stack:
+            print("      0x%x  %s" % (a, names.get(a, "?")))
+
+
+if __name__ == "__main__":
+    main()
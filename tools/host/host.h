@@ -0,0 +1,47 @@
+#ifndef HOST_H
+#define HOST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Hosted build of pmm.c, vmm.c and kalloc.c (`make host`). The kernel
+// sources are compiled as they are, shim.c stands in for the rest of the
+// kernel and for the hardware:
+//
+//  - Physical memory is a memfd, mapped whole at HOST_HHDM_BASE, so the
+//    HHDM works exactly as under Limine.
+//  - Page tables are built by vmm.c in that memory. read_cr3() returns the
+//    simulated CR3 and invlpg() walks the tables and mmaps the memfd page
+//    (or PROT_NONE) at the address, so heap pointers really go through
+//    the kernel's page tables.
+//  - The heap window (HEAP_BASE, set by the Makefile) is reserved in user
+//    space as PROT_NONE.
+//
+// Every invlpg() is an mmap() syscall, so the mapping paths cost far more
+// than on hardware. Compare those numbers between host runs only.
+
+#define HOST_HHDM_BASE  0x200000000000ULL
+#define HOST_PHYS_BASE  0x100000ULL             // First usable "physical" byte
+#define HOST_HEAP_SIZE  0x60000000ULL           // Matches kalloc.c's windows
+
+// Simulated memory sizes are in MiB, 64 unless set
+#define HOST_DEFAULT_MEM_MB 64
+
+// Map `mem_mb` MiB of physical memory and bring up pmm, vmm and kalloc.
+// Exits on failure.
+void host_boot(size_t mem_mb);
+
+// Usable physical range, as HHDM addresses
+uint64_t host_mem_start(void);
+uint64_t host_mem_end(void);
+
+// Simulated TLB flushes so far
+uint64_t host_invlpg_count(void);
+
+// Runtime klog filter, KLOG_WARN unless changed
+void host_set_klog_level(int level);
+
+// Monotonic nanoseconds
+uint64_t host_ns(void);
+
+#endif /* HOST_H */
@@ -0,0 +1,314 @@
+// Allocator microbenchmarks on the host build of the memory code.
+//
+//   mmbench [-m MiB] [-n ops] [-s seed] [suite...]
+//
+// Suites are pair, live, batch, mix, pages and vmalloc, all of them by
+// default. Results use the kernel's BENCH line format with ns/op added, so
+// the same scripts read both.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../../src/kernel/include/cpu.h"
+#include "../../src/kernel/include/pmm.h"
+#include "../../src/kernel/include/kalloc.h"
+#include "host.h"
+
+static uint64_t ops = 1000000;
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static const size_t sizes[] = { 16, 64, 256, 1024, 2048, 4096, 16384, 65536 };
+#define NR_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+static const size_t live_sets[] = { 64, 4096, 65536 };
+#define NR_LIVE_SETS (sizeof(live_sets) / sizeof(live_sets[0]))
+
+// Big enough for the largest live set
+static void *slots[65536];
+
+static uint64_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+struct timing {
+    uint64_t tsc;
+    uint64_t ns;
+};
+
+static void timing_start(struct timing *t) {
+    t->ns = host_ns();
+    t->tsc = rdtsc();
+}
+
+static void report(const char *suite, const char *name, uint64_t param,
+                   uint64_t n, const struct timing *t) {
+    uint64_t cycles = rdtsc() - t->tsc;
+    uint64_t ns = host_ns() - t->ns;
+
+    printf("BENCH %s %s param=%lu ops=%lu cycles=%lu cyc/op=%lu ns/op=%lu.%02lu\n",
+           suite, name, param, n, cycles, n ? cycles / n : 0,
+           n ? ns / n : 0, n ? (ns * 100 / n) % 100 : 0);
+}
+
+// Helper: Whether `count` objects of `size` fit comfortably in memory.
+// Slab objects are counted twice over for the slab header and the waste
+// of the big caches, which also keeps them inside the slab VA window.
+static int fits(size_t count, size_t size) {
+    uint64_t mem = host_mem_end() - host_mem_start();
+    size_t footprint = size < 4096 ? size * 2 : (size + 4095) & ~(size_t)4095;
+    return (uint64_t)count * footprint <= mem / 2;
+}
+
+// kmalloc() straight followed by kfree(), the magazine fast path
+static void bench_pair(void) {
+    for (size_t i = 0; i < NR_SIZES; i++) {
+        size_t size = sizes[i];
+        uint64_t n = size > 4096 ? ops / 16 : ops;
+        struct timing t;
+
+        timing_start(&t);
+        for (uint64_t j = 0; j < n; j++) {
+            void *p = kmalloc(size);
+            kfree(p);
+        }
+        report("host_kmalloc", "pair", size, n, &t);
+    }
+}
+
+// A live set of `live` objects where random slots are freed and
+// reallocated, so frees land on cold objects from many slabs
+static void bench_live(void) {
+    for (size_t l = 0; l < NR_LIVE_SETS; l++) {
+        size_t live = live_sets[l];
+
+        for (size_t i = 0; i < NR_SIZES; i++) {
+            size_t size = sizes[i];
+            if (!fits(live, size)) {
+                continue;
+            }
+
+            for (size_t j = 0; j < live; j++) {
+                slots[j] = kmalloc(size);
+            }
+
+            uint64_t n = size > 4096 ? ops / 16 : ops;
+            struct timing t;
+            timing_start(&t);
+            for (uint64_t j = 0; j < n; j++) {
+                size_t s = rng() % live;
+                kfree(slots[s]);
+                slots[s] = kmalloc(size);
+            }
+
+            char name[32];
+            snprintf(name, sizeof(name), "live%zu", live);
+            report("host_kmalloc", name, size, n, &t);
+
+            for (size_t j = 0; j < live; j++) {
+                kfree(slots[j]);
+            }
+        }
+    }
+}
+
+// Allocate a whole set, then free it in allocation (fifo) or reverse
+// (lifo) order. Spills and refills magazines and grows and shrinks slabs.
+static void bench_batch(void) {
+    const size_t batch = 4096;
+
+    for (size_t i = 0; i < NR_SIZES; i++) {
+        size_t size = sizes[i];
+        if (!fits(batch, size)) {
+            continue;
+        }
+
+        uint64_t rounds = (size > 4096 ? ops / 16 : ops) / batch;
+        if (!rounds) {
+            rounds = 1;
+        }
+
+        struct timing t;
+        timing_start(&t);
+        for (uint64_t r = 0; r < rounds; r++) {
+            for (size_t j = 0; j < batch; j++) {
+                slots[j] = kmalloc(size);
+            }
+            for (size_t j = 0; j < batch; j++) {
+                kfree(slots[j]);
+            }
+        }
+        report("host_kmalloc", "batch_fifo", size, rounds * batch, &t);
+
+        timing_start(&t);
+        for (uint64_t r = 0; r < rounds; r++) {
+            for (size_t j = 0; j < batch; j++) {
+                slots[j] = kmalloc(size);
+            }
+            for (size_t j = batch; j-- > 0;) {
+                kfree(slots[j]);
+            }
+        }
+        report("host_kmalloc", "batch_lifo", size, rounds * batch, &t);
+    }
+}
+
+// Helper: A size from a small-object heavy distribution: 70% up to 256
+// bytes, 25% up to a page, 5% up to 64 KiB
+static size_t mix_size(void) {
+    uint64_t r = rng();
+    unsigned int pick = r % 100;
+    r >>= 8;
+
+    if (pick < 70) {
+        return 8 + r % 249;
+    } else if (pick < 95) {
+        return 257 + r % (4096 - 257);
+    }
+    return 4097 + r % (65536 - 4097);
+}
+
+// Random sizes over a live set, half the operations free, half allocate
+static void bench_mix(void) {
+    for (size_t l = 0; l < NR_LIVE_SETS; l++) {
+        size_t live = live_sets[l];
+        if (!fits(live, 4096)) {
+            continue;
+        }
+
+        memset(slots, 0, live * sizeof(void *));
+
+        struct timing t;
+        timing_start(&t);
+        for (uint64_t j = 0; j < ops; j++) {
+            size_t s = rng() % live;
+            if (slots[s]) {
+                kfree(slots[s]);
+                slots[s] = NULL;
+            } else {
+                slots[s] = kmalloc(mix_size());
+            }
+        }
+        report("host_kmalloc", "mix", live, ops, &t);
+
+        for (size_t j = 0; j < live; j++) {
+            kfree(slots[j]);
+        }
+    }
+}
+
+// Buddy allocator alone, alloc/free pairs and a batch per order
+static void bench_pages(void) {
+    for (unsigned int order = 0; order <= 4; order++) {
+        struct timing t;
+
+        timing_start(&t);
+        for (uint64_t j = 0; j < ops; j++) {
+            void *p = pmm_alloc_pages(order);
+            pmm_free_pages(p, order);
+        }
+        report("host_pmm", "pair", order, ops, &t);
+
+        const size_t batch = 1024;
+        uint64_t rounds = ops / batch / 4;
+        if (!rounds) {
+            rounds = 1;
+        }
+
+        timing_start(&t);
+        for (uint64_t r = 0; r < rounds; r++) {
+            for (size_t j = 0; j < batch; j++) {
+                slots[j] = pmm_alloc_pages(order);
+            }
+            for (size_t j = 0; j < batch; j++) {
+                pmm_free_pages(slots[j], order);
+            }
+        }
+        report("host_pmm", "batch", order, rounds * batch, &t);
+    }
+}
+
+// Page-mapped allocations, dominated by the simulated TLB flushes
+static void bench_vmalloc(void) {
+    for (size_t pages = 1; pages <= 64; pages *= 4) {
+        uint64_t n = ops / 64 / pages;
+        if (!n) {
+            n = 1;
+        }
+
+        uint64_t flushes = host_invlpg_count();
+        struct timing t;
+        timing_start(&t);
+        for (uint64_t j = 0; j < n; j++) {
+            void *p = vmalloc(pages * 4096);
+            kfree(p);
+        }
+        report("host_vmalloc", "pair", pages, n, &t);
+        printf("BENCH host_vmalloc pair param=%zu invlpg/op=%lu\n",
+               pages, (host_invlpg_count() - flushes) / n);
+    }
+}
+
+static const struct {
+    const char *name;
+    void (*run)(void);
+} suites[] = {
+    { "pair",    bench_pair },
+    { "live",    bench_live },
+    { "batch",   bench_batch },
+    { "mix",     bench_mix },
+    { "pages",   bench_pages },
+    { "vmalloc", bench_vmalloc },
+};
+
+#define NR_SUITES (sizeof(suites) / sizeof(suites[0]))
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-m MiB] [-n ops] [-s seed] [suite...]\nsuites:", prog);
+    for (size_t i = 0; i < NR_SUITES; i++) {
+        fprintf(stderr, " %s", suites[i].name);
+    }
+    fputc('\n', stderr);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    size_t mem_mb = 256;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:n:s:h")) != -1) {
+        switch (opt) {
+        case 'm':
+            mem_mb = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            ops = strtoull(optarg, NULL, 0);
+            break;
+        case 's':
+            rng_state = strtoull(optarg, NULL, 0) | 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    host_boot(mem_mb);
+    printf("BENCH_CONFIG host=1 mem_mb=%zu ops=%lu\n", mem_mb, ops);
+
+    for (size_t i = 0; i < NR_SUITES; i++) {
+        int selected = optind == argc;
+        for (int a = optind; a < argc; a++) {
+            if (!strcmp(argv[a], suites[i].name)) {
+                selected = 1;
+            }
+        }
+        if (selected) {
+            suites[i].run();
+        }
+    }
+
+    return 0;
+}
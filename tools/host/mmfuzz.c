@@ -0,0 +1,587 @@
+// Fuzz harness for the host build of the memory code. Each input is a
+// program of allocator calls run against a shadow table of live blocks.
+// After every call the harness checks what the allocators promise:
+//
+//  - blocks are aligned, inside memory (HHDM or heap window) and never
+//    overlap a live block
+//  - contents survive until free, and krealloc() keeps the common prefix
+//  - KM_ZERO/PMM_ZERO memory is zero, ctor state survives free/alloc
+//  - page blocks are naturally aligned and report their order, KM_DMA32
+//    memory is physically contiguous below 4 GiB
+//  - heap pages read the same through the page tables and the HHDM
+//  - after everything is freed and reclaimed, the pages in use don't grow
+//    from one input to the next
+//
+// Built with LIBFUZZER=1 this is a libFuzzer target. Otherwise main() below
+// replays files given on the command line, or runs random inputs:
+//
+//   mmfuzz [-i iterations] [-s seed] [file...]
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../../src/kernel/include/klog.h"
+#include "../../src/kernel/include/pmm.h"
+#include "../../src/kernel/include/vmm.h"
+#include "../../src/kernel/include/kalloc.h"
+#include "../../src/kernel/include/shrinker.h"
+#include "host.h"
+
+#define PAGE_SIZE 4096
+#define NR_SLOTS  256
+#define BULK_MAX  16
+
+// Pages in use may creep this far above the first input's after teardown
+// (slab VA stack pages, magazines parked in the depot)
+#define LEAK_SLACK 64
+
+#define CTOR_MAGIC 0xC7C7C7C7C7C7C7C7ULL
+
+enum kind {
+    K_NONE,
+    K_KMALLOC,
+    K_VMALLOC,
+    K_CACHE,
+    K_PAGES,
+};
+
+struct block {
+    uint8_t *ptr;
+    size_t size;
+    uint8_t kind;
+    uint8_t arg;            // Cache index or page order
+    uint8_t seed;
+};
+
+static struct block live[NR_SLOTS];
+
+struct input {
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+};
+
+static struct kmem_cache *caches[3];
+static const size_t cache_sizes[3] = { 40, 200, 72 };
+static const size_t cache_aligns[3] = { 8, 8, 64 };
+
+// The input being run, saved by check_fail() for replay
+static const uint8_t *cur_data;
+static size_t cur_size;
+
+static uint64_t total_pages;
+static uint64_t baseline_in_use;
+static uint64_t inputs_run;
+
+static void check_fail(const char *what, const struct block *b) {
+    fprintf(stderr, "mmfuzz: %s", what);
+    if (b) {
+        fprintf(stderr, " (ptr %p size %zu kind %u arg %u)", (void *)b->ptr,
+                b->size, b->kind, b->arg);
+    }
+    fprintf(stderr, " after %lu inputs\n", inputs_run);
+
+#ifndef HOST_LIBFUZZER
+    // libFuzzer saves the input itself
+    FILE *f = fopen("crash-input.bin", "wb");
+    if (f) {
+        fwrite(cur_data, 1, cur_size, f);
+        fclose(f);
+        fprintf(stderr, "mmfuzz: input saved to crash-input.bin\n");
+    }
+#endif
+    abort();
+}
+
+#define CHECK(cond, what, b)            \
+    do {                                \
+        if (!(cond)) {                  \
+            check_fail((what), (b));    \
+        }                               \
+    } while (0)
+
+static uint8_t next(struct input *in) {
+    return in->pos < in->size ? in->data[in->pos++] : 0;
+}
+
+// Helper: A size spread over the slab, page and large ranges
+static size_t next_size(struct input *in) {
+    uint8_t cls = next(in);
+    uint16_t v = (uint16_t)(next(in) | (next(in) << 8));
+
+    switch (cls >> 6) {
+    case 0:  return 1 + v % 256;
+    case 1:  return 1 + v % 4096;
+    case 2:  return 1 + v % 65536;
+    default: return 1 + (size_t)v * 4;      // Up to 256 KiB
+    }
+}
+
+// Blocks are filled with seed ^ noise[i], largest block is 256 KiB
+#define MAX_BLOCK (256 * 1024)
+static uint8_t noise[MAX_BLOCK];
+
+// Ctor cache objects keep their first word for the ctor's magic
+static size_t data_start(const struct block *b) {
+    return b->kind == K_CACHE && b->arg == 0 ? sizeof(uint64_t) : 0;
+}
+
+// The loops work on locals and accumulate instead of checking per byte,
+// so they vectorize
+static void fill(struct block *b) {
+    uint8_t *p = b->ptr;
+    uint8_t seed = b->seed;
+    size_t size = b->size;
+
+    for (size_t i = data_start(b); i < size; i++) {
+        p[i] = seed ^ noise[i];
+    }
+}
+
+static void verify(const struct block *b, size_t upto) {
+    const uint8_t *p = b->ptr;
+    uint8_t seed = b->seed;
+    uint8_t diff = 0;
+
+    for (size_t i = data_start(b); i < upto; i++) {
+        diff |= p[i] ^ seed ^ noise[i];
+    }
+    CHECK(diff == 0, "contents changed while allocated", b);
+
+    if (data_start(b)) {
+        CHECK(*(uint64_t *)b->ptr == CTOR_MAGIC, "ctor state clobbered", b);
+    }
+}
+
+static int in_heap(uint64_t addr) {
+    return addr >= HEAP_BASE && addr < HEAP_BASE + HOST_HEAP_SIZE;
+}
+
+// Helper: Physical address behind a block address, from whichever mapping
+// it's in
+static uint64_t to_phys(uint64_t addr, const struct block *b) {
+    if (in_heap(addr)) {
+        uint64_t phys;
+        CHECK(vmm_translate(addr, &phys) == 0, "heap page not in the page tables", b);
+        return phys;
+    }
+    return addr - HOST_HHDM_BASE;
+}
+
+// Helper: Checks every new block goes through
+static void check_new(struct block *b, size_t align) {
+    uint64_t start = (uint64_t)b->ptr;
+    uint64_t end = start + b->size;
+
+    CHECK(start % align == 0, "misaligned block", b);
+    CHECK((in_heap(start) && end <= HEAP_BASE + HOST_HEAP_SIZE) ||
+          (start >= host_mem_start() && end <= host_mem_end()),
+          "block outside memory", b);
+
+    for (int i = 0; i < NR_SLOTS; i++) {
+        const struct block *o = &live[i];
+        if (o->kind != K_NONE && o != b &&
+            start < (uint64_t)o->ptr + o->size && (uint64_t)o->ptr < end) {
+            fprintf(stderr, "mmfuzz: overlaps live block %p size %zu\n",
+                    (void *)o->ptr, o->size);
+            check_fail("overlapping blocks", b);
+        }
+    }
+}
+
+// Helper: Heap pages must be the same memory seen through the HHDM
+static void check_mapping(const struct block *b) {
+    for (uint64_t page = (uint64_t)b->ptr & ~(uint64_t)(PAGE_SIZE - 1);
+         page < (uint64_t)b->ptr + b->size; page += PAGE_SIZE) {
+        if (!in_heap(page)) {
+            return;
+        }
+
+        uint64_t addr = page < (uint64_t)b->ptr ? (uint64_t)b->ptr : page;
+        uint8_t *alias = (uint8_t *)(HOST_HHDM_BASE + to_phys(addr, b));
+        CHECK(*alias == *(uint8_t *)addr, "HHDM alias disagrees with the heap mapping", b);
+    }
+}
+
+static void check_zero(const struct block *b) {
+    const uint8_t *p = b->ptr;
+    size_t size = b->size;
+    uint8_t any = 0;
+
+    for (size_t i = 0; i < size; i++) {
+        any |= p[i];
+    }
+    CHECK(any == 0, "zeroed allocation isn't", b);
+}
+
+static void check_contiguous(const struct block *b) {
+    uint64_t first = to_phys((uint64_t)b->ptr, b);
+    CHECK(first + b->size <= 0x100000000ULL, "KM_DMA32 block above 4 GiB", b);
+
+    for (size_t off = PAGE_SIZE - ((uint64_t)b->ptr % PAGE_SIZE); off < b->size;
+         off += PAGE_SIZE) {
+        CHECK(to_phys((uint64_t)b->ptr + off, b) == first + off,
+              "KM_DMA32 block not physically contiguous", b);
+    }
+}
+
+static void release(struct block *b) {
+    verify(b, b->size);
+    check_mapping(b);
+
+    switch (b->kind) {
+    case K_KMALLOC:
+    case K_VMALLOC:
+        kfree(b->ptr);
+        break;
+    case K_CACHE:
+        kmem_cache_free(caches[b->arg], b->ptr);
+        break;
+    case K_PAGES:
+        CHECK(pmm_block_order(b->ptr) == b->arg, "page block lost its order", b);
+        pmm_free_pages(b->ptr, b->arg);
+        break;
+    }
+    b->kind = K_NONE;
+}
+
+// Helper: Record a fresh allocation in slot s
+static struct block *take(int s, void *ptr, size_t size, int kind, int arg) {
+    struct block *b = &live[s];
+    b->ptr = ptr;
+    b->size = size;
+    b->kind = (uint8_t)kind;
+    b->arg = (uint8_t)arg;
+    b->seed = (uint8_t)(inputs_run + s);
+    return b;
+}
+
+static void ctor(void *obj) {
+    *(uint64_t *)obj = CTOR_MAGIC;
+}
+
+static void setup(void) {
+    uint32_t x = 0x12345678;
+    for (size_t i = 0; i < MAX_BLOCK; i++) {
+        x = x * 1103515245 + 12345;
+        noise[i] = (uint8_t)(x >> 16);
+    }
+
+    host_set_klog_level(KLOG_PANIC);
+    host_boot(HOST_DEFAULT_MEM_MB);
+
+    caches[0] = kmem_cache_create("fuzz_ctor", cache_sizes[0], 0, ctor, 0);
+    caches[1] = kmem_cache_create("fuzz_bitmap", cache_sizes[1], 0, NULL, KMC_BITMAP);
+    caches[2] = kmem_cache_create("fuzz_nomag", cache_sizes[2], 0, NULL,
+                                  KMC_NOMAGAZINE | KMC_HWCACHE_ALIGN);
+    if (!caches[0] || !caches[1] || !caches[2]) {
+        check_fail("kmem_cache_create failed", NULL);
+    }
+
+    total_pages = (host_mem_end() - host_mem_start()) / PAGE_SIZE;
+}
+
+static void op_kmalloc(struct input *in, int s, int flags) {
+    size_t size = next_size(in);
+    void *p = flags ? kmalloc_flags(size, flags) : kmalloc(size);
+    if (!p) {
+        return;
+    }
+
+    struct block *b = take(s, p, size, K_KMALLOC, 0);
+    check_new(b, size >= PAGE_SIZE ? PAGE_SIZE : 8);
+    if (flags & KM_ZERO) {
+        check_zero(b);
+    }
+    if (flags & KM_DMA32) {
+        check_contiguous(b);
+    }
+    fill(b);
+    check_mapping(b);
+}
+
+static void op_krealloc(struct input *in, struct block *b) {
+    size_t size = next_size(in);
+    uint8_t *p = krealloc(b->ptr, size);
+    if (!p) {
+        // The old block stays valid
+        verify(b, b->size);
+        return;
+    }
+
+    size_t keep = size < b->size ? size : b->size;
+    b->ptr = p;
+    verify(b, keep);
+
+    b->size = size;
+    check_new(b, size >= PAGE_SIZE ? PAGE_SIZE : 8);
+    fill(b);
+    check_mapping(b);
+}
+
+static void op_vmalloc(struct input *in, int s) {
+    size_t size = next_size(in);
+    void *p = vmalloc(size);
+    if (!p) {
+        return;
+    }
+
+    struct block *b = take(s, p, size, K_VMALLOC, 0);
+    check_new(b, PAGE_SIZE);
+    fill(b);
+    check_mapping(b);
+}
+
+static void op_cache_alloc(struct input *in, int s) {
+    uint8_t arg = next(in);
+    int c = arg % 3;
+
+    // KM_ZERO would wipe constructed state, so not for the ctor cache
+    int zero = (arg & 0x80) && c != 0;
+    void *p = zero ? kmem_cache_alloc_flags(caches[c], KM_ZERO)
+                   : kmem_cache_alloc(caches[c]);
+    if (!p) {
+        return;
+    }
+
+    struct block *b = take(s, p, cache_sizes[c], K_CACHE, c);
+    check_new(b, cache_aligns[c]);
+    if (c == 0) {
+        CHECK(*(uint64_t *)p == CTOR_MAGIC, "object handed out without ctor state", b);
+    } else if (zero) {
+        check_zero(b);
+    }
+    fill(b);
+}
+
+static void op_cache_bulk_alloc(struct input *in) {
+    int c = next(in) % 3;
+    size_t n = 1 + next(in) % BULK_MAX;
+    int slots[BULK_MAX];
+    size_t found = 0;
+
+    for (int i = 0; i < NR_SLOTS && found < n; i++) {
+        if (live[i].kind == K_NONE) {
+            slots[found++] = i;
+        }
+    }
+
+    void *objs[BULK_MAX];
+    if (kmem_cache_alloc_bulk(caches[c], found, objs) != found) {
+        return;
+    }
+
+    for (size_t i = 0; i < found; i++) {
+        struct block *b = take(slots[i], objs[i], cache_sizes[c], K_CACHE, c);
+        check_new(b, cache_aligns[c]);
+        if (c == 0) {
+            CHECK(*(uint64_t *)objs[i] == CTOR_MAGIC, "bulk object without ctor state", b);
+        }
+        fill(b);
+    }
+}
+
+static void op_cache_bulk_free(struct input *in) {
+    int c = next(in) % 3;
+    void *objs[BULK_MAX];
+    size_t n = 0;
+
+    for (int i = next(in); n < BULK_MAX && i < NR_SLOTS; i++) {
+        struct block *b = &live[i];
+        if (b->kind == K_CACHE && b->arg == c) {
+            verify(b, b->size);
+            objs[n++] = b->ptr;
+            b->kind = K_NONE;
+        }
+    }
+
+    kmem_cache_free_bulk(caches[c], n, objs);
+}
+
+static void op_pages(struct input *in, int s) {
+    uint8_t arg = next(in);
+    unsigned int order = arg % 7;
+    int flags = (arg >> 3) & (PMM_ATOMIC | PMM_ZERO | PMM_PREFER_ZERO | PMM_DMA32);
+    void *p = pmm_alloc_pages_flags(order, flags);
+    if (!p) {
+        return;
+    }
+
+    struct block *b = take(s, p, (size_t)PAGE_SIZE << order, K_PAGES, order);
+    check_new(b, PAGE_SIZE);
+    CHECK(((uint64_t)p - HOST_HHDM_BASE) % b->size == 0, "buddy block not naturally aligned", b);
+    CHECK(pmm_block_order(p) == (int)order, "pmm_block_order() disagrees", b);
+    if (flags & PMM_ZERO) {
+        check_zero(b);
+    }
+    fill(b);
+}
+
+// Run one input, then free everything it left and check for leaks
+static void run(const uint8_t *data, size_t size) {
+    struct input in = { data, size, 0 };
+    cur_data = data;
+    cur_size = size;
+
+    while (in.pos < in.size) {
+        uint8_t op = next(&in);
+        int s = next(&in) % NR_SLOTS;
+        struct block *b = &live[s];
+
+        switch (op % 12) {
+        case 0:
+        case 1:
+        case 2:
+            if (b->kind != K_NONE) {
+                release(b);
+            }
+            if (op % 12 == 0) {
+                op_kmalloc(&in, s, 0);
+            } else if (op % 12 == 1) {
+                op_kmalloc(&in, s, KM_ZERO);
+            } else {
+                op_kmalloc(&in, s, KM_DMA32 | (op & 0x80 ? KM_ZERO : 0));
+            }
+            break;
+        case 3:
+        case 4:
+            if (b->kind != K_NONE) {
+                release(b);
+            }
+            break;
+        case 5:
+            if (b->kind == K_KMALLOC) {
+                op_krealloc(&in, b);
+            }
+            break;
+        case 6:
+            if (b->kind != K_NONE) {
+                release(b);
+            }
+            op_vmalloc(&in, s);
+            break;
+        case 7:
+            if (b->kind != K_NONE) {
+                release(b);
+            }
+            op_cache_alloc(&in, s);
+            break;
+        case 8:
+            op_cache_bulk_alloc(&in);
+            break;
+        case 9:
+            op_cache_bulk_free(&in);
+            break;
+        case 10:
+            if (b->kind != K_NONE) {
+                release(b);
+            }
+            op_pages(&in, s);
+            break;
+        case 11:
+            reclaim_direct(next(&in));
+            break;
+        }
+
+        CHECK(pmm_free_page_count() <= total_pages, "more free pages than memory", NULL);
+    }
+
+    for (int i = 0; i < NR_SLOTS; i++) {
+        if (live[i].kind != K_NONE) {
+            release(&live[i]);
+        }
+    }
+
+    // Whatever the caches still hold can be given back
+    reclaim_direct(total_pages);
+    uint64_t in_use = total_pages - pmm_free_page_count();
+
+    if (inputs_run == 0) {
+        baseline_in_use = in_use;
+    } else if (in_use > baseline_in_use + LEAK_SLACK) {
+        fprintf(stderr, "mmfuzz: %lu pages in use after teardown, first input left %lu\n",
+                in_use, baseline_in_use);
+        check_fail("pages leaked", NULL);
+    }
+    inputs_run++;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    static int booted;
+    if (!booted) {
+        setup();
+        booted = 1;
+    }
+
+    run(data, size);
+    return 0;
+}
+
+#ifndef HOST_LIBFUZZER
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+// Helper: Replay one input file
+static int run_file(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    static uint8_t buf[1 << 20];
+    size_t n = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+
+    LLVMFuzzerTestOneInput(buf, n);
+    printf("%s: ok (%zu bytes)\n", path, n);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    uint64_t iterations = 1000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:s:h")) != -1) {
+        switch (opt) {
+        case 'i':
+            iterations = strtoull(optarg, NULL, 0);
+            break;
+        case 's':
+            rng_state = strtoull(optarg, NULL, 0) | 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-i iterations] [-s seed] [file...]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (optind < argc) {
+        int ret = 0;
+        for (int a = optind; a < argc; a++) {
+            ret |= run_file(argv[a]) != 0;
+        }
+        return ret;
+    }
+
+    // Random programs, a failing one is saved for replay
+    static uint8_t buf[4096];
+    for (uint64_t it = 0; it < iterations; it++) {
+        size_t n = 1 + rng() % sizeof(buf);
+        for (size_t i = 0; i < n; i++) {
+            buf[i] = (uint8_t)rng();
+        }
+        LLVMFuzzerTestOneInput(buf, n);
+    }
+
+    printf("mmfuzz: %lu inputs ok\n", iterations);
+    return 0;
+}
+#endif
@@ -0,0 +1,216 @@
+// Stand-ins for the parts of the kernel and the machine the memory code
+// needs when it runs as a Linux process, see host.h
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include "../../src/kernel/include/limine.h"
+#include "../../src/kernel/include/cpu.h"
+#include "../../src/kernel/include/klog.h"
+#include "../../src/kernel/include/serial.h"
+#include "../../src/kernel/include/trace.h"
+#include "../../src/kernel/include/pmm.h"
+#include "../../src/kernel/include/vmm.h"
+#include "../../src/kernel/include/kalloc.h"
+#include "host.h"
+
+void string_init(void);
+
+#define PAGE_SIZE 4096
+
+#define PTE_PRESENT (1ULL << 0)
+#define PTE_WRITE   (1ULL << 1)
+#define PTE_HUGE    (1ULL << 7)
+#define PTE_ADDR(e) ((e) & 0x000FFFFFFFFFF000ULL)
+
+static int phys_fd = -1;
+static uint64_t phys_end = 0;       // Size of the memfd, one past the last byte
+static uint64_t host_cr3 = 0;
+static uint64_t invlpgs = 0;
+static int klog_level = KLOG_WARN;
+
+static struct limine_hhdm_response hhdm_response = {
+    .offset = HOST_HHDM_BASE,
+};
+
+volatile struct limine_hhdm_request hhdm_request = {
+    .response = &hhdm_response,
+};
+
+// Helper: Report a broken simulation and stop
+static void die(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(stderr, "host: ");
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    abort();
+}
+
+uint64_t host_read_cr3(void) {
+    return host_cr3;
+}
+
+// Helper: Walk the simulated page tables, returns the leaf PTE or 0
+static uint64_t walk(uint64_t vaddr) {
+    uint64_t table = PTE_ADDR(host_cr3);
+
+    for (int shift = 39; shift >= 12; shift -= 9) {
+        if (table + PAGE_SIZE > phys_end) {
+            die("page table at phys 0x%lx is outside memory", table);
+        }
+
+        uint64_t entry = ((uint64_t *)(HOST_HHDM_BASE + table))[(vaddr >> shift) & 0x1FF];
+        if (!(entry & PTE_PRESENT)) {
+            return 0;
+        }
+        if (shift == 12) {
+            return entry;
+        }
+        if (entry & PTE_HUGE) {
+            die("huge page at 0x%lx, the heap only maps 4 KiB pages", vaddr);
+        }
+        table = PTE_ADDR(entry);
+    }
+    return 0;
+}
+
+// The TLB is the host mapping: reload the one entry from the page tables
+void host_invlpg(uint64_t vaddr) {
+    invlpgs++;
+    vaddr &= ~(uint64_t)(PAGE_SIZE - 1);
+
+    // Nothing but the heap window is mapped through the page tables
+    if (vaddr < HEAP_BASE || vaddr >= HEAP_BASE + HOST_HEAP_SIZE) {
+        return;
+    }
+
+    uint64_t pte = walk(vaddr);
+    void *r;
+
+    if (pte) {
+        uint64_t phys = PTE_ADDR(pte);
+        if (phys < HOST_PHYS_BASE || phys + PAGE_SIZE > phys_end) {
+            die("0x%lx mapped to phys 0x%lx, outside memory", vaddr, phys);
+        }
+
+        int prot = PROT_READ | ((pte & PTE_WRITE) ? PROT_WRITE : 0);
+        r = mmap((void *)vaddr, PAGE_SIZE, prot, MAP_SHARED | MAP_FIXED, phys_fd, phys);
+    } else {
+        r = mmap((void *)vaddr, PAGE_SIZE, PROT_NONE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+    }
+
+    if (r == MAP_FAILED) {
+        die("mmap for invlpg(0x%lx): %s (vm.max_map_count too low?)", vaddr, strerror(errno));
+    }
+}
+
+void host_boot(size_t mem_mb) {
+    if (!mem_mb) {
+        mem_mb = HOST_DEFAULT_MEM_MB;
+    }
+    uint64_t bytes = (uint64_t)mem_mb << 20;
+    phys_end = HOST_PHYS_BASE + bytes;
+
+    string_init();
+
+    phys_fd = memfd_create("lithium-phys", 0);
+    if (phys_fd < 0 || ftruncate(phys_fd, (off_t)phys_end) != 0) {
+        die("memfd: %s", strerror(errno));
+    }
+
+    // Populated up front so page faults don't land in the measurements
+    if (mmap((void *)HOST_HHDM_BASE, phys_end, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_FIXED_NOREPLACE | MAP_POPULATE, phys_fd, 0) == MAP_FAILED) {
+        die("mapping the HHDM: %s", strerror(errno));
+    }
+
+    if (mmap((void *)HEAP_BASE, HOST_HEAP_SIZE, PROT_NONE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE,
+             -1, 0) == MAP_FAILED) {
+        die("reserving the heap window: %s", strerror(errno));
+    }
+
+    // Low memory is reserved like on a PC, the rest is one usable region
+    static struct limine_memmap_entry low = { 0, HOST_PHYS_BASE, LIMINE_MEMMAP_RESERVED };
+    static struct limine_memmap_entry ram = { HOST_PHYS_BASE, 0, LIMINE_MEMMAP_USABLE };
+    static struct limine_memmap_entry *entries[] = { &low, &ram };
+    static struct limine_memmap_response memmap = { .entry_count = 2, .entries = entries };
+    ram.length = bytes;
+
+    pmm_init(&memmap, HOST_HHDM_BASE);
+
+    // An empty PML4, everything the kernel maps comes after this
+    void *pml4 = pmm_alloc();
+    if (!pml4) {
+        die("no memory for the PML4");
+    }
+    memset(pml4, 0, PAGE_SIZE);
+    host_cr3 = (uint64_t)pml4 - HOST_HHDM_BASE;
+
+    vmm_init();
+    kalloc_init();
+}
+
+uint64_t host_mem_start(void) {
+    return HOST_HHDM_BASE + HOST_PHYS_BASE;
+}
+
+uint64_t host_mem_end(void) {
+    return HOST_HHDM_BASE + phys_end;
+}
+
+uint64_t host_invlpg_count(void) {
+    return invlpgs;
+}
+
+void host_set_klog_level(int level) {
+    klog_level = level;
+}
+
+uint64_t host_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Kernel interfaces the memory code calls
+
+void klog_write(int level, const char *fmt, ...) {
+    if (level > klog_level) {
+        return;
+    }
+
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+}
+
+void serial_puts(const char *s) {
+    fputs(s, stdout);
+}
+
+void serial_putc(char c) {
+    putchar(c);
+}
+
+void serial_put_hex(uint64_t value) {
+    printf("0x%lX", value);
+}
+
+void serial_put_dec(uint64_t value) {
+    printf("%lu", value);
+}
+
+// Trace sites stay nops, nothing ever patches them in a host process
+void trace_record(int id, uint64_t arg0, uint64_t arg1) {
+}
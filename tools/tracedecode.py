@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+#
+# Turn a Lithium trace dump into Chrome trace JSON (chrome://tracing or
+# https://ui.perfetto.dev).
+#
+# Press 't' in kmon to start tracing, 'x' to dump. The dump is raw binary,
+# so capture serial with a raw backend, e.g. `-serial file:serial.log`, then:
+#   tools/tracedecode.py serial.log > trace.json
+#
+# SPDX-License-Identifier: GPL-3.0-Only
+
+import json
+import re
+import struct
+import sys
+
+# Must match include/trace.h
+EVENTS = [
+    ("pmm_alloc", "block", "order"),
+    ("pmm_free", "block", "order"),
+    ("vmm_map", "vaddr", "phys"),
+    ("vmm_unmap", "vaddr", None),
+    ("vmm_flush", "vaddr", None),
+    ("slab_grow", "slab", "object_size"),
+    ("slab_shrink", "slab", "object_size"),
+    ("kmalloc", "ptr", "size"),
+    ("kfree", "ptr", None),
+]
+
+EVENT = struct.Struct("<QHHIQQ")
+VERSION = 1
+
+
+def parse_fields(line):
+    return {k.decode(): int(v) for k, v in re.findall(rb"(\w+)=(\d+)", line)}
+
+
+def read_line(data, pos):
+    end = data.index(b"\n", pos)
+    return data[pos:end], end + 1
+
+
+def parse(data):
+    pos = data.rfind(b"TRACE_BEGIN ")
+    if pos < 0:
+        sys.exit("tracedecode: no TRACE_BEGIN in input")
+
+    line, pos = read_line(data, pos)
+    header = parse_fields(line)
+    if header.get("version") != VERSION or header.get("event_size") != EVENT.size:
+        sys.exit("tracedecode: unsupported dump %s" % line.decode(errors="replace"))
+
+    events = []
+    lost = {}
+    for _ in range(header["cpus"]):
+        line, pos = read_line(data, pos)
+        if not line.startswith(b"TRACE_CPU "):
+            sys.exit("tracedecode: expected TRACE_CPU, got %r" % line[:40])
+        cpu = parse_fields(line)
+        lost[cpu["cpu"]] = cpu["lost"]
+
+        size = cpu["count"] * EVENT.size
+        if pos + size > len(data):
+            sys.exit("tracedecode: dump for cpu %d is truncated" % cpu["cpu"])
+        events += [EVENT.unpack_from(data, pos + i) for i in range(0, size, EVENT.size)]
+        pos += size + 1
+
+    return header, lost, sorted(events)
+
+
+def to_chrome(lost, events, tsc_khz):
+    out = []
+    if not events:
+        return out
+
+    base = events[0][0]
+    pages = 0
+    heap = 0
+    live = {}
+
+    def us(tsc):
+        return (tsc - base) * 1000.0 / tsc_khz
+
+    for tsc, eid, cpu, _, arg0, arg1 in events:
+        if eid >= len(EVENTS):
+            continue
+        name, key0, key1 = EVENTS[eid]
+        args = {key0: "0x%x" % arg0}
+        if key1:
+            args[key1] = arg1
+        ts = us(tsc)
+        out.append({"name": name, "ph": "i", "s": "t", "ts": ts,
+                    "pid": 0, "tid": cpu, "args": args})
+
+        # Running totals as counter tracks
+        if name in ("pmm_alloc", "pmm_free"):
+            pages += (1 << arg1) if name == "pmm_alloc" else -(1 << arg1)
+            out.append({"name": "pmm pages", "ph": "C", "ts": ts, "pid": 0,
+                        "args": {"allocated": pages}})
+        elif name in ("kmalloc", "kfree"):
+            if name == "kmalloc":
+                live[arg0] = arg1
+                heap += arg1
+            else:
+                heap -= live.pop(arg0, 0)
+            out.append({"name": "kmalloc bytes", "ph": "C", "ts": ts, "pid": 0,
+                        "args": {"live": heap}})
+
+    for cpu, n in lost.items():
+        out.append({"name": "thread_name", "ph": "M", "pid": 0, "tid": cpu,
+                    "args": {"name": "cpu %d (%d events overwritten)" % (cpu, n)}})
+    return out
+
+
+def main():
+    args = sys.argv[1:]
+    tsc_khz = None
+    if len(args) >= 2 and args[0] == "--tsc-khz":
+        tsc_khz = int(args[1])
+        args = args[2:]
+    if len(args) > 1:
+        print("usage: tracedecode.py [--tsc-khz N] [dump]", file=sys.stderr)
+        sys.exit(1)
+
+    data = open(args[0], "rb").read() if args else sys.stdin.buffer.read()
+    header, lost, events = parse(data)
+
+    if tsc_khz is None:
+        tsc_khz = header.get("tsc_khz") or 0
+    if not tsc_khz:
+        print("tracedecode: TSC rate unknown, assuming 1 GHz (use --tsc-khz)",
+              file=sys.stderr)
+        tsc_khz = 1000000
+
+    json.dump({"traceEvents": to_chrome(lost, events, tsc_khz),
+               "displayTimeUnit": "ns"}, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()